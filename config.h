@@ -1,78 +1,324 @@
-/*  Define all your connections/pins into the data acquisition board
- *   and other relevant globals(Arduino Uno?), include the folder in your arduino main
- *   5-IR,6-touch,7-solenoid  -side A (0)
- *   8-IR,9-touch,10-solenoid - side B (1)
- */
-
-#ifndef CONFIG
-#define CONFIG
-
-#include "data.h"
-
-/*
- * Timing mode
- * defaults to millis which can run upto ~49days before encountering overflow and restarts from 0
- * beware while using micros as overflow occurs rather quickly at around 70min and restarts from 0
- */
-const bool TIME_IN_MICROSECONDS = false;
-
-/*Operation Mode*/
-// change manually between trial MODE_A for reward at A and MODE_B for reward at B runs to switch reward location as required
-const enum Mode OPERATION_MODE = MODE_A;
-
-/*Pins*/
-const byte INPUT_TRIGGER = A0; //Connected to output_1 of RWD 810 fiberphotometery, received upon acquisition start
-const byte OUTPUT_TRIGGER = A1; //Connected to input_1 of RWD 810 fiberphotometery, sent upon runtime completion to stop acquisition
-
-const byte IR_A_INDICATOR = A2;
-const byte IR_B_INDICATOR = A3;
-
-const byte OUTPUT_IR = 2; //Connected to input_2 of RWD 810 fiberphotometery
-const byte OUTPUT_TOUCH = 3;  //Connected to input_3 of RWD 810 fiberphotometery
-const byte OUTPUT_SOLENOID = 4; //Connected to input_4 of RWD 810 fiberphotometery
-
-const byte IR_A_PIN = 5;
-const byte TOUCH_A_PIN = 6;
-const byte SOLENOID_A_PIN = 7;
-
-const byte IR_B_PIN = 8;
-const byte TOUCH_B_PIN = 9;
-const byte SOLENOID_B_PIN = 10;
-
-const byte LED_BLINK_PIN = 12;
-const byte LED_RUNTIME = 13;
-
-
-// Serial transfer baud rate;
-const unsigned long BAUD_RATE = 9600UL;
-
-/*Identifiers for serial data transfer*/
-const byte SIDE_A = 0;
-const byte SIDE_B = 1;
-const byte OFF = 0;
-const byte ON = 1;
-const byte IR = 0;
-const byte TOUCH = 1;
-const byte SOLENOID = 2;
-
-/*Sensor state indicator logic*/
-const bool IR_ACTIVE_LOW = false;
-const bool TOUCH_ACTIVE_LOW = false;
-const bool SOLENOID_ACTIVE_LOW = true;
-
-/*Time parameters - type dependent on tNow parameter in*/
-const unsigned long CLOCK_TOLERANCE = 20UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));         //tolerance range if timing function jumps? would subsequent calls be resolved?
-
-const unsigned long TTL_DURATION = 50UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));
-const unsigned long TTL_PULSE_WIDTH = 20UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));
-const unsigned long TTL_PULSE_PERIOD = 50UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));
-// const unsigned long TTL_TOLERANCE = 5UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));
-
-const unsigned long DELAY_START = 4UL * 1000UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));      // time to start void loop()
-const unsigned long RUN_TIME_DURATION = 20UL * 60UL * 1000UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1))); // time since above delay completion
-
-const unsigned long MIN_IR_BREAK = 5UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));             // duration for signal persistance to avoid transient spike
-const unsigned long SOLENOID_DURATION = 40UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));       // duration of solenoid valve release
-const unsigned long LED_BLINK_INTERVAL = 500UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));     // led blink on interval
-
+/*  Define all your connections/pins into the data acquisition board
+ *   and other relevant globals(Arduino Uno?), include the folder in your arduino main
+ *   5-IR,6-touch,7-solenoid  -side A (0)
+ *   8-IR,9-touch,10-solenoid - side B (1)
+ */
+
+#ifndef CONFIG
+#define CONFIG
+
+// features with their own interrupt vectors or static state, as macros so hal.h and the sketch compile them out
+// entirely when off - the const bools of their sections below follow these, see the sections for what they do
+#define SENSOR_EDGE_CAPTURE_ENABLED 0
+#define TTL_HARDWARE_TIMER_ENABLED 1
+#define SYNC_BARCODE_ENABLED 1
+#define LINEAR_ACTUATOR_ENABLED 0
+
+// AVR interrupt vectors compiled into hal.h, only those of the enabled features so the others stay free for other
+// libraries - PCINT0..2 for SENSOR_EDGE_CAPTURE, Timer1 (also used by Servo and tone()) for TTL_HARDWARE_TIMER or
+// LINEAR_ACTUATOR
+#define HAL_PIN_CHANGE_ISR SENSOR_EDGE_CAPTURE_ENABLED
+#define HAL_TICK_ISR (TTL_HARDWARE_TIMER_ENABLED || LINEAR_ACTUATOR_ENABLED)
+
+#include "hal.h"
+
+// enumerated operation modes
+enum Mode
+{
+  MODE_A,
+  MODE_B,
+};
+
+// sensor debounce filters, applied to the level sampled every DEBOUNCE_TICK
+enum DebounceMode
+{
+  DEBOUNCE_OFF,         // raw level, legacy IR persistance check
+  DEBOUNCE_SHIFT,       // switch once the last N samples agree
+  DEBOUNCE_INTEGRATOR,  // saturating up/down counter, switch at 0 and N
+  DEBOUNCE_MAJORITY,    // switch on the majority of the last N samples, even N holds on a tie
+};
+
+// serial encodings of the event log
+enum EventEncoding
+{
+  EVENT_ASCII,          // legacy lines, side, type, state digits followed by the absolute time
+  EVENT_FRAME,          // fixed size binary frames with the absolute time
+  EVENT_COMPACT,        // batched codes with varint time deltas, sequence numbers and absolute time keyframes
+};
+
+// answers of the board to the session link commands
+enum LinkStatus
+{
+  LINK_OK,
+  LINK_BAD_VERSION,     // parameter block of another layout or size
+  LINK_BAD_VALUE,       // parameter out of range
+  LINK_BUSY,            // not allowed in the current session state
+  LINK_UNKNOWN,         // command not known
+};
+
+/*
+ * Timing mode
+ * defaults to millis, set true for micros - currentTime() folds the 32 bit counter overflows
+ * (millis ~49days, micros ~70min) into a 64 bit Timestamp so either is safe for multi hour sessions
+ */
+const bool TIME_IN_MICROSECONDS = false;
+
+// monotonic time point in the unit selected above, durations below stay unsigned long
+typedef unsigned long long Timestamp;
+// low 32 bits of a Timestamp for state that is only compared with times close to now (within half an overflow
+// period, ~35min in micros), widened again with extendTime()
+typedef uint32_t ShortTimestamp;
+
+/*Operation Mode*/
+// change manually between trial MODE_A for reward at A and MODE_B for reward at B runs to switch reward location as required,
+// on the port table MODE_A rewards the first and MODE_B the second port of every track
+const enum Mode OPERATION_MODE = MODE_A;
+
+/*Pins*/
+const byte INPUT_TRIGGER = A0; //Connected to output_1 of RWD 810 fiberphotometery, received upon acquisition start
+const byte OUTPUT_TRIGGER = A1; //Connected to input_1 of RWD 810 fiberphotometery, sent upon runtime completion to stop acquisition
+
+const byte IR_A_INDICATOR = A2;
+const byte IR_B_INDICATOR = A3;
+
+const byte OUTPUT_IR = 2; //Connected to input_2 of RWD 810 fiberphotometery
+const byte OUTPUT_TOUCH = 3;  //Connected to input_3 of RWD 810 fiberphotometery
+const byte OUTPUT_SOLENOID = 4; //Connected to input_4 of RWD 810 fiberphotometery
+
+const byte IR_A_PIN = 5;
+const byte TOUCH_A_PIN = 6;
+const byte SOLENOID_A_PIN = 7;
+
+const byte IR_B_PIN = 8;
+const byte TOUCH_B_PIN = 9;
+const byte SOLENOID_B_PIN = 10;
+
+const byte LED_BLINK_PIN = 12;
+const byte LED_RUNTIME = 13;
+
+/*Reward port table*/
+// one column per reward port (IR beam, lick sensor, solenoid valve), the port index is the side identifier in the event log,
+// e.g. a second track on a larger board adds two more columns with track 1
+const byte PORT_COUNT = 2;
+const byte PORT_NONE = 0xFF;
+const byte PORT_IR_PIN[PORT_COUNT] = {IR_A_PIN, IR_B_PIN};
+const byte PORT_IR_INDICATOR[PORT_COUNT] = {IR_A_INDICATOR, IR_B_INDICATOR};
+const byte PORT_TOUCH_PIN[PORT_COUNT] = {TOUCH_A_PIN, TOUCH_B_PIN};
+const byte PORT_SOLENOID_PIN[PORT_COUNT] = {SOLENOID_A_PIN, SOLENOID_B_PIN};
+const byte PORT_TRACK[PORT_COUNT] = {0, 0};
+const byte PIN_NONE = 0xFF;
+
+
+// Serial transfer baud rate;
+const unsigned long BAUD_RATE = 115200UL;  // 250000, 500000 and 1000000 are exact on a 16MHz board
+
+/*Identifiers for serial data transfer*/
+const byte SIDE_A = 0;
+const byte SIDE_B = 1;
+const byte OFF = 0;
+const byte ON = 1;
+const byte IR = 0;
+const byte TOUCH = 1;
+const byte SOLENOID = 2;
+const byte RELOCATE = 3;  // reward moved to side, logged at every relocation schedule step
+const byte ACTUATOR = 4;  // linear actuator move, ON at its start and OFF at its end
+
+/*Reward relocation schedule*/
+// the session starts rewarding RELOCATION_MODE[0] and moves to the next step once that step reached its rewarded laps
+// or its duration (0 for no limit), the last step holds until the end of the session
+const byte RELOCATION_STEPS = 2;
+const enum Mode RELOCATION_MODE[RELOCATION_STEPS] = {OPERATION_MODE, OPERATION_MODE == MODE_A ? MODE_B : MODE_A};
+const unsigned int RELOCATION_LAPS[RELOCATION_STEPS] = {40, 0};
+
+/*Event log*/
+// EVENT_FRAME: sync, code (side << 4 | type << 1 | state), 6 byte little endian time, xor checksum of code and time
+// EVENT_COMPACT: sync, count | key << 7, sequence number of the first event, [6 byte absolute time of the first
+//   event if key], then per event its code followed by the zigzag varint (7 bits per byte, low bits first) time delta
+//   to the previous event (left out for the first event of a keyframe), xor checksum of everything after sync -
+//   sequence numbers count every event including the ones dropped on overflow, a keyframe is sent at start, after
+//   a drop, every EVENT_KEYFRAME_INTERVAL events and whenever a delta needs more than EVENT_DELTA_BYTES
+const enum EventEncoding EVENT_LOG_ENCODING = EVENT_COMPACT;
+const byte EVENT_FRAME_SYNC = 0xA5;
+const byte EVENT_FRAME_TIME_BYTES = 6;
+const byte EVENT_FRAME_SIZE = 3 + EVENT_FRAME_TIME_BYTES;
+const byte EVENT_COMPACT_SYNC = 0xA6;
+const byte EVENT_COMPACT_KEY = 0x80;
+const byte EVENT_BATCH_MAX = 8;             // events per compact frame
+const byte EVENT_DELTA_BYTES = 3;           // longest varint delta, 2^20 ticks either way
+const byte EVENT_KEYFRAME_INTERVAL = 64;    // events between keyframes, bounds the loss after a corrupt frame
+const byte EVENT_COMPACT_MAX_SIZE = 4 + EVENT_FRAME_TIME_BYTES + EVENT_BATCH_MAX * (1 + EVENT_DELTA_BYTES);
+const byte EVENT_LINE_SIZE = 25;            // longest legacy ascii line
+const byte EVENT_LOG_CAPACITY = 8;          // ring buffer slots, power of 2
+
+/*Record log*/
+// the text records of the session (P, B, E) and the link replies (A, N, V) are queued as whole lines and moved to
+// the serial port as the TX buffer frees up, so they never hold up loop() - a line that does not fit is dropped and
+// counted in recordLogQueue.overflow (reported in the E record), events wait while a line is only partly written so no frame splits it
+const unsigned int RECORD_LOG_CAPACITY = 128; // ring buffer bytes, power of 2 up to 256
+// longest line, the E record - letter, 20 digit time, lost events and records, statistics with 16 bit counters,
+// line end
+const unsigned int RECORD_LINE_MAX = 1 + 20 + 6 + 6 + 4 + 4 * 6 + 2 * 11 + PORT_COUNT * 2 * 6 + 2;
+static_assert(RECORD_LOG_CAPACITY <= 256 && RECORD_LINE_MAX < RECORD_LOG_CAPACITY, "the longest record must fit the record log");
+
+/*Raw pin trace*/
+// true to also log every raw IR/touch level change seen by the detection state machines, for offline replay
+// with host/replay_trace.cpp - frames: sync, code (port << 2 | type << 1 | level), 2 byte little endian signed
+// time delta to the previous frame, xor checksum, a code with bit 7 set is a keyframe carrying the 6 byte
+// absolute time instead, sent whenever the delta does not fit
+const bool PIN_TRACE = false;
+const byte PIN_TRACE_SYNC = 0x5A;
+const byte PIN_TRACE_KEYFRAME = 0x80;
+const byte PIN_TRACE_FRAME_SIZE = 5;
+const byte PIN_TRACE_KEYFRAME_SIZE = 3 + EVENT_FRAME_TIME_BYTES;
+const byte PIN_TRACE_CAPACITY = 32;   // ring buffer slots, power of 2
+
+/*TTL output backend*/
+// on to emit the TTL pulse trains from a hardware timer interrupt (Timer1 on AVR) instead of updateTTL() in loop(),
+// falls back to the software path where hal.h has no tick timer
+const bool TTL_HARDWARE_TIMER = TTL_HARDWARE_TIMER_ENABLED;
+const unsigned long TTL_TIMER_TICK_US = 100UL;  // edge resolution of the hardware trains and the actuator steps
+const unsigned long TTL_JITTER_MAX_US = TTL_TIMER_TICK_US; // largest pulse width/period error host/simulate accepts
+const byte TTL_CHANNEL_MAX = 4;      // outputs on the hardware timer, also bounds the outputs with a TTL queue
+
+/*TTL event queue*/
+// events arriving while an output is still sending a train are queued and sent after it instead of being dropped,
+// set TTL_PATTERN_ENCODING to send 1 + side + 2 * type pulses per event instead of the per side pulse period
+// so every side/type code is a distinct pattern on the photometry input
+const byte TTL_QUEUE_CAPACITY = 2;    // pending trains per output, power of 2
+const bool TTL_PATTERN_ENCODING = false;
+
+/*Sync barcode*/
+// every SYNC_BARCODE_INTERVAL of the session OUTPUT_TRIGGER sends a start slot (high), a guard slot (low) and the
+// barcode counter in SYNC_BARCODE_BITS level coded slots LSB first, each barcode is logged as a B<time>,<counter>
+// record - input_1 of the photometry system must record it as an event input, the session end trigger is queued
+// behind a barcode still being sent
+const bool SYNC_BARCODE = SYNC_BARCODE_ENABLED;
+const byte SYNC_BARCODE_BITS = 16;
+static_assert(SYNC_BARCODE_BITS <= 30, "the barcode slots must fit a 32 bit pattern");
+
+/*Linear actuator*/
+// stepper driven linear actuator (step/direction driver) moving the reward port, the step pulses come from the tick
+// timer interrupt with trapezoidal speed profiles so loop() never waits on a move - it homes against the proximal
+// limit switch at power on (home is ACTUATOR_HOME_OFFSET steps distal of the switch) and moves to
+// ACTUATOR_POSITION[mode] at every relocation schedule step, the moves are logged as ACTUATOR events
+const bool LINEAR_ACTUATOR = LINEAR_ACTUATOR_ENABLED;
+const byte ACTUATOR_STEP_PIN = 11;
+const byte ACTUATOR_DIR_PIN = A4;
+const byte ACTUATOR_PROXIMAL_LIMIT_PIN = A5;
+const byte ACTUATOR_DISTAL_LIMIT_PIN = PIN_NONE;      // no free pin left on the Uno
+const bool ACTUATOR_LIMIT_ACTIVE_LOW = true;          // switches to ground on the internal pullups
+const bool ACTUATOR_DIR_DISTAL = HIGH;                // direction level moving away from home
+const long ACTUATOR_TRAVEL = 8000L;                   // distal soft limit, steps from home
+const long ACTUATOR_HOME_OFFSET = 200L;
+const long ACTUATOR_POSITION[2] = {0L, 6400L};        // reward port position per Mode, steps from home
+const unsigned long ACTUATOR_START_SPEED = 200UL;     // steps/s, from and to standstill
+const unsigned long ACTUATOR_MAX_SPEED = 4000UL;      // steps/s
+const unsigned long ACTUATOR_ACCELERATION = 8000UL;   // steps/s^2
+const unsigned long ACTUATOR_HOMING_SPEED = 800UL;    // steps/s, constant
+const byte ACTUATOR_CHANNEL_MAX = 2;                  // actuators on the tick timer
+static_assert(ACTUATOR_MAX_SPEED * 2 * TTL_TIMER_TICK_US <= 1000000UL, "a step pulse takes two timer ticks");
+
+/*Session statistics*/
+// laps, rewards and touches per port, inter-lap intervals and error-free runs (laps since the last turn back to the
+// port visited last, or since the last relocation) are updated from every logged event and reported as a
+// P<time>,<statistics> record every SESSION_STATS_INTERVAL of the session and after the lost events and records of the E record,
+// set EVENT_LOG_SUMMARY to keep the events off the serial port (statistics, barcodes and TTL outputs remain) when
+// only the TTL aligned data is needed
+const bool SESSION_STATS = true;
+const bool EVENT_LOG_SUMMARY = false;
+
+/*Session link*/
+// host commands on the serial port, framed as LINK_SYNC, command, payload length, payload, CRC-16/CCITT (0xFFFF start)
+// of command to payload little endian - a board powers up armed (a session starts on the input trigger, or DELAY_START
+// after power on without one) until the host says LINK_HELLO, from then on it only arms on a valid parameter block
+// (LINK_PARAMS, an empty payload keeps the active block) and starts at once without an input trigger - every command
+// is answered with an A<command> record, or N<command>,<LinkStatus>, LINK_HELLO with V<version>,<block size>,<CRC of
+// the active block> first
+// parameter block, little endian: version, flags, solenoid duration (4), min IR break (4), run duration (6), per
+// relocation step its mode (1), laps (2) and duration (6) - with LINK_CACHE in the flags it is also stored in EEPROM
+// and loaded at power on when LINK_EEPROM_CACHE is set, so the rig keeps it without the host
+const bool SESSION_LINK = true;
+const bool LINK_EEPROM_CACHE = true;
+const byte LINK_SYNC = 0xA7;
+const byte LINK_HELLO = 'H';
+const byte LINK_PARAMS = 'C';
+const byte LINK_START = 'S';         // start the session now, without waiting for the input trigger
+const byte LINK_STOP = 'X';          // end the session now, without an input trigger the board then waits disarmed
+const byte LINK_RELOCATE = 'R';      // move to the next relocation step now
+const byte LINK_CACHE = 0x01;
+const byte LINK_PARAMS_VERSION = 1;
+const byte LINK_PARAMS_SIZE = 2 + 4 + 4 + EVENT_FRAME_TIME_BYTES + RELOCATION_STEPS * (3 + EVENT_FRAME_TIME_BYTES);
+const byte LINK_PAYLOAD_MAX = LINK_PARAMS_SIZE;
+const byte LINK_REPLY_MAX = 1 + 3 + 1 + 3 + 1 + 5 + 2;  // longest reply line, V<version>,<size>,<CRC>
+const unsigned int LINK_EEPROM_ADDRESS = 0;  // block followed by its CRC
+
+/*Memory budget*/
+// board memory for host/memory_budget.cpp, the static data of the image plus STACK_RESERVE must fit SRAM_SIZE
+// (Uno defaults), the state struct sizes and the static state of the enabled features plus CORE_SRAM_RESERVE are
+// also checked at compile time in data.h on AVR builds
+const unsigned int SRAM_SIZE = 2048;
+const unsigned int STACK_RESERVE = 256;       // deepest loop() call chain plus interrupt frames
+const unsigned int CORE_SRAM_RESERVE = 192;   // Arduino core - Serial with its two 64 byte rings, millis(), libc
+const unsigned long FLASH_SIZE = 32256UL;     // 32KB less the bootloader
+
+/*Timer scheduler*/
+const byte TIMER_SLOTS = 4;           // deadline entries per TimerScheduler, the sketch arms 4 on each
+
+/*Loop profiling*/
+// per loop() pass duration histogram (half octave buckets in us), reported after the E record
+const bool LOOP_PROFILING = true;
+const byte LOOP_HISTOGRAM_BUCKETS = 24;     // covers up to 4ms, slower passes land in the last bucket
+const unsigned long LOOP_BUDGET_US = 1000UL; // passes slower than this are counted as over budget
+
+/*Sensor edge capture*/
+// on to timestamp IR/touch edges in a pin change interrupt instead of sampling them once per loop(), its queues
+// do not fit the Uno next to the other defaults
+const bool SENSOR_EDGE_CAPTURE = SENSOR_EDGE_CAPTURE_ENABLED;
+const byte EDGE_QUEUE_CAPACITY = 16;  // per sensor ring buffer slots, power of 2
+const byte EDGE_CAPTURE_MAX = 2 * PORT_COUNT;  // sensors sharing the pin change handler
+
+/*Sensor state indicator logic*/
+const bool IR_ACTIVE_LOW = false;
+const bool TOUCH_ACTIVE_LOW = false;
+const bool SOLENOID_ACTIVE_LOW = true;
+
+/*Sensor debounce, up to 8 samples*/
+const enum DebounceMode IR_DEBOUNCE_MODE = DEBOUNCE_MAJORITY;  // tolerates the alternating read of the IR housing
+const byte IR_DEBOUNCE_SAMPLES = 8;
+const enum DebounceMode TOUCH_DEBOUNCE_MODE = DEBOUNCE_INTEGRATOR;
+const byte TOUCH_DEBOUNCE_SAMPLES = 4;
+
+/*Compile time pin types for the fast GPIO path (Pin<> in hal.h)*/
+typedef Pin<OUTPUT_TRIGGER> OutputTriggerPin;
+typedef Pin<OUTPUT_IR> OutputIRPin;
+typedef Pin<OUTPUT_TOUCH> OutputTouchPin;
+typedef Pin<OUTPUT_SOLENOID> OutputSolenoidPin;
+
+/*Time parameters - type dependent on tNow parameter in*/
+
+const unsigned long TTL_DURATION = 50UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));
+const unsigned long TTL_PULSE_WIDTH = 20UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));
+const unsigned long TTL_PULSE_PERIOD = 50UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));
+const unsigned long PORT_TTL_PERIOD[PORT_COUNT] = {TTL_PULSE_PERIOD, TTL_PULSE_PERIOD / 2};  // photometry pulse period per port
+const unsigned long TTL_TRAIN_GAP = 10UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));      // minimum idle time between queued trains
+const unsigned long TTL_PATTERN_WIDTH = 5UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));   // pulse width in TTL_PATTERN_ENCODING
+const unsigned long TTL_PATTERN_PERIOD = 10UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));  // pulse period in TTL_PATTERN_ENCODING
+const unsigned long SYNC_BARCODE_SLOT = 30UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));   // one barcode bit
+const Timestamp SYNC_BARCODE_INTERVAL = 30ULL * 1000ULL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1))); // barcode start to start
+const Timestamp SESSION_STATS_INTERVAL = 10ULL * 1000ULL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1))); // P record period
+// the hardware TTL channels count their ticks in 16 bits, the barcode is the longest train
+static_assert((2UL + SYNC_BARCODE_BITS) * SYNC_BARCODE_SLOT * (TIME_IN_MICROSECONDS ? 1UL : 1000UL) / TTL_TIMER_TICK_US <= 0xFFFFUL &&
+              TTL_DURATION * (TIME_IN_MICROSECONDS ? 1UL : 1000UL) / TTL_TIMER_TICK_US <= 0xFFFFUL, "TTL trains must fit 65535 timer ticks");
+// const unsigned long TTL_TOLERANCE = 5UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));
+
+const Timestamp DELAY_START = 4ULL * 1000ULL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));      // time to start void loop()
+const Timestamp RUN_TIME_DURATION = 20ULL * 60ULL * 1000ULL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1))); // time since above delay completion
+const Timestamp RELOCATION_DURATION[RELOCATION_STEPS] = {10ULL * 60ULL * 1000ULL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1))), 0}; // duration of each relocation step
+
+const unsigned long DEBOUNCE_TICK = 1UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));            // debounce sample period
+const unsigned long MIN_IR_BREAK = 5UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));             // duration for signal persistance to avoid transient spike, IR_DEBOUNCE_MODE DEBOUNCE_OFF only
+const unsigned long SOLENOID_DURATION = 40UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));       // duration of solenoid valve release
+const unsigned long SOLENOID_DURATION_MAX = 1000UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1))); // longest valve release a parameter block may set
+const unsigned long LED_BLINK_INTERVAL = 500UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));     // led blink on interval
+
 #endif
\ No newline at end of file
@@ -1,117 +1,490 @@
-/*
- * Data structures for sensor and actuator state parameters;
- */
-
-#ifndef DATA
-#define DATA
-
-// enumerated operation modes
-enum Mode
-{
-	MODE_A,
-	MODE_B,
-};
-
-struct TTLState
-{
-	byte pin;
-	byte mode;
-	bool state;
-	bool detect;
-	bool pulseState;
-	unsigned long tTTLon;
-	unsigned long tPulseon;
-	unsigned long duration;
-	unsigned long pulseWidth;
-	unsigned long pulsePeriod;
-};
-
-struct RuntimeState
-{
-	byte led_pin;
-	bool runtimeFlag;
-	bool inputTriggerExists;
-	unsigned long tNow;
-	unsigned long tLast;
-	unsigned long tStart;
-	unsigned long tRuntimeStart;
-	unsigned long duration;
-	unsigned long delay;
-	TTLState* inputTrigger;
-	TTLState* outputTrigger;
-};
-
-struct BlinkLEDState
-{
-	byte pin;
-	byte side;
-	bool ledBlinkState;
-	unsigned long blinkInterval;
-	unsigned long tLEDon;
-	unsigned long tLEDoff;
-};
-
-struct IRState
-{
-	byte pin;
-	byte side;
-	byte proxyLEDPin;
-	bool currentRead;
-	bool lastRead;
-	bool inBreak;
-	bool breakEvent;
-	bool breakEventMutable;
-	bool connectEvent;
-	unsigned long tStart;
-	unsigned long tOff;
-	unsigned long ttlPulsePeriod;
-	TTLState* outputTrigger;
-};
-
-struct TouchState
-{
-	byte pin;
-	byte side;
-	bool current;
-	bool last;
-	bool inTouch;
-	bool touchEvent;
-	bool clearEvent;
-	unsigned long tStart;
-	unsigned long tOff;
-	unsigned long ttlPulsePeriod;
-	TTLState* outputTrigger;
-};
-
-struct SolenoidState
-{
-	byte pin;
-	byte side;
-	bool open;
-	unsigned long tOpen;
-	unsigned long tClose;
-	unsigned long duration;
-	unsigned long ttlPulsePeriod;
-	TTLState* outputTrigger;
-};
-
-struct LinearActuatorState
-{
-	byte pin;
-	byte side;
-	byte operationMode;
-	bool distalLimitSwitch;
-	bool proximalLimitSwitch;
-	bool atCommandPosition;
-	bool atHome;
-	long distalLimitPosition;
-	long proximalLimitPosition;
-	long currentPosition;
-	long commandPosition;
-	long homePosition;
-	long calibrationPositionOffset;
-	unsigned long tStart;
-	unsigned long tStop;
-};
-
+/*
+ * Data structures for sensor and actuator state parameters;
+ */
+
+#ifndef DATA
+#define DATA
+
+#include "config.h"
+
+template <bool Wide>
+struct PackedWord
+{
+	typedef uint8_t type;
+};
+
+template <>
+struct PackedWord<true>
+{
+	typedef uint16_t type;
+};
+
+// one flag per port packed in a single word, indexed like a bool array - writes go through a proxy bit reference
+template <byte N>
+struct PackedBits
+{
+	static_assert(N <= 16, "PackedBits: up to 16 flags");
+	typedef typename PackedWord<(N > 8)>::type Word;
+
+	struct Ref
+	{
+		Word &bits;
+		Word mask;
+
+		Ref(Word &bits, Word mask) : bits(bits), mask(mask) {}
+		Ref(const Ref &) = default;
+		operator bool() const { return (bits & mask) != 0; }
+		Ref &operator=(bool on) { bits = on ? (Word)(bits | mask) : (Word)(bits & ~mask); return *this; }
+		Ref &operator=(const Ref &other) { return *this = (bool)other; }
+	};
+
+	Word bits;
+
+	bool operator[](byte i) const { return (bits >> i) & 1; }
+	Ref operator[](byte i) { return Ref(bits, (Word)(1U << i)); }
+};
+
+struct ClockState
+{
+	uint32_t lastRaw;
+	unsigned long overflows;
+};
+
+struct TimerEntry
+{
+	Timestamp deadline;
+	bool armed;
+	void (*fire)(void* state, Timestamp tNow);
+	void* state;
+};
+
+// min deadline scheduler, only entries whose deadline passed are run
+struct TimerScheduler
+{
+	TimerEntry entries[TIMER_SLOTS];
+	byte count;
+	bool pending;
+	Timestamp tNext;
+};
+
+// scheduler slot owned by an actuator, scheduler is nullptr while the actuator is polled
+struct TimerHandle
+{
+	TimerScheduler* scheduler;
+	byte slot;
+};
+
+// hardware timed TTL output, counters in timer ticks, owned by the tick ISR while active
+struct TTLChannel
+{
+	HalOutput output;
+	volatile bool active;
+	uint16_t elapsed;                // ticks, a train fits 65535 (checked in config.h)
+	uint16_t phase;
+	uint16_t durationTicks;
+	uint16_t widthTicks;
+	uint16_t periodTicks;
+	bool patterned;
+	unsigned long pattern;
+	volatile uint32_t tStart;        // time counter at the first edge of the train
+};
+
+// TTL train waiting for its output to become free
+struct TTLRequest
+{
+	unsigned long pulsePeriod;
+	unsigned long pulseWidth;
+	unsigned long duration;
+	ShortTimestamp tRequest;
+	unsigned long pattern;	// level per pulsePeriod slot LSB first, 0 for a plain pulse train
+};
+
+struct TTLQueue
+{
+	TTLRequest requests[TTL_QUEUE_CAPACITY];
+	byte head;
+	byte tail;
+};
+
+struct TTLState
+{
+	byte pin;
+	byte mode;
+	bool state : 1;
+	bool detect : 1;
+	bool pulseState : 1;
+	bool patterned : 1;
+	Timestamp tTTLon;
+	Timestamp tPulseon;
+	unsigned long duration;
+	unsigned long pulseWidth;
+	unsigned long pulsePeriod;
+	unsigned long pattern;	// remaining slots of a patterned train, bit 0 is the current level
+	Timestamp tTTLoff;
+	TimerHandle timer;
+	TTLChannel* channel;
+	TTLQueue* queue;
+	unsigned int sent;
+	unsigned int delayed;
+	unsigned int dropped;
+	unsigned long maxDelay;
+	void (*started)(unsigned long pattern, Timestamp tStart); // told the time every train went out, e.g. to log it
+};
+
+struct RuntimeState
+{
+	byte led_pin;
+	bool runtimeFlag : 1;
+	bool inputTriggerExists : 1;
+	bool armed : 1;                  // a session may start
+	Timestamp tNow;
+	Timestamp tLast;
+	Timestamp tStart;
+	Timestamp tRuntimeStart;
+	Timestamp duration;
+	Timestamp delay;
+	TTLState* inputTrigger;
+	TTLState* outputTrigger;
+};
+
+// counter barcode sent on a TTL output at a fixed interval, for clock alignment
+struct SyncBarcodeState
+{
+	TTLState* output;
+	unsigned int counter;
+	TimerHandle timer;
+};
+
+struct BlinkLEDState
+{
+	byte pin;
+	byte side;
+	bool ledBlinkState;
+	unsigned long blinkInterval;
+	Timestamp tLEDon;
+	Timestamp tLEDoff;
+	TimerHandle timer;
+};
+
+// t is the raw 32 bit counter value stamped in the ISR, extended when consumed
+struct EdgeEvent
+{
+	uint32_t t;
+	bool level;
+};
+
+// single producer (pin change ISR) / single consumer (loop) queue of timestamped sensor edges
+struct EdgeQueue
+{
+	byte pin;
+	bool activeLow;
+	volatile bool level;
+	volatile byte head;
+	volatile byte tail;
+	volatile byte overflow;
+	EdgeEvent edges[EDGE_QUEUE_CAPACITY];
+};
+
+// fixed rate debounce filter, history holds the newest sample in bit 0
+struct Debouncer
+{
+	byte mode;
+	byte samples;
+	byte history;
+	byte count;
+	byte settled;
+	bool raw : 1;
+	bool state : 1;
+	ShortTimestamp tRaw;             // onset of the raw level
+	Timestamp tNext;
+};
+
+// reward ports (IR beam, lick sensor, solenoid valve) as one array per field, indexed by port,
+// so a single pass sweeps every port and its inputs are sampled together - flags are packed one bit per port
+// and event times kept as ShortTimestamp
+template <byte N>
+struct PortBank
+{
+	static_assert(N <= 16, "PortBank: the event log codes the port in 4 bits");
+	byte count;
+	byte track[N];
+	byte trackRank[N];               // position of the port on its track, the port rewarded in Mode trackRank
+	byte lastPort[N];                // per track, last port whose IR beam was broken, PORT_NONE before the first visit
+	byte trackFirst[N];              // per track, first port of the track
+	uint16_t inputPorts;             // input registers read by the sweep
+	unsigned long ttlPulsePeriod[N];
+	TTLState* irTrigger;
+	TTLState* touchTrigger;
+	TTLState* solenoidTrigger;
+
+	// IR beam
+	byte irPin[N];
+	byte proxyLEDPin[N];
+	HalInput irInput[N];
+	PackedBits<N> irCurrentRead;
+	PackedBits<N> irLastRead;
+	PackedBits<N> inBreak;
+	PackedBits<N> breakEvent;
+	PackedBits<N> breakEventMutable;
+	PackedBits<N> connectEvent;
+	ShortTimestamp tBreak[N];
+	ShortTimestamp tConnect[N];
+	Debouncer irDebounce[N];
+	EdgeQueue* irEdges[N];
+
+	// lick sensor
+	byte touchPin[N];
+	HalInput touchInput[N];
+	PackedBits<N> inTouch;
+	PackedBits<N> touchEvent;
+	PackedBits<N> clearEvent;
+	ShortTimestamp tTouch[N];
+	ShortTimestamp tRelease[N];
+	Debouncer touchDebounce[N];
+	EdgeQueue* touchEdges[N];
+
+	// solenoid valve, one timer closes all of them
+	byte solenoidPin[N];
+	HalOutput solenoidOutput[N];
+	PackedBits<N> open;
+	ShortTimestamp tOpen[N];
+	ShortTimestamp tClose[N];
+	unsigned long solenoidDuration[N];
+	TimerHandle solenoidTimer;
+};
+
+// queued event, drained within one overflow period so only the low time bits are kept
+struct EventRecord
+{
+	byte code;
+	byte sequence;                   // EVENT_COMPACT sequence number
+	ShortTimestamp t;
+};
+
+struct EventLogState
+{
+	EventRecord records[EVENT_LOG_CAPACITY];
+	byte head;
+	byte tail;
+	unsigned int overflow;
+	byte encoding;                   // EventEncoding
+	byte sequence;                   // sequence number of the next event, dropped ones included
+	byte sequenceNext;               // sequence number that follows the last event written
+	byte sinceKey;                   // events written since the last keyframe
+	bool keyed;                      // a keyframe was written, deltas are valid
+	Timestamp tLast;                 // time of the last event written, base of the next delta
+};
+
+// queued text records, whole lines between head and tail, the line being built runs from head to end
+struct RecordLogState
+{
+	char text[RECORD_LOG_CAPACITY];
+	byte head;
+	byte tail;
+	byte end;
+	bool fits;                       // the line being built still fits the ring
+	bool partial;                    // a line is only partly in the serial TX buffer
+	unsigned int overflow;           // lines dropped
+};
+
+struct PinTraceState
+{
+	EventRecord records[PIN_TRACE ? PIN_TRACE_CAPACITY : 1]; // code is port << 2 | type << 1 | level
+	byte head;
+	byte tail;
+	unsigned int overflow;
+	uint32_t known;                  // per input (port << 1 | type), level traced since the last drop
+	uint32_t level;                  // per input, last traced level
+	Timestamp tLast;                 // time base of the next delta frame
+	bool keyed;                      // a keyframe went out, deltas are valid
+};
+
+struct LoopProfileState
+{
+	unsigned long histogram[LOOP_HISTOGRAM_BUCKETS];
+	unsigned long iterations;
+	unsigned long overBudget;
+	unsigned long maxDuration;
+	uint32_t tLast;
+};
+
+struct RelocationState
+{
+	byte step;
+	enum Mode mode;
+	unsigned int laps;
+	bool advance;                    // move to the next step at the next update
+	Timestamp tSessionStart;
+	Timestamp tStepStart;
+};
+
+// session parameters read at run time, the config.h values until replaced (e.g. by host/sweep.cpp)
+struct SessionParams
+{
+	unsigned long solenoidDuration;
+	unsigned long minIRBreak;
+	Timestamp runDuration;
+	byte relocationMode[RELOCATION_STEPS];
+	unsigned int relocationLaps[RELOCATION_STEPS];
+	Timestamp relocationDuration[RELOCATION_STEPS];
+};
+
+// fields of a session link frame, in arrival order
+enum LinkField
+{
+	LINK_FIELD_SYNC,
+	LINK_FIELD_COMMAND,
+	LINK_FIELD_LENGTH,
+	LINK_FIELD_PAYLOAD,
+	LINK_FIELD_CRC_LOW,
+	LINK_FIELD_CRC_HIGH,
+};
+
+// session link receiver, a frame is assembled in place from the serial bytes as they arrive
+struct LinkState
+{
+	byte field;
+	byte command;
+	byte length;
+	byte count;                      // payload bytes received
+	uint16_t crc;
+	byte crcLow;
+	byte payload[LINK_PAYLOAD_MAX];
+	unsigned int errors;             // frames dropped on a bad length or CRC
+	bool hello : 1;                  // a host took over, arm on its parameter block only
+	bool pending : 1;                // frame received, waits for record log room for its reply
+};
+
+// online session statistics, laps and rewards follow the reward rule of the sketch from the logged events
+struct SessionStats
+{
+	byte lastPort[PORT_COUNT];       // per track, last port with an IR break
+	byte lapPort;                    // arrival port of the latest lap until its reward, PORT_NONE after
+	byte steps;                      // relocation steps started
+	unsigned int laps;
+	unsigned int errors;             // IR breaks at the port visited last
+	unsigned int run;                // laps since the last error or relocation
+	unsigned int bestRun;            // longest run since the last relocation
+	unsigned int rewards[PORT_COUNT];
+	unsigned int touches[PORT_COUNT];
+	Timestamp tLap;                  // latest lap
+	Timestamp lapIntervalSum;
+	unsigned long lapIntervalMin;
+	TimerHandle timer;
+};
+
+// step pulse generator of a linear actuator, owned by the tick ISR while active - speeds in steps per tick as 8.24
+// fixed point, the trapezoidal profile brakes once the steps left are no more than the steps it took to accelerate
+struct StepperChannel
+{
+	HalOutput step;
+	HalInput limit;                  // limit switch in the direction of travel
+	bool checkLimit;
+	volatile bool active;
+	volatile bool limitHit;          // the move ended on the limit switch
+	bool pulse;                      // step output high
+	bool forward;
+	volatile long position;
+	unsigned long remaining;
+	unsigned long accelSteps;        // steps taken while accelerating
+	uint32_t phase;
+	uint32_t speed;
+	uint32_t startSpeed;
+	uint32_t maxSpeed;
+	uint32_t acceleration;           // speed change per tick
+	uint32_t tTick;                  // last tick in us where hal.h has no tick timer
+};
+
+// positions in steps from home
+struct LinearActuatorState
+{
+	byte pin;                        // step output
+	byte dirPin;
+	byte proximalLimitPin;
+	byte distalLimitPin;             // PIN_NONE without a switch
+	byte side;
+	byte operationMode;              // Mode of the last relocation command
+	bool distalLimitSwitch : 1;
+	bool proximalLimitSwitch : 1;
+	bool atCommandPosition : 1;
+	bool atHome : 1;
+	bool moving : 1;
+	bool homing : 1;
+	bool homed : 1;
+	long distalLimitPosition;        // soft limits, commands are clamped into them
+	long proximalLimitPosition;
+	long currentPosition;
+	long commandPosition;
+	long homePosition;
+	long calibrationPositionOffset;  // steps from the proximal limit switch to home
+	Timestamp tStart;
+	Timestamp tStop;
+	StepperChannel* channel;
+};
+
+static_assert(sizeof(PackedBits<8>) == 1 && sizeof(PackedBits<16>) == 2, "PackedBits: one bit per flag");
+
+// SRAM budget of the state structs with avr-gcc (byte alignment, 2 byte int and pointers) as fixed part plus
+// per slot cost, a struct outgrowing it fails the build - host/memory_budget.cpp reports the whole image
+const unsigned int TIMER_SCHEDULER_SRAM = 10 + TIMER_SLOTS * 13;
+const unsigned int TTL_CHANNEL_SRAM = 23;
+const unsigned int TTL_QUEUE_SRAM = 2 + TTL_QUEUE_CAPACITY * 20;
+const unsigned int TTL_STATE_SRAM = 62;
+const unsigned int RUNTIME_SRAM = 54;
+const unsigned int BLINK_LED_SRAM = 26;
+const unsigned int EDGE_QUEUE_SRAM = 6 + EDGE_QUEUE_CAPACITY * 5;
+const unsigned int DEBOUNCER_SRAM = 18;
+const unsigned int PORT_BANK_SRAM = 12 + PORT_COUNT * 87 + 10 * sizeof(PackedBits<PORT_COUNT>);
+const unsigned int EVENT_LOG_SRAM = 17 + EVENT_LOG_CAPACITY * 6;
+const unsigned int RECORD_LOG_SRAM = 7 + RECORD_LOG_CAPACITY;
+const unsigned int PIN_TRACE_SRAM = 21 + (PIN_TRACE ? PIN_TRACE_CAPACITY : 1) * 6;
+const unsigned int LOOP_PROFILE_SRAM = 16 + LOOP_HISTOGRAM_BUCKETS * 4;
+const unsigned int SESSION_PARAMS_SRAM = 16 + RELOCATION_STEPS * 11;
+const unsigned int LINK_SRAM = 10 + LINK_PAYLOAD_MAX;
+const unsigned int SESSION_STATS_SRAM = 33 + PORT_COUNT * 5;
+const unsigned int RELOCATION_SRAM = 22;
+const unsigned int SYNC_BARCODE_SRAM = 7;
+const unsigned int STEPPER_CHANNEL_SRAM = 46;
+const unsigned int LINEAR_ACTUATOR_SRAM = 49;
+
+// static state of the sketch per host/memory_budget.cpp subsystem - the globals of hal.h, helper.h and the .ino
+// (only those of the enabled features) and the config.h tables indexed at run time, which avr-gcc keeps in SRAM
+const unsigned int TTL_SUBSYSTEM_SRAM = 5 * TTL_STATE_SRAM + (TTL_HARDWARE_TIMER ? 4 * TTL_CHANNEL_SRAM : 0) +
+                                        (SYNC_BARCODE ? 4 : 3) * TTL_QUEUE_SRAM + 4 * TTL_CHANNEL_MAX + 5 + PORT_COUNT * 4;
+const unsigned int SCHEDULER_SUBSYSTEM_SRAM = 2 * TIMER_SCHEDULER_SRAM;
+const unsigned int PORTS_SUBSYSTEM_SRAM = PORT_BANK_SRAM + (SENSOR_EDGE_CAPTURE ? 2 * PORT_COUNT * EDGE_QUEUE_SRAM : 0) +
+                                          2 * EDGE_CAPTURE_MAX + 3 + PORT_COUNT * 5;
+const unsigned int EVENT_LOG_SUBSYSTEM_SRAM = EVENT_LOG_SRAM + RECORD_LOG_SRAM;
+const unsigned int SESSION_SUBSYSTEM_SRAM = 8 + SESSION_PARAMS_SRAM + RUNTIME_SRAM + BLINK_LED_SRAM + RELOCATION_SRAM + 6 +
+                                            RELOCATION_STEPS * 12;
+const unsigned int ACTUATOR_SUBSYSTEM_SRAM = (LINEAR_ACTUATOR ? LINEAR_ACTUATOR_SRAM + STEPPER_CHANNEL_SRAM + 8 : 0) +
+                                             2 * ACTUATOR_CHANNEL_MAX + 1;
+const unsigned int SKETCH_SRAM = TTL_SUBSYSTEM_SRAM + SCHEDULER_SUBSYSTEM_SRAM + PORTS_SUBSYSTEM_SRAM + EVENT_LOG_SUBSYSTEM_SRAM +
+                                 PIN_TRACE_SRAM + LOOP_PROFILE_SRAM + SESSION_STATS_SRAM + LINK_SRAM + SYNC_BARCODE_SRAM +
+                                 SESSION_SUBSYSTEM_SRAM + ACTUATOR_SUBSYSTEM_SRAM;
+
+#ifdef __AVR__
+static_assert(sizeof(TimerScheduler) <= TIMER_SCHEDULER_SRAM, "TimerScheduler over its SRAM budget");
+static_assert(sizeof(TTLChannel) <= TTL_CHANNEL_SRAM, "TTLChannel over its SRAM budget");
+static_assert(sizeof(TTLQueue) <= TTL_QUEUE_SRAM, "TTLQueue over its SRAM budget");
+static_assert(sizeof(TTLState) <= TTL_STATE_SRAM, "TTLState over its SRAM budget");
+static_assert(sizeof(RuntimeState) <= RUNTIME_SRAM, "RuntimeState over its SRAM budget");
+static_assert(sizeof(BlinkLEDState) <= BLINK_LED_SRAM, "BlinkLEDState over its SRAM budget");
+static_assert(sizeof(EdgeQueue) <= EDGE_QUEUE_SRAM, "EdgeQueue over its SRAM budget");
+static_assert(sizeof(Debouncer) <= DEBOUNCER_SRAM, "Debouncer over its SRAM budget");
+static_assert(sizeof(PortBank<PORT_COUNT>) <= PORT_BANK_SRAM, "PortBank over its SRAM budget");
+static_assert(sizeof(EventLogState) <= EVENT_LOG_SRAM, "EventLogState over its SRAM budget");
+static_assert(sizeof(RecordLogState) <= RECORD_LOG_SRAM, "RecordLogState over its SRAM budget");
+static_assert(sizeof(PinTraceState) <= PIN_TRACE_SRAM, "PinTraceState over its SRAM budget");
+static_assert(sizeof(LoopProfileState) <= LOOP_PROFILE_SRAM, "LoopProfileState over its SRAM budget");
+static_assert(sizeof(SessionParams) <= SESSION_PARAMS_SRAM, "SessionParams over its SRAM budget");
+static_assert(sizeof(LinkState) <= LINK_SRAM, "LinkState over its SRAM budget");
+static_assert(sizeof(SessionStats) <= SESSION_STATS_SRAM, "SessionStats over its SRAM budget");
+static_assert(sizeof(RelocationState) <= RELOCATION_SRAM, "RelocationState over its SRAM budget");
+static_assert(sizeof(SyncBarcodeState) <= SYNC_BARCODE_SRAM, "SyncBarcodeState over its SRAM budget");
+static_assert(sizeof(StepperChannel) <= STEPPER_CHANNEL_SRAM, "StepperChannel over its SRAM budget");
+static_assert(sizeof(LinearActuatorState) <= LINEAR_ACTUATOR_SRAM, "LinearActuatorState over its SRAM budget");
+static_assert(SKETCH_SRAM + CORE_SRAM_RESERVE + STACK_RESERVE <= SRAM_SIZE, "static state of the enabled features does not fit SRAM_SIZE");
+#endif
+
 #endif
\ No newline at end of file
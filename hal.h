@@ -0,0 +1,387 @@
+/*
+ * Hardware abstraction layer
+ *   on the board this is the Arduino core, on a host build (no ARDUINO define) the same
+ *   API is served by the virtual board in host/hal_host.h so setup()/loop() run unchanged
+ */
+
+#ifndef HAL
+#define HAL
+
+#ifdef ARDUINO
+
+#include <Arduino.h>
+
+// storage of the sketch state, one board runs one sketch
+#define BOARD_LOCAL
+
+inline void halHalt()
+{
+  /*
+  Park the MCU once a self timed session is over
+  */
+  while (true);
+}
+
+inline void halSessionEnd()
+{
+  /*
+  Notify the backend that the E record was issued, nothing to do on the board
+  */
+}
+
+void (*halPinChangeHandler)() = nullptr;
+
+#ifdef __AVR__
+
+#include <EEPROM.h>
+
+inline byte halEepromRead(unsigned int address)
+{
+  return EEPROM.read(address);
+}
+
+inline void halEepromUpdate(unsigned int address, byte value)
+{
+  /*
+  Write one EEPROM cell, skipped when it already holds the value to spare its erase cycles
+  */
+  EEPROM.update(address, value);
+}
+
+// interrupt vectors claimed by the HAL, config.h leaves out the ones no enabled feature uses so other libraries
+// can own them (PCINT: SoftwareSerial, PinChangeInterrupt - Timer1: Servo, tone())
+#ifndef HAL_PIN_CHANGE_ISR
+#define HAL_PIN_CHANGE_ISR 1
+#endif
+#ifndef HAL_TICK_ISR
+#define HAL_TICK_ISR 1
+#endif
+
+#if HAL_PIN_CHANGE_ISR
+
+inline void halAttachPinChange(byte pin, void (*handler)())
+{
+  /*
+  Route pin change interrupts of a digital pin to handler, every enabled pin shares the handler
+  <byte> pin : digital pin with a PCINT line
+  <void (*)()> handler : called from interrupt context on any edge of an enabled pin
+  */
+  halPinChangeHandler = handler;
+  *digitalPinToPCMSK(pin) |= bit(digitalPinToPCMSKbit(pin));
+  PCIFR |= bit(digitalPinToPCICRbit(pin));
+  PCICR |= bit(digitalPinToPCICRbit(pin));
+}
+
+ISR(PCINT0_vect)
+{
+  if (halPinChangeHandler) halPinChangeHandler();
+}
+
+#ifdef PCINT1_vect
+ISR(PCINT1_vect)
+{
+  if (halPinChangeHandler) halPinChangeHandler();
+}
+#endif
+
+#ifdef PCINT2_vect
+ISR(PCINT2_vect)
+{
+  if (halPinChangeHandler) halPinChangeHandler();
+}
+#endif
+
+#else
+
+inline void halAttachPinChange(byte, void (*)())
+{
+  /*
+  Pin change vectors not compiled in, see HAL_PIN_CHANGE_ISR
+  */
+}
+
+#endif
+
+#if HAL_TICK_ISR
+
+void (*halTickHandler)() = nullptr;
+const bool HAL_TICK_TIMER = true;
+
+inline void halStartTick(unsigned long periodUs, void (*handler)())
+{
+  /*
+  Start Timer1 in CTC mode, handler runs from the compare A interrupt every periodUs,
+    the first call comes one full period after this returns
+  <unsigned long> periodUs : tick period in us, up to 32767us at 16MHz
+  <void (*)()> handler : called from interrupt context on every tick
+  */
+  uint8_t oldSREG = SREG;
+  cli();
+  halTickHandler = handler;
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TCNT1 = 0;
+  OCR1A = (F_CPU / 8000000UL) * periodUs - 1;
+  TIFR1 = bit(OCF1A);
+  TIMSK1 = bit(OCIE1A);
+  TCCR1B = bit(WGM12) | bit(CS11);
+  SREG = oldSREG;
+}
+
+inline void halStopTick()
+{
+  /*
+  Stop Timer1, safe to call from the tick handler
+  */
+  TIMSK1 &= ~bit(OCIE1A);
+  TCCR1B = 0;
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+  if (halTickHandler) halTickHandler();
+}
+
+#else
+
+// Timer1 left to other libraries, hardware TTL trains and actuator steps fall back to the software path
+const bool HAL_TICK_TIMER = false;
+
+inline void halStartTick(unsigned long, void (*)())
+{
+}
+
+inline void halStopTick()
+{
+}
+
+#endif
+
+// port register and mask of an output, resolved once so interrupt handlers can write it directly
+struct HalOutput
+{
+  volatile uint8_t* out;
+  uint8_t mask;
+};
+
+inline HalOutput halOutput(byte pin)
+{
+  HalOutput output = {portOutputRegister(digitalPinToPort(pin)), digitalPinToBitMask(pin)};
+  return output;
+}
+
+inline void halWrite(const HalOutput &output, bool level)
+{
+  if (level)
+  {
+    *output.out |= output.mask;
+  }
+  else
+  {
+    *output.out &= ~output.mask;
+  }
+}
+
+// input pin as core port number and mask, read from a snapshot of the input registers taken once per sweep
+struct HalInput
+{
+  uint8_t port;
+  uint8_t mask;
+};
+
+const byte HAL_INPUT_PORTS = 13;  // core port numbers, PA = 1 .. PL = 12
+
+inline HalInput halInput(byte pin)
+{
+  HalInput input = {digitalPinToPort(pin), digitalPinToBitMask(pin)};
+  return input;
+}
+
+inline uint16_t halInputPorts(const HalInput &input)
+{
+  return 1 << input.port;
+}
+
+inline void halSampleInputs(uint8_t* snapshot, uint16_t ports)
+{
+  /*
+  Read the input register of every port in the set at once, so all pins of a sweep are sampled together
+  <uint8_t*> snapshot : HAL_INPUT_PORTS register values
+  <uint16_t> ports : bit set of the ports to read, see halInputPorts()
+  */
+  for (uint8_t port = 0; ports != 0; port++, ports >>= 1)
+  {
+    if (ports & 1)
+    {
+      snapshot[port] = *portInputRegister(port);
+    }
+  }
+}
+
+inline bool halRead(const uint8_t* snapshot, const HalInput &input)
+{
+  return (snapshot[input.port] & input.mask) != 0;
+}
+
+inline bool halReadNow(const HalInput &input)
+{
+  /*
+  Read a single input register directly, e.g. from an interrupt handler
+  */
+  return (*portInputRegister(input.port) & input.mask) != 0;
+}
+
+#else
+
+// no EEPROM library on every core, reads as erased so no cached parameter block is found
+inline byte halEepromRead(unsigned int)
+{
+  return 0xFF;
+}
+
+inline void halEepromUpdate(unsigned int, byte)
+{
+}
+
+inline void halAttachPinChange(byte pin, void (*handler)())
+{
+  halPinChangeHandler = handler;
+  attachInterrupt(digitalPinToInterrupt(pin), handler, CHANGE);
+}
+
+// no portable tick timer, hardware TTL trains fall back to the software path
+const bool HAL_TICK_TIMER = false;
+
+inline void halStartTick(unsigned long, void (*)())
+{
+}
+
+inline void halStopTick()
+{
+}
+
+struct HalOutput
+{
+  byte pin;
+};
+
+inline HalOutput halOutput(byte pin)
+{
+  HalOutput output = {pin};
+  return output;
+}
+
+inline void halWrite(const HalOutput &output, bool level)
+{
+  digitalWrite(output.pin, level ? HIGH : LOW);
+}
+
+// no port registers, inputs are read one by one
+struct HalInput
+{
+  byte pin;
+};
+
+const byte HAL_INPUT_PORTS = 1;
+
+inline HalInput halInput(byte pin)
+{
+  HalInput input = {pin};
+  return input;
+}
+
+inline uint16_t halInputPorts(const HalInput &)
+{
+  return 0;
+}
+
+inline void halSampleInputs(uint8_t*, uint16_t)
+{
+}
+
+inline bool halRead(const uint8_t*, const HalInput &input)
+{
+  return digitalRead(input.pin) != LOW;
+}
+
+inline bool halReadNow(const HalInput &input)
+{
+  return digitalRead(input.pin) != LOW;
+}
+
+#endif
+
+#else
+
+#include "host/hal_host.h"
+
+#endif
+
+/*
+ * Compile time pin specialization
+ *   Pin<N, ActiveLow> resolves pin number and polarity at compile time, on the ATmega328P every
+ *   read/write is a single port register access instead of the digitalRead/digitalWrite table
+ *   lookups and timer checks, other targets and the host board fall back to the core API
+ */
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) || defined(__AVR_ATmega168__)
+
+template <byte N, bool ActiveLow = false>
+struct Pin
+{
+  static_assert(N < 20, "Pin: not an ATmega328P digital pin");
+  static const byte number = N;
+  static const byte bitMask = 1 << (N < 8 ? N : (N < 14 ? N - 8 : N - 14));
+
+  static inline volatile uint8_t &in() { return N < 8 ? PIND : (N < 14 ? PINB : PINC); }
+  static inline volatile uint8_t &out() { return N < 8 ? PORTD : (N < 14 ? PORTB : PORTC); }
+
+  static inline bool read(byte = N)
+  {
+    return ((in() & bitMask) != 0) != ActiveLow;
+  }
+
+  static inline void write(bool state)
+  {
+    if (state != ActiveLow)
+    {
+      out() |= bitMask;
+    }
+    else
+    {
+      out() &= (byte)~bitMask;
+    }
+  }
+
+  static inline void write(byte, bool state)
+  {
+    write(state);
+  }
+};
+
+#else
+
+template <byte N, bool ActiveLow = false>
+struct Pin
+{
+  static const byte number = N;
+
+  static inline bool read(byte = N)
+  {
+    return (digitalRead(N) != LOW) != ActiveLow;
+  }
+
+  static inline void write(bool state)
+  {
+    digitalWrite(N, state != ActiveLow ? HIGH : LOW);
+  }
+
+  static inline void write(byte, bool state)
+  {
+    write(state);
+  }
+};
+
+#endif
+
+#endif
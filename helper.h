@@ -1,554 +1,3253 @@
-/*
- * Helper function definitions
- */
-
-#ifndef HELPER
-#define HELPER
-
-#include "data.h"
-#include "config.h"
-
-void eventLog(byte side, 
-              byte type, 
-              byte state, 
-              unsigned long t)
-{
-  /*
-  Optimized serial print- encoded sensor/actuator identifier with event time
-  <byte> side : side identifier
-  <byte> type : sensor/actuator identifier
-  <byte> state : sensor/actuator state identifier
-  <unsigned long> t : event time
-  */
-  Serial.print(side);
-  Serial.print(type);
-  Serial.print(state);
-  Serial.println(t);
-}
-
-unsigned long currentTime(unsigned long tLast = 0, 
-                          unsigned long tolerance = CLOCK_TOLERANCE, 
-                          bool timeInMicroseconds = TIME_IN_MICROSECONDS)
-{
-  /*
-  Get current time in millis() by default
-  <bool> time_in_microseconds : set true to get time in micros()
-
-  Returns:
-  <unsigned long> : current time is request format and checked for jumps greater than set tolerance
-
-  CAUTION: millis() can go up to ~49days before overflow where as
-           micros() encounters overflow in ~70min
-  */
-  unsigned long tNow = timeInMicroseconds ? micros() : millis();
-  if (tLast != -1) 
-  {
-    while (tNow - tLast > tolerance || tNow < tLast)
-    {
-      tNow = timeInMicroseconds ? micros() : millis();
-    }
-  }
-  return tNow;
-}
-
-inline bool digitalReadCorrected(byte pin, 
-                                 bool sensorLogicLow = false)
-{
-  /*
-  Get logic corrected digital read for IR input pin
-  <byte> pin : digital pin ID
-  <bool> sensorLogicLow : true if sensor return low for desired readout
-  
-  Returns : 
-  <bool> corrected logic response based on sensor output, not of actual read if sensorLogicLow is true
-  */
-  bool v = digitalRead(pin);
-  return sensorLogicLow ? !v : v;
-}
-
-void digitalWriteCorrected(byte pin, 
-                           bool state,
-                           bool activeLogicLow = false)
-{
-  /*
-  Write logic corrected value to digital pin
-  <byte> pin : digital pin to write
-  <bool> state : HIGH or LOW, or true or false, or 1 or 0
-  */
-  digitalWrite(pin, activeLogicLow ? !state : state);
-}
-
-void initTTL(TTLState &ttlState,
-             byte pin,
-             byte mode,
-             unsigned long duration = TTL_DURATION,
-             unsigned long pulsePeriod = TTL_PULSE_PERIOD,
-             unsigned long pulseWidth = TTL_PULSE_WIDTH)
-{
-  /*
-  Initialize default state variable for TTLState
-  <struct TTLState> ttlState : struct variable of type TTLState
-  <byte> pin : pin to send/receive TTL pulse
-  <byte> mode : pin mode - OUTPUT/INPUT_PULLUP/INPUT
-  <unsigned long> duration : total duration of TTL signal
-	<unsigned long> freq : freq of ttl pulse to be sent for said duration (default in kHz for t in ms or MHz for t in us)
-  <unsigned long> pulseWidth : pulseWidth of individual pulse (default in ms or can be in us if TIME_IN_MICROSECONDS) 
-  */
-
-  pinMode(pin, mode);
-  if (mode == OUTPUT)
-  {
-    digitalWrite(pin, LOW);
-  }
-  ttlState.pin = pin;
-  ttlState.mode = mode;
-  ttlState.state = false;
-  ttlState.detect = false;
-  ttlState.pulseState = false;
-  ttlState.tTTLon = -1;
-  ttlState.tPulseon = -1;
-  ttlState.duration = duration;
-  ttlState.pulseWidth = pulseWidth;
-  ttlState.pulsePeriod = pulsePeriod;
-};
-
-void updateTTL(TTLState &ttlState, unsigned long tNow)
-{
-  /*
-  Update ttl state
-
-  <struct TTLState> ttlState : struct variable of type TTLState
-  <unsigned long> tNow : current time
-
-  NOTE: if ttlState pulseWidth >= pulsePeriod then the TTL pulse remains high through out the set duration
-  */
-  if (ttlState.state)
-  { 
-    if ((tNow - ttlState.tTTLon) >= ttlState.duration)
-    { 
-      digitalWrite(ttlState.pin, LOW);
-      ttlState.state = false;
-      ttlState.tTTLon = -1;
-      ttlState.tPulseon = -1;
-    }
-    else
-    {
-      if (ttlState.pulseState)
-      { 
-        if (((tNow - ttlState.tPulseon) >= ttlState.pulseWidth) && (ttlState.pulseWidth <= ttlState.pulsePeriod))
-        {
-          digitalWrite(ttlState.pin, LOW);
-          ttlState.pulseState = false;
-        }
-      }
-      else 
-      {
-        if ((tNow - ttlState.tPulseon) >= ttlState.pulsePeriod)
-        {
-          digitalWrite(ttlState.pin, HIGH);
-          ttlState.pulseState = true;
-          ttlState.tPulseon = tNow;
-        }
-      }
-    }
-  }
-}
-
-void sendTTL(TTLState* ttlState, 
-             unsigned long tNow, 
-             unsigned long pulsePeriod = TTL_PULSE_PERIOD)
-{
-  /*
-  Send a TTL pulse with said freq
-
-  <struct TTLState> ttlState : struct variable of type TTLState
-  <unsigned long> tNow : current time
-  <unsigned long> freq : freq of ttl pulse
-  */
-  if (!ttlState->state && ttlState->mode == OUTPUT)
-  {
-    digitalWrite(ttlState->pin, HIGH);
-    ttlState->state = true;
-    ttlState->pulseState = true;
-    ttlState->tTTLon = tNow;
-    ttlState->tPulseon = tNow;
-    ttlState->pulsePeriod = pulsePeriod;
-  }
-}
-
-bool detectTTL(TTLState *ttlState, 
-               unsigned long tNow,
-               bool completeSquarePulse = false)  
-{ 
-  /*
-  Detect input TTL signal
-  <struct TTLState> ttlState : struct variable of type TTLState
-  <unsigned long> tNow : current time
-  <bool> completeSquarePulse : set to true if the you need detection of completion of square pulse of a specific duration
-
-  Returns:
-  <bool> : true if TTL is high in case of completeSquarePulse is set to false, 
-           else true only when square pulse of specific duration is detected 
-  */
-  if (ttlState->mode == INPUT || ttlState->mode == INPUT_PULLUP)
-  {
-    bool v = digitalRead(ttlState->pin);
-    if (!ttlState->state && v)
-    {
-      ttlState->state = true;
-      ttlState->tTTLon = tNow;
-      if (!completeSquarePulse) {
-        ttlState->detect = true;
-        return true;
-      }
-      ttlState->detect = false;
-      return false;
-    }
-    else if (ttlState->state && !v)
-    { 
-      unsigned long duration = tNow - ttlState->tTTLon;
-      ttlState->state = false;
-      ttlState->tTTLon = -1;
-      if(duration >= ttlState->pulseWidth)
-      {
-        ttlState->detect = true;
-        return true;
-      }
-      ttlState->detect = false;
-      return false;
-    }
-    ttlState->detect = false;
-    return false;
-  }
-}
-
-void initRuntime(RuntimeState &runtimeState,
-                 byte pin, TTLState* outputTrigger,
-                 TTLState* inputTrigger = nullptr,
-                 unsigned long duration = RUN_TIME_DURATION,
-                 unsigned long delay = DELAY_START)
-{
-  /*
-  Initialize default state variable for runtime
-  <struct RuntimeState> runtimeState : runtime struct variable
-  <byte> pin : led indicator pin for runtime - HIGH when on, LOW when off
-  <unsigned long> duration : set total duration for runtime execution, defaults to RUN_TIME_DURATION
-  */
-  pinMode(pin, OUTPUT);
-  runtimeState.led_pin  = pin;
-  runtimeState.runtimeFlag = false;
-  runtimeState.duration = duration;
-  runtimeState.delay = delay;
-  digitalWrite(runtimeState.led_pin, OFF);
-  runtimeState.tStart = currentTime(-1);
-  runtimeState.tLast = -1;
-  runtimeState.inputTrigger = inputTrigger;
-  runtimeState.outputTrigger = outputTrigger;
-}
-
-void updateRuntime(RuntimeState &runtimeState)
-{
-  /*
-  Poll for current time and check for start or exit conditions for runtime
-  <struct RuntimeState> runtimeState : runtime struct variable
-  */
-  runtimeState.tNow = currentTime(runtimeState.tLast);
-  if (runtimeState.inputTrigger == nullptr)
-  {
-    //exit condition
-    if (runtimeState.runtimeFlag && (runtimeState.tNow - runtimeState.tRuntimeStart >= runtimeState.duration))
-    {
-      digitalWrite(runtimeState.led_pin, OFF);
-      digitalWriteCorrected(SOLENOID_A_PIN, OFF, SOLENOID_ACTIVE_LOW);
-      digitalWriteCorrected(SOLENOID_B_PIN, OFF, SOLENOID_ACTIVE_LOW);
-      runtimeState.runtimeFlag = false;
-      // log
-      Serial.print('E');
-      Serial.println(runtimeState.tNow);
-
-      while (true);
-    }
-    //start condition
-    if (!runtimeState.runtimeFlag && runtimeState.tNow - runtimeState.tStart >= DELAY_START)
-    {
-      runtimeState.runtimeFlag = true;
-      digitalWrite(runtimeState.led_pin, ON);
-      runtimeState.tRuntimeStart = runtimeState.tNow;
-      // log
-      Serial.print('S');
-      Serial.println(runtimeState.tRuntimeStart);
-    }
-  }
-  else
-  { 
-    bool inputTrigger = detectTTL(runtimeState.inputTrigger, runtimeState.tNow);
-    if (runtimeState.runtimeFlag && (runtimeState.tNow - runtimeState.tRuntimeStart >= runtimeState.duration))
-    {
-      digitalWrite(runtimeState.led_pin, OFF);
-      digitalWriteCorrected(SOLENOID_A_PIN, OFF, SOLENOID_ACTIVE_LOW);
-      digitalWriteCorrected(SOLENOID_B_PIN, OFF, SOLENOID_ACTIVE_LOW);
-      runtimeState.runtimeFlag = false;
-      sendTTL(runtimeState.outputTrigger, runtimeState.tNow);
-      // log
-      Serial.print('E');
-      Serial.println(runtimeState.tNow);
-    }
-    if (inputTrigger && !runtimeState.runtimeFlag)
-    {
-      runtimeState.runtimeFlag = true;
-      digitalWrite(runtimeState.led_pin, ON);
-      runtimeState.tRuntimeStart = runtimeState.tNow;
-      // log
-      Serial.print('S');
-      Serial.println(runtimeState.tRuntimeStart);
-    }
-  }
-  runtimeState.tLast = runtimeState.tNow;
-}
-
-void initBlinkLED(BlinkLEDState &ledState,
-                  byte pin,
-                  byte side,
-                  unsigned long blinkInterval = LED_BLINK_INTERVAL)
-{
-  /*
-  Initialize default parameters for blinking LED
-  <struct BlinkLEDState> ledState : struct for led state parameters
-  <byte> side : led location/side identifier
-  <byte> pin : led pin
-  <unsigned long> blinkInterval : blink duration
-  */
-  pinMode(pin, OUTPUT);
-  ledState.pin = pin;
-  ledState.side = side;
-  ledState.tLEDon = 0;
-  ledState.tLEDoff = 0;
-  ledState.ledBlinkState = false; 
-  ledState.blinkInterval = blinkInterval;
-}
-
-void updateBlinkLED(BlinkLEDState &ledState,
-                    unsigned long tNow)
-{
-  /*
-  update led blink between on and off
-  <struct BlinkLEDState> ledState : struct for led state parameters
-  <unsigned long> tNow : current time
-  */
-  if (ledState.ledBlinkState && (tNow - ledState.tLEDon > ledState.blinkInterval))
-  {
-    digitalWrite(ledState.pin, OFF);
-    ledState.tLEDoff = tNow;
-    ledState.ledBlinkState = false;
-  }
-  if (!ledState.ledBlinkState && (tNow - ledState.tLEDoff > ledState.blinkInterval))
-  {
-    digitalWrite(ledState.pin, ON);
-    ledState.tLEDon = tNow;
-    ledState.ledBlinkState = true;
-  }
-
-}
-
-void initIR(IRState &irDetector,
-            byte pin,
-            byte side,
-            byte proxyLEDPin,
-            TTLState* outputTrigger,
-            unsigned long ttlPulsePeriod = TTL_PULSE_PERIOD)
-{
-  /*
-  Init function to initialize irDetector with default parameters
-  <IRState> irDetector : struct storing irDetector state parameters
-  <byte> pin : input pin ID connected to ir sensor
-  <byte> side : side identifier
-  */
-  pinMode(pin, INPUT_PULLUP);
-  pinMode(proxyLEDPin, OUTPUT);
-  digitalWrite(proxyLEDPin, LOW);
-  irDetector.pin = pin;
-  irDetector.side = side;
-  irDetector.proxyLEDPin = proxyLEDPin;
-  irDetector.currentRead = digitalReadCorrected(pin, IR_ACTIVE_LOW);
-  irDetector.lastRead = false;
-  irDetector.inBreak = false;
-  irDetector.breakEvent = false;
-  irDetector.breakEventMutable = false;
-  irDetector.connectEvent = true;
-  irDetector.outputTrigger = outputTrigger;
-  irDetector.ttlPulsePeriod = ttlPulsePeriod;
-}
-
-void detectIR(IRState &irDetector,
-              unsigned long tNow)
-{
-  /*
-  Function to detect irDetector state changes and update state parameters accordingly
-    IR state change event is recorded following persistance in signal
-    Additionally since alternating high-low sig was detected when IR emitter and detector
-    were placed inside a circular housing within the behavior setup, || login between current and last read is implemented
-
-  <IRState> irDetector : struct storing irDetector state parameters
-  <unsigned long> tNow : current time of execution
-  */
-  bool v = digitalReadCorrected(irDetector.pin, IR_ACTIVE_LOW);
-  if ((irDetector.currentRead || irDetector.lastRead) && v && !irDetector.inBreak)
-  {
-    irDetector.tStart = tNow;
-    irDetector.inBreak = true;
-  }
-  else if (!(irDetector.currentRead || irDetector.lastRead) && !v && irDetector.inBreak)
-  {
-    irDetector.tOff = tNow;
-    irDetector.inBreak = false;
-  }
-  if (tNow - irDetector.tOff >= MIN_IR_BREAK && !irDetector.inBreak && irDetector.breakEvent)
-  {
-    irDetector.inBreak = false;
-    irDetector.breakEvent = false;
-    irDetector.breakEventMutable = false;
-    irDetector.connectEvent = true;
-    // log
-    eventLog(irDetector.side, IR, OFF, tNow);
-    digitalWrite(irDetector.proxyLEDPin, LOW);
-  }
-  if (tNow - irDetector.tStart >= MIN_IR_BREAK && irDetector.inBreak && irDetector.connectEvent)
-  {
-    irDetector.breakEvent = true;
-    irDetector.breakEventMutable = true;
-    irDetector.connectEvent = false;
-    // log
-    eventLog(irDetector.side, IR, ON, tNow);
-    digitalWrite(irDetector.proxyLEDPin, HIGH);
-    sendTTL(irDetector.outputTrigger, tNow, irDetector.ttlPulsePeriod);
-  }
-  irDetector.lastRead = irDetector.currentRead;
-  irDetector.currentRead = v;
-}
-
-void initTouch(TouchState &touchSensor,
-               byte pin,
-               byte side,
-               TTLState* outputTrigger,
-               unsigned long ttlPulsePeriod = TTL_PULSE_PERIOD)
-{
-  /*
-  Init function to initialize touchSensor with default parameters
-  <TouchState> touchSensor : struct storing touchSensor state parameters
-  <byte> pin : input pin ID connected to touch sensor
-  <byte> side : side identifier
-  */
-  pinMode(pin, INPUT_PULLUP);
-  touchSensor.pin = pin;
-  touchSensor.side = side;
-  touchSensor.current = digitalReadCorrected(touchSensor.pin, TOUCH_ACTIVE_LOW);
-  touchSensor.last = false;
-  touchSensor.inTouch = false;
-  touchSensor.touchEvent = false;
-  touchSensor.clearEvent = true;
-  touchSensor.outputTrigger = outputTrigger;
-  touchSensor.ttlPulsePeriod = ttlPulsePeriod;
-}
-
-void detectTouch(TouchState &touchSensor,
-                 unsigned long tNow)
-{
-  /*
-  Function to detect touchSensor state changes and update state parameters accordingly
-  <TouchState> touchSensor : struct storing irDetector state parameters
-  <unsigned long> tNow : current time of execution
-  <unsigned long> tRuntimeStart : time of runtime start
-  */
-  bool v = digitalReadCorrected(touchSensor.pin, TOUCH_ACTIVE_LOW);
-
-  if (v && !touchSensor.last)
-  {
-    // add state change as and when needed for duration dependent reward release
-    touchSensor.tStart = tNow;
-    touchSensor.inTouch = true;
-    touchSensor.touchEvent = true;
-    touchSensor.clearEvent = false;
-    // log
-    eventLog(touchSensor.side, TOUCH, ON, tNow);
-    sendTTL(touchSensor.outputTrigger, tNow, touchSensor.ttlPulsePeriod);
-  }
-  else if (!v && touchSensor.last)
-  {
-    touchSensor.inTouch = false;
-    touchSensor.clearEvent = true;
-    touchSensor.touchEvent = false;
-    // log
-    eventLog(touchSensor.side, TOUCH, OFF, tNow);
-  }
-  touchSensor.last = v;
-}
-
-void initSolenoid(SolenoidState &solenoidValve,
-                  byte pin,
-                  byte side,
-                  TTLState* outputTrigger,
-                  unsigned long ttlPulsePeriod = TTL_PULSE_PERIOD)
-{
-  /*
-  Init function to initialize solenoidState with default parameters
-  <SolenoidState> solenoidValve : struct storing solenoid valve state parameters
-  <byte> pin : input pin ID connected to touch sensor
-  <byte> side : side identifier
-  */
-  pinMode(pin, OUTPUT);
-  digitalWriteCorrected(pin, OFF, SOLENOID_ACTIVE_LOW);
-  solenoidValve.pin = pin;
-  solenoidValve.side = side;
-  solenoidValve.open = false;
-  solenoidValve.outputTrigger = outputTrigger;
-  solenoidValve.ttlPulsePeriod = TTL_PULSE_PERIOD;
-}
-
-void activateSolenoid(SolenoidState &solenoidValve,
-                      unsigned long tNow,
-                      unsigned long duration = SOLENOID_DURATION)
-{
-  /*
-  Function to activate solenoid valve and update state parameters accordingly
-  <SolenoidState> solenoidValve : struct storing solenoid valve state parameters
-  <unsigned long> duration : duration to keep the solenoid valve open/close depending on type of solenoid
-  <unsigned long> tNow : current time of execution
-  <unsigned long> tRuntimeStart : time of runtime start
-  */
-  if (solenoidValve.open)
-  {
-    return;
-  }
-  if (!solenoidValve.open)
-  {
-    solenoidValve.open = true;
-    solenoidValve.tOpen = tNow;
-    solenoidValve.duration = duration;
-    digitalWriteCorrected(solenoidValve.pin, ON, SOLENOID_ACTIVE_LOW);
-
-    // log
-    eventLog(solenoidValve.side, SOLENOID, ON, tNow);
-    sendTTL(solenoidValve.outputTrigger, tNow, solenoidValve.ttlPulsePeriod);
-  }
-}
-
-void updateSolenoid(SolenoidState &solenoidValve,
-                    unsigned long tNow)
-{
-  /*
-  Function to check for duration elapsed since solenoid valve activation and update state parameters accordingly
-  <SolenoidState> solenoidValve : struct storing solenoid valve state parameters
-  <unsigned long> tNow : current time of execution
-  <unsigned long> tRuntimeStart : time of runtime start
-  */
-  if (solenoidValve.open && tNow - solenoidValve.tOpen >= solenoidValve.duration)
-  {
-    solenoidValve.open = false;
-    solenoidValve.tClose = tNow;
-    digitalWriteCorrected(solenoidValve.pin, OFF, SOLENOID_ACTIVE_LOW);
-    // log
-    eventLog(solenoidValve.side, SOLENOID, OFF, tNow);
-  }
-}
-
+/*
+ * Helper function definitions
+ */
+
+#ifndef HELPER
+#define HELPER
+
+#include "data.h"
+#include "config.h"
+
+BOARD_LOCAL ClockState systemClock;
+
+void initClock(ClockState &clock)
+{
+  /*
+  Start the extended clock from the current hardware counter
+  <struct ClockState> clock : extended clock state
+  */
+  clock.lastRaw = TIME_IN_MICROSECONDS ? micros() : millis();
+  clock.overflows = 0;
+}
+
+Timestamp currentTime()
+{
+  /*
+  Get current time in millis(), or micros() if TIME_IN_MICROSECONDS, extended to 64 bit
+
+  Returns:
+  <Timestamp> : monotonic current time in the configured unit
+
+  NOTE: the 32 bit hardware counter overflows (millis() ~49days, micros() ~70min) are folded into
+        the upper word, which holds as long as this is called at least once per overflow period
+  */
+  uint32_t raw = TIME_IN_MICROSECONDS ? micros() : millis();
+  if (raw < systemClock.lastRaw)
+  {
+    systemClock.overflows++;
+  }
+  systemClock.lastRaw = raw;
+  return ((Timestamp)systemClock.overflows << 32) | raw;
+}
+
+Timestamp extendTime(uint32_t raw,
+                     Timestamp tNow)
+{
+  /*
+  Extend a 32 bit hardware counter value taken in the recent past (less than one overflow period) to 64 bit
+  <uint32_t> raw : counter value, e.g. stamped in an ISR
+  <Timestamp> tNow : current extended time
+
+  Returns:
+  <Timestamp> : extended time, later than tNow if raw is ahead of the counter value in tNow
+  */
+  int32_t age = (int32_t)((uint32_t)tNow - raw);
+  return tNow - age;
+}
+
+void printTimestamp(Timestamp t)
+{
+  /*
+  Serial.print for 64 bit times, the core Print class stops at unsigned long
+  */
+  if (t <= 0xFFFFFFFFULL)
+  {
+    Serial.print((unsigned long)t);
+    return;
+  }
+  char digits[21];
+  byte i = sizeof(digits) - 1;
+  digits[i] = '\0';
+  do
+  {
+    digits[--i] = '0' + t % 10;
+    t /= 10;
+  } while (t);
+  Serial.print(digits + i);
+}
+
+BOARD_LOCAL SessionParams sessionParams;
+
+void initSessionParams(SessionParams &params)
+{
+  /*
+  Load the config.h defaults of the run time session parameters
+  <struct SessionParams> params : session parameters
+  */
+  params.solenoidDuration = SOLENOID_DURATION;
+  params.minIRBreak = MIN_IR_BREAK;
+  params.runDuration = RUN_TIME_DURATION;
+  for (byte i = 0; i < RELOCATION_STEPS; i++)
+  {
+    params.relocationMode[i] = RELOCATION_MODE[i];
+    params.relocationLaps[i] = RELOCATION_LAPS[i];
+    params.relocationDuration[i] = RELOCATION_DURATION[i];
+  }
+}
+
+BOARD_LOCAL SessionStats sessionStats;
+
+void initSessionStats(SessionStats &stats)
+{
+  /*
+  Clear the session statistics, at every session start
+  <struct SessionStats> stats : session statistics
+  */
+  for (byte i = 0; i < PORT_COUNT; i++)
+  {
+    stats.lastPort[i] = PORT_NONE;
+    stats.rewards[i] = 0;
+    stats.touches[i] = 0;
+  }
+  stats.lapPort = PORT_NONE;
+  stats.steps = 0;
+  stats.laps = 0;
+  stats.errors = 0;
+  stats.run = 0;
+  stats.bestRun = 0;
+  stats.tLap = 0;
+  stats.lapIntervalSum = 0;
+  stats.lapIntervalMin = 0;
+}
+
+void updateSessionStats(SessionStats &stats,
+                        byte side,
+                        byte type,
+                        byte state,
+                        Timestamp t)
+{
+  /*
+  Count one event, constant time - a lap ends with an IR break at a port of the track another port of which
+    was visited last, a break at the port visited last is an error (the animal turned back), the reward of a
+    lap is the first valve opening at its arrival port and a RELOCATE event starts a new error-free run
+  <byte> side : side identifier
+  <byte> type : sensor/actuator identifier
+  <byte> state : sensor/actuator state identifier
+  <Timestamp> t : event time
+  */
+  if (state != ON || side >= PORT_COUNT)
+  {
+    return;
+  }
+  if (type == IR)
+  {
+    byte &last = stats.lastPort[PORT_TRACK[side]];
+    if (last == side)
+    {
+      stats.errors++;
+      stats.run = 0;
+    }
+    else if (last != PORT_NONE)
+    {
+      if (stats.laps)
+      {
+        unsigned long interval = t - stats.tLap;
+        stats.lapIntervalSum += interval;
+        stats.lapIntervalMin = stats.laps == 1 || interval < stats.lapIntervalMin ? interval : stats.lapIntervalMin;
+      }
+      stats.laps++;
+      stats.tLap = t;
+      stats.lapPort = side;
+      stats.run++;
+      stats.bestRun = stats.run > stats.bestRun ? stats.run : stats.bestRun;
+    }
+    last = side;
+  }
+  else if (type == TOUCH)
+  {
+    stats.touches[side]++;
+  }
+  else if (type == SOLENOID && side == stats.lapPort)
+  {
+    stats.rewards[side]++;
+    stats.lapPort = PORT_NONE;
+  }
+  else if (type == RELOCATE)
+  {
+    stats.steps++;
+    stats.run = 0;
+    stats.bestRun = 0;
+  }
+}
+
+BOARD_LOCAL RecordLogState recordLogQueue;
+
+void initRecordLog(RecordLogState &log)
+{
+  /*
+  Initialize empty text record ring buffer
+  <struct RecordLogState> log : record log ring buffer
+  */
+  log.head = 0;
+  log.tail = 0;
+  log.end = 0;
+  log.fits = false;
+  log.partial = false;
+  log.overflow = 0;
+}
+
+void recordChar(RecordLogState &log,
+                char c)
+{
+  /*
+  Append a character to the line being built, never blocks
+  <struct RecordLogState> log : record log ring buffer
+  <char> c : character
+  */
+  byte next = (log.end + 1) & (RECORD_LOG_CAPACITY - 1);
+  if (!log.fits || next == log.tail)
+  {
+    log.fits = false;
+    return;
+  }
+  log.text[log.end] = c;
+  log.end = next;
+}
+
+void recordNumber(RecordLogState &log,
+                  Timestamp v)
+{
+  /*
+  Append an unsigned number in decimal to the line being built, 32 bit arithmetic unless it needs more
+  <struct RecordLogState> log : record log ring buffer
+  <Timestamp> v : number
+  */
+  char digits[20];
+  byte n = 0;
+  if (v <= 0xFFFFFFFFULL)
+  {
+    uint32_t w = v;
+    do
+    {
+      digits[n++] = '0' + w % 10;
+      w /= 10;
+    } while (w);
+  }
+  else
+  {
+    do
+    {
+      digits[n++] = '0' + v % 10;
+      v /= 10;
+    } while (v);
+  }
+  while (n > 0)
+  {
+    recordChar(log, digits[--n]);
+  }
+}
+
+void beginRecord(RecordLogState &log,
+                 char kind)
+{
+  /*
+  Start a text line, its fields follow with recordChar()/recordNumber() and endRecord() queues it
+  <struct RecordLogState> log : record log ring buffer
+  <char> kind : record letter
+  */
+  log.end = log.head;
+  log.fits = true;
+  recordChar(log, kind);
+}
+
+void endRecord(RecordLogState &log)
+{
+  /*
+  Terminate the line being built and queue it, never blocks
+  <struct RecordLogState> log : record log ring buffer
+
+  NOTE: a line that does not fit the ring is dropped whole and counted in log.overflow
+  */
+  recordChar(log, '\r');
+  recordChar(log, '\n');
+  if (!log.fits)
+  {
+    if (log.overflow != 0xFFFF)
+    {
+      log.overflow++;
+    }
+    return;
+  }
+  log.head = log.end;
+  log.fits = false;
+}
+
+byte recordLogRoom(const RecordLogState &log)
+{
+  /*
+  Free bytes of the ring for the next line
+  <struct RecordLogState> log : record log ring buffer
+
+  Returns:
+  <byte> : longest line, line end included, that is queued without overflow
+  */
+  return (log.tail - log.head - 1) & (RECORD_LOG_CAPACITY - 1);
+}
+
+void drainRecordLog(RecordLogState &log)
+{
+  /*
+  Move queued lines into the serial TX buffer while they fit without blocking, call every loop() after
+    drainEventLog() - a line cut short by a full TX buffer holds back the events until it is complete
+  <struct RecordLogState> log : record log ring buffer
+  */
+  int space = Serial.availableForWrite();
+  while (log.tail != log.head && space > 0)
+  {
+    unsigned int size = (log.head > log.tail ? log.head : RECORD_LOG_CAPACITY) - log.tail;
+    size = size < (unsigned int)space ? size : space;
+    Serial.write((const uint8_t*)log.text + log.tail, size);
+    space -= size;
+    log.tail = (log.tail + size) & (RECORD_LOG_CAPACITY - 1);
+    log.partial = log.text[(log.tail - 1) & (RECORD_LOG_CAPACITY - 1)] != '\n';
+  }
+}
+
+void flushRecordLog(RecordLogState &log)
+{
+  /*
+  Write out every queued line, blocking - only for session boundaries
+  <struct RecordLogState> log : record log ring buffer
+  */
+  while (log.tail != log.head)
+  {
+    Serial.write((uint8_t)log.text[log.tail]);
+    log.tail = (log.tail + 1) & (RECORD_LOG_CAPACITY - 1);
+  }
+  log.partial = false;
+}
+
+BOARD_LOCAL EventLogState eventLogQueue;
+
+void initEventLog(EventLogState &log)
+{
+  /*
+  Initialize empty event log ring buffer, the encoding comes from EVENT_LOG_ENCODING
+  <struct EventLogState> log : event log ring buffer
+  */
+  log.head = 0;
+  log.tail = 0;
+  log.overflow = 0;
+  log.encoding = EVENT_LOG_ENCODING;
+  log.sequence = 0;
+  log.sequenceNext = 0;
+  log.sinceKey = 0;
+  log.keyed = false;
+  log.tLast = 0;
+}
+
+void eventLog(byte side, 
+              byte type, 
+              byte state, 
+              Timestamp t)
+{
+  /*
+  Queue encoded sensor/actuator identifier with event time for transmission, never blocks
+  <byte> side : side identifier
+  <byte> type : sensor/actuator identifier
+  <byte> state : sensor/actuator state identifier
+  <Timestamp> t : event time
+
+  NOTE: events are dropped and counted in eventLogQueue.overflow when the ring buffer is full,
+        a dropped event still takes its sequence number so the receiver sees the gap - with
+        EVENT_LOG_SUMMARY events only update the session statistics
+  */
+  if (SESSION_STATS)
+  {
+    updateSessionStats(sessionStats, side, type, state, t);
+  }
+  if (EVENT_LOG_SUMMARY)
+  {
+    return;
+  }
+  byte sequence = eventLogQueue.sequence++;
+  byte next = (eventLogQueue.head + 1) & (EVENT_LOG_CAPACITY - 1);
+  if (next == eventLogQueue.tail)
+  {
+    if (eventLogQueue.overflow != 0xFFFF)
+    {
+      eventLogQueue.overflow++;
+    }
+    return;
+  }
+  eventLogQueue.records[eventLogQueue.head].code = (side << 4) | (type << 1) | state;
+  eventLogQueue.records[eventLogQueue.head].sequence = sequence;
+  eventLogQueue.records[eventLogQueue.head].t = (ShortTimestamp)t;
+  eventLogQueue.head = next;
+}
+
+void writeEventRecord(byte code,
+                      Timestamp t,
+                      byte encoding)
+{
+  /*
+  Serialize one queued event as a fixed size binary frame or legacy ascii line
+  <byte> code : event code
+  <Timestamp> t : event time, extended
+  <byte> encoding : EVENT_FRAME or EVENT_ASCII
+  */
+  if (encoding == EVENT_FRAME)
+  {
+    byte frame[EVENT_FRAME_SIZE];
+    frame[0] = EVENT_FRAME_SYNC;
+    frame[1] = code;
+    byte checksum = frame[1];
+    for (byte i = 0; i < EVENT_FRAME_TIME_BYTES; i++)
+    {
+      frame[2 + i] = t >> (8 * i);
+      checksum ^= frame[2 + i];
+    }
+    frame[EVENT_FRAME_SIZE - 1] = checksum;
+    Serial.write(frame, EVENT_FRAME_SIZE);
+  }
+  else
+  {
+    Serial.print((byte)(code >> 4));
+    Serial.print((byte)((code >> 1) & 0x07));
+    Serial.print((byte)(code & 0x01));
+    printTimestamp(t);
+    Serial.println();
+  }
+}
+
+byte putVarint(byte* out,
+               int64_t delta)
+{
+  /*
+  Zigzag varint encoding of a signed time delta, 7 bits per byte low bits first
+
+  Returns:
+  <byte> : bytes written, EVENT_DELTA_BYTES + 1 if the delta does not fit in EVENT_DELTA_BYTES (out untouched past that)
+  */
+  uint64_t v = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+  byte n = 0;
+  while (n < EVENT_DELTA_BYTES)
+  {
+    out[n] = (v & 0x7F) | (v > 0x7F ? 0x80 : 0);
+    n++;
+    v >>= 7;
+    if (v == 0)
+    {
+      return n;
+    }
+  }
+  return EVENT_DELTA_BYTES + 1;
+}
+
+byte writeEventBatch(EventLogState &log,
+                     int space,
+                     Timestamp tNow)
+{
+  /*
+  Serialize the oldest queued events as one EVENT_COMPACT frame - up to EVENT_BATCH_MAX consecutive events
+    that fit in space, a keyframe when the deltas are not valid or the keyframe interval is due
+  <struct EventLogState> log : event log ring buffer
+  <int> space : bytes free in the serial TX buffer
+  <Timestamp> tNow : current time, the queued event times are extended against it
+
+  Returns:
+  <byte> : events written, 0 if not even one fits in space
+  */
+  byte frame[EVENT_COMPACT_MAX_SIZE];
+  const EventRecord &first = log.records[log.tail];
+  Timestamp tFirst = extendTime(first.t, tNow);
+  bool key = !log.keyed || log.sinceKey >= EVENT_KEYFRAME_INTERVAL || first.sequence != log.sequenceNext;
+  byte size = 3;
+  byte delta[EVENT_DELTA_BYTES + 1];
+  byte deltaSize = key ? 0 : putVarint(delta, (int64_t)(tFirst - log.tLast));
+  if (deltaSize > EVENT_DELTA_BYTES)
+  {
+    key = true;
+    deltaSize = 0;
+  }
+  if (key)
+  {
+    for (byte i = 0; i < EVENT_FRAME_TIME_BYTES; i++)
+    {
+      frame[size++] = tFirst >> (8 * i);
+    }
+  }
+  byte count = 0;
+  byte tail = log.tail;
+  Timestamp tLast = tFirst;
+  while (true)
+  {
+    // the first event is always taken, later ones only while consecutive and within the frame and space
+    if (count > 0)
+    {
+      const EventRecord &record = log.records[tail];
+      if (tail == log.head || count == EVENT_BATCH_MAX || record.sequence != (byte)(log.records[(tail - 1) & (EVENT_LOG_CAPACITY - 1)].sequence + 1))
+      {
+        break;
+      }
+      Timestamp t = extendTime(record.t, tNow);
+      deltaSize = putVarint(delta, (int64_t)(t - tLast));
+      if (deltaSize > EVENT_DELTA_BYTES || size + 2 + deltaSize > space)
+      {
+        break;
+      }
+      tLast = t;
+    }
+    frame[size++] = log.records[tail].code;
+    for (byte i = 0; i < deltaSize; i++)
+    {
+      frame[size++] = delta[i];
+    }
+    count++;
+    tail = (tail + 1) & (EVENT_LOG_CAPACITY - 1);
+  }
+  if (size + 1 > space)
+  {
+    return 0;
+  }
+  frame[0] = EVENT_COMPACT_SYNC;
+  frame[1] = count | (key ? EVENT_COMPACT_KEY : 0);
+  frame[2] = first.sequence;
+  byte checksum = 0;
+  for (byte i = 1; i < size; i++)
+  {
+    checksum ^= frame[i];
+  }
+  frame[size++] = checksum;
+  Serial.write(frame, size);
+  log.sinceKey = key ? count : log.sinceKey + count;
+  log.keyed = true;
+  log.sequenceNext = log.records[(tail - 1) & (EVENT_LOG_CAPACITY - 1)].sequence + 1;
+  log.tLast = tLast;
+  log.tail = tail;
+  return count;
+}
+
+void drainEventLog(EventLogState &log)
+{
+  /*
+  Move queued events into the serial TX buffer while they fit without blocking, call every loop(), not while
+    a record line is partly written
+  <struct EventLogState> log : event log ring buffer
+  */
+  if (log.tail == log.head || recordLogQueue.partial)
+  {
+    return;
+  }
+  Timestamp tNow = currentTime();
+  if (log.encoding == EVENT_COMPACT)
+  {
+    while (log.tail != log.head && writeEventBatch(log, Serial.availableForWrite(), tNow))
+    {
+    }
+    return;
+  }
+  byte size = log.encoding == EVENT_FRAME ? EVENT_FRAME_SIZE : EVENT_LINE_SIZE;
+  while (log.tail != log.head && Serial.availableForWrite() >= size)
+  {
+    writeEventRecord(log.records[log.tail].code, extendTime(log.records[log.tail].t, tNow), log.encoding);
+    log.tail = (log.tail + 1) & (EVENT_LOG_CAPACITY - 1);
+  }
+}
+
+void flushEventLog(EventLogState &log)
+{
+  /*
+  Write out every queued event after the queued record lines, blocking - only for session boundaries
+  <struct EventLogState> log : event log ring buffer
+  */
+  flushRecordLog(recordLogQueue);
+  Timestamp tNow = currentTime();
+  while (log.tail != log.head)
+  {
+    if (log.encoding == EVENT_COMPACT)
+    {
+      writeEventBatch(log, EVENT_COMPACT_MAX_SIZE, tNow);
+      continue;
+    }
+    writeEventRecord(log.records[log.tail].code, extendTime(log.records[log.tail].t, tNow), log.encoding);
+    log.tail = (log.tail + 1) & (EVENT_LOG_CAPACITY - 1);
+  }
+}
+
+BOARD_LOCAL PinTraceState pinTrace;
+
+void initPinTrace(PinTraceState &trace)
+{
+  /*
+  Initialize empty raw pin trace, the next level of every input is traced and the next frame is a keyframe
+  <struct PinTraceState> trace : pin trace ring buffer
+  */
+  trace.head = 0;
+  trace.tail = 0;
+  trace.overflow = 0;
+  trace.known = 0;
+  trace.level = 0;
+  trace.tLast = 0;
+  trace.keyed = false;
+}
+
+inline void tracePin(byte port,
+                     byte type,
+                     bool level,
+                     Timestamp t)
+{
+  /*
+  Queue a raw input level for the pin trace if it differs from the last one traced, never blocks
+  <byte> port : port of the input
+  <byte> type : IR or TOUCH
+  <bool> level : logic corrected level as fed to the detection state machine
+  <Timestamp> t : sample or edge time
+
+  NOTE: no-op unless PIN_TRACE, a dropped level is counted in pinTrace.overflow and the input is traced
+        again at its next sample
+  */
+  if (!PIN_TRACE)
+  {
+    return;
+  }
+  uint32_t bit = 1UL << ((port << 1) | type);
+  if ((pinTrace.known & bit) && ((pinTrace.level & bit) != 0) == level)
+  {
+    return;
+  }
+  byte next = (pinTrace.head + 1) & (PIN_TRACE_CAPACITY - 1);
+  if (next == pinTrace.tail)
+  {
+    if (pinTrace.overflow != 0xFFFF)
+    {
+      pinTrace.overflow++;
+    }
+    pinTrace.known &= ~bit;
+    return;
+  }
+  pinTrace.known |= bit;
+  pinTrace.level = level ? pinTrace.level | bit : pinTrace.level & ~bit;
+  pinTrace.records[pinTrace.head].code = (port << 2) | (type << 1) | level;
+  pinTrace.records[pinTrace.head].t = (ShortTimestamp)t;
+  pinTrace.head = next;
+}
+
+byte writeTraceRecord(PinTraceState &trace,
+                      byte code,
+                      Timestamp t,
+                      int space)
+{
+  /*
+  Serialize one traced level as a delta frame, or as a keyframe when the time since the previous frame
+    does not fit in 16 bits
+  <struct PinTraceState> trace : pin trace ring buffer
+  <byte> code : traced input and level
+  <Timestamp> t : level time, extended
+  <int> space : bytes free in the serial TX buffer
+
+  Returns:
+  <byte> : bytes written, 0 if the frame does not fit in space
+  */
+  byte frame[PIN_TRACE_KEYFRAME_SIZE];
+  int64_t delta = (int64_t)(t - trace.tLast);
+  bool key = !trace.keyed || delta < -32767 || delta > 32767;
+  byte size = key ? PIN_TRACE_KEYFRAME_SIZE : PIN_TRACE_FRAME_SIZE;
+  if (space < size)
+  {
+    return 0;
+  }
+  frame[0] = PIN_TRACE_SYNC;
+  frame[1] = key ? code | PIN_TRACE_KEYFRAME : code;
+  byte checksum = frame[1];
+  for (byte i = 0; i < size - 3; i++)
+  {
+    frame[2 + i] = key ? t >> (8 * i) : (uint16_t)delta >> (8 * i);
+    checksum ^= frame[2 + i];
+  }
+  frame[size - 1] = checksum;
+  Serial.write(frame, size);
+  trace.tLast = t;
+  trace.keyed = true;
+  return size;
+}
+
+void drainPinTrace(PinTraceState &trace)
+{
+  /*
+  Move traced levels into the serial TX buffer while they fit without blocking, call every loop() after
+    drainEventLog() and drainRecordLog() so events and records keep priority
+  <struct PinTraceState> trace : pin trace ring buffer
+  */
+  if (!PIN_TRACE || trace.tail == trace.head || recordLogQueue.partial)
+  {
+    return;
+  }
+  Timestamp tNow = currentTime();
+  while (trace.tail != trace.head &&
+         writeTraceRecord(trace, trace.records[trace.tail].code, extendTime(trace.records[trace.tail].t, tNow), Serial.availableForWrite()))
+  {
+    trace.tail = (trace.tail + 1) & (PIN_TRACE_CAPACITY - 1);
+  }
+}
+
+void flushPinTrace(PinTraceState &trace)
+{
+  /*
+  Write out every traced level, blocking - only for session boundaries
+  <struct PinTraceState> trace : pin trace ring buffer
+  */
+  Timestamp tNow = currentTime();
+  while (PIN_TRACE && trace.tail != trace.head)
+  {
+    writeTraceRecord(trace, trace.records[trace.tail].code, extendTime(trace.records[trace.tail].t, tNow), PIN_TRACE_KEYFRAME_SIZE);
+    trace.tail = (trace.tail + 1) & (PIN_TRACE_CAPACITY - 1);
+  }
+}
+
+BOARD_LOCAL LoopProfileState loopProfile;
+
+void initLoopProfile(LoopProfileState &profile)
+{
+  /*
+  Clear loop duration statistics
+  <struct LoopProfileState> profile : loop profile
+  */
+  for (byte i = 0; i < LOOP_HISTOGRAM_BUCKETS; i++)
+  {
+    profile.histogram[i] = 0;
+  }
+  profile.iterations = 0;
+  profile.overBudget = 0;
+  profile.maxDuration = 0;
+  profile.tLast = micros();
+}
+
+byte loopHistogramBucket(unsigned long d)
+{
+  /*
+  Half octave bucket of a duration - 0, 1, [2,3), [3,4), [4,6), [6,8), [8,12) ...
+  <unsigned long> d : duration in us
+  */
+  if (d < 2)
+  {
+    return d;
+  }
+  byte msb = 0;
+  for (unsigned long v = d >> 1; v; v >>= 1)
+  {
+    msb++;
+  }
+  byte bucket = 2 * msb + ((d >> (msb - 1)) & 1);
+  return bucket < LOOP_HISTOGRAM_BUCKETS ? bucket : LOOP_HISTOGRAM_BUCKETS - 1;
+}
+
+unsigned long loopHistogramUpper(byte bucket)
+{
+  /*
+  Exclusive upper bound of a half octave bucket in us
+  */
+  bucket++;
+  if (bucket < 2)
+  {
+    return bucket;
+  }
+  return (unsigned long)(2 | (bucket & 1)) << (bucket / 2 - 1);
+}
+
+void updateLoopProfile(LoopProfileState &profile)
+{
+  /*
+  Record the duration since the previous call, call once at the top of loop()
+  <struct LoopProfileState> profile : loop profile
+  */
+  uint32_t t = micros();
+  unsigned long d = t - profile.tLast;
+  profile.tLast = t;
+  profile.histogram[loopHistogramBucket(d)]++;
+  profile.iterations++;
+  if (d > profile.maxDuration)
+  {
+    profile.maxDuration = d;
+  }
+  if (d > LOOP_BUDGET_US)
+  {
+    profile.overBudget++;
+  }
+}
+
+unsigned long loopProfilePercentile(const LoopProfileState &profile,
+                                    byte percent)
+{
+  /*
+  Upper bound of the bucket holding the requested percentile, clamped to the worst pass seen
+  <struct LoopProfileState> profile : loop profile
+  <byte> percent : percentile, 99 for p99
+  */
+  unsigned long rank = profile.iterations - (profile.iterations * (100 - percent)) / 100;
+  unsigned long count = 0;
+  for (byte i = 0; i < LOOP_HISTOGRAM_BUCKETS; i++)
+  {
+    count += profile.histogram[i];
+    if (count >= rank)
+    {
+      unsigned long upper = loopHistogramUpper(i);
+      return upper < profile.maxDuration ? upper : profile.maxDuration;
+    }
+  }
+  return profile.maxDuration;
+}
+
+void logLoopProfile(const LoopProfileState &profile)
+{
+  /*
+  Write the loop profile records - L<iterations>,<max us>,<p99 us>,<over budget> and H<bucket counts>
+  <struct LoopProfileState> profile : loop profile
+  */
+  Serial.print('L');
+  Serial.print(profile.iterations);
+  Serial.print(',');
+  Serial.print(profile.maxDuration);
+  Serial.print(',');
+  Serial.print(loopProfilePercentile(profile, 99));
+  Serial.print(',');
+  Serial.println(profile.overBudget);
+  Serial.print('H');
+  for (byte i = 0; i < LOOP_HISTOGRAM_BUCKETS; i++)
+  {
+    if (i)
+    {
+      Serial.print(',');
+    }
+    Serial.print(profile.histogram[i]);
+  }
+  Serial.println();
+}
+
+void recordSessionStats(RecordLogState &log,
+                        const SessionStats &stats)
+{
+  /*
+  Append the statistics fields to the line being built - relocation steps started, laps, errors, error-free run,
+    best run since the relocation, mean and min inter-lap interval (0 before the second lap), then rewards and
+    touches per port
+  <struct RecordLogState> log : record log ring buffer
+  <struct SessionStats> stats : session statistics
+  */
+  recordNumber(log, stats.steps);
+  recordChar(log, ',');
+  recordNumber(log, stats.laps);
+  recordChar(log, ',');
+  recordNumber(log, stats.errors);
+  recordChar(log, ',');
+  recordNumber(log, stats.run);
+  recordChar(log, ',');
+  recordNumber(log, stats.bestRun);
+  recordChar(log, ',');
+  recordNumber(log, stats.laps > 1 ? (unsigned long)(stats.lapIntervalSum / (stats.laps - 1)) : 0UL);
+  recordChar(log, ',');
+  recordNumber(log, stats.lapIntervalMin);
+  for (byte i = 0; i < PORT_COUNT; i++)
+  {
+    recordChar(log, ',');
+    recordNumber(log, stats.rewards[i]);
+  }
+  for (byte i = 0; i < PORT_COUNT; i++)
+  {
+    recordChar(log, ',');
+    recordNumber(log, stats.touches[i]);
+  }
+}
+
+void logSessionStats(const SessionStats &stats,
+                     Timestamp tNow)
+{
+  /*
+  Queue the P<time>,<statistics> record, never blocks
+  */
+  beginRecord(recordLogQueue, 'P');
+  recordNumber(recordLogQueue, tNow);
+  recordChar(recordLogQueue, ',');
+  recordSessionStats(recordLogQueue, stats);
+  endRecord(recordLogQueue);
+}
+
+void logSessionStart(Timestamp tNow)
+{
+  /*
+  Write the S record after the queued record lines and start loop profiling, the statistics and the lost record
+    count for the session
+  <Timestamp> tNow : session start time
+  */
+  flushRecordLog(recordLogQueue);
+  Serial.print('S');
+  printTimestamp(tNow);
+  Serial.println();
+  recordLogQueue.overflow = 0;
+  initLoopProfile(loopProfile);
+  initSessionStats(sessionStats);
+}
+
+void logSessionEnd(Timestamp tNow)
+{
+  /*
+  Flush the queued records, events and raw pin levels, then write the session end records, blocking:
+    E<end time>,<events lost to overflow>,<record lines lost to overflow>[,<statistics> when SESSION_STATS is set,
+      see recordSessionStats()]
+    R<raw pin levels lost to overflow> when PIN_TRACE is set
+    L and H loop profile records when LOOP_PROFILING is set, see logLoopProfile()
+  <Timestamp> tNow : session end time
+  */
+  flushEventLog(eventLogQueue);
+  flushPinTrace(pinTrace);
+  beginRecord(recordLogQueue, 'E');
+  recordNumber(recordLogQueue, tNow);
+  recordChar(recordLogQueue, ',');
+  recordNumber(recordLogQueue, eventLogQueue.overflow);
+  recordChar(recordLogQueue, ',');
+  recordNumber(recordLogQueue, recordLogQueue.overflow);
+  if (SESSION_STATS)
+  {
+    recordChar(recordLogQueue, ',');
+    recordSessionStats(recordLogQueue, sessionStats);
+  }
+  endRecord(recordLogQueue);
+  flushRecordLog(recordLogQueue);
+  if (PIN_TRACE)
+  {
+    Serial.print('R');
+    Serial.println(pinTrace.overflow);
+  }
+  if (LOOP_PROFILING)
+  {
+    logLoopProfile(loopProfile);
+  }
+}
+
+inline bool digitalReadCorrected(byte pin, 
+                                 bool sensorLogicLow = false)
+{
+  /*
+  Get logic corrected digital read for IR input pin
+  <byte> pin : digital pin ID
+  <bool> sensorLogicLow : true if sensor return low for desired readout
+  
+  Returns : 
+  <bool> corrected logic response based on sensor output, not of actual read if sensorLogicLow is true
+  */
+  bool v = digitalRead(pin);
+  return sensorLogicLow ? !v : v;
+}
+
+void digitalWriteCorrected(byte pin, 
+                           bool state,
+                           bool activeLogicLow = false)
+{
+  /*
+  Write logic corrected value to digital pin
+  <byte> pin : digital pin to write
+  <bool> state : HIGH or LOW, or true or false, or 1 or 0
+  */
+  digitalWrite(pin, activeLogicLow ? !state : state);
+}
+
+template <bool ActiveLow = false>
+struct DynamicPin
+{
+  /*
+  Runtime pin counterpart of Pin<N, ActiveLow>, default pin policy of the templated state machine
+  functions - the pin number comes from the state struct, Pin<> ignores it
+  */
+  static inline bool read(byte pin)
+  {
+    return digitalReadCorrected(pin, ActiveLow);
+  }
+
+  static inline void write(byte pin, bool state)
+  {
+    digitalWriteCorrected(pin, state, ActiveLow);
+  }
+};
+
+void initTimerScheduler(TimerScheduler &scheduler)
+{
+  /*
+  Initialize empty timer scheduler
+  <struct TimerScheduler> scheduler : deadline scheduler
+  */
+  scheduler.count = 0;
+  scheduler.pending = false;
+  scheduler.tNext = 0;
+}
+
+TimerHandle addTimer(TimerScheduler &scheduler,
+                     void (*fire)(void*, Timestamp),
+                     void* state)
+{
+  /*
+  Register a disarmed timer entry
+  <struct TimerScheduler> scheduler : deadline scheduler
+  <void (*)(void*, Timestamp)> fire : called with state and current time once the deadline passed
+  <void*> state : actuator state struct
+
+  Returns:
+  <struct TimerHandle> : handle to arm the entry, unscheduled (polled) handle if the scheduler is full
+  */
+  TimerHandle handle = {nullptr, 0};
+  if (scheduler.count < TIMER_SLOTS)
+  {
+    TimerEntry &entry = scheduler.entries[scheduler.count];
+    entry.armed = false;
+    entry.fire = fire;
+    entry.state = state;
+    handle.scheduler = &scheduler;
+    handle.slot = scheduler.count++;
+  }
+  return handle;
+}
+
+void armTimer(TimerHandle &handle,
+              Timestamp deadline)
+{
+  /*
+  (Re)arm a timer entry, no-op for polled actuators
+  <struct TimerHandle> handle : timer handle
+  <Timestamp> deadline : time at which the entry fires
+  */
+  if (handle.scheduler == nullptr)
+  {
+    return;
+  }
+  TimerScheduler &scheduler = *handle.scheduler;
+  TimerEntry &entry = scheduler.entries[handle.slot];
+  entry.deadline = deadline;
+  entry.armed = true;
+  if (!scheduler.pending || deadline < scheduler.tNext)
+  {
+    scheduler.tNext = deadline;
+    scheduler.pending = true;
+  }
+}
+
+void runTimers(TimerScheduler &scheduler,
+               Timestamp tNow)
+{
+  /*
+  Fire every entry whose deadline passed, a single comparison while nothing is due
+  <struct TimerScheduler> scheduler : deadline scheduler
+  <Timestamp> tNow : current time
+  */
+  if (!scheduler.pending || tNow < scheduler.tNext)
+  {
+    return;
+  }
+  for (byte i = 0; i < scheduler.count; i++)
+  {
+    TimerEntry &entry = scheduler.entries[i];
+    if (entry.armed && tNow >= entry.deadline)
+    {
+      entry.armed = false;
+      entry.fire(entry.state, tNow);
+    }
+  }
+  scheduler.pending = false;
+  for (byte i = 0; i < scheduler.count; i++)
+  {
+    TimerEntry &entry = scheduler.entries[i];
+    if (entry.armed && (!scheduler.pending || entry.deadline < scheduler.tNext))
+    {
+      scheduler.tNext = entry.deadline;
+      scheduler.pending = true;
+    }
+  }
+}
+
+void initTTL(TTLState &ttlState,
+             byte pin,
+             byte mode,
+             unsigned long duration = TTL_DURATION,
+             unsigned long pulsePeriod = TTL_PULSE_PERIOD,
+             unsigned long pulseWidth = TTL_PULSE_WIDTH)
+{
+  /*
+  Initialize default state variable for TTLState
+  <struct TTLState> ttlState : struct variable of type TTLState
+  <byte> pin : pin to send/receive TTL pulse
+  <byte> mode : pin mode - OUTPUT/INPUT_PULLUP/INPUT
+  <unsigned long> duration : total duration of TTL signal
+	<unsigned long> freq : freq of ttl pulse to be sent for said duration (default in kHz for t in ms or MHz for t in us)
+  <unsigned long> pulseWidth : pulseWidth of individual pulse (default in ms or can be in us if TIME_IN_MICROSECONDS) 
+  */
+
+  pinMode(pin, mode);
+  if (mode == OUTPUT)
+  {
+    digitalWrite(pin, LOW);
+  }
+  ttlState.pin = pin;
+  ttlState.mode = mode;
+  ttlState.state = false;
+  ttlState.detect = false;
+  ttlState.pulseState = false;
+  ttlState.tTTLon = -1;
+  ttlState.tPulseon = -1;
+  ttlState.duration = duration;
+  ttlState.pulseWidth = pulseWidth;
+  ttlState.pulsePeriod = pulsePeriod;
+  ttlState.patterned = false;
+  ttlState.pattern = 0;
+  ttlState.tTTLoff = -1;
+  ttlState.timer.scheduler = nullptr;
+  ttlState.channel = nullptr;
+  ttlState.queue = nullptr;
+  ttlState.sent = 0;
+  ttlState.delayed = 0;
+  ttlState.dropped = 0;
+  ttlState.maxDelay = 0;
+  ttlState.started = nullptr;
+};
+
+BOARD_LOCAL TTLChannel* ttlChannels[TTL_CHANNEL_MAX];
+BOARD_LOCAL byte ttlChannelCount = 0;
+BOARD_LOCAL StepperChannel* stepperChannels[ACTUATOR_CHANNEL_MAX];
+BOARD_LOCAL byte stepperChannelCount = 0;
+BOARD_LOCAL volatile bool ttlTickRunning = false;
+
+const uint32_t STEPPER_ONE_STEP = 1UL << 24;
+
+bool stepperTick(StepperChannel &channel)
+{
+  /*
+  Advance a stepper move by one tick, runs in interrupt context - a step pulse is high for one tick, the
+    speed follows the trapezoidal profile and the move stops on the limit switch of its direction
+  <struct StepperChannel> channel : step pulse generator
+
+  Returns:
+  <bool> : true while the move goes on
+  */
+  if (!channel.active)
+  {
+    return false;
+  }
+  if (channel.pulse)
+  {
+    // at most half a step per tick, no step is due in the tick after one
+    halWrite(channel.step, LOW);
+    channel.pulse = false;
+  }
+  if (channel.remaining == 0)
+  {
+    channel.active = false;
+    return false;
+  }
+  if (channel.checkLimit && halReadNow(channel.limit) != ACTUATOR_LIMIT_ACTIVE_LOW)
+  {
+    channel.limitHit = true;
+    channel.active = false;
+    return false;
+  }
+  bool accelerating = false;
+  if (channel.remaining <= channel.accelSteps)
+  {
+    channel.speed = channel.speed > channel.startSpeed + channel.acceleration ? channel.speed - channel.acceleration : channel.startSpeed;
+  }
+  else if (channel.speed < channel.maxSpeed)
+  {
+    channel.speed = channel.maxSpeed - channel.speed > channel.acceleration ? channel.speed + channel.acceleration : channel.maxSpeed;
+    accelerating = true;
+  }
+  channel.phase += channel.speed;
+  if (channel.phase >= STEPPER_ONE_STEP)
+  {
+    channel.phase -= STEPPER_ONE_STEP;
+    halWrite(channel.step, HIGH);
+    channel.pulse = true;
+    channel.position += channel.forward ? 1 : -1;
+    channel.remaining--;
+    channel.accelSteps += accelerating;
+  }
+  return true;
+}
+
+void ttlTick()
+{
+  /*
+  Tick handler, runs in interrupt context - advances every active hardware TTL train and stepper move by
+  one tick and stops the timer once all of them are done
+  */
+  bool running = false;
+  for (byte i = 0; i < stepperChannelCount; i++)
+  {
+    running = stepperTick(*stepperChannels[i]) || running;
+  }
+  for (byte i = 0; i < ttlChannelCount; i++)
+  {
+    TTLChannel &channel = *ttlChannels[i];
+    if (!channel.active)
+    {
+      continue;
+    }
+    if (channel.elapsed >= channel.durationTicks)
+    {
+      halWrite(channel.output, LOW);
+      channel.active = false;
+      continue;
+    }
+    if (channel.elapsed == 0)
+    {
+      channel.tStart = TIME_IN_MICROSECONDS ? micros() : millis();
+    }
+    if (channel.phase >= channel.periodTicks)
+    {
+      channel.phase = 0;
+    }
+    if (channel.phase == 0 && channel.patterned)
+    {
+      halWrite(channel.output, channel.pattern & 1);
+      channel.pattern >>= 1;
+    }
+    else if (channel.phase == 0)
+    {
+      halWrite(channel.output, HIGH);
+    }
+    else if (channel.phase == channel.widthTicks && channel.widthTicks <= channel.periodTicks && !channel.patterned)
+    {
+      halWrite(channel.output, LOW);
+    }
+    channel.phase++;
+    channel.elapsed++;
+    running = true;
+  }
+  if (!running)
+  {
+    ttlTickRunning = false;
+    halStopTick();
+  }
+}
+
+unsigned long ttlTicks(unsigned long t)
+{
+  /*
+  Convert a duration in the configured time unit to hardware TTL timer ticks
+  */
+  return (t * (TIME_IN_MICROSECONDS ? 1UL : 1000UL) + TTL_TIMER_TICK_US / 2) / TTL_TIMER_TICK_US;
+}
+
+void attachTTLChannel(TTLState &ttlState,
+                      TTLChannel &channel)
+{
+  /*
+  Move an output TTL onto the hardware timer backend, sendTTL()/updateTTL() keep their behaviour
+    and only hand the edges to the tick ISR, nothing changes where hal.h has no tick timer
+  <struct TTLState> ttlState : struct variable of type TTLState
+  <struct TTLChannel> channel : hardware channel storage
+  */
+  if (!HAL_TICK_TIMER || ttlState.mode != OUTPUT)
+  {
+    return;
+  }
+  channel.output = halOutput(ttlState.pin);
+  channel.active = false;
+  byte i = 0;
+  while (i < ttlChannelCount && ttlChannels[i] != &channel)
+  {
+    i++;
+  }
+  if (i == TTL_CHANNEL_MAX)
+  {
+    return;
+  }
+  ttlChannels[i] = &channel;
+  ttlChannelCount = i == ttlChannelCount ? i + 1 : ttlChannelCount;
+  ttlState.channel = &channel;
+}
+
+BOARD_LOCAL TTLState* ttlQueuedOutputs[TTL_CHANNEL_MAX];
+BOARD_LOCAL byte ttlQueuedOutputCount = 0;
+
+void attachTTLQueue(TTLState &ttlState,
+                    TTLQueue &queue)
+{
+  /*
+  Queue trains requested while the output is busy instead of dropping them,
+    the output is reported in the T records at session end
+  <struct TTLState> ttlState : struct variable of type TTLState
+  <struct TTLQueue> queue : pending train storage
+  */
+  queue.head = 0;
+  queue.tail = 0;
+  byte i = 0;
+  while (i < ttlQueuedOutputCount && ttlQueuedOutputs[i] != &ttlState)
+  {
+    i++;
+  }
+  if (i == TTL_CHANNEL_MAX)
+  {
+    return;
+  }
+  ttlQueuedOutputs[i] = &ttlState;
+  ttlQueuedOutputCount = i == ttlQueuedOutputCount ? i + 1 : ttlQueuedOutputCount;
+  ttlState.queue = &queue;
+}
+
+void resetTTLStats()
+{
+  for (byte i = 0; i < ttlQueuedOutputCount; i++)
+  {
+    TTLState &ttlState = *ttlQueuedOutputs[i];
+    ttlState.sent = 0;
+    ttlState.delayed = 0;
+    ttlState.dropped = 0;
+    ttlState.maxDelay = 0;
+  }
+}
+
+void logTTLStats()
+{
+  /*
+  Write one T record per queued output - pin, trains sent, trains sent late, trains dropped, longest delay
+  */
+  for (byte i = 0; i < ttlQueuedOutputCount; i++)
+  {
+    TTLState &ttlState = *ttlQueuedOutputs[i];
+    Serial.print('T');
+    Serial.print(ttlState.pin);
+    Serial.print(',');
+    Serial.print(ttlState.sent);
+    Serial.print(',');
+    Serial.print(ttlState.delayed);
+    Serial.print(',');
+    Serial.print(ttlState.dropped);
+    Serial.print(',');
+    Serial.println(ttlState.maxDelay);
+  }
+}
+
+inline bool ttlPending(const TTLState &ttlState)
+{
+  return ttlState.queue != nullptr && ttlState.queue->head != ttlState.queue->tail;
+}
+
+inline bool ttlReady(const TTLState &ttlState,
+                     Timestamp tNow)
+{
+  /*
+  true when the output is idle and the gap after its last train has passed,
+    tNow may be a replayed edge time from before the train ended
+  */
+  return !ttlState.state && (ttlState.tTTLoff == (Timestamp)-1 || tNow >= ttlState.tTTLoff + TTL_TRAIN_GAP);
+}
+
+void armTTL(TTLState &ttlState)
+{
+  /*
+  Arm the TTL timer for the next transition of updateTTL - pulse edge, end of the train or start of a queued one
+  <struct TTLState> ttlState : struct variable of type TTLState
+  */
+  if (!ttlState.state)
+  {
+    if (ttlPending(ttlState))
+    {
+      armTimer(ttlState.timer, ttlState.tTTLoff + TTL_TRAIN_GAP);
+    }
+    return;
+  }
+  Timestamp tEnd = ttlState.tTTLon + ttlState.duration;
+  if (ttlState.channel != nullptr)
+  {
+    // the ISR finishes the train, check back once it should be done
+    armTimer(ttlState.timer, tEnd);
+    return;
+  }
+  Timestamp tEdge;
+  if (ttlState.patterned)
+  {
+    tEdge = ttlState.tPulseon + ttlState.pulsePeriod;
+  }
+  else if (ttlState.pulseState)
+  {
+    tEdge = ttlState.pulseWidth <= ttlState.pulsePeriod ? ttlState.tPulseon + ttlState.pulseWidth : tEnd;
+  }
+  else
+  {
+    tEdge = ttlState.tPulseon + ttlState.pulsePeriod;
+  }
+  armTimer(ttlState.timer, tEdge < tEnd ? tEdge : tEnd);
+}
+
+void startTTL(TTLState &ttlState,
+              const TTLRequest &request,
+              Timestamp tNow)
+{
+  /*
+  Start a TTL train on an idle output and account for how long it waited
+  <struct TTLState> ttlState : struct variable of type TTLState
+  <struct TTLRequest> request : train parameters and time it was requested
+  <Timestamp> tNow : current time
+
+  NOTE: the started hook is told the train start time here for a software train, a hardware train only goes
+        out with the next tick so its hook waits for updateTTL() to see it done
+  */
+  if (ttlState.channel != nullptr)
+  {
+    // hardware train, the rising edge comes with the next tick
+    TTLChannel &channel = *ttlState.channel;
+    noInterrupts();
+    channel.durationTicks = ttlTicks(request.duration);
+    channel.widthTicks = ttlTicks(request.pulseWidth);
+    channel.periodTicks = ttlTicks(request.pulsePeriod);
+    channel.patterned = request.pattern != 0;
+    channel.pattern = request.pattern;
+    channel.elapsed = 0;
+    channel.phase = 0;
+    channel.active = true;
+    bool start = !ttlTickRunning;
+    ttlTickRunning = true;
+    interrupts();
+    if (start)
+    {
+      halStartTick(TTL_TIMER_TICK_US, ttlTick);
+    }
+  }
+  else
+  {
+    digitalWrite(ttlState.pin, request.pattern == 0 || (request.pattern & 1));
+  }
+  ttlState.state = true;
+  ttlState.pulseState = request.pattern == 0 || (request.pattern & 1);
+  ttlState.patterned = request.pattern != 0;
+  ttlState.pattern = request.pattern;
+  ttlState.tTTLon = tNow;
+  ttlState.tPulseon = tNow;
+  ttlState.pulsePeriod = request.pulsePeriod;
+  ttlState.pulseWidth = request.pulseWidth;
+  ttlState.duration = request.duration;
+  if (ttlState.started != nullptr && ttlState.channel == nullptr)
+  {
+    ttlState.started(request.pattern, tNow);
+  }
+  ttlState.sent++;
+  int32_t wait = (int32_t)((ShortTimestamp)tNow - request.tRequest);
+  unsigned long waited = wait > 0 ? (unsigned long)wait : 0UL;
+  if (waited > 0)
+  {
+    ttlState.delayed++;
+    ttlState.maxDelay = waited > ttlState.maxDelay ? waited : ttlState.maxDelay;
+  }
+  armTTL(ttlState);
+}
+
+template <class P = DynamicPin<>>
+void updateTTL(TTLState &ttlState, Timestamp tNow)
+{
+  /*
+  Update ttl state
+
+  <class P> : pin policy, Pin<N> for the compile time fast path
+  <struct TTLState> ttlState : struct variable of type TTLState
+  <Timestamp> tNow : current time
+
+  NOTE: if ttlState pulseWidth >= pulsePeriod then the TTL pulse remains high through out the set duration,
+        the next queued train starts once the output has been idle for TTL_TRAIN_GAP
+  */
+  if (ttlState.channel != nullptr)
+  {
+    // hardware train, only track its completion and report when its first edge went out
+    if (ttlState.state && !ttlState.channel->active)
+    {
+      if (ttlState.started != nullptr)
+      {
+        ttlState.started(ttlState.pattern, extendTime(ttlState.channel->tStart, tNow));
+      }
+      ttlState.state = false;
+      ttlState.tTTLon = -1;
+      ttlState.tPulseon = -1;
+      ttlState.tTTLoff = tNow;
+    }
+  }
+  else if (ttlState.state)
+  { 
+    if ((tNow - ttlState.tTTLon) >= ttlState.duration)
+    { 
+      P::write(ttlState.pin, LOW);
+      ttlState.state = false;
+      ttlState.tTTLon = -1;
+      ttlState.tPulseon = -1;
+      ttlState.tTTLoff = tNow;
+    }
+    else if (ttlState.patterned)
+    {
+      // next slot of the pattern, on the slot grid of the train start
+      if ((tNow - ttlState.tPulseon) >= ttlState.pulsePeriod)
+      {
+        ttlState.pattern >>= 1;
+        ttlState.pulseState = ttlState.pattern & 1;
+        ttlState.tPulseon += ttlState.pulsePeriod;
+        P::write(ttlState.pin, ttlState.pulseState);
+      }
+    }
+    else
+    {
+      if (ttlState.pulseState)
+      { 
+        if (((tNow - ttlState.tPulseon) >= ttlState.pulseWidth) && (ttlState.pulseWidth <= ttlState.pulsePeriod))
+        {
+          P::write(ttlState.pin, LOW);
+          ttlState.pulseState = false;
+        }
+      }
+      else 
+      {
+        if ((tNow - ttlState.tPulseon) >= ttlState.pulsePeriod)
+        {
+          P::write(ttlState.pin, HIGH);
+          ttlState.pulseState = true;
+          ttlState.tPulseon = tNow;
+        }
+      }
+    }
+  }
+  if (ttlPending(ttlState) && ttlReady(ttlState, tNow))
+  {
+    TTLQueue &queue = *ttlState.queue;
+    TTLRequest request = queue.requests[queue.tail];
+    queue.tail = (queue.tail + 1) & (TTL_QUEUE_CAPACITY - 1);
+    startTTL(ttlState, request, tNow);
+  }
+}
+
+template <class P>
+void fireTTL(void* state, Timestamp tNow)
+{
+  TTLState &ttlState = *(TTLState*)state;
+  updateTTL<P>(ttlState, tNow);
+  armTTL(ttlState);
+}
+
+template <class P = DynamicPin<>>
+void scheduleTTL(TTLState &ttlState,
+                 TimerScheduler &scheduler)
+{
+  /*
+  Drive an output TTL from a timer scheduler instead of polling updateTTL every loop()
+  <class P> : pin policy, Pin<N> for the compile time fast path
+  <struct TTLState> ttlState : struct variable of type TTLState
+  <struct TimerScheduler> scheduler : deadline scheduler
+  */
+  ttlState.timer = addTimer(scheduler, fireTTL<P>, &ttlState);
+  armTTL(ttlState);
+}
+
+void sendTTL(TTLState* ttlState, 
+             Timestamp tNow, 
+             unsigned long pulsePeriod = TTL_PULSE_PERIOD,
+             unsigned long pulseWidth = TTL_PULSE_WIDTH,
+             unsigned long duration = TTL_DURATION,
+             unsigned long pattern = 0)
+{
+  /*
+  Send a TTL pulse train, queued behind the running one when the output has a TTLQueue attached
+
+  <struct TTLState> ttlState : struct variable of type TTLState
+  <Timestamp> tNow : current time
+  <unsigned long> pulsePeriod : period of the ttl pulses
+  <unsigned long> pulseWidth : width of the individual pulses
+  <unsigned long> duration : total duration of the train
+  <unsigned long> pattern : non zero to send the output level of every pulsePeriod slot instead of pulses,
+                            bit 0 first, pulseWidth is then unused
+
+  NOTE: requests are counted in ttlState dropped when the output is busy without a queue or the queue is full
+  */
+  if (ttlState->mode != OUTPUT)
+  {
+    return;
+  }
+  TTLRequest request = {pulsePeriod, pulseWidth, duration, (ShortTimestamp)tNow, pattern};
+  if (ttlState->queue == nullptr)
+  {
+    if (ttlState->state)
+    {
+      ttlState->dropped++;
+      return;
+    }
+    startTTL(*ttlState, request, tNow);
+    return;
+  }
+  if (!ttlPending(*ttlState) && ttlReady(*ttlState, tNow))
+  {
+    startTTL(*ttlState, request, tNow);
+    return;
+  }
+  TTLQueue &queue = *ttlState->queue;
+  byte next = (queue.head + 1) & (TTL_QUEUE_CAPACITY - 1);
+  if (next == queue.tail)
+  {
+    ttlState->dropped++;
+    return;
+  }
+  queue.requests[queue.head] = request;
+  queue.head = next;
+  armTTL(*ttlState);
+}
+
+void sendTTLEvent(TTLState* ttlState,
+                  byte side,
+                  byte type,
+                  Timestamp tNow,
+                  unsigned long pulsePeriod = TTL_PULSE_PERIOD)
+{
+  /*
+  Send the TTL train of a sensor/actuator event, with TTL_PATTERN_ENCODING the train carries
+    1 + side + 2 * type pulses of TTL_PATTERN_WIDTH so every code is distinct on its own,
+    otherwise the side is told apart by pulsePeriod as before
+  <struct TTLState> ttlState : struct variable of type TTLState
+  <byte> side : side identifier
+  <byte> type : sensor/actuator identifier
+  <Timestamp> tNow : current time
+  <unsigned long> pulsePeriod : period of the ttl pulses without TTL_PATTERN_ENCODING
+  */
+  if (TTL_PATTERN_ENCODING)
+  {
+    sendTTL(ttlState, tNow, TTL_PATTERN_PERIOD, TTL_PATTERN_WIDTH, (1 + side + 2 * type) * TTL_PATTERN_PERIOD);
+  }
+  else
+  {
+    sendTTL(ttlState, tNow, pulsePeriod);
+  }
+}
+
+void logSyncBarcode(unsigned long pattern,
+                    Timestamp tStart)
+{
+  /*
+  Started hook of the barcode output, queues a B<time>,<counter> record for every barcode - the time is that of
+    the start edge like the events of the log, the other trains of the output have no pattern and are skipped
+  <unsigned long> pattern : slot levels of the train, the counter follows the start and guard slots
+  <Timestamp> tStart : time the start slot went high
+  */
+  if (pattern == 0)
+  {
+    return;
+  }
+  beginRecord(recordLogQueue, 'B');
+  recordNumber(recordLogQueue, tStart);
+  recordChar(recordLogQueue, ',');
+  recordNumber(recordLogQueue, (pattern >> 2) & ((1UL << SYNC_BARCODE_BITS) - 1));
+  endRecord(recordLogQueue);
+}
+
+void initSyncBarcode(SyncBarcodeState &barcode,
+                     TTLState* output)
+{
+  /*
+  Initialize the sync barcode of an output TTL, the counter runs from 0 at power on
+  <struct SyncBarcodeState> barcode : barcode state
+  <struct TTLState> output : TTL output the barcodes are sent on, its TTLQueue holds back other trains meanwhile
+  */
+  barcode.output = output;
+  output->started = logSyncBarcode;
+  barcode.counter = 0;
+  barcode.timer.scheduler = nullptr;
+}
+
+void sendSyncBarcode(SyncBarcodeState &barcode,
+                     Timestamp tNow)
+{
+  /*
+  Send the next barcode - start slot high, guard slot low, SYNC_BARCODE_BITS counter bits LSB first - it is
+    logged by logSyncBarcode() once it went out, possibly later than tNow behind a queued train
+  <struct SyncBarcodeState> barcode : barcode state
+  <Timestamp> tNow : current time
+  */
+  unsigned long pattern = 1UL | ((unsigned long)barcode.counter << 2);
+  sendTTL(barcode.output, tNow, SYNC_BARCODE_SLOT, SYNC_BARCODE_SLOT, (2UL + SYNC_BARCODE_BITS) * SYNC_BARCODE_SLOT, pattern);
+  barcode.counter = (barcode.counter + 1) & ((1UL << SYNC_BARCODE_BITS) - 1);
+}
+
+void fireSyncBarcode(void* state, Timestamp tNow)
+{
+  SyncBarcodeState &barcode = *(SyncBarcodeState*)state;
+  sendSyncBarcode(barcode, tNow);
+  armTimer(barcode.timer, tNow + SYNC_BARCODE_INTERVAL);
+}
+
+void scheduleSyncBarcode(SyncBarcodeState &barcode,
+                         TimerScheduler &scheduler)
+{
+  /*
+  Send the barcodes from a timer scheduler, the first one as soon as the scheduler runs
+  <struct SyncBarcodeState> barcode : barcode state
+  <struct TimerScheduler> scheduler : deadline scheduler, e.g. one that only runs during the session
+  */
+  barcode.timer = addTimer(scheduler, fireSyncBarcode, &barcode);
+  armTimer(barcode.timer, 0);
+}
+
+void fireSessionStats(void* state, Timestamp tNow)
+{
+  SessionStats &stats = *(SessionStats*)state;
+  logSessionStats(stats, tNow);
+  armTimer(stats.timer, tNow + SESSION_STATS_INTERVAL);
+}
+
+void scheduleSessionStats(SessionStats &stats,
+                          TimerScheduler &scheduler)
+{
+  /*
+  Write the P records from a timer scheduler, the first one as soon as the scheduler runs
+  <struct SessionStats> stats : session statistics
+  <struct TimerScheduler> scheduler : deadline scheduler, e.g. one that only runs during the session
+  */
+  stats.timer = addTimer(scheduler, fireSessionStats, &stats);
+  armTimer(stats.timer, 0);
+}
+
+template <class P = DynamicPin<>>
+bool detectTTL(TTLState *ttlState, 
+               Timestamp tNow,
+               bool completeSquarePulse = false)  
+{ 
+  /*
+  Detect input TTL signal
+  <class P> : pin policy, Pin<N> for the compile time fast path
+  <struct TTLState> ttlState : struct variable of type TTLState
+  <Timestamp> tNow : current time
+  <bool> completeSquarePulse : set to true if the you need detection of completion of square pulse of a specific duration
+
+  Returns:
+  <bool> : true if TTL is high in case of completeSquarePulse is set to false, 
+           else true only when square pulse of specific duration is detected 
+  */
+  if (ttlState->mode == INPUT || ttlState->mode == INPUT_PULLUP)
+  {
+    bool v = P::read(ttlState->pin);
+    if (!ttlState->state && v)
+    {
+      ttlState->state = true;
+      ttlState->tTTLon = tNow;
+      if (!completeSquarePulse) {
+        ttlState->detect = true;
+        return true;
+      }
+      ttlState->detect = false;
+      return false;
+    }
+    else if (ttlState->state && !v)
+    { 
+      Timestamp duration = tNow - ttlState->tTTLon;
+      ttlState->state = false;
+      ttlState->tTTLon = -1;
+      if(duration >= ttlState->pulseWidth)
+      {
+        ttlState->detect = true;
+        return true;
+      }
+      ttlState->detect = false;
+      return false;
+    }
+    ttlState->detect = false;
+    return false;
+  }
+  return false;
+}
+
+void initRuntime(RuntimeState &runtimeState,
+                 byte pin, TTLState* outputTrigger,
+                 TTLState* inputTrigger = nullptr,
+                 Timestamp duration = RUN_TIME_DURATION,
+                 Timestamp delay = DELAY_START)
+{
+  /*
+  Initialize default state variable for runtime, armed so a session starts on its own
+  <struct RuntimeState> runtimeState : runtime struct variable
+  <byte> pin : led indicator pin for runtime - HIGH when on, LOW when off
+  <Timestamp> duration : set total duration for runtime execution, defaults to RUN_TIME_DURATION
+  <Timestamp> delay : start delay after power on without an input trigger, defaults to DELAY_START
+  */
+  pinMode(pin, OUTPUT);
+  runtimeState.led_pin  = pin;
+  runtimeState.runtimeFlag = false;
+  runtimeState.armed = true;
+  runtimeState.duration = duration;
+  runtimeState.delay = delay;
+  digitalWrite(runtimeState.led_pin, OFF);
+  runtimeState.tStart = currentTime();
+  runtimeState.tLast = runtimeState.tStart;
+  runtimeState.inputTrigger = inputTrigger;
+  runtimeState.outputTrigger = outputTrigger;
+}
+
+void startRuntime(RuntimeState &runtimeState)
+{
+  /*
+  Start the session at runtimeState.tNow
+  <struct RuntimeState> runtimeState : runtime struct variable
+  */
+  runtimeState.runtimeFlag = true;
+  digitalWrite(runtimeState.led_pin, ON);
+  runtimeState.tRuntimeStart = runtimeState.tNow;
+  // log
+  logSessionStart(runtimeState.tRuntimeStart);
+  resetTTLStats();
+}
+
+void endRuntime(RuntimeState &runtimeState,
+                bool halt = true)
+{
+  /*
+  End the session at runtimeState.tNow - with an input trigger the output trigger stops the acquisition and the
+    next trigger starts a new session, without one the board halts
+  <struct RuntimeState> runtimeState : runtime struct variable
+  <bool> halt : false to keep running without an input trigger, e.g. on a host stop so the host can start the next
+                session
+  */
+  digitalWrite(runtimeState.led_pin, OFF);
+  for (byte i = 0; i < PORT_COUNT; i++)
+  {
+    digitalWriteCorrected(PORT_SOLENOID_PIN[i], OFF, SOLENOID_ACTIVE_LOW);
+  }
+  runtimeState.runtimeFlag = false;
+  // log
+  logSessionEnd(runtimeState.tNow);
+  logTTLStats();
+  halSessionEnd();
+  if (runtimeState.inputTrigger == nullptr)
+  {
+    if (halt)
+    {
+      halHalt();
+    }
+    return;
+  }
+  // the blocking flush above can take a while, resync before timing the trigger
+  runtimeState.tNow = currentTime();
+  sendTTL(runtimeState.outputTrigger, runtimeState.tNow);
+}
+
+void updateRuntime(RuntimeState &runtimeState)
+{
+  /*
+  Poll for current time and check for start or exit conditions for runtime
+  <struct RuntimeState> runtimeState : runtime struct variable
+  */
+  runtimeState.tNow = currentTime();
+  if (runtimeState.inputTrigger == nullptr)
+  {
+    //exit condition
+    if (runtimeState.runtimeFlag && (runtimeState.tNow - runtimeState.tRuntimeStart >= runtimeState.duration))
+    {
+      endRuntime(runtimeState);
+      return;
+    }
+    //start condition
+    if (!runtimeState.runtimeFlag && runtimeState.armed && runtimeState.tNow - runtimeState.tStart >= runtimeState.delay)
+    {
+      startRuntime(runtimeState);
+    }
+  }
+  else
+  { 
+    bool inputTrigger = detectTTL(runtimeState.inputTrigger, runtimeState.tNow);
+    if (runtimeState.runtimeFlag && (runtimeState.tNow - runtimeState.tRuntimeStart >= runtimeState.duration))
+    {
+      endRuntime(runtimeState);
+    }
+    if (inputTrigger && !runtimeState.runtimeFlag && runtimeState.armed)
+    {
+      startRuntime(runtimeState);
+    }
+  }
+  runtimeState.tLast = runtimeState.tNow;
+}
+
+void initBlinkLED(BlinkLEDState &ledState,
+                  byte pin,
+                  byte side,
+                  unsigned long blinkInterval = LED_BLINK_INTERVAL)
+{
+  /*
+  Initialize default parameters for blinking LED
+  <struct BlinkLEDState> ledState : struct for led state parameters
+  <byte> side : led location/side identifier
+  <byte> pin : led pin
+  <unsigned long> blinkInterval : blink duration
+  */
+  pinMode(pin, OUTPUT);
+  ledState.pin = pin;
+  ledState.side = side;
+  ledState.tLEDon = 0;
+  ledState.tLEDoff = 0;
+  ledState.ledBlinkState = false; 
+  ledState.blinkInterval = blinkInterval;
+  ledState.timer.scheduler = nullptr;
+}
+
+void updateBlinkLED(BlinkLEDState &ledState,
+                    Timestamp tNow)
+{
+  /*
+  update led blink between on and off
+  <struct BlinkLEDState> ledState : struct for led state parameters
+  <Timestamp> tNow : current time
+  */
+  if (ledState.ledBlinkState && (tNow - ledState.tLEDon > ledState.blinkInterval))
+  {
+    digitalWrite(ledState.pin, OFF);
+    ledState.tLEDoff = tNow;
+    ledState.ledBlinkState = false;
+  }
+  if (!ledState.ledBlinkState && (tNow - ledState.tLEDoff > ledState.blinkInterval))
+  {
+    digitalWrite(ledState.pin, ON);
+    ledState.tLEDon = tNow;
+    ledState.ledBlinkState = true;
+  }
+
+}
+
+void fireBlinkLED(void* state, Timestamp tNow)
+{
+  BlinkLEDState &ledState = *(BlinkLEDState*)state;
+  updateBlinkLED(ledState, tNow);
+  armTimer(ledState.timer, (ledState.ledBlinkState ? ledState.tLEDon : ledState.tLEDoff) + ledState.blinkInterval + 1);
+}
+
+void scheduleBlinkLED(BlinkLEDState &ledState,
+                      TimerScheduler &scheduler)
+{
+  /*
+  Drive the blinking LED from a timer scheduler instead of polling updateBlinkLED every loop()
+  <struct BlinkLEDState> ledState : struct for led state parameters
+  <struct TimerScheduler> scheduler : deadline scheduler
+  */
+  ledState.timer = addTimer(scheduler, fireBlinkLED, &ledState);
+  armTimer(ledState.timer, (ledState.ledBlinkState ? ledState.tLEDon : ledState.tLEDoff) + ledState.blinkInterval + 1);
+}
+
+BOARD_LOCAL EdgeQueue* edgeCaptureQueues[EDGE_CAPTURE_MAX];
+BOARD_LOCAL byte edgeCaptureCount = 0;
+
+void captureEdges()
+{
+  /*
+  Pin change handler, runs in interrupt context - timestamps the new level of every registered
+  sensor that changed since the last interrupt and pushes it to that sensor's queue
+  */
+  uint32_t t = TIME_IN_MICROSECONDS ? micros() : millis();
+  for (byte i = 0; i < edgeCaptureCount; i++)
+  {
+    EdgeQueue &queue = *edgeCaptureQueues[i];
+    bool v = digitalReadCorrected(queue.pin, queue.activeLow);
+    if (v == queue.level)
+    {
+      continue;
+    }
+    queue.level = v;
+    byte next = (queue.head + 1) & (EDGE_QUEUE_CAPACITY - 1);
+    if (next == queue.tail)
+    {
+      if (queue.overflow != 0xFF)
+      {
+        queue.overflow++;
+      }
+      continue;
+    }
+    queue.edges[queue.head].t = t;
+    queue.edges[queue.head].level = v;
+    queue.head = next;
+  }
+}
+
+void initEdgeCapture(EdgeQueue &queue,
+                     byte pin,
+                     bool activeLow)
+{
+  /*
+  Register a sensor input for interrupt driven edge capture
+  <struct EdgeQueue> queue : per sensor edge queue
+  <byte> pin : sensor input pin, must have a pin change interrupt
+  <bool> activeLow : sensor logic, edges are queued logic corrected
+  */
+  queue.pin = pin;
+  queue.activeLow = activeLow;
+  queue.level = digitalReadCorrected(pin, activeLow);
+  queue.head = 0;
+  queue.tail = 0;
+  queue.overflow = 0;
+  byte i = 0;
+  while (i < edgeCaptureCount && edgeCaptureQueues[i] != &queue)
+  {
+    i++;
+  }
+  if (i == EDGE_CAPTURE_MAX)
+  {
+    return;
+  }
+  edgeCaptureQueues[i] = &queue;
+  edgeCaptureCount = i == edgeCaptureCount ? i + 1 : edgeCaptureCount;
+  halAttachPinChange(pin, captureEdges);
+}
+
+bool popEdge(EdgeQueue &queue,
+             Timestamp &t,
+             bool &level,
+             Timestamp tNow)
+{
+  /*
+  Take the oldest captured edge up to tNow, consumer side of the queue
+  <struct EdgeQueue> queue : per sensor edge queue
+  <Timestamp> t : filled with the extended edge time
+  <bool> level : filled with the logic corrected level after the edge
+  <Timestamp> tNow : current time, edges stamped after it stay queued for the next pass
+
+  Returns:
+  <bool> : true if an edge was taken
+  */
+  if (queue.tail == queue.head)
+  {
+    return false;
+  }
+  const EdgeEvent &next = queue.edges[queue.tail];
+  Timestamp tEdge = extendTime(next.t, tNow);
+  if (tEdge > tNow)
+  {
+    return false;
+  }
+  t = tEdge;
+  level = next.level;
+  queue.tail = (queue.tail + 1) & (EDGE_QUEUE_CAPACITY - 1);
+  return true;
+}
+
+void initDebouncer(Debouncer &debouncer,
+                   byte mode,
+                   byte samples,
+                   bool level)
+{
+  /*
+  Initialize a debounce filter, the debounced state starts low and sampling starts now
+  <struct Debouncer> debouncer : filter state
+  <byte> mode : DebounceMode
+  <byte> samples : filter length in DEBOUNCE_TICK samples, 1 to 8
+  <bool> level : current logic corrected raw level
+  */
+  debouncer.mode = mode;
+  debouncer.samples = samples;
+  debouncer.history = 0;
+  debouncer.count = 0;
+  debouncer.settled = level ? 0 : samples;
+  debouncer.raw = level;
+  debouncer.state = false;
+  debouncer.tNext = currentTime();
+  debouncer.tRaw = (ShortTimestamp)debouncer.tNext;
+}
+
+inline bool debounceSample(Debouncer &debouncer)
+{
+  /*
+  Shift the raw level in as one sample and update the debounced state
+
+  Returns:
+  <bool> : true if the debounced state changed
+  */
+  byte mask = (byte)((2 << (debouncer.samples - 1)) - 1);
+  debouncer.history = (debouncer.history << 1) | debouncer.raw;
+  byte h = debouncer.history & mask;
+  bool state = debouncer.state;
+  switch (debouncer.mode)
+  {
+    case DEBOUNCE_SHIFT:
+      state = (h == mask) | (state & (h != 0));
+      break;
+    case DEBOUNCE_INTEGRATOR:
+      debouncer.count += debouncer.raw ? (debouncer.count < debouncer.samples) : -(debouncer.count > 0);
+      state = (debouncer.count == debouncer.samples) | (state & (debouncer.count != 0));
+      break;
+    case DEBOUNCE_MAJORITY:
+    {
+      byte n = 2 * __builtin_popcount(h);
+      state = (n > debouncer.samples) | (state & (n == debouncer.samples));
+      break;
+    }
+    default:
+      state = debouncer.raw;
+  }
+  bool changed = state != debouncer.state;
+  debouncer.state = state;
+  return changed;
+}
+
+bool debounceUntil(Debouncer &debouncer,
+                   Timestamp tUntil,
+                   Timestamp &tChange)
+{
+  /*
+  Run the DEBOUNCE_TICK samples due up to tUntil, stopping at the first change of the debounced state,
+    once the history holds nothing but the raw level the remaining samples are skipped
+  <struct Debouncer> debouncer : filter state
+  <Timestamp> tUntil : last sample time to run, inclusive
+  <Timestamp> tChange : filled with the sample time of the change
+
+  Returns:
+  <bool> : true if the debounced state changed, call again to run the remaining samples
+  */
+  while (debouncer.tNext <= tUntil)
+  {
+    if (debouncer.settled >= debouncer.samples)
+    {
+      debouncer.tNext += ((tUntil - debouncer.tNext) / DEBOUNCE_TICK + 1) * DEBOUNCE_TICK;
+      return false;
+    }
+    Timestamp t = debouncer.tNext;
+    debouncer.tNext += DEBOUNCE_TICK;
+    debouncer.settled++;
+    if (debounceSample(debouncer))
+    {
+      tChange = t;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline void debounceInput(Debouncer &debouncer,
+                          bool level,
+                          Timestamp t)
+{
+  /*
+  Set the raw level seen from t on, samples before t must have been run already
+  */
+  if (level != debouncer.raw)
+  {
+    debouncer.raw = level;
+    debouncer.tRaw = (ShortTimestamp)t;
+    debouncer.settled = 0;
+  }
+}
+
+template <byte N>
+void initPorts(PortBank<N> &ports,
+               byte count,
+               const byte* irPins,
+               const byte* proxyLEDPins,
+               const byte* touchPins,
+               const byte* solenoidPins,
+               const byte* tracks,
+               const unsigned long* ttlPulsePeriods,
+               TTLState* irTrigger,
+               TTLState* touchTrigger,
+               TTLState* solenoidTrigger,
+               EdgeQueue* irEdges = nullptr,
+               EdgeQueue* touchEdges = nullptr)
+{
+  /*
+  Init function to initialize the reward ports from a port table (see config.h) with default parameters
+  <PortBank> ports : struct storing the port state arrays
+  <byte> count : number of ports, clamped to N
+  <const byte*> irPins : per port input pin ID connected to ir sensor
+  <const byte*> proxyLEDPins : per port ir state indicator LED
+  <const byte*> touchPins : per port input pin ID connected to touch sensor
+  <const byte*> solenoidPins : per port solenoid valve pin
+  <const byte*> tracks : per port track, the ports of a track alternate in table order
+  <const unsigned long*> ttlPulsePeriods : per port photometry pulse period
+  <struct TTLState> irTrigger, touchTrigger, solenoidTrigger : photometry outputs shared by all ports
+  <struct EdgeQueue> irEdges, touchEdges : count edge queues each for interrupt driven capture, nullptr to poll the pins
+  */
+  count = count < N ? count : N;
+  ports.count = count;
+  ports.inputPorts = 0;
+  ports.irTrigger = irTrigger;
+  ports.touchTrigger = touchTrigger;
+  ports.solenoidTrigger = solenoidTrigger;
+  ports.solenoidTimer.scheduler = nullptr;
+  for (byte i = 0; i < N; i++)
+  {
+    ports.lastPort[i] = PORT_NONE;
+    ports.trackFirst[i] = PORT_NONE;
+  }
+  for (byte i = 0; i < count; i++)
+  {
+    byte track = tracks[i];
+    ports.track[i] = track;
+    ports.trackRank[i] = 0;
+    for (byte j = 0; j < i; j++)
+    {
+      ports.trackRank[i] += tracks[j] == track;
+    }
+    ports.trackFirst[track] = ports.trackFirst[track] == PORT_NONE ? i : ports.trackFirst[track];
+    ports.ttlPulsePeriod[i] = ttlPulsePeriods[i];
+
+    // IR beam
+    pinMode(irPins[i], INPUT_PULLUP);
+    pinMode(proxyLEDPins[i], OUTPUT);
+    digitalWrite(proxyLEDPins[i], LOW);
+    ports.irPin[i] = irPins[i];
+    ports.proxyLEDPin[i] = proxyLEDPins[i];
+    ports.irInput[i] = halInput(irPins[i]);
+    ports.irCurrentRead[i] = digitalReadCorrected(irPins[i], IR_ACTIVE_LOW);
+    ports.irLastRead[i] = false;
+    ports.inBreak[i] = false;
+    ports.breakEvent[i] = false;
+    ports.breakEventMutable[i] = false;
+    ports.connectEvent[i] = true;
+    ports.tBreak[i] = 0;
+    ports.tConnect[i] = 0;
+    ports.irEdges[i] = irEdges != nullptr ? &irEdges[i] : nullptr;
+    initDebouncer(ports.irDebounce[i], IR_DEBOUNCE_MODE, IR_DEBOUNCE_SAMPLES, ports.irCurrentRead[i]);
+    tracePin(i, IR, ports.irCurrentRead[i], currentTime());
+    if (irEdges != nullptr)
+    {
+      initEdgeCapture(irEdges[i], irPins[i], IR_ACTIVE_LOW);
+    }
+    else
+    {
+      ports.inputPorts |= halInputPorts(ports.irInput[i]);
+    }
+
+    // lick sensor
+    pinMode(touchPins[i], INPUT_PULLUP);
+    ports.touchPin[i] = touchPins[i];
+    ports.touchInput[i] = halInput(touchPins[i]);
+    ports.inTouch[i] = false;
+    ports.touchEvent[i] = false;
+    ports.clearEvent[i] = true;
+    ports.tTouch[i] = 0;
+    ports.tRelease[i] = 0;
+    ports.touchEdges[i] = touchEdges != nullptr ? &touchEdges[i] : nullptr;
+    bool touchLevel = digitalReadCorrected(touchPins[i], TOUCH_ACTIVE_LOW);
+    initDebouncer(ports.touchDebounce[i], TOUCH_DEBOUNCE_MODE, TOUCH_DEBOUNCE_SAMPLES, touchLevel);
+    tracePin(i, TOUCH, touchLevel, currentTime());
+    if (touchEdges != nullptr)
+    {
+      initEdgeCapture(touchEdges[i], touchPins[i], TOUCH_ACTIVE_LOW);
+    }
+    else
+    {
+      ports.inputPorts |= halInputPorts(ports.touchInput[i]);
+    }
+
+    // solenoid valve
+    pinMode(solenoidPins[i], OUTPUT);
+    digitalWriteCorrected(solenoidPins[i], OFF, SOLENOID_ACTIVE_LOW);
+    ports.solenoidPin[i] = solenoidPins[i];
+    ports.solenoidOutput[i] = halOutput(solenoidPins[i]);
+    ports.open[i] = false;
+    ports.tOpen[i] = 0;
+    ports.tClose[i] = 0;
+    ports.solenoidDuration[i] = 0;
+  }
+}
+
+template <byte N>
+void applyIR(PortBank<N> &ports,
+             byte i,
+             bool on,
+             Timestamp tEvent,
+             Timestamp t)
+{
+  /*
+  Register an accepted beam break/connect - flags, log, indicator LED and TTL
+  <PortBank> ports : struct storing the port state arrays
+  <byte> i : port
+  <bool> on : true for a beam break
+  <Timestamp> tEvent : onset time of the new level, logged
+  <Timestamp> t : time the change was accepted, the TTL is sent from here
+  */
+  ports.inBreak[i] = on;
+  ports.breakEvent[i] = on;
+  ports.breakEventMutable[i] = on;
+  ports.connectEvent[i] = !on;
+  if (on)
+  {
+    ports.tBreak[i] = (ShortTimestamp)tEvent;
+    // log
+    eventLog(i, IR, ON, tEvent);
+    digitalWrite(ports.proxyLEDPin[i], HIGH);
+    sendTTLEvent(ports.irTrigger, i, IR, t, ports.ttlPulsePeriod[i]);
+  }
+  else
+  {
+    ports.tConnect[i] = (ShortTimestamp)tEvent;
+    // log
+    eventLog(i, IR, OFF, tEvent);
+    digitalWrite(ports.proxyLEDPin[i], LOW);
+  }
+}
+
+template <byte N>
+void stepIR(PortBank<N> &ports,
+            byte i,
+            bool v,
+            Timestamp t)
+{
+  /*
+  Advance the legacy IR state machine of a port by one sample (IR_DEBOUNCE_MODE DEBOUNCE_OFF)
+    IR state change event is recorded following persistance in signal, stamped with the onset time
+    Additionally since alternating high-low sig was detected when IR emitter and detector
+    were placed inside a circular housing within the behavior setup, || login between current and last read is implemented
+
+  <PortBank> ports : struct storing the port state arrays
+  <byte> i : port
+  <bool> v : logic corrected sensor level
+  <Timestamp> t : sample time
+  */
+  if ((ports.irCurrentRead[i] || ports.irLastRead[i]) && v && !ports.inBreak[i])
+  {
+    ports.tBreak[i] = (ShortTimestamp)t;
+    ports.inBreak[i] = true;
+  }
+  else if (!(ports.irCurrentRead[i] || ports.irLastRead[i]) && !v && ports.inBreak[i])
+  {
+    ports.tConnect[i] = (ShortTimestamp)t;
+    ports.inBreak[i] = false;
+  }
+  if ((ShortTimestamp)t - ports.tConnect[i] >= sessionParams.minIRBreak && !ports.inBreak[i] && ports.breakEvent[i])
+  {
+    applyIR(ports, i, false, extendTime(ports.tConnect[i], t), t);
+  }
+  if ((ShortTimestamp)t - ports.tBreak[i] >= sessionParams.minIRBreak && ports.inBreak[i] && ports.connectEvent[i])
+  {
+    applyIR(ports, i, true, extendTime(ports.tBreak[i], t), t);
+  }
+  ports.irLastRead[i] = ports.irCurrentRead[i];
+  ports.irCurrentRead[i] = v;
+}
+
+template <byte N>
+void debounceIR(PortBank<N> &ports,
+                byte i,
+                Timestamp tUntil)
+{
+  /*
+  Run the IR debounce samples of a port due up to tUntil, applying every accepted change at its sample time
+  */
+  Timestamp t;
+  while (debounceUntil(ports.irDebounce[i], tUntil, t))
+  {
+    applyIR(ports, i, ports.irDebounce[i].state, extendTime(ports.irDebounce[i].tRaw, t), t);
+  }
+}
+
+template <byte N>
+void detectIR(PortBank<N> &ports,
+              byte i,
+              const uint8_t* inputs,
+              Timestamp tNow)
+{
+  /*
+  Function to detect IR state changes of a port and update state parameters accordingly
+    polls the pin once, or in edge capture mode replays every queued edge at its own timestamp
+    before sampling the last known level at tNow for the persistance check
+
+  <PortBank> ports : struct storing the port state arrays
+  <byte> i : port
+  <const uint8_t*> inputs : input register snapshot of the sweep
+  <Timestamp> tNow : current time of execution
+
+  NOTE: with IR_DEBOUNCE_MODE set, levels go through the debounce filter sampled every DEBOUNCE_TICK
+        (the level between polls is held) and replace the legacy persistance check
+  */
+  EdgeQueue* edges = ports.irEdges[i];
+  Timestamp t;
+  bool level;
+  if (ports.irDebounce[i].mode != DEBOUNCE_OFF)
+  {
+    if (edges == nullptr)
+    {
+      level = halRead(inputs, ports.irInput[i]) != IR_ACTIVE_LOW;
+      tracePin(i, IR, level, tNow);
+      debounceIR(ports, i, tNow - 1);
+      debounceInput(ports.irDebounce[i], level, tNow);
+    }
+    while (edges != nullptr && popEdge(*edges, t, level, tNow))
+    {
+      tracePin(i, IR, level, t);
+      debounceIR(ports, i, t - 1);
+      debounceInput(ports.irDebounce[i], level, t);
+    }
+    debounceIR(ports, i, tNow);
+    return;
+  }
+  if (edges == nullptr)
+  {
+    level = halRead(inputs, ports.irInput[i]) != IR_ACTIVE_LOW;
+    tracePin(i, IR, level, tNow);
+    stepIR(ports, i, level, tNow);
+    return;
+  }
+  while (popEdge(*edges, t, level, tNow))
+  {
+    tracePin(i, IR, level, t);
+    stepIR(ports, i, level, t);
+  }
+  stepIR(ports, i, ports.irCurrentRead[i], tNow);
+}
+
+template <byte N>
+void applyTouch(PortBank<N> &ports,
+                byte i,
+                bool on,
+                Timestamp tEvent,
+                Timestamp t)
+{
+  /*
+  Register an accepted touch/release - flags, log and TTL
+  <PortBank> ports : struct storing the port state arrays
+  <byte> i : port
+  <bool> on : true for a touch
+  <Timestamp> tEvent : onset time of the new level, logged
+  <Timestamp> t : time the change was accepted, the TTL is sent from here
+  */
+  ports.inTouch[i] = on;
+  ports.touchEvent[i] = on;
+  ports.clearEvent[i] = !on;
+  if (on)
+  {
+    // add state change as and when needed for duration dependent reward release
+    ports.tTouch[i] = (ShortTimestamp)tEvent;
+    // log
+    eventLog(i, TOUCH, ON, tEvent);
+    sendTTLEvent(ports.touchTrigger, i, TOUCH, t, ports.ttlPulsePeriod[i]);
+  }
+  else
+  {
+    ports.tRelease[i] = (ShortTimestamp)tEvent;
+    // log
+    eventLog(i, TOUCH, OFF, tEvent);
+  }
+}
+
+template <byte N>
+void debounceTouch(PortBank<N> &ports,
+                   byte i,
+                   Timestamp tUntil)
+{
+  /*
+  Run the touch debounce samples of a port due up to tUntil, applying every accepted change at its sample time
+  */
+  Timestamp t;
+  while (debounceUntil(ports.touchDebounce[i], tUntil, t))
+  {
+    applyTouch(ports, i, ports.touchDebounce[i].state, extendTime(ports.touchDebounce[i].tRaw, t), t);
+  }
+}
+
+template <byte N>
+void detectTouch(PortBank<N> &ports,
+                 byte i,
+                 const uint8_t* inputs,
+                 Timestamp tNow)
+{
+  /*
+  Function to detect touch state changes of a port and update state parameters accordingly
+    polls the pin once, or in edge capture mode replays every queued edge at its own timestamp,
+    raw levels change the state directly (TOUCH_DEBOUNCE_MODE DEBOUNCE_OFF)
+  <PortBank> ports : struct storing the port state arrays
+  <byte> i : port
+  <const uint8_t*> inputs : input register snapshot of the sweep
+  <Timestamp> tNow : current time of execution
+
+  NOTE: with TOUCH_DEBOUNCE_MODE set, levels go through the debounce filter sampled every DEBOUNCE_TICK
+  */
+  EdgeQueue* edges = ports.touchEdges[i];
+  Timestamp t;
+  bool level;
+  if (ports.touchDebounce[i].mode != DEBOUNCE_OFF)
+  {
+    if (edges == nullptr)
+    {
+      level = halRead(inputs, ports.touchInput[i]) != TOUCH_ACTIVE_LOW;
+      tracePin(i, TOUCH, level, tNow);
+      debounceTouch(ports, i, tNow - 1);
+      debounceInput(ports.touchDebounce[i], level, tNow);
+    }
+    while (edges != nullptr && popEdge(*edges, t, level, tNow))
+    {
+      tracePin(i, TOUCH, level, t);
+      debounceTouch(ports, i, t - 1);
+      debounceInput(ports.touchDebounce[i], level, t);
+    }
+    debounceTouch(ports, i, tNow);
+    return;
+  }
+  if (edges == nullptr)
+  {
+    level = halRead(inputs, ports.touchInput[i]) != TOUCH_ACTIVE_LOW;
+    tracePin(i, TOUCH, level, tNow);
+    if (level != ports.inTouch[i])
+    {
+      applyTouch(ports, i, level, tNow, tNow);
+    }
+    return;
+  }
+  while (popEdge(*edges, t, level, tNow))
+  {
+    tracePin(i, TOUCH, level, t);
+    if (level != ports.inTouch[i])
+    {
+      applyTouch(ports, i, level, t, t);
+    }
+  }
+}
+
+template <byte N>
+void detectPorts(PortBank<N> &ports,
+                 Timestamp tNow)
+{
+  /*
+  Sweep every port - the polled input pins are sampled together from one snapshot of the input registers,
+    then the IR and touch state of each port is updated
+  <PortBank> ports : struct storing the port state arrays
+  <Timestamp> tNow : current time of execution
+  */
+  uint8_t inputs[HAL_INPUT_PORTS];
+  halSampleInputs(inputs, ports.inputPorts);
+  for (byte i = 0; i < ports.count; i++)
+  {
+    detectIR(ports, i, inputs, tNow);
+    detectTouch(ports, i, inputs, tNow);
+  }
+}
+
+template <byte N>
+void updateLastPort(PortBank<N> &ports)
+{
+  /*
+  Record every newly broken IR beam as the last port visited on its track
+  <PortBank> ports : struct storing the port state arrays
+  */
+  for (byte i = 0; i < ports.count; i++)
+  {
+    if (ports.breakEventMutable[i])
+    {
+      ports.breakEventMutable[i] = false;
+      ports.lastPort[ports.track[i]] = i;
+    }
+  }
+}
+
+template <byte N>
+void armSolenoids(PortBank<N> &ports,
+                  Timestamp tNow)
+{
+  /*
+  Arm the solenoid timer for the earliest closing valve
+  */
+  bool pending = false;
+  Timestamp tNext = 0;
+  for (byte i = 0; i < ports.count; i++)
+  {
+    Timestamp tDue = extendTime(ports.tOpen[i], tNow) + ports.solenoidDuration[i];
+    if (ports.open[i] && (!pending || tDue < tNext))
+    {
+      tNext = tDue;
+      pending = true;
+    }
+  }
+  if (pending)
+  {
+    armTimer(ports.solenoidTimer, tNext);
+  }
+}
+
+template <byte N>
+void activateSolenoid(PortBank<N> &ports,
+                      byte i,
+                      Timestamp tNow,
+                      unsigned long duration = SOLENOID_DURATION)
+{
+  /*
+  Function to activate the solenoid valve of a port and update state parameters accordingly
+  <PortBank> ports : struct storing the port state arrays
+  <byte> i : port
+  <Timestamp> tNow : current time of execution
+  <unsigned long> duration : duration to keep the solenoid valve open/close depending on type of solenoid
+  */
+  if (ports.open[i])
+  {
+    return;
+  }
+  ports.open[i] = true;
+  ports.tOpen[i] = (ShortTimestamp)tNow;
+  ports.solenoidDuration[i] = duration;
+  halWrite(ports.solenoidOutput[i], ON != SOLENOID_ACTIVE_LOW);
+  armSolenoids(ports, tNow);
+
+  // log
+  eventLog(i, SOLENOID, ON, tNow);
+  sendTTLEvent(ports.solenoidTrigger, i, SOLENOID, tNow, ports.ttlPulsePeriod[i]);
+}
+
+template <byte N>
+void updateSolenoids(PortBank<N> &ports,
+                     Timestamp tNow)
+{
+  /*
+  Function to check for duration elapsed since solenoid valve activation and close every valve that is due
+  <PortBank> ports : struct storing the port state arrays
+  <Timestamp> tNow : current time of execution
+  */
+  for (byte i = 0; i < ports.count; i++)
+  {
+    if (ports.open[i] && (ShortTimestamp)tNow - ports.tOpen[i] >= ports.solenoidDuration[i])
+    {
+      ports.open[i] = false;
+      ports.tClose[i] = (ShortTimestamp)tNow;
+      halWrite(ports.solenoidOutput[i], OFF != SOLENOID_ACTIVE_LOW);
+      // log
+      eventLog(i, SOLENOID, OFF, tNow);
+    }
+  }
+}
+
+template <byte N>
+void fireSolenoids(void* state, Timestamp tNow)
+{
+  PortBank<N> &ports = *(PortBank<N>*)state;
+  updateSolenoids(ports, tNow);
+  armSolenoids(ports, tNow);
+}
+
+template <byte N>
+void scheduleSolenoids(PortBank<N> &ports,
+                       TimerScheduler &scheduler)
+{
+  /*
+  Close the solenoid valves from a timer scheduler instead of polling updateSolenoids every loop()
+  <PortBank> ports : struct storing the port state arrays
+  <struct TimerScheduler> scheduler : deadline scheduler
+  */
+  ports.solenoidTimer = addTimer(scheduler, fireSolenoids<N>, &ports);
+}
+
+void initRelocation(RelocationState &relocation)
+{
+  /*
+  Initialize the reward relocation schedule, the first step starts with the session
+  <struct RelocationState> relocation : relocation schedule state
+  */
+  relocation.step = 0;
+  relocation.mode = (enum Mode)sessionParams.relocationMode[0];
+  relocation.laps = 0;
+  relocation.advance = false;
+  relocation.tSessionStart = -1;
+  relocation.tStepStart = -1;
+}
+
+bool updateRelocation(RelocationState &relocation,
+                      Timestamp tRuntimeStart,
+                      Timestamp tNow)
+{
+  /*
+  Follow the relocation schedule - restart it with every new session, move to the next step once the
+    current one reached its rewarded laps or duration or relocation.advance is set (session link), every
+    step start is logged as a RELOCATE event for the side now rewarded
+  <struct RelocationState> relocation : relocation schedule state, laps counted by the caller
+  <Timestamp> tRuntimeStart : start of the running session
+  <Timestamp> tNow : current time
+
+  Returns:
+  <bool> : true when the rewarded mode (may have) changed
+  */
+  if (relocation.tSessionStart != tRuntimeStart)
+  {
+    relocation.tSessionStart = tRuntimeStart;
+    relocation.step = 0;
+  }
+  else
+  {
+    if (relocation.step + 1 >= RELOCATION_STEPS)
+    {
+      return false;
+    }
+    unsigned int laps = sessionParams.relocationLaps[relocation.step];
+    Timestamp duration = sessionParams.relocationDuration[relocation.step];
+    if (!(laps != 0 && relocation.laps >= laps) && !(duration != 0 && tNow - relocation.tStepStart >= duration) &&
+        !relocation.advance)
+    {
+      return false;
+    }
+    relocation.step++;
+  }
+  relocation.advance = false;
+  relocation.mode = (enum Mode)sessionParams.relocationMode[relocation.step];
+  relocation.laps = 0;
+  relocation.tStepStart = tNow;
+  // log
+  eventLog(relocation.mode == MODE_A ? SIDE_A : SIDE_B, RELOCATE, ON, tNow);
+  return true;
+}
+
+uint16_t crc16(uint16_t crc,
+               byte c)
+{
+  /*
+  CRC-16/CCITT (polynomial 0x1021, MSB first) of one more byte, start from 0xFFFF
+  */
+  crc ^= (uint16_t)c << 8;
+  for (byte i = 0; i < 8; i++)
+  {
+    crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+uint16_t crc16(const byte* data,
+               byte size)
+{
+  uint16_t crc = 0xFFFF;
+  for (byte i = 0; i < size; i++)
+  {
+    crc = crc16(crc, data[i]);
+  }
+  return crc;
+}
+
+void putLittleEndian(byte* &out,
+                     uint64_t value,
+                     byte size)
+{
+  for (byte i = 0; i < size; i++)
+  {
+    *out++ = value >> (8 * i);
+  }
+}
+
+uint64_t getLittleEndian(const byte* &in,
+                         byte size)
+{
+  uint64_t value = 0;
+  for (byte i = 0; i < size; i++)
+  {
+    value |= (uint64_t)*in++ << (8 * i);
+  }
+  return value;
+}
+
+void packSessionParams(const SessionParams &params,
+                       byte flags,
+                       byte* block)
+{
+  /*
+  Write the LINK_PARAMS_SIZE byte parameter block of the session link (layout in config.h)
+  <struct SessionParams> params : session parameters
+  <byte> flags : LINK_CACHE to have the board store it in EEPROM
+  <byte*> block : LINK_PARAMS_SIZE bytes
+  */
+  *block++ = LINK_PARAMS_VERSION;
+  *block++ = flags;
+  putLittleEndian(block, params.solenoidDuration, 4);
+  putLittleEndian(block, params.minIRBreak, 4);
+  putLittleEndian(block, params.runDuration, EVENT_FRAME_TIME_BYTES);
+  for (byte i = 0; i < RELOCATION_STEPS; i++)
+  {
+    *block++ = params.relocationMode[i];
+    putLittleEndian(block, params.relocationLaps[i], 2);
+    putLittleEndian(block, params.relocationDuration[i], EVENT_FRAME_TIME_BYTES);
+  }
+}
+
+byte unpackSessionParams(SessionParams &params,
+                         byte &flags,
+                         const byte* block,
+                         byte size)
+{
+  /*
+  Read and check a parameter block, params is only changed when the block is valid
+  <struct SessionParams> params : session parameters
+  <byte> flags : flags of the block
+  <const byte*> block : parameter block
+  <byte> size : block size
+
+  Returns:
+  <byte> : LinkStatus of the block
+  */
+  if (size != LINK_PARAMS_SIZE || block[0] != LINK_PARAMS_VERSION)
+  {
+    return LINK_BAD_VERSION;
+  }
+  SessionParams read;
+  flags = block[1];
+  block += 2;
+  read.solenoidDuration = getLittleEndian(block, 4);
+  read.minIRBreak = getLittleEndian(block, 4);
+  read.runDuration = getLittleEndian(block, EVENT_FRAME_TIME_BYTES);
+  bool valid = read.solenoidDuration > 0 && read.solenoidDuration <= SOLENOID_DURATION_MAX && read.runDuration > 0;
+  for (byte i = 0; i < RELOCATION_STEPS; i++)
+  {
+    read.relocationMode[i] = *block++;
+    read.relocationLaps[i] = getLittleEndian(block, 2);
+    read.relocationDuration[i] = getLittleEndian(block, EVENT_FRAME_TIME_BYTES);
+    valid = valid && read.relocationMode[i] <= MODE_B;
+  }
+  if (!valid)
+  {
+    return LINK_BAD_VALUE;
+  }
+  params = read;
+  return LINK_OK;
+}
+
+bool loadSessionParams(SessionParams &params)
+{
+  /*
+  Load the parameter block cached in EEPROM by the session link
+
+  Returns:
+  <bool> : true when a valid block was found, params is left as it is otherwise
+  */
+  byte block[LINK_PARAMS_SIZE + 2];
+  for (byte i = 0; i < sizeof(block); i++)
+  {
+    block[i] = halEepromRead(LINK_EEPROM_ADDRESS + i);
+  }
+  byte flags;
+  const byte* crc = block + LINK_PARAMS_SIZE;
+  return getLittleEndian(crc, 2) == crc16(block, LINK_PARAMS_SIZE) &&
+         unpackSessionParams(params, flags, block, LINK_PARAMS_SIZE) == LINK_OK;
+}
+
+void saveSessionParams(const byte* block)
+{
+  /*
+  Cache a valid parameter block in EEPROM, followed by its CRC
+  */
+  uint16_t crc = crc16(block, LINK_PARAMS_SIZE);
+  for (byte i = 0; i < LINK_PARAMS_SIZE; i++)
+  {
+    halEepromUpdate(LINK_EEPROM_ADDRESS + i, block[i]);
+  }
+  halEepromUpdate(LINK_EEPROM_ADDRESS + LINK_PARAMS_SIZE, crc);
+  halEepromUpdate(LINK_EEPROM_ADDRESS + LINK_PARAMS_SIZE + 1, crc >> 8);
+}
+
+void initLink(LinkState &link)
+{
+  /*
+  Initialize the session link receiver
+  <struct LinkState> link : session link state
+  */
+  link.field = LINK_FIELD_SYNC;
+  link.errors = 0;
+  link.hello = false;
+  link.pending = false;
+}
+
+bool readLinkFrame(LinkState &link)
+{
+  /*
+  Assemble a frame from the bytes received so far, stops at the end of a valid frame so it is handled before
+    the next one overwrites it
+
+  Returns:
+  <bool> : true with a valid frame in link.command, link.length and link.payload
+  */
+  while (Serial.available() > 0)
+  {
+    byte c = Serial.read();
+    switch (link.field)
+    {
+      case LINK_FIELD_SYNC:
+        link.field = c == LINK_SYNC ? LINK_FIELD_COMMAND : LINK_FIELD_SYNC;
+        break;
+      case LINK_FIELD_COMMAND:
+        link.command = c;
+        link.crc = crc16(0xFFFF, c);
+        link.field = LINK_FIELD_LENGTH;
+        break;
+      case LINK_FIELD_LENGTH:
+        link.length = c;
+        link.count = 0;
+        link.crc = crc16(link.crc, c);
+        link.field = c == 0 ? LINK_FIELD_CRC_LOW : LINK_FIELD_PAYLOAD;
+        if (c > LINK_PAYLOAD_MAX)
+        {
+          link.errors++;
+          link.field = LINK_FIELD_SYNC;
+        }
+        break;
+      case LINK_FIELD_PAYLOAD:
+        link.payload[link.count++] = c;
+        link.crc = crc16(link.crc, c);
+        link.field = link.count == link.length ? LINK_FIELD_CRC_LOW : LINK_FIELD_PAYLOAD;
+        break;
+      case LINK_FIELD_CRC_LOW:
+        link.crcLow = c;
+        link.field = LINK_FIELD_CRC_HIGH;
+        break;
+      default:
+        link.field = LINK_FIELD_SYNC;
+        if ((link.crcLow | (uint16_t)c << 8) == link.crc)
+        {
+          return true;
+        }
+        link.errors++;
+    }
+  }
+  return false;
+}
+
+void replyLink(byte command,
+               byte status)
+{
+  /*
+  Queue the answer to a command, an A<command> record or N<command>,<status>, never blocks
+  */
+  beginRecord(recordLogQueue, status == LINK_OK ? 'A' : 'N');
+  recordChar(recordLogQueue, (char)command);
+  if (status != LINK_OK)
+  {
+    recordChar(recordLogQueue, ',');
+    recordNumber(recordLogQueue, status);
+  }
+  endRecord(recordLogQueue);
+}
+
+void updateLink(LinkState &link,
+                RuntimeState &runtimeState,
+                RelocationState &relocation)
+{
+  /*
+  Handle the session link commands received since the last call
+  <struct LinkState> link : session link state
+  <struct RuntimeState> runtimeState : runtime struct variable
+  <struct RelocationState> relocation : relocation schedule, advanced on LINK_RELOCATE at its next update
+
+  NOTE: a command is only handled once the record log has room for its reply, until then it stays pending and
+        the following bytes wait in the serial RX buffer, so no reply is lost to a full record log
+  */
+  while (link.pending || readLinkFrame(link))
+  {
+    link.pending = recordLogRoom(recordLogQueue) < LINK_REPLY_MAX;
+    if (link.pending)
+    {
+      return;
+    }
+    runtimeState.tNow = currentTime();
+    byte status = LINK_OK;
+    if (link.command == LINK_HELLO)
+    {
+      // the host takes over arming, the board waits for its parameters
+      link.hello = true;
+      runtimeState.armed = runtimeState.runtimeFlag;
+      byte block[LINK_PARAMS_SIZE];
+      packSessionParams(sessionParams, 0, block);
+      beginRecord(recordLogQueue, 'V');
+      recordNumber(recordLogQueue, LINK_PARAMS_VERSION);
+      recordChar(recordLogQueue, ',');
+      recordNumber(recordLogQueue, LINK_PARAMS_SIZE);
+      recordChar(recordLogQueue, ',');
+      recordNumber(recordLogQueue, crc16(block, LINK_PARAMS_SIZE));
+      endRecord(recordLogQueue);
+      continue;
+    }
+    if (link.command == LINK_PARAMS)
+    {
+      status = runtimeState.runtimeFlag ? LINK_BUSY : LINK_OK;
+      // an empty block arms with the active parameters, e.g. when the host found them current from the hello
+      if (status == LINK_OK && link.length > 0)
+      {
+        byte flags;
+        status = unpackSessionParams(sessionParams, flags, link.payload, link.length);
+        if (status == LINK_OK && LINK_EEPROM_CACHE && (flags & LINK_CACHE))
+        {
+          link.payload[1] = 0;
+          saveSessionParams(link.payload);
+        }
+        runtimeState.duration = sessionParams.runDuration;
+      }
+      runtimeState.armed = runtimeState.armed || status == LINK_OK;
+      replyLink(link.command, status);
+      // armed, without an input trigger the session starts right away
+      if (status == LINK_OK && runtimeState.inputTrigger == nullptr)
+      {
+        startRuntime(runtimeState);
+      }
+      continue;
+    }
+    if (link.command == LINK_START)
+    {
+      status = runtimeState.runtimeFlag || !runtimeState.armed ? LINK_BUSY : LINK_OK;
+      replyLink(link.command, status);
+      if (status == LINK_OK)
+      {
+        startRuntime(runtimeState);
+      }
+      continue;
+    }
+    if (link.command == LINK_STOP)
+    {
+      status = runtimeState.runtimeFlag ? LINK_OK : LINK_BUSY;
+      replyLink(link.command, status);
+      if (status == LINK_OK)
+      {
+        // without an input trigger the board stays up disarmed, the next session waits for a parameter block
+        runtimeState.armed = runtimeState.inputTrigger != nullptr;
+        endRuntime(runtimeState, false);
+      }
+      continue;
+    }
+    if (link.command == LINK_RELOCATE)
+    {
+      status = runtimeState.runtimeFlag && relocation.step + 1 < RELOCATION_STEPS ? LINK_OK : LINK_BUSY;
+      relocation.advance = status == LINK_OK;
+      replyLink(link.command, status);
+      continue;
+    }
+    replyLink(link.command, LINK_UNKNOWN);
+  }
+}
+
+uint32_t stepperSpeed(unsigned long stepsPerSecond)
+{
+  /*
+  Convert a speed in steps/s to steps per tick timer tick, 8.24 fixed point
+  */
+  return (uint32_t)((unsigned long long)stepsPerSecond * TTL_TIMER_TICK_US * STEPPER_ONE_STEP / 1000000ULL);
+}
+
+uint32_t stepperAcceleration(unsigned long stepsPerSecond2)
+{
+  /*
+  Convert an acceleration in steps/s^2 to the speed change per tick timer tick, 8.24 fixed point
+  */
+  return (uint32_t)((unsigned long long)stepsPerSecond2 * TTL_TIMER_TICK_US * TTL_TIMER_TICK_US * STEPPER_ONE_STEP / 1000000000000ULL);
+}
+
+void initLinearActuator(LinearActuatorState &actuator,
+                        StepperChannel &channel,
+                        byte side = SIDE_A,
+                        byte stepPin = ACTUATOR_STEP_PIN,
+                        byte dirPin = ACTUATOR_DIR_PIN,
+                        byte proximalLimitPin = ACTUATOR_PROXIMAL_LIMIT_PIN,
+                        byte distalLimitPin = ACTUATOR_DISTAL_LIMIT_PIN)
+{
+  /*
+  Initialize a linear actuator at rest and put its step pulse generator on the tick timer, the position is
+    unknown until homeLinearActuator() found the proximal limit switch
+  <struct LinearActuatorState> actuator : actuator state
+  <struct StepperChannel> channel : step pulse generator storage
+  <byte> side : side identifier of its ACTUATOR events
+  <byte> stepPin, dirPin : driver inputs
+  <byte> proximalLimitPin, distalLimitPin : limit switch inputs, PIN_NONE without a distal switch
+  */
+  pinMode(stepPin, OUTPUT);
+  pinMode(dirPin, OUTPUT);
+  digitalWrite(stepPin, LOW);
+  pinMode(proximalLimitPin, ACTUATOR_LIMIT_ACTIVE_LOW ? INPUT_PULLUP : INPUT);
+  if (distalLimitPin != PIN_NONE)
+  {
+    pinMode(distalLimitPin, ACTUATOR_LIMIT_ACTIVE_LOW ? INPUT_PULLUP : INPUT);
+  }
+  actuator.pin = stepPin;
+  actuator.dirPin = dirPin;
+  actuator.proximalLimitPin = proximalLimitPin;
+  actuator.distalLimitPin = distalLimitPin;
+  actuator.side = side;
+  actuator.operationMode = OPERATION_MODE;
+  actuator.distalLimitSwitch = false;
+  actuator.proximalLimitSwitch = false;
+  actuator.atCommandPosition = false;
+  actuator.atHome = false;
+  actuator.moving = false;
+  actuator.homing = false;
+  actuator.homed = false;
+  actuator.distalLimitPosition = ACTUATOR_TRAVEL;
+  actuator.proximalLimitPosition = 0;
+  actuator.currentPosition = 0;
+  actuator.commandPosition = 0;
+  actuator.homePosition = 0;
+  actuator.calibrationPositionOffset = ACTUATOR_HOME_OFFSET;
+  actuator.tStart = -1;
+  actuator.tStop = -1;
+  actuator.channel = &channel;
+  channel.step = halOutput(stepPin);
+  channel.active = false;
+  channel.pulse = false;
+  channel.position = 0;
+  byte i = 0;
+  while (i < stepperChannelCount && stepperChannels[i] != &channel)
+  {
+    i++;
+  }
+  if (i < ACTUATOR_CHANNEL_MAX)
+  {
+    stepperChannels[i] = &channel;
+    stepperChannelCount = i == stepperChannelCount ? i + 1 : stepperChannelCount;
+  }
+}
+
+void startLinearActuator(LinearActuatorState &actuator,
+                         long target,
+                         bool homing,
+                         Timestamp tNow)
+{
+  /*
+  Hand a move to the tick ISR and log its start - a homing move runs at constant speed towards the proximal
+    switch for up to the whole travel, any other move follows the trapezoidal profile to target and stops
+    early on the limit switch of its direction
+  <struct LinearActuatorState> actuator : actuator state, at rest
+  <long> target : position to move to, ignored when homing
+  <bool> homing : search the proximal limit switch
+  <Timestamp> tNow : current time
+  */
+  StepperChannel &channel = *actuator.channel;
+  bool forward = !homing && target > actuator.currentPosition;
+  byte limitPin = forward ? actuator.distalLimitPin : actuator.proximalLimitPin;
+  digitalWrite(actuator.dirPin, forward == ACTUATOR_DIR_DISTAL ? HIGH : LOW);
+  noInterrupts();
+  channel.forward = forward;
+  channel.checkLimit = limitPin != PIN_NONE;
+  channel.limit = halInput(limitPin != PIN_NONE ? limitPin : actuator.proximalLimitPin);
+  channel.limitHit = false;
+  channel.pulse = false;
+  channel.phase = 0;
+  channel.accelSteps = 0;
+  if (homing)
+  {
+    channel.remaining = (unsigned long)(actuator.distalLimitPosition - actuator.proximalLimitPosition + 2 * actuator.calibrationPositionOffset);
+    channel.startSpeed = stepperSpeed(ACTUATOR_HOMING_SPEED);
+    channel.maxSpeed = channel.startSpeed;
+    channel.acceleration = 0;
+  }
+  else
+  {
+    channel.remaining = (unsigned long)(forward ? target - actuator.currentPosition : actuator.currentPosition - target);
+    channel.startSpeed = stepperSpeed(ACTUATOR_START_SPEED);
+    channel.maxSpeed = stepperSpeed(ACTUATOR_MAX_SPEED);
+    channel.acceleration = stepperAcceleration(ACTUATOR_ACCELERATION);
+  }
+  channel.speed = channel.startSpeed;
+  channel.tTick = micros();
+  channel.active = true;
+  bool start = false;
+  if (HAL_TICK_TIMER)
+  {
+    start = !ttlTickRunning;
+    ttlTickRunning = true;
+  }
+  interrupts();
+  if (start)
+  {
+    halStartTick(TTL_TIMER_TICK_US, ttlTick);
+  }
+  actuator.moving = true;
+  actuator.homing = homing;
+  actuator.atCommandPosition = false;
+  actuator.atHome = false;
+  actuator.tStart = tNow;
+  // log
+  eventLog(actuator.side, ACTUATOR, ON, tNow);
+}
+
+void homeLinearActuator(LinearActuatorState &actuator,
+                        Timestamp tNow)
+{
+  /*
+  Search the proximal limit switch, the position is set from it and the actuator moves on to the command
+    position (home unless commanded otherwise meanwhile), queued behind a move in progress
+  <struct LinearActuatorState> actuator : actuator state
+  <Timestamp> tNow : current time
+  */
+  actuator.homed = false;
+  if (!actuator.moving)
+  {
+    startLinearActuator(actuator, 0, true, tNow);
+  }
+}
+
+void commandLinearActuator(LinearActuatorState &actuator,
+                           long position,
+                           Timestamp tNow)
+{
+  /*
+  Move to a position, never blocks - clamped into the soft limits, started once the actuator is homed and
+    the move in progress (if any) is done, a newer command replaces one still waiting
+  <struct LinearActuatorState> actuator : actuator state
+  <long> position : target in steps from home
+  <Timestamp> tNow : current time
+  */
+  position = position < actuator.proximalLimitPosition ? actuator.proximalLimitPosition : position;
+  position = position > actuator.distalLimitPosition ? actuator.distalLimitPosition : position;
+  actuator.commandPosition = position;
+  actuator.atCommandPosition = !actuator.moving && actuator.homed && actuator.currentPosition == position;
+  if (!actuator.moving && actuator.homed && !actuator.atCommandPosition)
+  {
+    startLinearActuator(actuator, position, false, tNow);
+  }
+}
+
+void relocateLinearActuator(LinearActuatorState &actuator,
+                            enum Mode mode,
+                            Timestamp tNow)
+{
+  /*
+  Move the reward port to its position for an operation mode, ACTUATOR_POSITION[mode]
+  */
+  actuator.operationMode = mode;
+  commandLinearActuator(actuator, ACTUATOR_POSITION[mode], tNow);
+}
+
+void updateLinearActuator(LinearActuatorState &actuator,
+                          Timestamp tNow)
+{
+  /*
+  Function to check for the end of a move and update state parameters accordingly, starts the next move
+    when the command position changed meanwhile, call every loop()
+  <struct LinearActuatorState> actuator : actuator state
+  <Timestamp> tNow : current time of execution
+
+  NOTE: where hal.h has no tick timer the profile advances by at most one tick per call, moves then
+        slow down with long loop() passes but the step pulses keep their width
+  */
+  StepperChannel &channel = *actuator.channel;
+  if (!actuator.moving)
+  {
+    return;
+  }
+  if (!HAL_TICK_TIMER && channel.active && (uint32_t)(micros() - channel.tTick) >= TTL_TIMER_TICK_US)
+  {
+    channel.tTick = micros();
+    stepperTick(channel);
+  }
+  noInterrupts();
+  bool active = channel.active;
+  long position = channel.position;
+  interrupts();
+  actuator.currentPosition = position;
+  if (active)
+  {
+    return;
+  }
+  actuator.moving = false;
+  actuator.tStop = tNow;
+  actuator.proximalLimitSwitch = digitalReadCorrected(actuator.proximalLimitPin, ACTUATOR_LIMIT_ACTIVE_LOW);
+  actuator.distalLimitSwitch = actuator.distalLimitPin != PIN_NONE && digitalReadCorrected(actuator.distalLimitPin, ACTUATOR_LIMIT_ACTIVE_LOW);
+  // log
+  eventLog(actuator.side, ACTUATOR, OFF, tNow);
+  if (actuator.homing)
+  {
+    actuator.homing = false;
+    actuator.homed = channel.limitHit;
+    if (actuator.homed)
+    {
+      // the switch closes calibrationPositionOffset steps before home
+      actuator.currentPosition = actuator.homePosition - actuator.calibrationPositionOffset;
+      channel.position = actuator.currentPosition;
+    }
+  }
+  else if (channel.limitHit)
+  {
+    // a limit switch where none was expected, the position is lost
+    homeLinearActuator(actuator, tNow);
+    return;
+  }
+  actuator.atCommandPosition = actuator.homed && actuator.currentPosition == actuator.commandPosition;
+  actuator.atHome = actuator.homed && actuator.currentPosition == actuator.homePosition;
+  if (actuator.homed && !actuator.atCommandPosition)
+  {
+    startLinearActuator(actuator, actuator.commandPosition, false, tNow);
+  }
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,580 @@
+/*
+ * Behavior to photometry clock alignment
+ *   the photometry system only records the TTL trains of OUTPUT_TRIGGER, OUTPUT_IR, OUTPUT_TOUCH and
+ *   OUTPUT_SOLENOID (inputs 1 to 4 of the RWD 810), the events of the log that send a train (IR break,
+ *   touch, valve opening and the session end trigger) are matched to the train onsets on their input and
+ *   the MCU clock is fitted onto the photometry clock, t_photometry = offset + slope * t_mcu in seconds
+ *
+ *   with SYNC_BARCODE the barcodes of OUTPUT_TRIGGER are decoded from the edges and looked up by counter in the
+ *   B records, their pairs give the fit directly and the events are matched around it, without barcodes
+ *   matching starts from candidate pairs of early events and trains and tracks forward with the running
+ *   fit, so missing edges, trains delayed in the TTL queue and trains without a logged event only cost
+ *   their own match, the line is then refitted with Tukey's bisquare (IRLS on a MAD scale) to reject
+ *   the matches that are still wrong
+ */
+
+#ifndef ALIGN
+#define ALIGN
+
+#include "log_tables.h"
+
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+const byte ALIGN_INPUTS = 4;          // photometry inputs 1 to 4 - trigger, IR, touch, solenoid
+const double ALIGN_TICK_S = TIME_IN_MICROSECONDS ? 1e-6 : 1e-3;
+
+struct TTLEdge
+{
+  double t;                           // photometry clock, s
+  byte input;                         // 1 to ALIGN_INPUTS
+  bool level;
+};
+
+struct AlignMark
+{
+  double t;                           // s
+  byte input;
+};
+
+struct SyncBarcode
+{
+  double t;                           // start edge, s
+  uint32_t counter;
+};
+
+struct AlignParams
+{
+  double trainGap;                    // idle time before a rising edge that starts a train, s
+  double tolerance;                   // match window around the predicted onset, s
+  double maxDrift;                    // bound on |slope - 1|
+  double resolution;                  // floor of the residual scale, the coarser of the two clocks, s
+  unsigned candidateEvents;           // early events tried as anchors
+  unsigned candidateTrains;           // early trains per input tried against each anchor
+  unsigned probeEvents;               // events tracked to rank the anchors
+  double barcodeSlot;                 // sync barcode bit, s
+  byte barcodeBits;
+};
+
+struct AlignFit
+{
+  bool ok;
+  double offset;                      // s
+  double slope;
+  unsigned long events;
+  unsigned long trains;
+  unsigned long matched;              // event train and barcode pairs kept by the robust fit
+  unsigned long barcodes;             // barcode pairs found, 0 when the fit comes from the search
+  double residualMad;                 // s
+  double residualMax;                 // s, over the pairs kept
+};
+
+struct AlignJob
+{
+  std::vector<AlignMark> events;      // MCU clock, sorted
+  std::vector<double> trains[ALIGN_INPUTS];  // train onsets on the photometry clock per input, sorted
+  std::vector<SyncBarcode> barcodes;  // B records, MCU clock
+  std::vector<SyncBarcode> barcodeTrains;    // decoded from the trigger input, photometry clock
+  AlignFit fit;
+};
+
+inline AlignParams defaultAlignParams()
+{
+  AlignParams params;
+  params.trainGap = TTL_TRAIN_GAP * ALIGN_TICK_S;
+  params.tolerance = 0.015;
+  params.maxDrift = 0.01;             // ceramic resonators stay well within 1 %
+  params.resolution = ALIGN_TICK_S;
+  params.candidateEvents = 16;
+  params.candidateTrains = 64;
+  params.probeEvents = 256;
+  params.barcodeSlot = SYNC_BARCODE_SLOT * ALIGN_TICK_S;
+  params.barcodeBits = SYNC_BARCODE_BITS;
+  return params;
+}
+
+inline void alignTrains(const std::vector<TTLEdge> &edges,
+                        double trainGap,
+                        std::vector<double> trains[])
+{
+  /*
+  Reduce a recorded edge list to train onsets, a rising edge at least trainGap after the previous edge of
+    its input starts a train, a missed first edge makes the onset one pulse late (an outlier for the fit)
+  <std::vector<TTLEdge>> edges : edges of all inputs in time order
+  <std::vector<double>[ALIGN_INPUTS]> trains : filled with the onsets per input
+  */
+  double tLast[ALIGN_INPUTS];
+  bool seen[ALIGN_INPUTS] = {};
+  for (byte i = 0; i < ALIGN_INPUTS; i++)
+  {
+    trains[i].clear();
+  }
+  for (const TTLEdge &edge : edges)
+  {
+    if (edge.input < 1 || edge.input > ALIGN_INPUTS)
+    {
+      continue;
+    }
+    byte i = edge.input - 1;
+    if (edge.level && (!seen[i] || edge.t - tLast[i] >= trainGap))
+    {
+      trains[i].push_back(edge.t);
+    }
+    tLast[i] = edge.t;
+    seen[i] = true;
+  }
+}
+
+inline bool readTTLEdges(const char* path,
+                         std::vector<TTLEdge> &edges)
+{
+  /*
+  Read a "time_s,input,level" edge list as exported from the photometry system, other lines are skipped,
+    sorted by time on the way out
+  */
+  MappedLog file;
+  if (!mapLog(path, file))
+  {
+    return false;
+  }
+  edges.clear();
+  const char* c = (const char*)file.data;
+  const char* end = c + file.size;
+  while (c < end)
+  {
+    const char* eol = (const char*)memchr(c, '\n', end - c);
+    eol = eol ? eol : end;
+    char line[64];
+    size_t length = std::min<size_t>(eol - c, sizeof(line) - 1);
+    memcpy(line, c, length);
+    line[length] = 0;
+    double t;
+    unsigned input, level;
+    if (sscanf(line, "%lf,%u,%u", &t, &input, &level) == 3)
+    {
+      edges.push_back({t, (byte)input, level != 0});
+    }
+    c = eol + 1;
+  }
+  unmapLog(file);
+  std::stable_sort(edges.begin(), edges.end(), [](const TTLEdge &a, const TTLEdge &b) { return a.t < b.t; });
+  return true;
+}
+
+inline void decodeBarcodes(const std::vector<TTLEdge> &edges,
+                           const AlignParams &params,
+                           std::vector<SyncBarcode> &barcodes)
+{
+  /*
+  Find the sync barcodes on the trigger input (input 1) - a rising edge after at least one slot low, the
+    start slot high within a quarter slot, then the counter bits read at the slot centers, other trains
+    (the session end trigger) do not have the start slot and are passed over
+  <std::vector<TTLEdge>> edges : edges of all inputs in time order
+  <std::vector<SyncBarcode>> barcodes : filled with the barcodes in time order
+  */
+  std::vector<const TTLEdge*> trigger;
+  for (const TTLEdge &edge : edges)
+  {
+    if (edge.input == 1)
+    {
+      trigger.push_back(&edge);
+    }
+  }
+  barcodes.clear();
+  double slot = params.barcodeSlot;
+  for (size_t k = 0; k + 1 < trigger.size(); k++)
+  {
+    double t0 = trigger[k]->t;
+    if (!trigger[k]->level || (k > 0 && t0 - trigger[k - 1]->t < slot) || trigger[k + 1]->level ||
+        fabs(trigger[k + 1]->t - t0 - slot) > slot / 4)
+    {
+      continue;
+    }
+    uint32_t counter = 0;
+    size_t e = k + 1;
+    for (byte bit = 0; bit < params.barcodeBits; bit++)
+    {
+      double tBit = t0 + (2.5 + bit) * slot;
+      while (e + 1 < trigger.size() && trigger[e + 1]->t <= tBit)
+      {
+        e++;
+      }
+      counter |= (uint32_t)trigger[e]->level << bit;
+    }
+    barcodes.push_back({t0, counter});
+    double tEnd = t0 + (2 + params.barcodeBits) * slot;
+    while (k + 1 < trigger.size() && trigger[k + 1]->t < tEnd)
+    {
+      k++;
+    }
+  }
+}
+
+inline void alignInputs(const std::vector<TTLEdge> &edges,
+                        const AlignParams &params,
+                        AlignJob &job)
+{
+  /*
+  Train onsets and sync barcodes of a recorded edge list, the edges inside a barcode are not trains
+  */
+  alignTrains(edges, params.trainGap, job.trains);
+  decodeBarcodes(edges, params, job.barcodeTrains);
+  std::vector<double> &trigger = job.trains[0];
+  size_t kept = 0, b = 0;
+  for (size_t i = 0; i < trigger.size(); i++)
+  {
+    while (b < job.barcodeTrains.size() && job.barcodeTrains[b].t + (2 + params.barcodeBits) * params.barcodeSlot <= trigger[i])
+    {
+      b++;
+    }
+    if (b == job.barcodeTrains.size() || trigger[i] < job.barcodeTrains[b].t)
+    {
+      trigger[kept++] = trigger[i];
+    }
+  }
+  trigger.resize(kept);
+}
+
+inline void alignEvents(const LogTables &tables,
+                        std::vector<AlignMark> &events)
+{
+  /*
+  Events of a decoded log that send a photometry train, in time order - IR break on input 2, touch on
+    input 3, valve opening on input 4, session end (E record) on input 1
+  */
+  static const byte inputs[LOG_TYPES] = {2, 3, 4, 0, 0};
+  events.clear();
+  for (byte type = 0; type < LOG_TYPES; type++)
+  {
+    const EventTable &table = tables.events[type];
+    for (size_t i = 0; inputs[type] && i < table.t.size(); i++)
+    {
+      if (table.state[i] == ON)
+      {
+        events.push_back({table.t[i] * ALIGN_TICK_S, inputs[type]});
+      }
+    }
+  }
+  for (Timestamp t : tables.sessions.tEnd)
+  {
+    if (t)
+    {
+      events.push_back({t * ALIGN_TICK_S, 1});
+    }
+  }
+  std::sort(events.begin(), events.end(), [](const AlignMark &a, const AlignMark &b) { return a.t < b.t; });
+}
+
+inline void alignBarcodeRecords(const LogTables &tables,
+                                std::vector<SyncBarcode> &barcodes)
+{
+  barcodes.clear();
+  for (size_t i = 0; i < tables.barcodes.t.size(); i++)
+  {
+    barcodes.push_back({tables.barcodes.t[i] * ALIGN_TICK_S, tables.barcodes.counter[i]});
+  }
+}
+
+inline size_t nearestTrain(const std::vector<double> &trains,
+                           size_t first,
+                           double t)
+{
+  /*
+  Index of the train onset nearest to t at or after index first, trains.size() if there is none
+  */
+  size_t i = std::lower_bound(trains.begin() + first, trains.end(), t) - trains.begin();
+  if (i > first && (i == trains.size() || t - trains[i - 1] < trains[i] - t))
+  {
+    i--;
+  }
+  return i;
+}
+
+inline unsigned long trackAlignment(const AlignJob &job,
+                                    const AlignParams &params,
+                                    size_t anchor,
+                                    double offset,
+                                    size_t limit,
+                                    std::vector<long>* match)
+{
+  /*
+  Match events forward from an anchor pair, each one to the nearest unused train of its input within
+    tolerance of the running least squares prediction, the slope stays 1 until the matches span 2 s
+  <size_t> anchor : event index of the anchor pair, offset its train onset minus its time
+  <size_t> limit : number of events tracked from the anchor
+  <std::vector<long>*> match : train index per event, -1 if unmatched, nullptr to only count
+
+  Returns:
+  <unsigned long> : events matched
+  */
+  size_t next[ALIGN_INPUTS] = {};
+  double x0 = job.events[anchor].t;
+  double y0 = x0 + offset;
+  double sx = 0, sy = 0, sxx = 0, sxy = 0, xMin = 0, xMax = 0;
+  unsigned long n = 0;
+  if (match)
+  {
+    match->assign(job.events.size(), -1);
+  }
+  size_t end = std::min(job.events.size(), anchor + limit);
+  for (size_t e = anchor; e < end; e++)
+  {
+    const AlignMark &event = job.events[e];
+    const std::vector<double> &trains = job.trains[event.input - 1];
+    double slope = 1;
+    if (n >= 2 && xMax - xMin >= 2)
+    {
+      slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+      slope = std::min(std::max(slope, 1 - params.maxDrift), 1 + params.maxDrift);
+    }
+    double x = event.t - x0;
+    double predicted = n ? y0 + (sy - slope * sx) / n + slope * x : y0 + x;
+    size_t i = nearestTrain(trains, next[event.input - 1], predicted);
+    if (i == trains.size() || fabs(trains[i] - predicted) > params.tolerance)
+    {
+      continue;
+    }
+    double y = trains[i] - y0;
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    sxy += x * y;
+    xMin = n ? std::min(xMin, x) : x;
+    xMax = n ? std::max(xMax, x) : x;
+    n++;
+    next[event.input - 1] = i + 1;
+    if (match)
+    {
+      (*match)[e] = (long)i;
+    }
+  }
+  return n;
+}
+
+inline void fitRobustLine(const std::vector<double> &x,
+                          const std::vector<double> &y,
+                          double resolution,
+                          AlignFit &fit)
+{
+  /*
+  Fit y = offset + slope * x with Tukey's bisquare by iteratively reweighted least squares, the scale is
+    the MAD of the residuals of the previous pass but no less than resolution, x is centered for the
+    conditioning
+  */
+  size_t n = x.size();
+  std::vector<double> w(n, 1.0), r(n), a(n);
+  double xc = 0;
+  for (double v : x)
+  {
+    xc += v / n;
+  }
+  double offset = 0, slope = 1, scale = 0;
+  for (int pass = 0; pass < 20; pass++)
+  {
+    double sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+      double dx = x[i] - xc;
+      sw += w[i];
+      sx += w[i] * dx;
+      sy += w[i] * y[i];
+      sxx += w[i] * dx * dx;
+      sxy += w[i] * dx * y[i];
+    }
+    double det = sw * sxx - sx * sx;
+    double nextSlope = det > 0 ? (sw * sxy - sx * sy) / det : 1;
+    double nextOffset = (sy - nextSlope * sx) / sw;
+    bool converged = pass > 0 && fabs(nextSlope - slope) < 1e-12 && fabs(nextOffset - offset) < 1e-9;
+    slope = nextSlope;
+    offset = nextOffset;
+    for (size_t i = 0; i < n; i++)
+    {
+      r[i] = y[i] - offset - slope * (x[i] - xc);
+      a[i] = fabs(r[i]);
+    }
+    std::nth_element(a.begin(), a.begin() + n / 2, a.end());
+    scale = a[n / 2];
+    if (converged)
+    {
+      break;
+    }
+    double c = 4.685 * std::max(scale / 0.6745, resolution);
+    for (size_t i = 0; i < n; i++)
+    {
+      double u = r[i] / c;
+      w[i] = fabs(u) < 1 ? (1 - u * u) * (1 - u * u) : 0;
+    }
+  }
+  fit.offset = offset - slope * xc;
+  fit.slope = slope;
+  fit.residualMad = scale;
+  fit.residualMax = 0;
+  fit.matched = 0;
+  double c = 4.685 * std::max(scale / 0.6745, resolution);
+  for (size_t i = 0; i < n; i++)
+  {
+    if (fabs(r[i]) < c)
+    {
+      fit.matched++;
+      fit.residualMax = std::max(fit.residualMax, fabs(r[i]));
+    }
+  }
+}
+
+inline double alignTime(const AlignFit &fit,
+                        double t)
+{
+  /*
+  MCU time in s onto the photometry clock
+  */
+  return fit.offset + fit.slope * t;
+}
+
+inline bool matchBarcodes(AlignJob &job,
+                          const AlignParams &params,
+                          std::vector<double> &x,
+                          std::vector<double> &y)
+{
+  /*
+  Fit from the barcodes found both in the log and on the trigger input, then match every event to the
+    nearest train within tolerance of that fit and refit on all the pairs
+
+  Returns:
+  <bool> : false with fewer than 2 barcode pairs, job.fit is then left for the search
+  */
+  std::vector<SyncBarcode> mcu = job.barcodes, photometry = job.barcodeTrains;
+  auto byCounter = [](const SyncBarcode &a, const SyncBarcode &b) { return a.counter < b.counter; };
+  std::stable_sort(mcu.begin(), mcu.end(), byCounter);
+  std::stable_sort(photometry.begin(), photometry.end(), byCounter);
+  x.clear();
+  y.clear();
+  for (size_t i = 0, j = 0; i < mcu.size() && j < photometry.size();)
+  {
+    if (mcu[i].counter < photometry[j].counter)
+    {
+      i++;
+    }
+    else if (photometry[j].counter < mcu[i].counter)
+    {
+      j++;
+    }
+    else
+    {
+      x.push_back(mcu[i++].t);
+      y.push_back(photometry[j++].t);
+    }
+  }
+  if (x.size() < 2)
+  {
+    return false;
+  }
+  AlignFit &fit = job.fit;
+  fit.barcodes = x.size();
+  fitRobustLine(x, y, params.resolution, fit);
+  size_t next[ALIGN_INPUTS] = {};
+  for (const AlignMark &event : job.events)
+  {
+    const std::vector<double> &trains = job.trains[event.input - 1];
+    double predicted = alignTime(fit, event.t);
+    size_t i = nearestTrain(trains, next[event.input - 1], predicted);
+    if (i < trains.size() && fabs(trains[i] - predicted) <= params.tolerance)
+    {
+      x.push_back(event.t);
+      y.push_back(trains[i]);
+      next[event.input - 1] = i + 1;
+    }
+  }
+  fitRobustLine(x, y, params.resolution, fit);
+  fit.ok = fit.matched >= 3;
+  return true;
+}
+
+inline void alignSession(AlignJob &job,
+                         const AlignParams &params)
+{
+  /*
+  Fit job.fit from job.events and job.trains, fit.ok is false without at least 3 matched pairs
+  */
+  AlignFit &fit = job.fit;
+  fit = AlignFit();
+  fit.slope = 1;
+  fit.events = job.events.size();
+  for (byte i = 0; i < ALIGN_INPUTS; i++)
+  {
+    fit.trains += job.trains[i].size();
+  }
+  std::vector<double> x, y;
+  if (matchBarcodes(job, params, x, y))
+  {
+    return;
+  }
+  // rank anchor pairs on a short probe, track the best one over the whole session
+  unsigned long best = 0;
+  size_t bestAnchor = 0;
+  double bestOffset = 0;
+  for (size_t e = 0; e < job.events.size() && e < params.candidateEvents; e++)
+  {
+    const std::vector<double> &trains = job.trains[job.events[e].input - 1];
+    for (size_t i = 0; i < trains.size() && i < params.candidateTrains; i++)
+    {
+      double offset = trains[i] - job.events[e].t;
+      unsigned long n = trackAlignment(job, params, e, offset, params.probeEvents, nullptr);
+      if (n > best)
+      {
+        best = n;
+        bestAnchor = e;
+        bestOffset = offset;
+      }
+    }
+  }
+  if (best < 3)
+  {
+    return;
+  }
+  std::vector<long> match;
+  trackAlignment(job, params, bestAnchor, bestOffset, job.events.size(), &match);
+  for (size_t e = 0; e < match.size(); e++)
+  {
+    if (match[e] >= 0)
+    {
+      x.push_back(job.events[e].t);
+      y.push_back(job.trains[job.events[e].input - 1][match[e]]);
+    }
+  }
+  fitRobustLine(x, y, params.resolution, fit);
+  fit.ok = fit.matched >= 3;
+}
+
+inline void alignCohort(std::vector<AlignJob> &jobs,
+                        const AlignParams &params,
+                        unsigned threads)
+{
+  /*
+  Align every session of a cohort, sessions are handed out to the threads one at a time
+  */
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i; (i = next++) < jobs.size();)
+    {
+      alignSession(jobs[i], params);
+    }
+  };
+  threads = std::max(1u, std::min<unsigned>(threads, jobs.size()));
+  std::vector<std::thread> pool;
+  for (unsigned i = 1; i < threads; i++)
+  {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &thread : pool)
+  {
+    thread.join();
+  }
+}
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * Host tool - align session logs onto the photometry clock
+ *
+ *   build : g++ -std=c++17 -O2 -pthread -o align_sessions host/align_sessions.cpp
+ *   usage : align_sessions [-o outdir] [-j threads] [-w tolerance s] log edges [log edges ...]
+ *
+ *   every log (raw serial capture, e.g. simulate -o) comes with the TTL edges recorded by the photometry
+ *   system in that session, a text file of "time_s,input,level" lines (input 1 to 4 as wired in config.h,
+ *   other lines are skipped), the sessions are aligned in parallel, the tables of decode_logs are written
+ *   with one more column t_photometry (f8, s on the photometry clock) per table with a time column, and
+ *   one CSV row per session goes to stdout - barcode pairs (0 when the fit had to be searched), offset, drift
+ *   in ppm, matched pairs and residuals
+ */
+
+#include "../config.h"
+#include "align.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+bool readFile(const char* path,
+              std::string &data)
+{
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr)
+  {
+    return false;
+  }
+  char chunk[65536];
+  data.clear();
+  for (size_t n; (n = fread(chunk, 1, sizeof(chunk), file)) > 0;)
+  {
+    data.append(chunk, n);
+  }
+  fclose(file);
+  return true;
+}
+
+template <typename T>
+bool writeAligned(FILE* manifest,
+                  const std::string &base,
+                  const char* table,
+                  const std::vector<T> &t,
+                  const AlignFit &fit)
+{
+  std::vector<double> aligned(t.size());
+  for (size_t i = 0; i < t.size(); i++)
+  {
+    aligned[i] = alignTime(fit, t[i] * ALIGN_TICK_S);
+  }
+  return writeColumn(manifest, base, table, "t_photometry", "f8", aligned);
+}
+
+int main(int argc, char** argv)
+{
+  std::string outDir = ".";
+  unsigned threads = std::thread::hardware_concurrency();
+  AlignParams params = defaultAlignParams();
+  std::vector<const char*> paths;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "-o" && i + 1 < argc) outDir = argv[++i];
+    else if (arg == "-j" && i + 1 < argc) threads = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "-w" && i + 1 < argc) params.tolerance = strtod(argv[++i], nullptr);
+    else if (arg[0] != '-') paths.push_back(argv[i]);
+    else paths.clear(), i = argc;
+  }
+  if (paths.empty() || paths.size() % 2)
+  {
+    fprintf(stderr, "usage: %s [-o outdir] [-j threads] [-w tolerance s] log edges [log edges ...]\n", argv[0]);
+    return 2;
+  }
+
+  size_t sessions = paths.size() / 2;
+  std::vector<LogTables> tables(sessions);
+  std::vector<AlignJob> jobs(sessions);
+  std::vector<TTLEdge> edges;
+  std::string data;
+  for (size_t i = 0; i < sessions; i++)
+  {
+    if (!readFile(paths[2 * i], data) || !readTTLEdges(paths[2 * i + 1], edges))
+    {
+      fprintf(stderr, "cannot read %s or %s\n", paths[2 * i], paths[2 * i + 1]);
+      return 1;
+    }
+    decodeLogTables((const byte*)data.data(), data.size(), tables[i]);
+    alignEvents(tables[i], jobs[i].events);
+    alignBarcodeRecords(tables[i], jobs[i].barcodes);
+    alignInputs(edges, params, jobs[i]);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  alignCohort(jobs, params, threads);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  int failed = 0;
+  printf("log,ok,events,trains,barcodes,matched,offset_s,drift_ppm,residual_mad_ms,residual_max_ms\n");
+  for (size_t i = 0; i < sessions; i++)
+  {
+    const AlignFit &fit = jobs[i].fit;
+    printf("%s,%d,%lu,%lu,%lu,%lu,%.6f,%.1f,%.3f,%.3f\n", paths[2 * i], fit.ok, fit.events, fit.trains, fit.barcodes, fit.matched,
+           fit.offset, (fit.slope - 1) * 1e6, fit.residualMad * 1e3, fit.residualMax * 1e3);
+    if (!fit.ok)
+    {
+      failed++;
+      continue;
+    }
+    std::string name = paths[2 * i];
+    name = name.substr(name.find_last_of('/') + 1);
+    std::string base = outDir + "/" + name.substr(0, name.find_last_of('.'));
+    bool ok = writeLogTables(tables[i], base);
+    FILE* manifest = fopen((base + ".manifest").c_str(), "a");
+    ok = manifest != nullptr && ok;
+    for (byte type = 0; ok && type < LOG_TYPES; type++)
+    {
+      ok = writeAligned(manifest, base, LOG_TYPE_NAMES[type], tables[i].events[type].t, fit) && ok;
+    }
+    if (ok)
+    {
+      ok = writeAligned(manifest, base, "laps", tables[i].laps.t, fit) && ok;
+      ok = writeAligned(manifest, base, "rewards", tables[i].rewards.t, fit) && ok;
+      fprintf(manifest, "# t_photometry = %.9f + %.12f * t * %g\n", fit.offset, fit.slope, ALIGN_TICK_S);
+    }
+    ok = manifest != nullptr && fclose(manifest) == 0 && ok;
+    if (!ok)
+    {
+      fprintf(stderr, "cannot write the tables of %s to %s\n", paths[2 * i], outDir.c_str());
+      failed++;
+    }
+  }
+  fprintf(stderr, "%zu sessions aligned in %.3f s\n", sessions, seconds);
+  return failed ? 1 : 0;
+}
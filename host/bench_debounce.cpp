@@ -0,0 +1,212 @@
+/*
+ * Host benchmark - sensor debounce filters against the legacy IR/touch logic
+ *
+ *   build : g++ -std=c++17 -O2 -o bench_debounce host/bench_debounce.cpp
+ *   usage : bench_debounce [contacts] [seed]
+ *
+ *   replays the same synthetic IR and touch traces (contact bounce at onset and release, isolated
+ *   glitches) through detectIR()/detectTouch() of a one port PortBank on the virtual board at 1 loop() pass per ms, both
+ *   polled and with edge capture, and counts the events logged against the true contacts,
+ *   the filter cost alone is timed on a random bit stream
+ */
+
+#include "../helper.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <stdlib.h>
+
+struct TraceEdge
+{
+  unsigned long long t;
+  bool level;
+};
+
+std::vector<TraceEdge> makeTrace(std::mt19937_64 &rng,
+                                 unsigned long contacts,
+                                 double minContact,
+                                 double maxContact,
+                                 double minGap,
+                                 double maxGap)
+{
+  /*
+  Contacts of random length, each onset and release bouncing for up to 4 edges pairs of 50-800us,
+    plus isolated 50-400us glitches in one out of four gaps, times in us
+  */
+  auto uniform = [&](double lo, double hi) { return std::uniform_real_distribution<double>(lo, hi)(rng); };
+  std::vector<TraceEdge> trace;
+  double t = 2e6;
+  for (unsigned long i = 0; i < contacts; i++)
+  {
+    for (int b = (int)uniform(0, 5); b > 0; b--)
+    {
+      trace.push_back({(unsigned long long)t, true});
+      t += uniform(50, 800);
+      trace.push_back({(unsigned long long)t, false});
+      t += uniform(50, 800);
+    }
+    trace.push_back({(unsigned long long)t, true});
+    t += uniform(minContact, maxContact);
+    for (int b = (int)uniform(0, 5); b > 0; b--)
+    {
+      trace.push_back({(unsigned long long)t, false});
+      t += uniform(50, 800);
+      trace.push_back({(unsigned long long)t, true});
+      t += uniform(50, 800);
+    }
+    trace.push_back({(unsigned long long)t, false});
+    double gap = uniform(minGap, maxGap);
+    if (uniform(0, 1) < 0.25)
+    {
+      double tGlitch = t + uniform(0.2, 0.8) * gap;
+      trace.push_back({(unsigned long long)tGlitch, true});
+      trace.push_back({(unsigned long long)(tGlitch + uniform(50, 400)), false});
+    }
+    t += gap;
+  }
+  return trace;
+}
+
+struct ReplayResult
+{
+  unsigned long events;
+  double nsPerPass;
+};
+
+ReplayResult replay(const std::vector<TraceEdge> &trace,
+                    bool touch,
+                    byte mode,
+                    byte samples,
+                    bool capture)
+{
+  /*
+  Run one trace through the sensor on a fresh virtual board, returns the ON events logged
+  */
+  hostReset();
+  size_t next = 0;
+  byte pin = touch ? PORT_TOUCH_PIN[0] : PORT_IR_PIN[0];
+  hostBoard.drive = [&](HostBoard &board) {
+    while (next < trace.size() && trace[next].t <= board.tMicros)
+    {
+      hostDrivePin(pin, trace[next].level);
+      next++;
+    }
+    return next < trace.size() ? trace[next].t : ~0ULL;
+  };
+  initClock(systemClock);
+  initSessionParams(sessionParams);
+  initEventLog(eventLogQueue);
+  TTLState output;
+  initTTL(output, OUTPUT_TOUCH, OUTPUT);
+  PortBank<1> port;
+  EdgeQueue edges;
+  initPorts(port, 1, PORT_IR_PIN, PORT_IR_INDICATOR, PORT_TOUCH_PIN, PORT_SOLENOID_PIN, PORT_TRACK, PORT_TTL_PERIOD,
+            &output, &output, &output, touch || !capture ? nullptr : &edges, touch && capture ? &edges : nullptr);
+  initDebouncer(touch ? port.touchDebounce[0] : port.irDebounce[0], mode, samples, false);
+  uint8_t inputs[HAL_INPUT_PORTS];
+
+  ReplayResult result = {0, 0};
+  unsigned long passes = 0;
+  double ns = 0;
+  unsigned long long tEnd = trace.back().t + 100000ULL;
+  while (hostBoard.tMicros < tEnd)
+  {
+    hostAdvance(1000);
+    Timestamp tNow = currentTime();
+    auto start = std::chrono::steady_clock::now();
+    halSampleInputs(inputs, port.inputPorts);
+    if (touch)
+    {
+      detectTouch(port, 0, inputs, tNow);
+    }
+    else
+    {
+      detectIR(port, 0, inputs, tNow);
+    }
+    ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    passes++;
+    updateTTL(output, tNow);
+    while (eventLogQueue.tail != eventLogQueue.head)
+    {
+      result.events += eventLogQueue.records[eventLogQueue.tail].code & 0x01;
+      eventLogQueue.tail = (eventLogQueue.tail + 1) & (EVENT_LOG_CAPACITY - 1);
+    }
+  }
+  hostBoard.drive = nullptr;
+  result.nsPerPass = ns / passes;
+  return result;
+}
+
+double sampleCost(byte mode, byte samples, unsigned long iterations)
+{
+  /*
+  ns per debounceSample() on a random level stream
+  */
+  std::mt19937 rng(11);
+  std::vector<byte> levels(4096);
+  for (byte &level : levels)
+  {
+    level = (rng() & 3) != 0;
+  }
+  Debouncer debouncer;
+  initDebouncer(debouncer, mode, samples, false);
+  unsigned long changes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned long i = 0; i < iterations; i++)
+  {
+    debouncer.raw = levels[i & 4095];
+    changes += debounceSample(debouncer);
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  // keep the loop from being optimized away
+  if (changes == ~0UL)
+  {
+    printf("%lu\n", changes);
+  }
+  return ns / iterations;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned long contacts = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000UL;
+  unsigned long long seed = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1ULL;
+
+  struct Filter
+  {
+    const char* name;
+    byte mode;
+    byte samples;
+  };
+  const Filter filters[] = {
+    {"legacy", DEBOUNCE_OFF, 1},
+    {"shift4", DEBOUNCE_SHIFT, 4},
+    {"integrator4", DEBOUNCE_INTEGRATOR, 4},
+    {"majority8", DEBOUNCE_MAJORITY, 8},
+  };
+
+  std::mt19937_64 rng(seed);
+  // licks, 15-40ms contacts 50-250ms apart - IR breaks, 0.2-3s long 0.5-5s apart
+  std::vector<TraceEdge> touchTrace = makeTrace(rng, contacts, 15e3, 40e3, 50e3, 250e3);
+  std::vector<TraceEdge> irTrace = makeTrace(rng, contacts / 10, 2e5, 3e6, 5e5, 5e6);
+
+  printf("sensor,filter,input,contacts,events,false_events,missed,ns_per_pass,ns_per_sample\n");
+  for (int touch = 1; touch >= 0; touch--)
+  {
+    const std::vector<TraceEdge> &trace = touch ? touchTrace : irTrace;
+    unsigned long truth = touch ? contacts : contacts / 10;
+    for (const Filter &filter : filters)
+    {
+      double nsSample = filter.mode == DEBOUNCE_OFF ? 0 : sampleCost(filter.mode, filter.samples, 50000000UL);
+      for (int capture = 0; capture < 2; capture++)
+      {
+        ReplayResult r = replay(trace, touch, filter.mode, filter.samples, capture);
+        printf("%s,%s,%s,%lu,%lu,%lu,%lu,%.1f,%.2f\n",
+               touch ? "touch" : "ir", filter.name, capture ? "edges" : "polled", truth, r.events,
+               r.events > truth ? r.events - truth : 0, r.events < truth ? truth - r.events : 0,
+               r.nsPerPass, nsSample);
+      }
+    }
+  }
+  return 0;
+}
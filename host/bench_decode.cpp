@@ -0,0 +1,146 @@
+/*
+ * Host benchmark - throughput of the columnar log decoder over a synthetic log corpus
+ *
+ *   build : g++ -std=c++17 -O2 -o bench_decode host/bench_decode.cpp
+ *   usage : bench_decode [corpus MB] [directory] [seed]
+ *
+ *   for every event log encoding one session of lap traffic (IR breaks alternating between the ports,
+ *   touch bursts, valve openings) is written through the firmware logSessionStart()/eventLog()/
+ *   drainEventLog()/logSessionEnd() on the virtual board, repeated into log files of 64 MB up to the corpus
+ *   size (2048 MB by default), then every file is mapped and decoded into tables as decode_logs does -
+ *   the page cache is not dropped, the numbers are decode throughput, not disk throughput
+ */
+
+#include "../helper.h"
+#include "log_tables.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const size_t FILE_BYTES = 64UL << 20;
+
+std::string makeSession(byte encoding,
+                        unsigned long long seed,
+                        unsigned long &events)
+{
+  /*
+  One 10 minute session of synthetic lap traffic in the given encoding, as captured on the host
+  */
+  hostReset();
+  Serial.begin(1000000UL);
+  initClock(systemClock);
+  initEventLog(eventLogQueue);
+  eventLogQueue.encoding = encoding;
+  std::mt19937_64 rng(seed);
+  std::exponential_distribution<double> gap(1 / 2e5);
+  logSessionStart(1);
+  byte port = 0;
+  bool touching = false;
+  double tNext = 1e6;
+  events = 0;
+  while (hostBoard.tMicros < 601e6)
+  {
+    hostAdvance(1000);
+    while (tNext <= hostBoard.tMicros && eventLogQueue.head == eventLogQueue.tail)
+    {
+      Timestamp t = (Timestamp)(TIME_IN_MICROSECONDS ? tNext : tNext / 1000);
+      unsigned long r = rng() % 16;
+      if (r == 0)
+      {
+        port = (port + 1) % PORT_COUNT;
+        eventLog(port, IR, ON, t);
+        eventLog(port, IR, OFF, t + 3);
+        eventLog(port, SOLENOID, ON, t + 5);
+        eventLog(port, SOLENOID, OFF, t + 90);
+        events += 4;
+      }
+      else
+      {
+        touching = !touching;
+        eventLog(port, TOUCH, touching, t);
+        events++;
+      }
+      tNext += gap(rng);
+    }
+    drainEventLog(eventLogQueue);
+  }
+  logSessionEnd((Timestamp)(TIME_IN_MICROSECONDS ? hostBoard.tMicros : hostBoard.tMicros / 1000));
+  return hostBoard.serialOut;
+}
+
+int main(int argc, char** argv)
+{
+  size_t corpusBytes = (argc > 1 ? strtoull(argv[1], nullptr, 10) : 2048ULL) << 20;
+  std::string directory = argc > 2 ? argv[2] : "/tmp";
+  unsigned long long seed = argc > 3 ? strtoull(argv[3], nullptr, 10) : 1ULL;
+  const char* names[] = {"ascii", "frame", "compact"};
+
+  printf("encoding,corpus_mb,files,sessions,events,bytes_per_event,decode_s,mb_per_s,mevents_per_s\n");
+  for (byte encoding = EVENT_ASCII; encoding <= EVENT_COMPACT; encoding++)
+  {
+    unsigned long sessionEvents;
+    std::string session = makeSession(encoding, seed, sessionEvents);
+    std::string chunk;
+    while (chunk.size() + session.size() <= FILE_BYTES)
+    {
+      chunk += session;
+    }
+    std::vector<std::string> paths;
+    for (size_t written = 0; written + chunk.size() <= corpusBytes || paths.empty(); written += chunk.size())
+    {
+      paths.push_back(directory + "/bench_decode_" + names[encoding] + "_" + std::to_string(paths.size()) + ".log");
+      FILE* file = fopen(paths.back().c_str(), "wb");
+      if (file == nullptr || fwrite(chunk.data(), 1, chunk.size(), file) != chunk.size() || fclose(file) != 0)
+      {
+        fprintf(stderr, "cannot write %s\n", paths.back().c_str());
+        return 1;
+      }
+    }
+
+    LogTables tables;
+    unsigned long long events = 0, sessions = 0, bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const std::string &path : paths)
+    {
+      int fd = open(path.c_str(), O_RDONLY);
+      void* map = mmap(nullptr, chunk.size(), PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (map == MAP_FAILED)
+      {
+        fprintf(stderr, "cannot map %s\n", path.c_str());
+        return 1;
+      }
+      madvise(map, chunk.size(), MADV_SEQUENTIAL);
+      decodeLogTables((const byte*)map, chunk.size(), tables);
+      munmap(map, chunk.size());
+      for (byte type = 0; type < LOG_TYPES; type++)
+      {
+        events += tables.events[type].t.size();
+      }
+      sessions += tables.sessions.tStart.size();
+      bytes += chunk.size();
+      if (tables.eventsLost + tables.eventsUnresolved > 0)
+      {
+        fprintf(stderr, "%s: %lu events lost\n", path.c_str(), tables.eventsLost + tables.eventsUnresolved);
+      }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (const std::string &path : paths)
+    {
+      unlink(path.c_str());
+    }
+    if (events != sessions * sessionEvents)
+    {
+      fprintf(stderr, "%s: %llu events decoded, %llu logged\n", names[encoding], events, sessions * sessionEvents);
+    }
+    printf("%s,%.0f,%zu,%llu,%llu,%.2f,%.3f,%.1f,%.2f\n", names[encoding], bytes / 1048576.0, paths.size(), sessions,
+           events, (double)bytes / events, seconds, bytes / 1e6 / seconds, events / 1e6 / seconds);
+  }
+  return 0;
+}
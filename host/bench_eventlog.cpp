@@ -0,0 +1,137 @@
+/*
+ * Host benchmark - sustainable event rate of the event log encodings against the baud rate
+ *
+ *   build : g++ -std=c++17 -O2 -o bench_eventlog host/bench_eventlog.cpp
+ *   usage : bench_eventlog [seconds] [seed]
+ *
+ *   Poisson touch/release traffic goes through eventLog()/drainEventLog() on the virtual board at
+ *   1 loop() pass per ms, the highest rate without a single event dropped on the ring buffer is found by
+ *   bisection, the captured stream is decoded back and checked event by event, at twice that rate the
+ *   EVENT_COMPACT sequence numbers must account for the dropped events (all but the ones dropped after the
+ *   last event that got through, which leave no gap to see)
+ */
+
+#include "../helper.h"
+#include "log_decode.h"
+
+#include <random>
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+
+const unsigned long long US_PER_TICK = TIME_IN_MICROSECONDS ? 1ULL : 1000ULL;
+
+struct RateResult
+{
+  unsigned long events;
+  unsigned long dropped;
+  unsigned long decoded;
+  unsigned long lost;          // decoder.eventsLost + eventsUnresolved
+  unsigned long mismatched;    // decoded events that differ from the ones queued
+  size_t bytes;
+};
+
+RateResult run(byte encoding,
+               unsigned long baud,
+               double rate,
+               double seconds,
+               unsigned long long seed)
+{
+  /*
+  Log Poisson events at rate per second for seconds of virtual time and decode the stream back
+  */
+  hostReset();
+  Serial.begin(baud);
+  initClock(systemClock);
+  initEventLog(eventLogQueue);
+  eventLogQueue.encoding = encoding;
+
+  std::mt19937_64 rng(seed);
+  std::exponential_distribution<double> gap(rate / 1e6);
+  std::vector<LogRecord> sent;
+  RateResult result = {};
+  double tNext = 1e6 + gap(rng);
+  bool touching[2] = {};
+  unsigned long long tEnd = (unsigned long long)((1 + seconds) * 1e6);
+  while (hostBoard.tMicros < tEnd)
+  {
+    hostAdvance(1000);
+    while (tNext <= hostBoard.tMicros)
+    {
+      byte side = rng() & 1;
+      touching[side] = !touching[side];
+      unsigned int overflow = eventLogQueue.overflow;
+      Timestamp t = (Timestamp)(tNext / US_PER_TICK);
+      eventLog(side, TOUCH, touching[side], t);
+      if (eventLogQueue.overflow == overflow)
+      {
+        sent.push_back({(byte)((side << 4) | (TOUCH << 1) | touching[side]), 0, t});
+      }
+      result.events++;
+      tNext += gap(rng);
+    }
+    drainEventLog(eventLogQueue);
+  }
+  flushEventLog(eventLogQueue);
+  result.dropped = eventLogQueue.overflow;
+  result.bytes = hostBoard.serialOut.size();
+
+  LogDecoder decoder;
+  LogItem item;
+  initLogDecoder(decoder, hostBoard.serialOut);
+  while (nextLogItem(decoder, item))
+  {
+    LogRecord e = {};
+    if (item.kind == LOG_EVENT)
+    {
+      e.code = item.code;
+      e.t = item.t;
+    }
+    else if (item.kind == LOG_LINE && item.length > 3)
+    {
+      e.code = ((item.line[0] - '0') << 4) | ((item.line[1] - '0') << 1) | (item.line[2] - '0');
+      e.t = strtoull(std::string(item.line + 3, item.length - 3).c_str(), nullptr, 10);
+    }
+    else
+    {
+      continue;
+    }
+    if (result.decoded >= sent.size() || sent[result.decoded].code != e.code || sent[result.decoded].t != e.t)
+    {
+      result.mismatched++;
+    }
+    result.decoded++;
+  }
+  result.lost = decoder.eventsLost + decoder.eventsUnresolved;
+  return result;
+}
+
+int main(int argc, char** argv)
+{
+  double seconds = argc > 1 ? strtod(argv[1], nullptr) : 20.0;
+  unsigned long long seed = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1ULL;
+  const char* names[] = {"ascii", "frame", "compact"};
+  const unsigned long bauds[] = {9600UL, 115200UL, 250000UL, 1000000UL};
+
+  printf("encoding,baud,max_events_per_s,bytes_per_event,decode_errors,overload_dropped,overload_seq_lost\n");
+  for (byte encoding = EVENT_ASCII; encoding <= EVENT_COMPACT; encoding++)
+  {
+    for (unsigned long baud : bauds)
+    {
+      // bisect the highest rate with nothing dropped, the board loop caps it at well below 1 event per us
+      double lo = 1, hi = 200000;
+      while (hi / lo > 1.01)
+      {
+        double mid = sqrt(lo * hi);
+        RateResult r = run(encoding, baud, mid, seconds, seed);
+        (r.dropped == 0 ? lo : hi) = mid;
+      }
+      RateResult best = run(encoding, baud, lo, seconds, seed);
+      RateResult over = run(encoding, baud, 2 * lo, seconds, seed);
+      printf("%s,%lu,%.0f,%.2f,%lu,%lu,%s\n", names[encoding], baud, lo, (double)best.bytes / best.events,
+             best.mismatched + (best.decoded != best.events), over.dropped,
+             encoding == EVENT_COMPACT ? std::to_string(over.lost).c_str() : "-");
+    }
+  }
+  return 0;
+}
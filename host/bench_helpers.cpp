@@ -0,0 +1,506 @@
+/*
+ * Host benchmark - per call cost of the helper.h hot paths under idle, realistic and worst case input
+ *
+ *   build : g++ -std=c++17 -O2 -o bench_helpers host/bench_helpers.cpp
+ *   usage : bench_helpers [-n calls] [-r repeats] [-f function] [-c baseline.csv] [-s seed]
+ *           -f runs only the rows of one function, -c adds the ns/call change against an earlier run
+ *
+ *   every row calls one function once per ms of virtual time on the virtual board, input patterns:
+ *     idle      inputs steady, outputs free
+ *     beam      IR breaks of 0.2-3s every 0.5-5s, up to 4 bounce samples at onset and release
+ *     burst     licking bouts of 1-4s (15-40ms contacts every 50-250ms) every 2-10s, bouncing contacts
+ *     chatter   the input toggles on every call
+ *     train     a TTL train is running on the output, overlap - a train is requested while one is running
+ *   sensor rows run polled and with edge capture (captureEdges() fires on every level change, its cost is included),
+ *   the TTL trains started by the sensor rows run on a TimerScheduler serviced after every call like loop() does -
+ *   the harness row is that loop alone (clock advance, timer service, event queue reset), subtract it for the
+ *   cost of the function itself
+ *
+ *   one CSV row per function, pattern and input: median ns/call over the repeats, instructions, branches and
+ *   branch misses per call from the hardware counters (perf_event_open, - where the kernel or the VM does not
+ *   provide them) and logged events per call
+ */
+
+#include "../helper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const unsigned long long US_PER_TICK = TIME_IN_MICROSECONDS ? 1ULL : 1000ULL;
+const unsigned long long STEP_US = 1000ULL;      // virtual time per call
+const Timestamp STEP = STEP_US / US_PER_TICK;
+
+// user space hardware counters of this thread as one group, leader -1 where they are not available
+struct Counters
+{
+  int leader;
+  int fds[3];
+};
+
+struct BenchResult
+{
+  double ns;
+  double instructions;
+  double branches;
+  double misses;
+  bool counted;
+  double events;
+};
+
+TTLState irOutput, touchOutput, solenoidOutput, ttl, inputTrigger;
+TTLQueue irQueue, touchQueue, solenoidQueue, ttlQueue;
+PortBank<PORT_COUNT> ports;
+EdgeQueue irEdges[PORT_COUNT], touchEdges[PORT_COUNT];
+TimerScheduler ttlTimers;
+Timestamp tNow;
+unsigned long long events;
+volatile unsigned long long sink;
+
+int openCounter(uint64_t config,
+                int leader)
+{
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = leader == -1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+Counters openCounters()
+{
+  /*
+  Instructions, branches and branch misses of this thread, all or none
+  */
+  Counters counters;
+  const uint64_t configs[3] = {PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES};
+  counters.leader = -1;
+  for (int i = 0; i < 3; i++)
+  {
+    counters.fds[i] = openCounter(configs[i], counters.leader);
+    if (counters.fds[i] < 0)
+    {
+      for (int j = 0; j < i; j++)
+      {
+        close(counters.fds[j]);
+      }
+      counters.leader = -1;
+      return counters;
+    }
+    counters.leader = counters.fds[0];
+  }
+  return counters;
+}
+
+void resetPins()
+{
+  /*
+  Fresh virtual board with the sketch outputs, ports and TTL timers, the clock 2s after power on
+  */
+  hostReset(2000000ULL);
+  initClock(systemClock);
+  initSessionParams(sessionParams);
+  tNow = currentTime();
+  initEventLog(eventLogQueue);
+  initSessionStats(sessionStats);
+  initTimerScheduler(ttlTimers);
+  initTTL(inputTrigger, INPUT_TRIGGER, INPUT);
+  initTTL(irOutput, OUTPUT_IR, OUTPUT);
+  initTTL(touchOutput, OUTPUT_TOUCH, OUTPUT);
+  initTTL(solenoidOutput, OUTPUT_SOLENOID, OUTPUT);
+  initTTL(ttl, OUTPUT_TRIGGER, OUTPUT);
+  attachTTLQueue(irOutput, irQueue);
+  attachTTLQueue(touchOutput, touchQueue);
+  attachTTLQueue(solenoidOutput, solenoidQueue);
+  scheduleTTL<OutputIRPin>(irOutput, ttlTimers);
+  scheduleTTL<OutputTouchPin>(touchOutput, ttlTimers);
+  scheduleTTL<OutputSolenoidPin>(solenoidOutput, ttlTimers);
+}
+
+void resetPorts(bool edges)
+{
+  resetPins();
+  edgeCaptureCount = 0;
+  initPorts(ports, PORT_COUNT, PORT_IR_PIN, PORT_IR_INDICATOR, PORT_TOUCH_PIN, PORT_SOLENOID_PIN, PORT_TRACK, PORT_TTL_PERIOD,
+            &irOutput, &touchOutput, &solenoidOutput, edges ? irEdges : nullptr, edges ? touchEdges : nullptr);
+}
+
+std::vector<uint8_t> makePattern(const std::string &pattern,
+                                 unsigned long calls,
+                                 std::mt19937_64 &rng)
+{
+  /*
+  Input level per call (one call per STEP_US), see the header for the patterns
+  */
+  auto uniform = [&](double lo, double hi) { return std::uniform_real_distribution<double>(lo, hi)(rng); };
+  std::vector<uint8_t> levels(calls, 0);
+  if (pattern == "chatter")
+  {
+    for (unsigned long i = 0; i < calls; i++)
+    {
+      levels[i] = i & 1;
+    }
+    return levels;
+  }
+  // contacts [on, off) in calls, each edge bouncing for up to 4 calls
+  auto contact = [&](unsigned long on, unsigned long off) {
+    for (unsigned long i = on; i < off && i < calls; i++)
+    {
+      levels[i] = 1;
+    }
+    for (int b = (int)uniform(0, 5); b > 0; b--)
+    {
+      if (on + b < calls) levels[on + b] ^= b & 1;
+      if (off + b < calls) levels[off + b] ^= !(b & 1);
+    }
+  };
+  double ms = 1000.0 / STEP_US;   // calls per ms
+  double t = uniform(0, 500) * ms;
+  while (pattern == "beam" && t < calls)
+  {
+    double length = uniform(200, 3000) * ms;
+    contact((unsigned long)t, (unsigned long)(t + length));
+    t += length + uniform(500, 5000) * ms;
+  }
+  while (pattern == "burst" && t < calls)
+  {
+    double tEnd = t + uniform(1000, 4000) * ms;
+    while (t < tEnd)
+    {
+      double length = uniform(15, 40) * ms;
+      contact((unsigned long)t, (unsigned long)(t + length));
+      t += length + uniform(50, 250) * ms;
+    }
+    t += uniform(2000, 10000) * ms;
+  }
+  return levels;
+}
+
+template <class Setup, class Call>
+BenchResult measure(Setup setup,
+                    Call call,
+                    unsigned long calls,
+                    int repeats,
+                    Counters &counters)
+{
+  /*
+  Run calls of call(i) after setup(), repeats times, between calls the harness advances the clock by STEP,
+    services the TTL timers and empties the event queue
+
+  Returns:
+  <struct BenchResult> : median ns/call, counters and events per call averaged over the repeats
+  */
+  std::vector<double> ns;
+  BenchResult result = {};
+  result.counted = counters.leader != -1;
+  for (int r = 0; r < repeats; r++)
+  {
+    setup();
+    events = 0;
+    if (result.counted)
+    {
+      ioctl(counters.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(counters.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < calls; i++)
+    {
+      hostBoard.tMicros += STEP_US;
+      tNow += STEP;
+      call(i);
+      runTimers(ttlTimers, tNow);
+      events += (eventLogQueue.head - eventLogQueue.tail) & (EVENT_LOG_CAPACITY - 1);
+      eventLogQueue.tail = eventLogQueue.head;
+    }
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    if (result.counted)
+    {
+      ioctl(counters.leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+      uint64_t values[4];
+      if (read(counters.leader, values, sizeof(values)) == sizeof(values) && values[0] == 3)
+      {
+        result.instructions += (double)values[1] / calls / repeats;
+        result.branches += (double)values[2] / calls / repeats;
+        result.misses += (double)values[3] / calls / repeats;
+      }
+    }
+    ns.push_back(elapsed / calls);
+    result.events += (double)events / calls / repeats;
+  }
+  std::sort(ns.begin(), ns.end());
+  result.ns = ns[ns.size() / 2];
+  return result;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned long calls = 2000000UL;
+  int repeats = 5;
+  unsigned long long seed = 1ULL;
+  std::string only;
+  const char* baselinePath = nullptr;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "-n" && i + 1 < argc) calls = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "-r" && i + 1 < argc) repeats = atoi(argv[++i]);
+    else if (arg == "-f" && i + 1 < argc) only = argv[++i];
+    else if (arg == "-c" && i + 1 < argc) baselinePath = argv[++i];
+    else if (arg == "-s" && i + 1 < argc) seed = strtoull(argv[++i], nullptr, 10);
+    else
+    {
+      fprintf(stderr, "usage: %s [-n calls] [-r repeats] [-f function] [-c baseline.csv] [-s seed]\n", argv[0]);
+      return 1;
+    }
+  }
+  repeats = repeats < 1 ? 1 : repeats;
+
+  // ns/call of an earlier run per function,pattern,input
+  std::map<std::string, double> baseline;
+  if (baselinePath)
+  {
+    FILE* file = fopen(baselinePath, "r");
+    if (!file)
+    {
+      fprintf(stderr, "cannot read %s\n", baselinePath);
+      return 1;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), file))
+    {
+      char function[64], pattern[64], input[64];
+      unsigned long n;
+      double ns;
+      if (sscanf(line, "%63[^,],%63[^,],%63[^,],%lu,%lf", function, pattern, input, &n, &ns) == 5)
+      {
+        baseline[std::string(function) + "," + pattern + "," + input] = ns;
+      }
+    }
+    fclose(file);
+  }
+
+  Counters counters = openCounters();
+  printf("function,pattern,input,calls,ns_per_call,instructions_per_call,branches_per_call,branch_misses_per_call,events_per_call%s\n",
+         baselinePath ? ",ns_change_pct" : "");
+  auto report = [&](const char* function, const char* pattern, const char* input, const BenchResult &result) {
+    printf("%s,%s,%s,%lu,%.2f", function, pattern, input, calls, result.ns);
+    if (result.counted)
+    {
+      printf(",%.1f,%.2f,%.3f", result.instructions, result.branches, result.misses);
+    }
+    else
+    {
+      printf(",-,-,-");
+    }
+    printf(",%.4f", result.events);
+    if (baselinePath)
+    {
+      auto before = baseline.find(std::string(function) + "," + pattern + "," + input);
+      if (before != baseline.end() && before->second > 0)
+      {
+        printf(",%+.1f", 100.0 * (result.ns - before->second) / before->second);
+      }
+      else
+      {
+        printf(",-");
+      }
+    }
+    printf("\n");
+    fflush(stdout);
+  };
+  auto selected = [&](const char* function) { return only.empty() || only == function; };
+  std::mt19937_64 rng(seed);
+
+  if (selected("harness"))
+  {
+    report("harness", "idle", "-", measure(resetPins, [](unsigned long) {}, calls, repeats, counters));
+  }
+
+  if (selected("currentTime"))
+  {
+    report("currentTime", "idle", "-", measure(resetPins, [](unsigned long) { sink += currentTime(); }, calls, repeats, counters));
+  }
+
+  if (selected("eventLog"))
+  {
+    report("eventLog", "idle", "-", measure(resetPins, [](unsigned long i) { eventLog(i & 1, TOUCH, (i >> 1) & 1, tNow); },
+                                            calls, repeats, counters));
+    // ring buffer full, every call takes the overflow path
+    auto fill = []() {
+      resetPins();
+      eventLogQueue.head = EVENT_LOG_CAPACITY - 1;
+    };
+    report("eventLog", "full", "-", measure(fill, [](unsigned long i) {
+      eventLogQueue.tail = 0;
+      eventLogQueue.head = EVENT_LOG_CAPACITY - 1;
+      eventLog(i & 1, TOUCH, (i >> 1) & 1, tNow);
+      eventLogQueue.head = eventLogQueue.tail;
+    }, calls, repeats, counters));
+  }
+
+  // sensor rows, the level of port 0 follows the pattern, captureEdges() fires on its changes with edge capture
+  const char* sensorPatterns[] = {"idle", "beam", "burst", "chatter"};
+  for (const char* function : {"detectIR", "detectTouch", "detectPorts"})
+  {
+    if (!selected(function))
+    {
+      continue;
+    }
+    bool touch = strcmp(function, "detectTouch") == 0;
+    for (const char* pattern : sensorPatterns)
+    {
+      if ((touch && strcmp(pattern, "beam") == 0) || (!touch && strcmp(pattern, "burst") == 0 && strcmp(function, "detectPorts") != 0))
+      {
+        continue;
+      }
+      std::vector<uint8_t> levels = makePattern(pattern, calls, rng);
+      byte pin = touch || strcmp(pattern, "burst") == 0 ? PORT_TOUCH_PIN[0] : PORT_IR_PIN[0];
+      bool activeLow = pin == PORT_TOUCH_PIN[0] ? TOUCH_ACTIVE_LOW : IR_ACTIVE_LOW;
+      for (bool edges : {false, true})
+      {
+        auto setup = [&]() { resetPorts(edges); };
+        auto drive = [&, edges](unsigned long i) {
+          bool level = levels[i] != activeLow;
+          if (hostBoard.level[pin] != level)
+          {
+            hostBoard.level[pin] = level;
+            if (edges)
+            {
+              captureEdges();
+            }
+          }
+        };
+        BenchResult result;
+        if (strcmp(function, "detectIR") == 0)
+        {
+          result = measure(setup, [&](unsigned long i) {
+            drive(i);
+            uint8_t inputs[HAL_INPUT_PORTS];
+            halSampleInputs(inputs, ports.inputPorts);
+            detectIR(ports, 0, inputs, tNow);
+          }, calls, repeats, counters);
+        }
+        else if (touch)
+        {
+          result = measure(setup, [&](unsigned long i) {
+            drive(i);
+            uint8_t inputs[HAL_INPUT_PORTS];
+            halSampleInputs(inputs, ports.inputPorts);
+            detectTouch(ports, 0, inputs, tNow);
+          }, calls, repeats, counters);
+        }
+        else
+        {
+          result = measure(setup, [&](unsigned long i) {
+            drive(i);
+            detectPorts(ports, tNow);
+          }, calls, repeats, counters);
+        }
+        report(function, pattern, edges ? "edges" : "polled", result);
+      }
+    }
+  }
+
+  if (selected("detectTTL"))
+  {
+    for (const char* pattern : {"idle", "beam", "chatter"})
+    {
+      std::vector<uint8_t> levels = makePattern(pattern, calls, rng);
+      report("detectTTL", strcmp(pattern, "beam") == 0 ? "pulse" : pattern, "polled", measure(resetPins, [&](unsigned long i) {
+        hostBoard.level[INPUT_TRIGGER] = levels[i];
+        sink += detectTTL<Pin<INPUT_TRIGGER>>(&inputTrigger, tNow);
+      }, calls, repeats, counters));
+    }
+  }
+
+  if (selected("updateTTL"))
+  {
+    report("updateTTL", "idle", "-", measure(resetPins, [](unsigned long) { updateTTL<OutputTriggerPin>(ttl, tNow); },
+                                             calls, repeats, counters));
+    // one train spanning the whole run, pulses every TTL_PULSE_PERIOD
+    auto train = []() {
+      resetPins();
+      sendTTL(&ttl, tNow, TTL_PULSE_PERIOD, TTL_PULSE_WIDTH, 0xFFFFFFFFUL);
+    };
+    report("updateTTL", "train", "-", measure(train, [](unsigned long) { updateTTL<OutputTriggerPin>(ttl, tNow); },
+                                              calls, repeats, counters));
+    // a short train requested every 20 calls into a queue, trains run back to back
+    auto overlap = []() {
+      resetPins();
+      attachTTLQueue(ttl, ttlQueue);
+    };
+    report("updateTTL", "overlap", "-", measure(overlap, [](unsigned long i) {
+      if (i % 20 == 0)
+      {
+        sendTTL(&ttl, tNow);
+      }
+      updateTTL<OutputTriggerPin>(ttl, tNow);
+    }, calls, repeats, counters));
+  }
+
+  if (selected("sendTTL"))
+  {
+    // the output is put back to idle before every call, each request starts a train
+    report("sendTTL", "idle", "-", measure(resetPins, [](unsigned long) {
+      ttl.state = false;
+      sendTTL(&ttl, tNow);
+    }, calls, repeats, counters));
+    // a train runs, the request is queued (the queue is emptied again after every call)
+    auto queued = []() {
+      resetPins();
+      attachTTLQueue(ttl, ttlQueue);
+      sendTTL(&ttl, tNow, TTL_PULSE_PERIOD, TTL_PULSE_WIDTH, 0xFFFFFFFFUL);
+    };
+    report("sendTTL", "overlap", "queue", measure(queued, [](unsigned long) {
+      sendTTL(&ttl, tNow);
+      ttlQueue.tail = ttlQueue.head;
+    }, calls, repeats, counters));
+    // a train runs on an output without a queue, the request is dropped
+    auto busy = []() {
+      resetPins();
+      sendTTL(&ttl, tNow, TTL_PULSE_PERIOD, TTL_PULSE_WIDTH, 0xFFFFFFFFUL);
+    };
+    report("sendTTL", "overlap", "drop", measure(busy, [](unsigned long) { sendTTL(&ttl, tNow); }, calls, repeats, counters));
+  }
+
+  if (selected("updateSolenoids"))
+  {
+    auto closed = []() { resetPorts(false); };
+    report("updateSolenoids", "idle", "-", measure(closed, [](unsigned long) { updateSolenoids(ports, tNow); },
+                                                   calls, repeats, counters));
+    // every valve open and not due
+    auto open = []() {
+      resetPorts(false);
+      for (byte i = 0; i < PORT_COUNT; i++)
+      {
+        activateSolenoid(ports, i, tNow, 0xFFFFFFFFUL);
+      }
+      eventLogQueue.tail = eventLogQueue.head;
+    };
+    report("updateSolenoids", "open", "-", measure(open, [](unsigned long) { updateSolenoids(ports, tNow); },
+                                                   calls, repeats, counters));
+    // a reward every call - port 0 opens and closes on the next call
+    report("updateSolenoids", "chatter", "-", measure(closed, [](unsigned long) {
+      if (!ports.open[0])
+      {
+        activateSolenoid(ports, 0, tNow, STEP);
+      }
+      updateSolenoids(ports, tNow);
+    }, calls, repeats, counters));
+  }
+  return 0;
+}
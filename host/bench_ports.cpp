@@ -0,0 +1,139 @@
+/*
+ * Host benchmark - per loop() cost of the port sweep against the number of ports
+ *
+ *   build : g++ -std=c++17 -O2 -o bench_ports host/bench_ports.cpp
+ *   usage : bench_ports [passes] [seed]
+ *
+ *   a PortBank of 1..PORT_BENCH_MAX ports on synthetic pins, two ports per track, sees random beam
+ *   breaks and licks while detectPorts(), the reward sweep, the solenoid timer and updateLastPort()
+ *   run at 1 loop() pass per ms of virtual time, the same way the sketch calls them
+ */
+
+#include "../helper.h"
+
+#include <chrono>
+#include <random>
+#include <stdlib.h>
+
+const byte PORT_BENCH_MAX = 16;
+const byte PORT_BENCH_INDICATOR = 5;   // synthetic pins, indicator/IR/touch/solenoid blocks of PORT_BENCH_MAX
+const byte PORT_BENCH_IR = 22;
+const byte PORT_BENCH_TOUCH = 38;
+const byte PORT_BENCH_SOLENOID = 54;
+
+PortBank<PORT_BENCH_MAX> ports;
+TimerScheduler sessionTimers;
+
+byte rewardPorts(Timestamp tNow)
+{
+  /*
+  Reward sweep of the sketch in MODE_B, the second port of a track is rewarded coming from the first
+  */
+  byte laps = 0;
+  for (byte i = 0; i < ports.count; i++)
+  {
+    byte last = ports.lastPort[ports.track[i]];
+    if (ports.trackRank[i] == MODE_B && ports.breakEvent[i] && last != PORT_NONE && last != i)
+    {
+      activateSolenoid(ports, i, tNow);
+      activateSolenoid(ports, ports.trackFirst[ports.track[i]], tNow);
+      laps++;
+    }
+  }
+  return laps;
+}
+
+struct BenchResult
+{
+  double nsPerPass;
+  unsigned long events;
+  unsigned long laps;
+};
+
+BenchResult run(byte count, unsigned long passes, unsigned long long seed)
+{
+  /*
+  Sweep count ports for passes loop() passes, returns ns per pass, events logged and laps rewarded
+  */
+  hostReset();
+  std::mt19937_64 rng(seed);
+  unsigned long long tNextVisit = 0;
+  unsigned long long tRelease = 0;
+  byte visited = 0;
+  // the animal visits a random port every 0.5-3s, breaking the beam for 200ms and licking 5 times
+  hostBoard.drive = [&](HostBoard &board) {
+    if (board.tMicros >= tNextVisit)
+    {
+      visited = rng() % count;
+      hostDrivePin(PORT_BENCH_IR + visited, !IR_ACTIVE_LOW);
+      tRelease = board.tMicros + 200000ULL;
+      tNextVisit = tRelease + 300000ULL + rng() % 2500000ULL;
+    }
+    if (board.tMicros >= tRelease)
+    {
+      hostDrivePin(PORT_BENCH_IR + visited, IR_ACTIVE_LOW);
+      tRelease = ~0ULL;
+    }
+    if (tRelease != ~0ULL)
+    {
+      bool lick = ((board.tMicros - (tRelease - 200000ULL)) / 20000ULL) & 1;
+      hostDrivePin(PORT_BENCH_TOUCH + visited, lick != TOUCH_ACTIVE_LOW);
+    }
+    unsigned long long tNext = tRelease != ~0ULL ? board.tMicros + 1000ULL : tNextVisit;
+    return tNext < tRelease ? tNext : tRelease;
+  };
+
+  byte irPins[PORT_BENCH_MAX], indicatorPins[PORT_BENCH_MAX], touchPins[PORT_BENCH_MAX], solenoidPins[PORT_BENCH_MAX];
+  byte tracks[PORT_BENCH_MAX];
+  unsigned long ttlPeriods[PORT_BENCH_MAX];
+  for (byte i = 0; i < PORT_BENCH_MAX; i++)
+  {
+    indicatorPins[i] = PORT_BENCH_INDICATOR + i;
+    irPins[i] = PORT_BENCH_IR + i;
+    touchPins[i] = PORT_BENCH_TOUCH + i;
+    solenoidPins[i] = PORT_BENCH_SOLENOID + i;
+    tracks[i] = i / 2;
+    ttlPeriods[i] = TTL_PULSE_PERIOD;
+  }
+  initClock(systemClock);
+  initSessionParams(sessionParams);
+  initEventLog(eventLogQueue);
+  TTLState output;
+  initTTL(output, OUTPUT_IR, OUTPUT);
+  initTimerScheduler(sessionTimers);
+  initPorts(ports, count, irPins, indicatorPins, touchPins, solenoidPins, tracks, ttlPeriods, &output, &output, &output);
+  scheduleSolenoids(ports, sessionTimers);
+
+  BenchResult result = {0, 0, 0};
+  double ns = 0;
+  for (unsigned long pass = 0; pass < passes; pass++)
+  {
+    hostAdvance(1000);
+    Timestamp tNow = currentTime();
+    auto start = std::chrono::steady_clock::now();
+    detectPorts(ports, tNow);
+    runTimers(sessionTimers, tNow);
+    result.laps += rewardPorts(tNow);
+    updateLastPort(ports);
+    ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    updateTTL(output, tNow);
+    result.events += (eventLogQueue.head - eventLogQueue.tail) & (EVENT_LOG_CAPACITY - 1);
+    eventLogQueue.tail = eventLogQueue.head;
+  }
+  hostBoard.drive = nullptr;
+  result.nsPerPass = ns / passes;
+  return result;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned long passes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000000UL;
+  unsigned long long seed = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1ULL;
+  printf("ports,passes,events,laps,ns_per_pass,ns_per_port\n");
+  for (byte count = 1; count <= PORT_BENCH_MAX; count *= 2)
+  {
+    BenchResult r = run(count, passes, seed);
+    printf("%u,%lu,%lu,%lu,%.1f,%.2f\n", count, passes, r.events, r.laps, r.nsPerPass, r.nsPerPass / count);
+  }
+  return 0;
+}
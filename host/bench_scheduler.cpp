@@ -0,0 +1,95 @@
+/*
+ * Host benchmark - per loop() cost of the actuator updates, polled every pass vs timer scheduler
+ *
+ *   build : g++ -std=c++17 -O2 -o bench_scheduler host/bench_scheduler.cpp
+ *   usage : bench_scheduler [iterations]
+ *
+ *   both paths replay the same actuator traffic (TTL trains on the four photometry channels,
+ *   reward deliveries, blinking LED) at 10 loop() passes per ms of virtual time
+ */
+
+#include "../helper.h"
+
+#include <chrono>
+#include <random>
+#include <stdlib.h>
+
+TTLState ttl[4];
+PortBank<PORT_COUNT> ports;
+BlinkLEDState led;
+TimerScheduler ttlTimers, sessionTimers;
+
+void setupActuators(bool scheduled)
+{
+  hostReset();
+  initTTL(ttl[0], OUTPUT_TRIGGER, OUTPUT);
+  initTTL(ttl[1], OUTPUT_IR, OUTPUT);
+  initTTL(ttl[2], OUTPUT_TOUCH, OUTPUT);
+  initTTL(ttl[3], OUTPUT_SOLENOID, OUTPUT);
+  initPorts(ports, PORT_COUNT, PORT_IR_PIN, PORT_IR_INDICATOR, PORT_TOUCH_PIN, PORT_SOLENOID_PIN, PORT_TRACK, PORT_TTL_PERIOD,
+            &ttl[1], &ttl[2], &ttl[3]);
+  initBlinkLED(led, LED_BLINK_PIN, SIDE_A);
+  if (scheduled)
+  {
+    initTimerScheduler(ttlTimers);
+    initTimerScheduler(sessionTimers);
+    scheduleTTL<OutputTriggerPin>(ttl[0], ttlTimers);
+    scheduleTTL<OutputIRPin>(ttl[1], ttlTimers);
+    scheduleTTL<OutputTouchPin>(ttl[2], ttlTimers);
+    scheduleTTL<OutputSolenoidPin>(ttl[3], ttlTimers);
+    scheduleBlinkLED(led, sessionTimers);
+    scheduleSolenoids(ports, sessionTimers);
+  }
+}
+
+double run(bool scheduled, unsigned long iterations)
+{
+  /*
+  Replay the actuator traffic, returns ns per loop() pass spent in actuator updates and traffic
+  */
+  setupActuators(scheduled);
+  std::mt19937 rng(7);
+  unsigned long tNextTTL = 100;
+  unsigned long tNextReward = 1000;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned long i = 0; i < iterations; i++)
+  {
+    unsigned long tNow = 1000 + i / 10;
+    if (tNow >= tNextTTL)
+    {
+      sendTTL(&ttl[1 + rng() % 3], tNow);
+      tNextTTL = tNow + 50 + rng() % 400;
+    }
+    if (tNow >= tNextReward)
+    {
+      activateSolenoid(ports, rng() & 1, tNow);
+      tNextReward = tNow + 2000 + rng() % 6000;
+    }
+    if (scheduled)
+    {
+      runTimers(ttlTimers, tNow);
+      runTimers(sessionTimers, tNow);
+    }
+    else
+    {
+      updateTTL<OutputTriggerPin>(ttl[0], tNow);
+      updateTTL<OutputIRPin>(ttl[1], tNow);
+      updateTTL<OutputTouchPin>(ttl[2], tNow);
+      updateTTL<OutputSolenoidPin>(ttl[3], tNow);
+      updateBlinkLED(led, tNow);
+      updateSolenoids(ports, tNow);
+    }
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  eventLogQueue.head = eventLogQueue.tail;
+  return ns / iterations;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned long iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 20000000UL;
+  printf("path,iterations,ns_per_loop\n");
+  printf("polled,%lu,%.2f\n", iterations, run(false, iterations));
+  printf("scheduled,%lu,%.2f\n", iterations, run(true, iterations));
+  return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * Host check - no sensor edge is lost between the pin change handler and loop()
+ *
+ *   build : g++ -std=c++17 -O2 -o check_edges host/check_edges.cpp
+ *   usage : check_edges [-n bursts] [-b pulses per burst] [-g pulse spacing us] [-i burst interval us]
+ *                       [-p loop period us] [-s seed]
+ *
+ *   every IR and touch pin of the port table is registered for edge capture as with SENSOR_EDGE_CAPTURE, then
+ *   driven with bursts of pulses (high for half the spacing) far faster than the loop period - the bursts of the
+ *   pins are offset at random so their edges interleave - while a loop() stand-in drains the EdgeQueues with
+ *   popEdge() once per period, every popped edge is checked against the injected one for its level and its time
+ *   (in the configured unit)
+ *
+ *   prints one CSV row per pin - injected and captured edges, queue overflows, edges out of order (wrong level or
+ *   time), the deepest queue seen by the loop - and exits with status 1 on any edge lost, overflowed or out of
+ *   order, so a queue too small for the burst rate fails here rather than on the rig
+ */
+
+#include "../helper.h"
+
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <vector>
+#include <string>
+#include <stdlib.h>
+
+// virtual clock is in us, sketch time parameters are in ms unless TIME_IN_MICROSECONDS
+const unsigned long long US_PER_TICK = TIME_IN_MICROSECONDS ? 1ULL : 1000ULL;
+const byte EDGE_CHECK_SENSORS = 2 * PORT_COUNT;
+
+struct InjectedEdge
+{
+  unsigned long long t;
+  bool level;
+};
+
+struct SensorCheck
+{
+  byte pin;
+  EdgeQueue queue;
+  std::deque<InjectedEdge> script;    // edges still to drive
+  std::deque<InjectedEdge> expected;  // driven, not yet popped
+  unsigned long injected;
+  unsigned long captured;
+  unsigned long mismatched;
+  byte depthMax;
+};
+
+int main(int argc, char** argv)
+{
+  unsigned long bursts = 50;
+  unsigned long pulses = 6;
+  unsigned long spacing = 300;
+  unsigned long long interval = 20000;
+  unsigned long long loopPeriod = 5000;
+  unsigned long long seed = 1;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "-n" && i + 1 < argc) bursts = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "-b" && i + 1 < argc) pulses = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "-g" && i + 1 < argc) spacing = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "-i" && i + 1 < argc) interval = strtoull(argv[++i], nullptr, 10);
+    else if (arg == "-p" && i + 1 < argc) loopPeriod = strtoull(argv[++i], nullptr, 10);
+    else if (arg == "-s" && i + 1 < argc) seed = strtoull(argv[++i], nullptr, 10);
+    else pulses = 0, i = argc;
+  }
+  if (pulses == 0 || spacing < 2 || loopPeriod == 0 || interval < pulses * spacing)
+  {
+    fprintf(stderr, "usage: %s [-n bursts] [-b pulses per burst] [-g pulse spacing us] [-i burst interval us] "
+                    "[-p loop period us] [-s seed]\n", argv[0]);
+    return 2;
+  }
+
+  hostReset();
+  initClock(systemClock);
+  std::mt19937_64 rng(seed);
+  std::vector<SensorCheck> sensors(EDGE_CHECK_SENSORS);
+  for (byte i = 0; i < EDGE_CHECK_SENSORS; i++)
+  {
+    SensorCheck &sensor = sensors[i];
+    sensor.pin = i < PORT_COUNT ? PORT_IR_PIN[i] : PORT_TOUCH_PIN[i - PORT_COUNT];
+    pinMode(sensor.pin, INPUT);
+    initEdgeCapture(sensor.queue, sensor.pin, false);
+    sensor.injected = 0;
+    sensor.captured = 0;
+    sensor.mismatched = 0;
+    sensor.depthMax = 0;
+    unsigned long long tBurst = 1000 + std::uniform_int_distribution<unsigned long long>(0, interval / 2)(rng);
+    for (unsigned long burst = 0; burst < bursts; burst++, tBurst += interval)
+    {
+      for (unsigned long pulse = 0; pulse < pulses; pulse++)
+      {
+        sensor.script.push_back({tBurst + pulse * spacing, true});
+        sensor.script.push_back({tBurst + pulse * spacing + spacing / 2, false});
+      }
+    }
+  }
+  // drive every edge at its exact time, the pin change handler fires from hostDrivePin()
+  hostBoard.drive = [&](HostBoard &board)
+  {
+    unsigned long long tNext = ~0ULL;
+    for (SensorCheck &sensor : sensors)
+    {
+      while (!sensor.script.empty() && sensor.script.front().t <= board.tMicros)
+      {
+        hostDrivePin(sensor.pin, sensor.script.front().level);
+        sensor.expected.push_back(sensor.script.front());
+        sensor.script.pop_front();
+        sensor.injected++;
+      }
+      tNext = sensor.script.empty() ? tNext : std::min(tNext, sensor.script.front().t);
+    }
+    return tNext;
+  };
+
+  unsigned long long tEnd = 1000 + bursts * interval + interval + loopPeriod;
+  while (hostBoard.tMicros < tEnd)
+  {
+    hostAdvance(loopPeriod);
+    Timestamp tNow = currentTime();
+    for (SensorCheck &sensor : sensors)
+    {
+      byte depth = (sensor.queue.head - sensor.queue.tail) & (EDGE_QUEUE_CAPACITY - 1);
+      sensor.depthMax = depth > sensor.depthMax ? depth : sensor.depthMax;
+      Timestamp t;
+      bool level;
+      while (popEdge(sensor.queue, t, level, tNow))
+      {
+        sensor.captured++;
+        if (sensor.expected.empty())
+        {
+          sensor.mismatched++;
+          continue;
+        }
+        InjectedEdge edge = sensor.expected.front();
+        sensor.expected.pop_front();
+        sensor.mismatched += level != edge.level || t != edge.t / US_PER_TICK;
+      }
+    }
+  }
+  hostBoard.drive = nullptr;
+
+  bool lost = false;
+  printf("pin,injected,captured,overflow,mismatched,depth_max\n");
+  for (const SensorCheck &sensor : sensors)
+  {
+    printf("%u,%lu,%lu,%u,%lu,%u\n", sensor.pin, sensor.injected, sensor.captured, sensor.queue.overflow,
+           sensor.mismatched, sensor.depthMax);
+    lost = lost || sensor.captured != sensor.injected || sensor.queue.overflow != 0 || sensor.mismatched != 0;
+  }
+  if (lost)
+  {
+    fprintf(stderr, "edges lost with %lu pulse bursts at %lu us spacing against a %llu us loop\n", pulses, spacing,
+            loopPeriod);
+    return 1;
+  }
+  return 0;
+}
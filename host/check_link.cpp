@@ -0,0 +1,182 @@
+/*
+ * Host check - every session link command is answered, also while the record log is full
+ *
+ *   build : g++ -std=c++17 -O2 -o check_link host/check_link.cpp
+ *   usage : check_link [-n commands] [-p loop period us] [-s seed]
+ *
+ *   the sketch runs on the virtual board, a host takes over with LINK_HELLO, arms with an empty LINK_PARAMS and
+ *   starts the session with LINK_START, then the record log is filled with P records until one is dropped and the
+ *   commands (hello, relocate, parameters while running, unknown, picked at random) are handed over at once - every
+ *   one must be answered, in order, without another record line lost while the replies wait for room - a LINK_STOP
+ *   then ends the session with the input trigger, and again without one (runtime.inputTrigger cleared), where the
+ *   board must stay up disarmed until the next parameter block starts a session
+ *
+ *   prints one CSV row - commands sent, replies, commands missing a reply, replies out of order, record lines lost
+ *   during the flood, loop() passes a command waited for room - and exits with status 1 on a missing or out of
+ *   order reply, a lost record line, a flood that never waited (too small to check anything) or a stop that halted
+ *   or restarted the board
+ */
+
+#include "../linear_track_alternate_reward.ino"
+#include "log_decode.h"
+
+#include <random>
+#include <string>
+#include <stdlib.h>
+
+// virtual clock is in us, sketch time parameters are in ms unless TIME_IN_MICROSECONDS
+const unsigned long long US_PER_TICK = TIME_IN_MICROSECONDS ? 1ULL : 1000ULL;
+const byte LINK_CHECK_UNKNOWN = 'Q';
+const byte LINK_CHECK_FLOOD[] = {LINK_HELLO, LINK_RELOCATE, LINK_PARAMS, LINK_CHECK_UNKNOWN};
+
+struct LinkCheck
+{
+  unsigned long long loopPeriod;
+  std::string commands;        // every command sent, in order
+  unsigned long waited;        // loop() passes ending with a command pending
+};
+
+void sendCommand(LinkCheck &check,
+                 byte command)
+{
+  /*
+  Hand one frame without payload to the board, an empty LINK_PARAMS keeps the active parameter block
+  */
+  byte frame[5] = {LINK_SYNC, command, 0, 0, 0};
+  uint16_t crc = crc16(crc16(0xFFFF, command), 0);
+  frame[3] = crc;
+  frame[4] = crc >> 8;
+  hostSerialInput(frame, sizeof(frame));
+  check.commands += (char)command;
+}
+
+void runBoard(LinkCheck &check,
+              unsigned long long duration)
+{
+  /*
+  Run loop() for duration us of virtual time
+  */
+  unsigned long long tEnd = hostBoard.tMicros + duration;
+  while (hostBoard.tMicros < tEnd)
+  {
+    hostAdvance(check.loopPeriod);
+    loop();
+    check.waited += sessionLink.pending;
+  }
+}
+
+unsigned long countRecords(char kind)
+{
+  /*
+  Count the text lines of one record letter in the serial output so far
+  */
+  LogDecoder decoder;
+  LogItem item;
+  unsigned long count = 0;
+  initLogDecoder(decoder, hostBoard.serialOut);
+  while (nextLogItem(decoder, item))
+  {
+    count += item.kind == LOG_LINE && item.length > 1 && item.line[0] == kind && item.line[1] >= '0' && item.line[1] <= '9';
+  }
+  return count;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned long count = 200;
+  LinkCheck check = {1000, "", 0};
+  unsigned long long seed = 1;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "-n" && i + 1 < argc) count = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "-p" && i + 1 < argc) check.loopPeriod = strtoull(argv[++i], nullptr, 10);
+    else if (arg == "-s" && i + 1 < argc) seed = strtoull(argv[++i], nullptr, 10);
+    else count = 0, i = argc;
+  }
+  if (count == 0 || check.loopPeriod == 0)
+  {
+    fprintf(stderr, "usage: %s [-n commands] [-p loop period us] [-s seed]\n", argv[0]);
+    return 2;
+  }
+
+  hostReset();
+  setup();
+  sendCommand(check, LINK_HELLO);
+  sendCommand(check, LINK_PARAMS);
+  sendCommand(check, LINK_START);
+  runBoard(check, 100000);
+  bool started = runtime.runtimeFlag;
+
+  // records pending - the ring is full once a P record no longer fits
+  unsigned int lost = recordLogQueue.overflow;
+  while (recordLogQueue.overflow == lost)
+  {
+    logSessionStats(sessionStats, currentTime());
+  }
+  lost = recordLogQueue.overflow;
+  std::mt19937_64 rng(seed);
+  for (unsigned long i = 0; i < count; i++)
+  {
+    sendCommand(check, LINK_CHECK_FLOOD[std::uniform_int_distribution<size_t>(0, sizeof(LINK_CHECK_FLOOD) - 1)(rng)]);
+  }
+  runBoard(check, count * 2000ULL + 100000);
+  lost = recordLogQueue.overflow - lost;
+
+  // host stop with the input trigger, the board waits for the next trigger
+  sendCommand(check, LINK_STOP);
+  runBoard(check, 100000);
+  bool stopped = !runtime.runtimeFlag && !hostBoard.halted && countRecords('E') == 1;
+
+  // and without one, the board stays up disarmed until the next parameter block
+  runtime.inputTrigger = nullptr;
+  sendCommand(check, LINK_PARAMS);
+  runBoard(check, 100000);
+  sendCommand(check, LINK_STOP);
+  runBoard(check, 2 * US_PER_TICK * DELAY_START);
+  stopped = stopped && !runtime.runtimeFlag && !hostBoard.halted && countRecords('E') == 2 && countRecords('S') == 2;
+  sendCommand(check, LINK_PARAMS);
+  runBoard(check, 100000);
+  stopped = stopped && runtime.runtimeFlag && countRecords('S') == 3;
+
+  // replies in the order of the commands, V answers the hello
+  LogDecoder decoder;
+  LogItem item;
+  unsigned long replies = 0;
+  unsigned long mismatched = 0;
+  size_t next = 0;
+  initLogDecoder(decoder, hostBoard.serialOut);
+  while (nextLogItem(decoder, item))
+  {
+    if (item.kind != LOG_LINE || item.length < 2 || (item.line[0] != 'A' && item.line[0] != 'N' && item.line[0] != 'V'))
+    {
+      continue;
+    }
+    replies++;
+    bool match = next < check.commands.size() &&
+                 (item.line[0] == 'V' ? check.commands[next] == (char)LINK_HELLO : item.line[1] == check.commands[next]);
+    next += match;
+    mismatched += !match;
+  }
+  unsigned long missing = check.commands.size() - next;
+
+  printf("commands,replies,missing,mismatched,records_lost,waited\n");
+  printf("%zu,%lu,%lu,%lu,%u,%lu\n", check.commands.size(), replies, missing, mismatched, lost, check.waited);
+  bool failed = false;
+  if (missing != 0 || mismatched != 0 || lost != 0)
+  {
+    fprintf(stderr, "link replies lost with %lu commands against a full record log\n", count);
+    failed = true;
+  }
+  if (check.waited == 0)
+  {
+    fprintf(stderr, "no command waited for record log room, the flood checked nothing\n");
+    failed = true;
+  }
+  if (!started || !stopped)
+  {
+    fprintf(stderr, "session %s on the host commands\n", started ? "not stopped and restarted" : "not started");
+    failed = true;
+  }
+  return failed ? 1 : 0;
+}
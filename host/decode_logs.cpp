@@ -0,0 +1,102 @@
+/*
+ * Host tool - session logs to columnar event tables
+ *
+ *   build : g++ -std=c++17 -O2 -pthread -o decode_logs host/decode_logs.cpp
+ *   usage : decode_logs [-o outdir] [-j threads] [-n] log...
+ *           -n decodes without writing the tables, for timing
+ *
+ *   every log (raw serial capture of one or more sessions in any EVENT_LOG_ENCODING, e.g. simulate -o) is
+ *   memory mapped and decoded in place into <outdir>/<log name>.<table>.<column> raw little endian arrays
+ *   listed in <outdir>/<log name>.manifest, tables ir, touch, solenoid, relocate (t, side, state, session),
+ *   laps (t, from, to, rewarded, session), rewards (t, side, lap, latency, session), barcodes (t, counter,
+ *   session) and sessions
+ *   (t_start, t_end, overflow, record_overflow) - laps follow the PORT_TRACK table of this build, logs are spread over
+ *   the threads, one CSV summary row per log on stdout
+ */
+
+#include "../config.h"
+#include "log_tables.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+std::string baseName(const char* path)
+{
+  std::string name = path;
+  size_t slash = name.find_last_of('/');
+  name = slash == std::string::npos ? name : name.substr(slash + 1);
+  size_t dot = name.find_last_of('.');
+  return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+int main(int argc, char** argv)
+{
+  std::string outDir = ".";
+  unsigned threads = std::thread::hardware_concurrency();
+  bool write = true;
+  std::vector<const char*> paths;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "-o" && i + 1 < argc) outDir = argv[++i];
+    else if (arg == "-j" && i + 1 < argc) threads = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "-n") write = false;
+    else if (arg[0] != '-') paths.push_back(argv[i]);
+    else paths.clear(), i = argc;
+  }
+  if (paths.empty())
+  {
+    fprintf(stderr, "usage: %s [-o outdir] [-j threads] [-n] log...\n", argv[0]);
+    return 2;
+  }
+  threads = threads == 0 ? 1 : (threads > paths.size() ? paths.size() : threads);
+
+  std::atomic<size_t> next(0);
+  std::atomic<size_t> bytes(0);
+  std::atomic<int> failed(0);
+  std::mutex output;
+  printf("log,bytes,sessions,ir,touch,solenoid,relocate,laps,rewards,events_lost\n");
+  auto start = std::chrono::steady_clock::now();
+  auto worker = [&]() {
+    LogTables tables;
+    MappedLog log;
+    for (size_t i; (i = next++) < paths.size();)
+    {
+      if (!mapLog(paths[i], log))
+      {
+        fprintf(stderr, "cannot open %s\n", paths[i]);
+        failed++;
+        continue;
+      }
+      decodeLogTables(log.data, log.size, tables);
+      bytes += log.size;
+      if (write && !writeLogTables(tables, outDir + "/" + baseName(paths[i])))
+      {
+        fprintf(stderr, "cannot write the tables of %s to %s\n", paths[i], outDir.c_str());
+        failed++;
+      }
+      std::lock_guard<std::mutex> lock(output);
+      printf("%s,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%lu\n", paths[i], log.size, tables.sessions.tStart.size(),
+             tables.events[IR].t.size(), tables.events[TOUCH].t.size(), tables.events[SOLENOID].t.size(),
+             tables.events[RELOCATE].t.size(), tables.laps.t.size(), tables.rewards.t.size(),
+             tables.eventsLost + tables.eventsUnresolved);
+      unmapLog(log);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (unsigned i = 0; i < threads; i++)
+  {
+    pool.emplace_back(worker);
+  }
+  for (std::thread &thread : pool)
+  {
+    thread.join();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  fprintf(stderr, "%zu logs, %.1f MB in %.3f s, %.1f MB/s on %u threads\n", paths.size(), bytes / 1e6, seconds,
+          bytes / 1e6 / seconds, threads);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,430 @@
+/*
+ * Host backend for hal.h - a virtual Arduino Uno
+ *   time only moves when the simulator (or a blocking call such as delay() or a full
+ *   serial TX buffer) advances it, input pins are driven by a pluggable script callback
+ *   and everything written to Serial is captured for later decoding
+ */
+
+#ifndef HAL_HOST
+#define HAL_HOST
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <functional>
+#include <vector>
+
+typedef uint8_t byte;
+
+// storage of the sketch state, per thread like hostBoard so every thread runs its own copy of the sketch
+#define BOARD_LOCAL thread_local
+
+const byte LOW = 0;
+const byte HIGH = 1;
+
+const byte INPUT = 0x0;
+const byte OUTPUT = 0x1;
+const byte INPUT_PULLUP = 0x2;
+
+// Uno pin numbering of the analog header
+const byte A0 = 14;
+const byte A1 = 15;
+const byte A2 = 16;
+const byte A3 = 17;
+const byte A4 = 18;
+const byte A5 = 19;
+
+const byte HOST_NUM_PINS = 70;                  // large enough for Mega style pinouts
+const unsigned int HOST_SERIAL_TX_BUFFER = 64;  // HardwareSerial TX ring size on AVR
+const unsigned int HOST_EEPROM_SIZE = 1024;     // ATmega328P
+
+struct HostEdge
+{
+  unsigned long long t;
+  byte pin;
+  bool level;
+};
+
+struct HostBoard
+{
+  unsigned long long tMicros;                  // virtual clock
+  byte mode[HOST_NUM_PINS];
+  bool level[HOST_NUM_PINS];
+  bool pinChange[HOST_NUM_PINS];               // pin change interrupt enabled
+  bool halted;                                 // halHalt() reached
+  bool sessionEnded;                           // halSessionEnd() reached
+  bool echo;                                   // mirror serial output to stdout
+  unsigned long baudRate;
+  unsigned long long tTxFree;                  // virtual time the TX buffer is drained
+  unsigned long long tSerialBlocked;           // total time spent blocked on a full TX buffer
+  std::string serialOut;
+  std::string serialIn;                        // bytes sent to the board, see hostSerialInput()
+  size_t serialInPos;                          // next byte Serial.read() returns
+  byte eeprom[HOST_EEPROM_SIZE];               // kept over hostReset(), zero until written
+  void (*pinChangeHandler)();                  // "ISR" fired by hostDrivePin()
+  void (*tickHandler)();                       // "ISR" of the tick timer, nullptr while stopped
+  unsigned long long tickPeriod;
+  unsigned long long tNextTick;
+  bool recordOutputs;                          // log every output level change into outputEdges
+  std::vector<HostEdge> outputEdges;
+  std::function<unsigned long long(HostBoard&)> drive; // input script, applies due pin changes and
+                                                       // returns the time of its next one
+  std::function<void(HostBoard&, byte, bool)> output;  // output model, sees every output level change
+};
+
+// one virtual board per thread so independent simulations can run side by side
+inline thread_local HostBoard hostBoard;
+
+inline void hostReset(unsigned long long tStart = 0)
+{
+  /*
+  Power cycle the virtual board
+  <unsigned long long> tStart : virtual clock value at reset in us
+  */
+  hostBoard.tMicros = tStart;
+  for (byte i = 0; i < HOST_NUM_PINS; i++)
+  {
+    hostBoard.mode[i] = INPUT;
+    hostBoard.level[i] = LOW;
+    hostBoard.pinChange[i] = false;
+  }
+  hostBoard.halted = false;
+  hostBoard.sessionEnded = false;
+  hostBoard.echo = false;
+  hostBoard.baudRate = 9600UL;
+  hostBoard.tTxFree = tStart;
+  hostBoard.tSerialBlocked = 0;
+  hostBoard.serialOut.clear();
+  hostBoard.serialIn.clear();
+  hostBoard.serialInPos = 0;
+  hostBoard.pinChangeHandler = nullptr;
+  hostBoard.tickHandler = nullptr;
+  hostBoard.recordOutputs = false;
+  hostBoard.outputEdges.clear();
+  hostBoard.drive = nullptr;
+  hostBoard.output = nullptr;
+}
+
+inline void hostAdvance(unsigned long long dt)
+{
+  /*
+  Move the virtual clock forward and let the input script update the pins,
+    the clock stops at every scheduled pin change and timer tick on the way so interrupts
+    see exact times
+  <unsigned long long> dt : time step in us
+  */
+  const unsigned long long never = ~0ULL;
+  unsigned long long tTarget = hostBoard.tMicros + dt;
+  unsigned long long tDrive = hostBoard.drive ? hostBoard.drive(hostBoard) : never;
+  while (true)
+  {
+    unsigned long long tTick = hostBoard.tickHandler ? hostBoard.tNextTick : never;
+    unsigned long long tNext = tTick < tDrive ? tTick : tDrive;
+    if (tNext > tTarget)
+    {
+      break;
+    }
+    hostBoard.tMicros = tNext > hostBoard.tMicros ? tNext : hostBoard.tMicros;
+    if (tNext == tTick)
+    {
+      hostBoard.tNextTick += hostBoard.tickPeriod;
+      hostBoard.tickHandler();
+    }
+    else
+    {
+      tDrive = hostBoard.drive(hostBoard);
+    }
+  }
+  hostBoard.tMicros = tTarget;
+}
+
+inline void hostSerialInput(const void* data, size_t size)
+{
+  /*
+  Hand bytes to the board's serial receiver, Serial.read() returns them from now on
+  */
+  if (hostBoard.serialInPos == hostBoard.serialIn.size())
+  {
+    hostBoard.serialIn.clear();
+    hostBoard.serialInPos = 0;
+  }
+  hostBoard.serialIn.append((const char*)data, size);
+}
+
+inline void hostDrivePin(byte pin, bool level)
+{
+  /*
+  Set the level seen on an input pin, meant to be called from the drive script,
+    fires the pin change handler on an edge of an enabled pin like the hardware would
+  */
+  bool edge = hostBoard.level[pin] != level;
+  hostBoard.level[pin] = level;
+  if (edge && hostBoard.pinChange[pin] && hostBoard.pinChangeHandler)
+  {
+    hostBoard.pinChangeHandler();
+  }
+}
+
+inline unsigned long millis()
+{
+  // truncated to the 32 bit counter range of the board
+  return (uint32_t)(hostBoard.tMicros / 1000ULL);
+}
+
+inline unsigned long micros()
+{
+  return (uint32_t)hostBoard.tMicros;
+}
+
+inline void delay(unsigned long ms)
+{
+  hostAdvance(ms * 1000ULL);
+}
+
+inline void delayMicroseconds(unsigned int us)
+{
+  hostAdvance(us);
+}
+
+inline void pinMode(byte pin, byte mode)
+{
+  hostBoard.mode[pin] = mode;
+}
+
+inline int digitalRead(byte pin)
+{
+  return hostBoard.level[pin] ? HIGH : LOW;
+}
+
+inline void digitalWrite(byte pin, byte value)
+{
+  if (hostBoard.mode[pin] == OUTPUT)
+  {
+    bool level = value != LOW;
+    bool edge = level != hostBoard.level[pin];
+    if (hostBoard.recordOutputs && edge)
+    {
+      hostBoard.outputEdges.push_back({hostBoard.tMicros, pin, level});
+    }
+    hostBoard.level[pin] = level;
+    if (edge && hostBoard.output)
+    {
+      hostBoard.output(hostBoard, pin, level);
+    }
+  }
+}
+
+inline void noInterrupts()
+{
+  // interrupts only fire from hostAdvance(), never inside sketch code
+}
+
+inline void interrupts()
+{
+}
+
+inline void halHalt()
+{
+  /*
+  Same contract as the board (nothing after this matters), but return control to the simulator
+  */
+  hostBoard.halted = true;
+}
+
+inline void halSessionEnd()
+{
+  hostBoard.sessionEnded = true;
+}
+
+inline byte halEepromRead(unsigned int address)
+{
+  return hostBoard.eeprom[address % HOST_EEPROM_SIZE];
+}
+
+inline void halEepromUpdate(unsigned int address, byte value)
+{
+  hostBoard.eeprom[address % HOST_EEPROM_SIZE] = value;
+}
+
+inline void halAttachPinChange(byte pin, void (*handler)())
+{
+  hostBoard.pinChange[pin] = true;
+  hostBoard.pinChangeHandler = handler;
+}
+
+const bool HAL_TICK_TIMER = true;
+
+inline void halStartTick(unsigned long periodUs, void (*handler)())
+{
+  hostBoard.tickPeriod = periodUs;
+  hostBoard.tNextTick = hostBoard.tMicros + periodUs;
+  hostBoard.tickHandler = handler;
+}
+
+inline void halStopTick()
+{
+  hostBoard.tickHandler = nullptr;
+}
+
+struct HalOutput
+{
+  byte pin;
+};
+
+inline HalOutput halOutput(byte pin)
+{
+  HalOutput output = {pin};
+  return output;
+}
+
+inline void halWrite(const HalOutput &output, bool level)
+{
+  digitalWrite(output.pin, level ? HIGH : LOW);
+}
+
+// no port registers, inputs are read one by one
+struct HalInput
+{
+  byte pin;
+};
+
+const byte HAL_INPUT_PORTS = 1;
+
+inline HalInput halInput(byte pin)
+{
+  HalInput input = {pin};
+  return input;
+}
+
+inline uint16_t halInputPorts(const HalInput &)
+{
+  return 0;
+}
+
+inline void halSampleInputs(uint8_t*, uint16_t)
+{
+}
+
+inline bool halRead(const uint8_t*, const HalInput &input)
+{
+  return digitalRead(input.pin) != LOW;
+}
+
+inline bool halReadNow(const HalInput &input)
+{
+  return digitalRead(input.pin) != LOW;
+}
+
+// strings kept in flash on the board, no separate address space on the host
+#define F(s) (s)
+
+class HostSerial
+{
+  /*
+  HardwareSerial stand-in with a 64 byte TX buffer draining at the configured baud rate,
+  writing into a full buffer blocks, i.e. advances the virtual clock, exactly like the board
+  */
+public:
+  void begin(unsigned long baud)
+  {
+    hostBoard.baudRate = baud;
+    hostBoard.tTxFree = hostBoard.tMicros;
+  }
+
+  int available()
+  {
+    return (int)(hostBoard.serialIn.size() - hostBoard.serialInPos);
+  }
+
+  int read()
+  {
+    return available() > 0 ? (byte)hostBoard.serialIn[hostBoard.serialInPos++] : -1;
+  }
+
+  int availableForWrite()
+  {
+    return HOST_SERIAL_TX_BUFFER - queued();
+  }
+
+  void flush()
+  {
+    if (hostBoard.tTxFree > hostBoard.tMicros)
+    {
+      block(hostBoard.tTxFree - hostBoard.tMicros);
+    }
+  }
+
+  size_t write(uint8_t c)
+  {
+    if (queued() >= HOST_SERIAL_TX_BUFFER)
+    {
+      block(hostBoard.tTxFree - (HOST_SERIAL_TX_BUFFER - 1) * byteTime() - hostBoard.tMicros);
+    }
+    unsigned long long tFrom = hostBoard.tTxFree > hostBoard.tMicros ? hostBoard.tTxFree : hostBoard.tMicros;
+    hostBoard.tTxFree = tFrom + byteTime();
+    hostBoard.serialOut.push_back((char)c);
+    if (hostBoard.echo)
+    {
+      fputc(c, stdout);
+    }
+    return 1;
+  }
+
+  size_t write(const uint8_t* buffer, size_t size)
+  {
+    for (size_t i = 0; i < size; i++)
+    {
+      write(buffer[i]);
+    }
+    return size;
+  }
+
+  size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char v) { return number(v); }
+  size_t print(int v) { return number(v); }
+  size_t print(unsigned int v) { return number(v); }
+  size_t print(long v) { return number(v); }
+  size_t print(unsigned long v) { return number(v); }
+
+  size_t println() { return print("\r\n"); }
+  template <typename T>
+  size_t println(T v) { size_t n = print(v); return n + println(); }
+
+  operator bool() { return true; }
+
+private:
+  unsigned long long byteTime()
+  {
+    // start + 8 data + stop bit
+    return (10ULL * 1000000ULL + hostBoard.baudRate - 1) / hostBoard.baudRate;
+  }
+
+  unsigned int queued()
+  {
+    if (hostBoard.tTxFree <= hostBoard.tMicros)
+    {
+      return 0;
+    }
+    return (unsigned int)((hostBoard.tTxFree - hostBoard.tMicros + byteTime() - 1) / byteTime());
+  }
+
+  void block(unsigned long long dt)
+  {
+    hostBoard.tSerialBlocked += dt;
+    hostAdvance(dt);
+  }
+
+  template <typename T>
+  size_t number(T v)
+  {
+    std::string s = std::to_string(v);
+    return write((const uint8_t*)s.data(), s.size());
+  }
+};
+
+inline HostSerial Serial;
+
+#endif
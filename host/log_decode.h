@@ -0,0 +1,355 @@
+/*
+ * Host decoder for the captured serial log stream
+ *   splits the bytes into eventLog() frames (EVENT_FRAME or EVENT_COMPACT), raw pin trace frames (PIN_TRACE)
+ *   and text lines (banner, S/E/T/R records, legacy ascii events), time deltas are resolved to absolute times
+ *   and the EVENT_COMPACT sequence numbers are checked - events missing from the stream (dropped on the
+ *   board or lost in transmission) are counted, events whose time cannot be resolved after a transmission
+ *   loss are skipped until the next keyframe - a streaming decoder (decoder.streaming) stops short of a frame
+ *   or line that may continue in the next read and resumes on the refilled buffer (resumeLogDecoder)
+ */
+
+#ifndef LOG_DECODE
+#define LOG_DECODE
+
+#include "../config.h"
+
+#include <string>
+
+const size_t LOG_FRAME_MAX = EVENT_COMPACT_MAX_SIZE > PIN_TRACE_KEYFRAME_SIZE ? EVENT_COMPACT_MAX_SIZE : PIN_TRACE_KEYFRAME_SIZE;
+const size_t LOG_LINE_MAX = 1024;    // longer text is split, bounds what a streaming decoder holds back
+
+enum LogItemKind
+{
+  LOG_EVENT,
+  LOG_TRACE,
+  LOG_LINE,
+};
+
+struct LogItem
+{
+  LogItemKind kind;
+  byte code;             // LOG_EVENT side << 4 | type << 1 | state, LOG_TRACE port << 2 | type << 1 | level
+  byte sequence;         // LOG_EVENT sequence number, EVENT_COMPACT only
+  Timestamp t;
+  const char* line;      // LOG_LINE text without the line ending, not terminated
+  size_t length;
+};
+
+// event or traced level with its full time, the firmware queues only the low time bits
+struct LogRecord
+{
+  byte code;
+  byte sequence;
+  Timestamp t;
+};
+
+struct LogDecoder
+{
+  const byte* data;
+  size_t size;
+  size_t pos;
+  Timestamp tTrace;      // time of the previous trace frame
+  bool traceKeyed;       // a trace keyframe was seen, deltas resolve
+  unsigned long traceUnresolved; // delta frames seen before the first keyframe
+  LogItem batch[0x7F];   // decoded events of the current EVENT_COMPACT frame
+  byte batchCount;
+  byte batchNext;
+  Timestamp tEvent;      // time of the previous compact event
+  bool eventKeyed;       // compact event times resolve
+  bool sequenceKnown;
+  byte sequenceNext;     // expected sequence number of the next compact event
+  unsigned long eventsLost;       // sequence numbers missing from the stream
+  unsigned long eventsUnresolved; // compact events skipped for lack of a time base
+  unsigned long bytesSkipped;     // stray bytes that are neither a frame nor text
+  bool streaming;        // more data may follow the end, hold back a frame or line that may be cut off
+};
+
+inline void initLogDecoder(LogDecoder &decoder,
+                           const byte* data,
+                           size_t size)
+{
+  /*
+  Start decoding a log in place, nothing is copied - items point into data, which must outlive the decoder
+  */
+  decoder.data = data;
+  decoder.size = size;
+  decoder.pos = 0;
+  decoder.tTrace = 0;
+  decoder.traceKeyed = false;
+  decoder.traceUnresolved = 0;
+  decoder.batchCount = 0;
+  decoder.batchNext = 0;
+  decoder.tEvent = 0;
+  decoder.eventKeyed = false;
+  decoder.sequenceKnown = false;
+  decoder.sequenceNext = 0;
+  decoder.eventsLost = 0;
+  decoder.eventsUnresolved = 0;
+  decoder.bytesSkipped = 0;
+  decoder.streaming = false;
+}
+
+inline void resumeLogDecoder(LogDecoder &decoder,
+                             const byte* data,
+                             size_t size,
+                             size_t consumed)
+{
+  /*
+  Continue a streaming decode on a buffer that was compacted and refilled, the decoder state is kept
+  <const byte*> data, size : buffer now holding the unread bytes followed by the new ones
+  <size_t> consumed : bytes dropped from the front of the buffer since the last call
+  */
+  decoder.data = data;
+  decoder.size = size;
+  decoder.pos -= consumed;
+}
+
+inline void initLogDecoder(LogDecoder &decoder,
+                           const std::string &stream)
+{
+  initLogDecoder(decoder, (const byte*)stream.data(), stream.size());
+}
+
+inline bool logFrameValid(const LogDecoder &decoder,
+                          size_t size)
+{
+  /*
+  True if a complete frame of size bytes with a matching xor checksum starts at the read position
+  */
+  if (decoder.pos + size > decoder.size)
+  {
+    return false;
+  }
+  byte checksum = 0;
+  for (size_t i = 1; i < size; i++)
+  {
+    checksum ^= decoder.data[decoder.pos + i];
+  }
+  return checksum == 0;
+}
+
+inline Timestamp logFrameTime(const LogDecoder &decoder,
+                              byte bytes,
+                              byte offset = 2)
+{
+  /*
+  Little endian time of bytes bytes starting offset bytes into the frame at the read position
+  */
+  Timestamp t = 0;
+  for (byte i = 0; i < bytes; i++)
+  {
+    t |= (Timestamp)decoder.data[decoder.pos + offset + i] << (8 * i);
+  }
+  return t;
+}
+
+inline size_t logCompactSize(const LogDecoder &decoder)
+{
+  /*
+  Length of the EVENT_COMPACT frame at the read position, 0 if it is malformed or incomplete
+  */
+  const byte* data = decoder.data;
+  size_t pos = decoder.pos + 3;
+  if (pos > decoder.size)
+  {
+    return 0;
+  }
+  byte count = data[decoder.pos + 1] & ~EVENT_COMPACT_KEY;
+  bool key = data[decoder.pos + 1] & EVENT_COMPACT_KEY;
+  pos += key ? EVENT_FRAME_TIME_BYTES : 0;
+  for (byte i = 0; i < count; i++)
+  {
+    pos++;
+    for (byte n = 0; !(i == 0 && key); n++)
+    {
+      if (pos >= decoder.size || n == EVENT_DELTA_BYTES)
+      {
+        return 0;
+      }
+      if (!(data[pos++] & 0x80))
+      {
+        break;
+      }
+    }
+  }
+  pos++;
+  return count > 0 && pos <= decoder.size ? pos - decoder.pos : 0;
+}
+
+inline void decodeCompactFrame(LogDecoder &decoder)
+{
+  /*
+  Resolve the events of the valid EVENT_COMPACT frame at the read position into decoder.batch
+  */
+  const byte* data = decoder.data;
+  byte count = data[decoder.pos + 1] & ~EVENT_COMPACT_KEY;
+  bool key = data[decoder.pos + 1] & EVENT_COMPACT_KEY;
+  byte sequence = data[decoder.pos + 2];
+  if (decoder.sequenceKnown && sequence != decoder.sequenceNext)
+  {
+    decoder.eventsLost += (byte)(sequence - decoder.sequenceNext);
+    // the board keys every frame after its own drops, a gap before a delta frame means frames were lost
+    decoder.eventKeyed = decoder.eventKeyed && key;
+  }
+  decoder.sequenceKnown = true;
+  decoder.sequenceNext = sequence + count;
+  size_t pos = decoder.pos + 3;
+  if (key)
+  {
+    decoder.tEvent = logFrameTime(decoder, EVENT_FRAME_TIME_BYTES, 3);
+    decoder.eventKeyed = true;
+    pos += EVENT_FRAME_TIME_BYTES;
+  }
+  decoder.batchCount = 0;
+  decoder.batchNext = 0;
+  for (byte i = 0; i < count; i++)
+  {
+    byte code = data[pos++];
+    if (!(i == 0 && key))
+    {
+      uint64_t v = 0;
+      for (byte shift = 0; ; shift += 7)
+      {
+        v |= (uint64_t)(data[pos] & 0x7F) << shift;
+        if (!(data[pos++] & 0x80))
+        {
+          break;
+        }
+      }
+      decoder.tEvent += (Timestamp)((v >> 1) ^ (0 - (v & 1)));
+    }
+    if (!decoder.eventKeyed)
+    {
+      decoder.eventsUnresolved++;
+      continue;
+    }
+    LogItem &item = decoder.batch[decoder.batchCount++];
+    item.kind = LOG_EVENT;
+    item.code = code;
+    item.sequence = sequence + i;
+    item.t = decoder.tEvent;
+  }
+}
+
+inline bool logTailComplete(const LogDecoder &decoder)
+{
+  /*
+  True if the frame starting at the read position near the end of a streaming buffer is complete and valid,
+    false if it may still be cut off
+  */
+  byte sync = decoder.data[decoder.pos];
+  if (sync == EVENT_COMPACT_SYNC)
+  {
+    size_t size = logCompactSize(decoder);
+    return size > 0 && logFrameValid(decoder, size);
+  }
+  if (sync == EVENT_FRAME_SYNC)
+  {
+    return logFrameValid(decoder, EVENT_FRAME_SIZE);
+  }
+  if (decoder.pos + 1 >= decoder.size)
+  {
+    return false;
+  }
+  bool key = decoder.data[decoder.pos + 1] & PIN_TRACE_KEYFRAME;
+  return logFrameValid(decoder, key ? PIN_TRACE_KEYFRAME_SIZE : PIN_TRACE_FRAME_SIZE);
+}
+
+inline bool nextLogItem(LogDecoder &decoder,
+                        LogItem &item)
+{
+  /*
+  Decode the next item of the stream
+  <struct LogDecoder> decoder : stream and read position
+  <struct LogItem> item : filled with the decoded item
+
+  Returns:
+  <bool> : false at the end of the stream, or of the complete data of a streaming decoder
+  */
+  while (decoder.batchNext < decoder.batchCount || decoder.pos < decoder.size)
+  {
+    if (decoder.batchNext < decoder.batchCount)
+    {
+      item = decoder.batch[decoder.batchNext++];
+      return true;
+    }
+    byte sync = decoder.data[decoder.pos];
+    if (decoder.streaming && decoder.size - decoder.pos < LOG_FRAME_MAX &&
+        (sync == EVENT_COMPACT_SYNC || sync == EVENT_FRAME_SYNC || sync == PIN_TRACE_SYNC) && !logTailComplete(decoder))
+    {
+      return false;
+    }
+    size_t size = sync == EVENT_COMPACT_SYNC ? logCompactSize(decoder) : 0;
+    if (size > 0 && logFrameValid(decoder, size))
+    {
+      decodeCompactFrame(decoder);
+      decoder.pos += size;
+      continue;
+    }
+    if (sync == EVENT_FRAME_SYNC && logFrameValid(decoder, EVENT_FRAME_SIZE))
+    {
+      item.kind = LOG_EVENT;
+      item.code = decoder.data[decoder.pos + 1];
+      item.sequence = 0;
+      item.t = logFrameTime(decoder, EVENT_FRAME_TIME_BYTES);
+      decoder.pos += EVENT_FRAME_SIZE;
+      return true;
+    }
+    if (sync == PIN_TRACE_SYNC && decoder.pos + 1 < decoder.size)
+    {
+      bool key = decoder.data[decoder.pos + 1] & PIN_TRACE_KEYFRAME;
+      byte size = key ? PIN_TRACE_KEYFRAME_SIZE : PIN_TRACE_FRAME_SIZE;
+      if (logFrameValid(decoder, size))
+      {
+        if (key)
+        {
+          decoder.tTrace = logFrameTime(decoder, EVENT_FRAME_TIME_BYTES);
+          decoder.traceKeyed = true;
+        }
+        else
+        {
+          decoder.tTrace += (int16_t)logFrameTime(decoder, 2);
+        }
+        item.kind = LOG_TRACE;
+        item.code = decoder.data[decoder.pos + 1] & ~PIN_TRACE_KEYFRAME;
+        item.t = decoder.tTrace;
+        decoder.pos += size;
+        if (!decoder.traceKeyed)
+        {
+          decoder.traceUnresolved++;
+          continue;
+        }
+        return true;
+      }
+    }
+    // text runs up to the line end or the first byte no text record contains, a stray byte is skipped
+    size_t eol = decoder.pos;
+    while (eol < decoder.size && ((decoder.data[eol] >= 0x20 && decoder.data[eol] < 0x7F) || decoder.data[eol] == '\r'))
+    {
+      eol++;
+    }
+    if (decoder.streaming && eol == decoder.size && eol - decoder.pos < LOG_LINE_MAX)
+    {
+      return false;
+    }
+    eol = eol - decoder.pos > LOG_LINE_MAX ? decoder.pos + LOG_LINE_MAX : eol;
+    if (eol == decoder.pos)
+    {
+      decoder.bytesSkipped++;
+      decoder.pos++;
+      continue;
+    }
+    item.kind = LOG_LINE;
+    item.line = (const char*)decoder.data + decoder.pos;
+    item.length = eol - decoder.pos;
+    if (item.line[item.length - 1] == '\r')
+    {
+      item.length--;
+    }
+    decoder.pos = eol < decoder.size && decoder.data[eol] == '\n' ? eol + 1 : eol;
+    return true;
+  }
+  return false;
+}
+
+#endif
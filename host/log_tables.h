@@ -0,0 +1,365 @@
+/*
+ * Columnar event tables of a session log
+ *   one pass over a mapped log with the zero copy LogDecoder, events go to per type column vectors
+ *   (time, side, state, session), laps and rewards are derived on the way with the reward rule of the
+ *   sketch - a lap ends with an IR break at a port of the track another port of which was visited last,
+ *   the reward is the first valve opening at the arrival port of the latest lap
+ */
+
+#ifndef LOG_TABLES
+#define LOG_TABLES
+
+#include "log_decode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const byte LOG_TYPES = ACTUATOR + 1;
+const char* const LOG_TYPE_NAMES[LOG_TYPES] = {"ir", "touch", "solenoid", "relocate", "actuator"};
+
+struct EventTable
+{
+  std::vector<Timestamp> t;
+  std::vector<byte> side;
+  std::vector<byte> state;
+  std::vector<uint16_t> session;
+};
+
+struct LapTable
+{
+  std::vector<Timestamp> t;           // arrival IR break
+  std::vector<byte> from;
+  std::vector<byte> to;
+  std::vector<byte> rewarded;
+  std::vector<uint16_t> session;
+};
+
+struct RewardTable
+{
+  std::vector<Timestamp> t;           // valve opening
+  std::vector<byte> side;
+  std::vector<uint32_t> lap;          // row in the lap table
+  std::vector<uint32_t> latency;      // from the arrival IR break
+  std::vector<uint16_t> session;
+};
+
+struct SessionTable
+{
+  std::vector<Timestamp> tStart;      // S record
+  std::vector<Timestamp> tEnd;        // E record, 0 if the log ends first
+  std::vector<uint32_t> overflow;     // events lost on the board per the E record
+  std::vector<uint32_t> recordOverflow; // record lines (P, B, A/N/V) lost on the board per the E record
+};
+
+struct BarcodeTable
+{
+  std::vector<Timestamp> t;           // start edge of the sync barcode
+  std::vector<uint32_t> counter;
+  std::vector<uint16_t> session;
+};
+
+struct LogTables
+{
+  EventTable events[LOG_TYPES];
+  LapTable laps;
+  RewardTable rewards;
+  SessionTable sessions;
+  BarcodeTable barcodes;
+  unsigned long eventsLost;           // missing sequence numbers, EVENT_COMPACT only
+  unsigned long eventsUnresolved;
+  unsigned long lines;                // text lines, banner and records included
+};
+
+inline void clearLogTables(LogTables &tables)
+{
+  tables = LogTables();
+  tables.eventsLost = 0;
+  tables.eventsUnresolved = 0;
+  tables.lines = 0;
+}
+
+inline void addLogEvent(LogTables &tables,
+                        byte code,
+                        Timestamp t,
+                        byte lastPort[],
+                        long &lastLap)
+{
+  /*
+  Append one event to its type table and derive laps and rewards
+  <byte[]> lastPort : per track last port with an IR break in this session, PORT_NONE before the first one
+  <long> lastLap : lap row still waiting for its reward, -1 if none
+  */
+  byte side = code >> 4;
+  byte type = (code >> 1) & 0x07;
+  byte state = code & 0x01;
+  uint16_t session = (uint16_t)tables.sessions.tStart.size();
+  if (type >= LOG_TYPES)
+  {
+    return;
+  }
+  EventTable &table = tables.events[type];
+  table.t.push_back(t);
+  table.side.push_back(side);
+  table.state.push_back(state);
+  table.session.push_back(session);
+  if (state != ON || side >= PORT_COUNT)
+  {
+    return;
+  }
+  if (type == IR)
+  {
+    byte &last = lastPort[PORT_TRACK[side]];
+    if (last != PORT_NONE && last != side)
+    {
+      lastLap = (long)tables.laps.t.size();
+      tables.laps.t.push_back(t);
+      tables.laps.from.push_back(last);
+      tables.laps.to.push_back(side);
+      tables.laps.rewarded.push_back(0);
+      tables.laps.session.push_back(session);
+    }
+    last = side;
+  }
+  else if (type == SOLENOID && lastLap >= 0 && tables.laps.to[lastLap] == side)
+  {
+    tables.laps.rewarded[lastLap] = 1;
+    tables.rewards.t.push_back(t);
+    tables.rewards.side.push_back(side);
+    tables.rewards.lap.push_back((uint32_t)lastLap);
+    tables.rewards.latency.push_back((uint32_t)(t - tables.laps.t[lastLap]));
+    tables.rewards.session.push_back(session);
+    lastLap = -1;
+  }
+}
+
+inline void decodeLogTables(const byte* data,
+                            size_t size,
+                            LogTables &tables)
+{
+  /*
+  Decode a whole log into tables (sync barcodes from the B records), sessions are numbered from 1 by their S records, 0 before the first one
+  <const byte*> data, size : log bytes, e.g. a mapped file
+  <struct LogTables> tables : filled, cleared first
+  */
+  clearLogTables(tables);
+  LogDecoder decoder;
+  LogItem item;
+  initLogDecoder(decoder, data, size);
+  byte lastPort[PORT_COUNT];
+  long lastLap = -1;
+  for (byte i = 0; i < PORT_COUNT; i++)
+  {
+    lastPort[i] = PORT_NONE;
+  }
+  while (nextLogItem(decoder, item))
+  {
+    if (item.kind == LOG_EVENT)
+    {
+      addLogEvent(tables, item.code, item.t, lastPort, lastLap);
+      continue;
+    }
+    if (item.kind != LOG_LINE || item.length == 0)
+    {
+      continue;
+    }
+    tables.lines++;
+    const char* line = item.line;
+    const char* end = line + item.length;
+    if (line[0] >= '0' && line[0] <= '9' && item.length > 3)
+    {
+      // legacy ascii event, side, type and state digits followed by the time
+      Timestamp t = 0;
+      for (const char* c = line + 3; c < end && *c >= '0' && *c <= '9'; c++)
+      {
+        t = t * 10 + (*c - '0');
+      }
+      addLogEvent(tables, ((line[0] - '0') << 4) | ((line[1] - '0') << 1) | (line[2] - '0'), t, lastPort, lastLap);
+    }
+    else if (line[0] == 'B')
+    {
+      Timestamp t = 0;
+      uint32_t counter = 0;
+      const char* c = line + 1;
+      for (; c < end && *c >= '0' && *c <= '9'; c++)
+      {
+        t = t * 10 + (*c - '0');
+      }
+      for (c += c < end && *c == ','; c < end && *c >= '0' && *c <= '9'; c++)
+      {
+        counter = counter * 10 + (*c - '0');
+      }
+      tables.barcodes.t.push_back(t);
+      tables.barcodes.counter.push_back(counter);
+      tables.barcodes.session.push_back((uint16_t)tables.sessions.tStart.size());
+    }
+    else if (line[0] == 'S' || line[0] == 'E')
+    {
+      Timestamp t = 0;
+      const char* c = line + 1;
+      for (; c < end && *c >= '0' && *c <= '9'; c++)
+      {
+        t = t * 10 + (*c - '0');
+      }
+      if (line[0] == 'S')
+      {
+        tables.sessions.tStart.push_back(t);
+        tables.sessions.tEnd.push_back(0);
+        tables.sessions.overflow.push_back(0);
+        tables.sessions.recordOverflow.push_back(0);
+        decoder.sequenceKnown = false;     // the board numbers events from 0 in every session
+        for (byte i = 0; i < PORT_COUNT; i++)
+        {
+          lastPort[i] = PORT_NONE;
+        }
+        lastLap = -1;
+      }
+      else if (!tables.sessions.tEnd.empty())
+      {
+        uint32_t overflow = 0;
+        for (c += c < end && *c == ','; c < end && *c >= '0' && *c <= '9'; c++)
+        {
+          overflow = overflow * 10 + (*c - '0');
+        }
+        uint32_t recordOverflow = 0;
+        for (c += c < end && *c == ','; c < end && *c >= '0' && *c <= '9'; c++)
+        {
+          recordOverflow = recordOverflow * 10 + (*c - '0');
+        }
+        tables.sessions.tEnd.back() = t;
+        tables.sessions.overflow.back() = overflow;
+        tables.sessions.recordOverflow.back() = recordOverflow;
+      }
+    }
+  }
+  tables.eventsLost = decoder.eventsLost;
+  tables.eventsUnresolved = decoder.eventsUnresolved;
+}
+
+template <typename T>
+bool writeColumn(FILE* manifest,
+                 const std::string &base,
+                 const char* table,
+                 const char* column,
+                 const char* dtype,
+                 const std::vector<T> &values)
+{
+  /*
+  Write one column as a raw little endian array <base>.<table>.<column> and list it in the manifest
+  */
+  std::string path = base + "." + table + "." + column;
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == nullptr)
+  {
+    return false;
+  }
+  bool ok = fwrite(values.data(), sizeof(T), values.size(), file) == values.size();
+  ok = fclose(file) == 0 && ok;
+  fprintf(manifest, "%s %s %s %zu\n", table, column, dtype, values.size());
+  return ok;
+}
+
+inline bool writeLogTables(const LogTables &tables,
+                           const std::string &base)
+{
+  /*
+  Write every table column next to a text manifest <base>.manifest, one "table column dtype rows" line each,
+    e.g. numpy.fromfile(base + ".touch.t", dtype="<u8")
+  */
+  FILE* manifest = fopen((base + ".manifest").c_str(), "w");
+  if (manifest == nullptr)
+  {
+    return false;
+  }
+  bool ok = true;
+  for (byte type = 0; type < LOG_TYPES; type++)
+  {
+    const EventTable &table = tables.events[type];
+    ok = writeColumn(manifest, base, LOG_TYPE_NAMES[type], "t", "u8", table.t) && ok;
+    ok = writeColumn(manifest, base, LOG_TYPE_NAMES[type], "side", "u1", table.side) && ok;
+    ok = writeColumn(manifest, base, LOG_TYPE_NAMES[type], "state", "u1", table.state) && ok;
+    ok = writeColumn(manifest, base, LOG_TYPE_NAMES[type], "session", "u2", table.session) && ok;
+  }
+  ok = writeColumn(manifest, base, "laps", "t", "u8", tables.laps.t) && ok;
+  ok = writeColumn(manifest, base, "laps", "from", "u1", tables.laps.from) && ok;
+  ok = writeColumn(manifest, base, "laps", "to", "u1", tables.laps.to) && ok;
+  ok = writeColumn(manifest, base, "laps", "rewarded", "u1", tables.laps.rewarded) && ok;
+  ok = writeColumn(manifest, base, "laps", "session", "u2", tables.laps.session) && ok;
+  ok = writeColumn(manifest, base, "rewards", "t", "u8", tables.rewards.t) && ok;
+  ok = writeColumn(manifest, base, "rewards", "side", "u1", tables.rewards.side) && ok;
+  ok = writeColumn(manifest, base, "rewards", "lap", "u4", tables.rewards.lap) && ok;
+  ok = writeColumn(manifest, base, "rewards", "latency", "u4", tables.rewards.latency) && ok;
+  ok = writeColumn(manifest, base, "rewards", "session", "u2", tables.rewards.session) && ok;
+  ok = writeColumn(manifest, base, "barcodes", "t", "u8", tables.barcodes.t) && ok;
+  ok = writeColumn(manifest, base, "barcodes", "counter", "u4", tables.barcodes.counter) && ok;
+  ok = writeColumn(manifest, base, "barcodes", "session", "u2", tables.barcodes.session) && ok;
+  ok = writeColumn(manifest, base, "sessions", "t_start", "u8", tables.sessions.tStart) && ok;
+  ok = writeColumn(manifest, base, "sessions", "t_end", "u8", tables.sessions.tEnd) && ok;
+  ok = writeColumn(manifest, base, "sessions", "overflow", "u4", tables.sessions.overflow) && ok;
+  ok = writeColumn(manifest, base, "sessions", "record_overflow", "u4", tables.sessions.recordOverflow) && ok;
+  fprintf(manifest, "# events_lost %lu events_unresolved %lu\n", tables.eventsLost, tables.eventsUnresolved);
+  return fclose(manifest) == 0 && ok;
+}
+
+struct MappedLog
+{
+  const byte* data;
+  size_t size;
+  void* map;
+  std::string buffer;                 // fallback when the file cannot be mapped
+};
+
+inline bool mapLog(const char* path,
+                   MappedLog &log)
+{
+  /*
+  Map a log read only, files that cannot be mapped (pipes, empty files) are read into memory instead
+  */
+  log.data = nullptr;
+  log.size = 0;
+  log.map = MAP_FAILED;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+  {
+    log.map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  if (log.map != MAP_FAILED)
+  {
+    madvise(log.map, st.st_size, MADV_SEQUENTIAL);
+    log.data = (const byte*)log.map;
+    log.size = st.st_size;
+    close(fd);
+    return true;
+  }
+  char chunk[65536];
+  for (ssize_t n; (n = read(fd, chunk, sizeof(chunk))) > 0;)
+  {
+    log.buffer.append(chunk, n);
+  }
+  close(fd);
+  log.data = (const byte*)log.buffer.data();
+  log.size = log.buffer.size();
+  return true;
+}
+
+inline void unmapLog(MappedLog &log)
+{
+  if (log.map != MAP_FAILED)
+  {
+    munmap(log.map, log.size);
+  }
+  log.map = MAP_FAILED;
+  log.buffer.clear();
+}
+
+#endif
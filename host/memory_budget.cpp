@@ -0,0 +1,264 @@
+/*
+ * Host tool - per subsystem SRAM and flash footprint of a firmware image, checked against the memory budget
+ *
+ *   build : g++ -std=c++17 -O2 -o memory_budget host/memory_budget.cpp
+ *   usage : avr-nm -C -S --size-sort image.elf | memory_budget [-c baseline.csv] [-v]
+ *           -c adds the change against an earlier report, -v lists every symbol with its subsystem
+ *   usage : memory_budget -e
+ *           estimate without an image, the SRAM budget of the static state of the enabled features (data.h)
+ *           plus CORE_SRAM_RESERVE, the figure checked at compile time on AVR builds
+ *
+ *   e.g. arduino-cli compile -b arduino:avr:uno --output-dir build . && avr-nm -C -S --size-sort
+ *   build/linear_track_alternate_reward.ino.elf | memory_budget -c budget.csv - symbols are put in a subsystem
+ *   by name (first matching rule below), .bss/.data count as SRAM and .text/.data as flash, one CSV row per
+ *   subsystem and a total row on stdout, the budget verdict on stderr
+ *
+ *   exit status 1 if the static data plus STACK_RESERVE exceeds SRAM_SIZE or the image exceeds FLASH_SIZE,
+ *   2 if the SRAM total grew against the baseline
+ */
+
+#include "../config.h"
+#include "../data.h"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// subsystem of every symbol whose demangled name contains the pattern, first match wins, the rest is core
+struct SubsystemRule
+{
+  const char* pattern;
+  const char* subsystem;
+};
+
+const SubsystemRule SUBSYSTEM_RULES[] = {
+  {"LinearActuator", "actuator"}, {"actuator", "actuator"}, {"Stepper", "actuator"}, {"stepper", "actuator"},
+  {"SessionStats", "session_stats"}, {"sessionStats", "session_stats"},
+  {"EventLog", "event_log"}, {"eventLog", "event_log"}, {"EventRecord", "event_log"}, {"EventBatch", "event_log"},
+  {"putVarint", "event_log"}, {"printTimestamp", "event_log"}, {"logSession", "event_log"},
+  {"RecordLog", "event_log"}, {"recordLog", "event_log"}, {"beginRecord", "event_log"}, {"endRecord", "event_log"},
+  {"recordChar", "event_log"}, {"recordNumber", "event_log"},
+  {"PinTrace", "pin_trace"}, {"pinTrace", "pin_trace"}, {"tracePin", "pin_trace"}, {"TraceRecord", "pin_trace"},
+  {"LoopProfile", "loop_profile"}, {"loopProfile", "loop_profile"}, {"loopHistogram", "loop_profile"},
+  {"SyncBarcode", "sync_barcode"}, {"syncBarcode", "sync_barcode"},
+  {"Timer", "scheduler"},
+  {"TTL", "ttl"}, {"ttl", "ttl"}, {"Trigger", "ttl"}, {"output", "ttl"}, {"halTick", "ttl"},
+  {"Port", "ports"}, {"ports", "ports"}, {"IR", "ports"}, {"Touch", "ports"}, {"Solenoid", "ports"},
+  {"Debounce", "ports"}, {"debounce", "ports"}, {"Edge", "ports"}, {"halPinChange", "ports"},
+  {"Link", "session_link"}, {"crc16", "session_link"}, {"LittleEndian", "session_link"}, {"packSessionParams", "session_link"},
+  {"loadSessionParams", "session_link"}, {"saveSessionParams", "session_link"}, {"halEeprom", "session_link"},
+  {"EEPROM", "session_link"},
+  {"Relocation", "session"}, {"relocation", "session"}, {"SessionParams", "session"}, {"sessionParams", "session"}, {"reward", "session"}, {"Runtime", "session"},
+  {"runtime", "session"}, {"BlinkLED", "session"}, {"ledA", "session"}, {"Clock", "session"},
+  {"currentTime", "session"}, {"extendTime", "session"}, {"setup", "session"}, {"loop", "session"},
+};
+
+struct Footprint
+{
+  unsigned long ram;
+  unsigned long flash;
+};
+
+const char* subsystemOf(const char* name)
+{
+  for (const SubsystemRule &rule : SUBSYSTEM_RULES)
+  {
+    if (strstr(name, rule.pattern))
+    {
+      return rule.subsystem;
+    }
+  }
+  return "core";
+}
+
+bool parseSymbol(char* line,
+                 unsigned long &size,
+                 char &type,
+                 const char* &name)
+{
+  /*
+  Split one nm -S line (address size type name), lines without a size are skipped
+
+  Returns:
+  <bool> : true for a sized symbol
+  */
+  char* fields[3];
+  char* p = line;
+  for (int i = 0; i < 3; i++)
+  {
+    while (*p == ' ')
+    {
+      p++;
+    }
+    fields[i] = p;
+    while (*p && *p != ' ')
+    {
+      p++;
+    }
+    if (!*p)
+    {
+      return false;
+    }
+    *p++ = '\0';
+  }
+  if (strlen(fields[2]) != 1)
+  {
+    return false;
+  }
+  size = strtoul(fields[1], nullptr, 16);
+  type = fields[2][0];
+  name = p;
+  return true;
+}
+
+bool readBaseline(const char* path,
+                  std::map<std::string, Footprint> &baseline)
+{
+  /*
+  Read the subsystem rows of an earlier report
+  */
+  FILE* file = fopen(path, "r");
+  if (!file)
+  {
+    return false;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), file))
+  {
+    char name[64];
+    Footprint footprint;
+    if (sscanf(line, "%63[^,],%lu,%lu", name, &footprint.ram, &footprint.flash) == 3)
+    {
+      baseline[name] = footprint;
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+int estimate()
+{
+  /*
+  Report the SRAM budget of the static state per subsystem as data.h sums it up for the current config.h
+
+  Returns:
+  <int> : exit status, 1 if it does not fit SRAM_SIZE with STACK_RESERVE
+  */
+  std::map<std::string, Footprint> subsystems = {
+    {"ttl", {TTL_SUBSYSTEM_SRAM, 0}}, {"scheduler", {SCHEDULER_SUBSYSTEM_SRAM, 0}}, {"ports", {PORTS_SUBSYSTEM_SRAM, 0}},
+    {"event_log", {EVENT_LOG_SUBSYSTEM_SRAM, 0}}, {"pin_trace", {PIN_TRACE_SRAM, 0}}, {"loop_profile", {LOOP_PROFILE_SRAM, 0}},
+    {"session_stats", {SESSION_STATS_SRAM, 0}}, {"session_link", {LINK_SRAM, 0}}, {"sync_barcode", {SYNC_BARCODE_SRAM, 0}},
+    {"session", {SESSION_SUBSYSTEM_SRAM, 0}}, {"actuator", {ACTUATOR_SUBSYSTEM_SRAM, 0}}, {"core", {CORE_SRAM_RESERVE, 0}},
+  };
+  Footprint total = {0, 0};
+  printf("subsystem,ram\n");
+  for (const auto &entry : subsystems)
+  {
+    printf("%s,%lu\n", entry.first.c_str(), entry.second.ram);
+    total.ram += entry.second.ram;
+  }
+  printf("total,%lu\n", total.ram);
+  if (total.ram != SKETCH_SRAM + CORE_SRAM_RESERVE)
+  {
+    fprintf(stderr, "subsystems sum to %lu, data.h to %u\n", total.ram, SKETCH_SRAM + CORE_SRAM_RESERVE);
+    return 1;
+  }
+  long ramFree = (long)SRAM_SIZE - STACK_RESERVE - (long)total.ram;
+  fprintf(stderr, "sram estimate %lu of %u bytes with a %u byte stack reserve, %ld %s\n", total.ram, SRAM_SIZE, STACK_RESERVE,
+          labs(ramFree), ramFree < 0 ? "over" : "free");
+  return ramFree < 0 ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+  const char* baselinePath = nullptr;
+  bool verbose = false;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "-c" && i + 1 < argc) baselinePath = argv[++i];
+    else if (arg == "-v") verbose = true;
+    else if (arg == "-e") return estimate();
+    else
+    {
+      fprintf(stderr, "usage: nm -C -S --size-sort image.elf | %s [-c baseline.csv] [-v], or %s -e\n", argv[0], argv[0]);
+      return 1;
+    }
+  }
+  std::map<std::string, Footprint> baseline;
+  if (baselinePath && !readBaseline(baselinePath, baseline))
+  {
+    fprintf(stderr, "cannot read %s\n", baselinePath);
+    return 1;
+  }
+
+  Footprint before = baseline.count("total") ? baseline["total"] : Footprint{0, 0};
+  std::map<std::string, Footprint> subsystems;
+  Footprint total = {0, 0};
+  std::vector<char> line(4096);
+  while (fgets(line.data(), line.size(), stdin))
+  {
+    line[strcspn(line.data(), "\r\n")] = '\0';
+    unsigned long size;
+    char type;
+    const char* name;
+    if (!parseSymbol(line.data(), size, type, name))
+    {
+      continue;
+    }
+    // .data is placed in SRAM and its initial values are stored in flash
+    bool ram = strchr("bBdDvV", type) != nullptr;
+    bool flash = strchr("tTwWdDrR", type) != nullptr;
+    if (!ram && !flash)
+    {
+      continue;
+    }
+    const char* subsystem = subsystemOf(name);
+    Footprint &footprint = subsystems[subsystem];
+    footprint.ram += ram ? size : 0;
+    footprint.flash += flash ? size : 0;
+    total.ram += ram ? size : 0;
+    total.flash += flash ? size : 0;
+    if (verbose)
+    {
+      fprintf(stderr, "%-14s %c %6lu %s\n", subsystem, type, size, name);
+    }
+  }
+
+  printf(baselinePath ? "subsystem,ram,flash,ram_change,flash_change\n" : "subsystem,ram,flash\n");
+  for (const auto &entry : subsystems)
+  {
+    printf("%s,%lu,%lu", entry.first.c_str(), entry.second.ram, entry.second.flash);
+    if (baselinePath)
+    {
+      const Footprint &previous = baseline[entry.first];
+      printf(",%ld,%ld", (long)(entry.second.ram - previous.ram), (long)(entry.second.flash - previous.flash));
+    }
+    printf("\n");
+  }
+  printf("total,%lu,%lu", total.ram, total.flash);
+  if (baselinePath)
+  {
+    printf(",%ld,%ld", (long)(total.ram - before.ram), (long)(total.flash - before.flash));
+  }
+  printf("\n");
+
+  long ramFree = (long)SRAM_SIZE - STACK_RESERVE - (long)total.ram;
+  long flashFree = (long)FLASH_SIZE - (long)total.flash;
+  fprintf(stderr, "sram %lu of %u bytes with a %u byte stack reserve, %ld %s\n", total.ram, SRAM_SIZE, STACK_RESERVE,
+          labs(ramFree), ramFree < 0 ? "over" : "free");
+  fprintf(stderr, "flash %lu of %lu bytes, %ld %s\n", total.flash, FLASH_SIZE, labs(flashFree), flashFree < 0 ? "over" : "free");
+  if (ramFree < 0 || flashFree < 0)
+  {
+    return 1;
+  }
+  if (baselinePath && total.ram > before.ram)
+  {
+    fprintf(stderr, "sram grew by %lu bytes against %s\n", total.ram - before.ram, baselinePath);
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,236 @@
+/*
+ * Host tool - peri-event photometry of a cohort
+ *
+ *   build : g++ -std=c++17 -O3 -march=native -pthread -o peth host/peth.cpp
+ *   usage : peth [-o outdir] [-j threads] [-w pre,post,dt] [-r] log edges photometry [log edges photometry ...]
+ *
+ *   for every session the log is decoded into tables, aligned onto the photometry clock with the recorded
+ *   TTL edges (align.h) and the photometry recording ("time_s,signal,isosbestic" lines, e.g. simulate -f)
+ *   is turned into dF/F, windows are cut around rewards (first valve opening of a lap) and arrivals (IR
+ *   break ending a lap) in every relocation block (0 before the first relocation, 1 after, ...), default
+ *   window 5 s before to 10 s after in 50 ms bins, every window referenced to its pre-event mean unless -r
+ *
+ *   per session <outdir>/<log name>.peth.csv holds mean and SEM per bin, the window matrices go to raw f4
+ *   files <outdir>/<log name>.peth.<event>.<block> of rows x bins, the cohort mean of the session means
+ *   to <outdir>/cohort.peth.csv, one CSV row per session, event and block on stdout
+ */
+
+#include "../config.h"
+#include "photometry.h"
+
+#include <chrono>
+#include <stdio.h>
+
+const byte PETH_EVENTS = 2;
+const char* const PETH_EVENT_NAMES[PETH_EVENTS] = {"reward", "arrival"};
+
+struct PethSession
+{
+  const char* log;
+  const char* edges;
+  const char* photometry;
+  bool ok;
+  AlignFit fit;
+  ControlFit control;
+  Peth peths[PETH_EVENTS][RELOCATION_STEPS];
+};
+
+void analyzeSession(PethSession &session,
+                    const PethParams &params)
+{
+  /*
+  Decode, align, correct and cut one session
+  */
+  session.ok = false;
+  MappedLog file;
+  LogTables tables;
+  AlignJob job;
+  std::vector<TTLEdge> edges;
+  if (!mapLog(session.log, file))
+  {
+    return;
+  }
+  decodeLogTables(file.data, file.size, tables);
+  unmapLog(file);
+  if (!readTTLEdges(session.edges, edges))
+  {
+    return;
+  }
+  AlignParams alignParams = defaultAlignParams();
+  alignEvents(tables, job.events);
+  alignBarcodeRecords(tables, job.barcodes);
+  alignInputs(edges, alignParams, job);
+  alignSession(job, alignParams);
+  session.fit = job.fit;
+  PhotometryTrace trace;
+  if (!job.fit.ok || !mapLog(session.photometry, file))
+  {
+    return;
+  }
+  readPhotometry(file.data, file.size, trace);
+  unmapLog(file);
+  std::vector<float> dff;
+  session.control = fitControl(trace);
+  deltaFF(trace, session.control, dff);
+
+  // relocation block of an event, the first RELOCATE event opens block 0
+  const std::vector<Timestamp> &relocations = tables.events[RELOCATE].t;
+  auto block = [&](Timestamp t) {
+    size_t k = std::upper_bound(relocations.begin(), relocations.end(), t) - relocations.begin();
+    return std::min<size_t>(k ? k - 1 : 0, RELOCATION_STEPS - 1);
+  };
+  const std::vector<Timestamp>* times[PETH_EVENTS] = {&tables.rewards.t, &tables.laps.t};
+  std::vector<double> events[RELOCATION_STEPS];
+  for (byte kind = 0; kind < PETH_EVENTS; kind++)
+  {
+    for (std::vector<double> &e : events)
+    {
+      e.clear();
+    }
+    for (Timestamp t : *times[kind])
+    {
+      events[block(t)].push_back(alignTime(job.fit, t * ALIGN_TICK_S));
+    }
+    for (byte b = 0; b < RELOCATION_STEPS; b++)
+    {
+      buildPeth(trace, dff, events[b], params, session.peths[kind][b]);
+    }
+  }
+  session.ok = true;
+}
+
+int main(int argc, char** argv)
+{
+  std::string outDir = ".";
+  unsigned threads = std::thread::hardware_concurrency();
+  PethParams params = {5.0, 10.0, 0.05, true};
+  std::vector<const char*> paths;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "-o" && i + 1 < argc) outDir = argv[++i];
+    else if (arg == "-j" && i + 1 < argc) threads = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "-w" && i + 1 < argc) sscanf(argv[++i], "%lf,%lf,%lf", &params.pre, &params.post, &params.dt);
+    else if (arg == "-r") params.baseline = false;
+    else if (arg[0] != '-') paths.push_back(argv[i]);
+    else paths.clear(), i = argc;
+  }
+  if (paths.empty() || paths.size() % 3 || params.dt <= 0)
+  {
+    fprintf(stderr, "usage: %s [-o outdir] [-j threads] [-w pre,post,dt] [-r] log edges photometry [...]\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<PethSession> sessions(paths.size() / 3);
+  for (size_t i = 0; i < sessions.size(); i++)
+  {
+    sessions[i].log = paths[3 * i];
+    sessions[i].edges = paths[3 * i + 1];
+    sessions[i].photometry = paths[3 * i + 2];
+  }
+  auto start = std::chrono::steady_clock::now();
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i; (i = next++) < sessions.size();)
+    {
+      analyzeSession(sessions[i], params);
+    }
+  };
+  threads = std::max(1u, std::min<unsigned>(threads, sessions.size()));
+  std::vector<std::thread> pool;
+  for (unsigned i = 1; i < threads; i++)
+  {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &thread : pool)
+  {
+    thread.join();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // per session tables, the cohort mean of the session means on the way
+  int failed = 0;
+  size_t bins = (size_t)lround((params.pre + params.post) / params.dt) + 1;
+  std::vector<double> cohort[PETH_EVENTS][RELOCATION_STEPS];
+  unsigned long cohortSessions[PETH_EVENTS][RELOCATION_STEPS] = {};
+  printf("log,event,block,events,peak_dff,peak_t,mean_post_dff,align_drift_ppm,control_slope\n");
+  for (PethSession &session : sessions)
+  {
+    if (!session.ok)
+    {
+      fprintf(stderr, "cannot analyze %s (alignment %s)\n", session.log, session.fit.ok ? "ok" : "failed");
+      failed++;
+      continue;
+    }
+    std::string name = session.log;
+    name = name.substr(name.find_last_of('/') + 1);
+    std::string base = outDir + "/" + name.substr(0, name.find_last_of('.')) + ".peth";
+    FILE* table = fopen((base + ".csv").c_str(), "w");
+    if (table == nullptr)
+    {
+      fprintf(stderr, "cannot write %s.csv\n", base.c_str());
+      failed++;
+      continue;
+    }
+    fprintf(table, "event,block,t,mean,sem,events\n");
+    for (byte kind = 0; kind < PETH_EVENTS; kind++)
+    {
+      for (byte b = 0; b < RELOCATION_STEPS; b++)
+      {
+        const Peth &peth = session.peths[kind][b];
+        size_t peak = 0;
+        double meanPost = 0;
+        for (size_t i = 0; i < peth.bins; i++)
+        {
+          double t = -params.pre + i * params.dt;
+          fprintf(table, "%s,%d,%.4f,%.6f,%.6f,%zu\n", PETH_EVENT_NAMES[kind], b, t, peth.mean[i], peth.sem[i], peth.rows);
+          peak = peth.mean[i] > peth.mean[peak] ? i : peak;
+          meanPost += t >= 0 ? peth.mean[i] * params.dt / params.post : 0;
+        }
+        printf("%s,%s,%d,%zu,%.5f,%.3f,%.5f,%.1f,%.4f\n", session.log, PETH_EVENT_NAMES[kind], b, peth.rows,
+               peth.mean[peak], -params.pre + peak * params.dt, meanPost, (session.fit.slope - 1) * 1e6, session.control.slope);
+        std::string path = base + "." + PETH_EVENT_NAMES[kind] + "." + std::to_string(b);
+        FILE* matrix = fopen(path.c_str(), "wb");
+        if (matrix == nullptr || fwrite(peth.windows.data(), sizeof(float), peth.windows.size(), matrix) != peth.windows.size())
+        {
+          fprintf(stderr, "cannot write %s\n", path.c_str());
+          failed++;
+        }
+        if (matrix != nullptr)
+        {
+          fclose(matrix);
+        }
+        if (peth.rows)
+        {
+          cohort[kind][b].resize(bins);
+          for (size_t i = 0; i < bins; i++)
+          {
+            cohort[kind][b][i] += peth.mean[i];
+          }
+          cohortSessions[kind][b]++;
+        }
+      }
+    }
+    fclose(table);
+  }
+  FILE* table = fopen((outDir + "/cohort.peth.csv").c_str(), "w");
+  if (table != nullptr)
+  {
+    fprintf(table, "event,block,t,mean,sessions\n");
+    for (byte kind = 0; kind < PETH_EVENTS; kind++)
+    {
+      for (byte b = 0; b < RELOCATION_STEPS; b++)
+      {
+        for (size_t i = 0; i < cohort[kind][b].size(); i++)
+        {
+          fprintf(table, "%s,%d,%.4f,%.6f,%lu\n", PETH_EVENT_NAMES[kind], b, -params.pre + i * params.dt,
+                  cohort[kind][b][i] / cohortSessions[kind][b], cohortSessions[kind][b]);
+        }
+      }
+    }
+    fclose(table);
+  }
+  fprintf(stderr, "%zu sessions in %.3f s on %u threads\n", sessions.size(), seconds, threads);
+  return failed ? 1 : 0;
+}
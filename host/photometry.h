@@ -0,0 +1,275 @@
+/*
+ * Peri-event photometry
+ *   a photometry recording (signal and isosbestic control channels on the photometry clock) is corrected
+ *   with the control fitted to the signal by least squares, dF/F = (signal - fit) / fit, and cut into
+ *   fixed windows around events aligned with align.h - rows of a window matrix are contiguous, so the
+ *   resampling and the mean/SEM over events run as plain loops over float arrays the compiler vectorizes
+ */
+
+#ifndef PHOTOMETRY
+#define PHOTOMETRY
+
+#include "align.h"
+
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+
+struct PhotometryTrace
+{
+  std::vector<double> t;              // photometry clock, s
+  std::vector<float> signal;
+  std::vector<float> control;         // isosbestic
+};
+
+struct ControlFit
+{
+  double slope;
+  double intercept;
+};
+
+struct PethParams
+{
+  double pre;                         // window start before the event, s
+  double post;                        // window end after the event, s
+  double dt;                          // bin width, s
+  bool baseline;                      // subtract the mean of the bins before the event from every row
+};
+
+struct Peth
+{
+  size_t rows;                        // events with a complete window
+  size_t bins;
+  std::vector<float> windows;         // rows x bins, row major
+  std::vector<float> mean;
+  std::vector<float> sem;
+};
+
+inline bool scanDecimal(const char* &c,
+                        const char* end,
+                        double &value)
+{
+  /*
+  Parse a decimal number in place (sign, digits, fraction, exponent) and move c past it, the mapped file is
+    not terminated so strtod cannot be used on it directly
+  Returns:
+  <bool> : false if c does not start with a number
+  */
+  const char* start = c;
+  bool negative = c < end && *c == '-';
+  c += c < end && (*c == '-' || *c == '+');
+  double mantissa = 0;
+  int exponent = 0;
+  bool digits = false;
+  for (; c < end && *c >= '0' && *c <= '9'; c++, digits = true)
+  {
+    mantissa = mantissa * 10 + (*c - '0');
+  }
+  if (c < end && *c == '.')
+  {
+    for (c++; c < end && *c >= '0' && *c <= '9'; c++, digits = true)
+    {
+      mantissa = mantissa * 10 + (*c - '0');
+      exponent--;
+    }
+  }
+  if (!digits)
+  {
+    c = start;
+    return false;
+  }
+  if (c + 1 < end && (*c == 'e' || *c == 'E'))
+  {
+    const char* e = c + 1;
+    bool negativeExponent = *e == '-';
+    e += *e == '-' || *e == '+';
+    int power = 0;
+    for (; e < end && *e >= '0' && *e <= '9'; e++)
+    {
+      power = power * 10 + (*e - '0');
+    }
+    exponent += negativeExponent ? -power : power;
+    c = e;
+  }
+  static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+  if (exponent < 0)
+  {
+    mantissa = -exponent < 16 ? mantissa / powers[-exponent] : mantissa * pow(10.0, exponent);
+  }
+  else if (exponent > 0)
+  {
+    mantissa = exponent < 16 ? mantissa * powers[exponent] : mantissa * pow(10.0, exponent);
+  }
+  value = negative ? -mantissa : mantissa;
+  return true;
+}
+
+inline size_t readPhotometry(const byte* data,
+                             size_t size,
+                             PhotometryTrace &trace)
+{
+  /*
+  Parse "time_s,signal,isosbestic" lines in one pass over the mapped file, lines that do not start with
+    three numbers (headers) are skipped, samples must be in time order
+  Returns:
+  <size_t> : samples read
+  */
+  trace.t.clear();
+  trace.signal.clear();
+  trace.control.clear();
+  trace.t.reserve(size / 24);
+  trace.signal.reserve(size / 24);
+  trace.control.reserve(size / 24);
+  const char* c = (const char*)data;
+  const char* end = c + size;
+  while (c < end)
+  {
+    double t, signal, control;
+    if (scanDecimal(c, end, t) && c < end && *c++ == ',' && scanDecimal(c, end, signal) && c < end && *c++ == ',' &&
+        scanDecimal(c, end, control))
+    {
+      trace.t.push_back(t);
+      trace.signal.push_back((float)signal);
+      trace.control.push_back((float)control);
+    }
+    const char* eol = (const char*)memchr(c, '\n', end - c);
+    c = eol ? eol + 1 : end;
+  }
+  return trace.t.size();
+}
+
+inline ControlFit fitControl(const PhotometryTrace &trace)
+{
+  /*
+  Least squares fit of the control channel onto the signal, signal ~ slope * control + intercept
+  */
+  size_t n = trace.signal.size();
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    double x = trace.control[i], y = trace.signal[i];
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    sxy += x * y;
+  }
+  ControlFit fit = {0, n ? sy / n : 0};
+  double det = n * sxx - sx * sx;
+  if (det > 0)
+  {
+    fit.slope = (n * sxy - sx * sy) / det;
+    fit.intercept = (sy - fit.slope * sx) / n;
+  }
+  return fit;
+}
+
+inline void deltaFF(const PhotometryTrace &trace,
+                    const ControlFit &fit,
+                    std::vector<float> &dff)
+{
+  /*
+  dF/F of the signal against the fitted control
+  */
+  size_t n = trace.signal.size();
+  dff.resize(n);
+  const float* signal = trace.signal.data();
+  const float* control = trace.control.data();
+  float* out = dff.data();
+  float slope = (float)fit.slope, intercept = (float)fit.intercept;
+  for (size_t i = 0; i < n; i++)
+  {
+    float fitted = slope * control[i] + intercept;
+    out[i] = (signal[i] - fitted) / fitted;
+  }
+}
+
+inline void buildPeth(const PhotometryTrace &trace,
+                      const std::vector<float> &dff,
+                      const std::vector<double> &events,
+                      const PethParams &params,
+                      Peth &peth)
+{
+  /*
+  Cut a window of dF/F around every event (photometry clock, s) by linear interpolation at the bin times,
+    events whose window leaves the recording are left out, rows are optionally referenced to their own
+    pre-event mean, then the mean and SEM per bin over the rows
+    - the recording is taken as uniformly sampled between its first and last sample
+  */
+  peth.bins = (size_t)lround((params.pre + params.post) / params.dt) + 1;
+  peth.rows = 0;
+  peth.windows.clear();
+  peth.mean.assign(peth.bins, 0.0f);
+  peth.sem.assign(peth.bins, 0.0f);
+  size_t n = trace.t.size();
+  if (n < 2)
+  {
+    return;
+  }
+  double t0 = trace.t.front();
+  double rate = (n - 1) / (trace.t.back() - t0);
+  double step = params.dt * rate;
+  peth.windows.resize(events.size() * peth.bins);
+  for (double tEvent : events)
+  {
+    double first = (tEvent - params.pre - t0) * rate;
+    double last = first + (peth.bins - 1) * step;
+    if (first < 0 || last > n - 1)
+    {
+      continue;
+    }
+    float* row = peth.windows.data() + peth.rows * peth.bins;
+    for (size_t b = 0; b < peth.bins; b++)
+    {
+      double x = first + b * step;
+      size_t i = std::min((size_t)x, n - 2);
+      float f = (float)(x - i);
+      row[b] = dff[i] + f * (dff[i + 1] - dff[i]);
+    }
+    size_t before = std::min(peth.bins, (size_t)(params.pre / params.dt));
+    if (params.baseline && before > 0)
+    {
+      float mean = 0;
+      for (size_t b = 0; b < before; b++)
+      {
+        mean += row[b];
+      }
+      mean /= before;
+      for (size_t b = 0; b < peth.bins; b++)
+      {
+        row[b] -= mean;
+      }
+    }
+    peth.rows++;
+  }
+  peth.windows.resize(peth.rows * peth.bins);
+  float* mean = peth.mean.data();
+  float* sem = peth.sem.data();
+  for (size_t r = 0; r < peth.rows; r++)
+  {
+    const float* row = peth.windows.data() + r * peth.bins;
+    for (size_t b = 0; b < peth.bins; b++)
+    {
+      mean[b] += row[b];
+    }
+  }
+  for (size_t b = 0; b < peth.bins && peth.rows; b++)
+  {
+    mean[b] /= peth.rows;
+  }
+  for (size_t r = 0; r < peth.rows; r++)
+  {
+    const float* row = peth.windows.data() + r * peth.bins;
+    for (size_t b = 0; b < peth.bins; b++)
+    {
+      float d = row[b] - mean[b];
+      sem[b] += d * d;
+    }
+  }
+  for (size_t b = 0; b < peth.bins && peth.rows > 1; b++)
+  {
+    sem[b] = sqrtf(sem[b] / (peth.rows - 1) / peth.rows);
+  }
+}
+
+#endif
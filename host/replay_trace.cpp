@@ -0,0 +1,356 @@
+/*
+ * Host replay - raw pin traces through the detection state machines of helper.h
+ *
+ *   build : g++ -std=c++17 -O2 -o replay_trace host/replay_trace.cpp
+ *   usage : replay_trace [-p poll ticks] [-v] log       replay a captured serial stream and diff the events
+ *           replay_trace -g seconds [-s seed]            replay a synthetic trace, throughput only
+ *
+ *   the stream must come from firmware built with PIN_TRACE and the same detection settings as this build
+ *   (port table, SENSOR_EDGE_CAPTURE, debounce, MIN_IR_BREAK, time unit), e.g. simulate -o or any raw serial
+ *   capture, every traced level is queued as a captured edge at its own time (or driven onto the input pin
+ *   when the firmware polls) and detectPorts() runs at every trace time and every -p ticks in between
+ *   (default DEBOUNCE_TICK), the replayed IR/touch events are diffed per input against the logged ones,
+ *   exit status 1 on any difference
+ *
+ *   debounced inputs and the legacy touch logic reproduce exactly, the legacy IR persistance check
+ *   (IR_DEBOUNCE_MODE DEBOUNCE_OFF) depends on the loop() timing of the rig and only reproduces when
+ *   the poll period matches it
+ */
+
+#include "../helper.h"
+#include "log_decode.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <stdlib.h>
+
+const unsigned long long US_PER_TICK = TIME_IN_MICROSECONDS ? 1ULL : 1000ULL;
+const byte REPLAY_INPUTS = 2 * PORT_COUNT;
+
+PortBank<PORT_COUNT> ports;
+EdgeQueue irEdges[PORT_COUNT], touchEdges[PORT_COUNT];
+
+struct ReplayStats
+{
+  unsigned long records;
+  unsigned long polls;
+  unsigned long edgeOverflow;
+  double wallSeconds;
+};
+
+void pushEdge(EdgeQueue &queue,
+              Timestamp t,
+              bool level,
+              ReplayStats &stats)
+{
+  /*
+  Queue a traced level as a captured edge, stands in for captureEdges()
+  */
+  byte next = (queue.head + 1) & (EDGE_QUEUE_CAPACITY - 1);
+  if (next == queue.tail)
+  {
+    stats.edgeOverflow++;
+    return;
+  }
+  queue.edges[queue.head].t = (uint32_t)t;
+  queue.edges[queue.head].level = level;
+  queue.level = level;
+  queue.head = next;
+}
+
+std::vector<LogRecord> replay(std::vector<LogRecord> trace,
+                                Timestamp pollPeriod,
+                                ReplayStats &stats)
+{
+  /*
+  Run a trace (code port << 2 | type << 1 | level) through a fresh PortBank on the virtual board
+  <std::vector<LogRecord>> trace : traced levels, the first one of every input is its level at initPorts()
+  <Timestamp> pollPeriod : detectPorts() period between trace times
+
+  Returns:
+  <std::vector<LogRecord>> : IR/touch events logged by the state machines
+  */
+  std::vector<LogRecord> events;
+  stats = {};
+  if (trace.empty())
+  {
+    return events;
+  }
+  std::stable_sort(trace.begin(), trace.end(), [](const LogRecord &a, const LogRecord &b) { return a.t < b.t; });
+  hostReset(trace.front().t * US_PER_TICK);
+
+  // the first level of every input is the one the firmware started from
+  bool initial[REPLAY_INPUTS] = {};
+  std::vector<bool> skip(trace.size(), false);
+  for (size_t i = 0; i < trace.size(); i++)
+  {
+    byte input = trace[i].code >> 1;
+    if (input < REPLAY_INPUTS && !initial[input])
+    {
+      initial[input] = true;
+      skip[i] = true;
+      byte port = input >> 1;
+      bool level = trace[i].code & 0x01;
+      if (input & 1)
+      {
+        hostBoard.level[PORT_TOUCH_PIN[port]] = level != TOUCH_ACTIVE_LOW;
+      }
+      else
+      {
+        hostBoard.level[PORT_IR_PIN[port]] = level != IR_ACTIVE_LOW;
+      }
+    }
+  }
+  initClock(systemClock);
+  initSessionParams(sessionParams);
+  initEventLog(eventLogQueue);
+  TTLState output;
+  initTTL(output, OUTPUT_IR, OUTPUT);
+  initPorts(ports, PORT_COUNT, PORT_IR_PIN, PORT_IR_INDICATOR, PORT_TOUCH_PIN, PORT_SOLENOID_PIN, PORT_TRACK, PORT_TTL_PERIOD,
+            &output, &output, &output, SENSOR_EDGE_CAPTURE ? irEdges : nullptr, SENSOR_EDGE_CAPTURE ? touchEdges : nullptr);
+
+  auto start = std::chrono::steady_clock::now();
+  Timestamp tNow = trace.front().t;
+  Timestamp tEnd = trace.back().t + MIN_IR_BREAK + 2 * 8 * DEBOUNCE_TICK;
+  size_t next = 0;
+  while (next < trace.size() || tNow < tEnd)
+  {
+    tNow += pollPeriod;
+    if (next < trace.size() && trace[next].t < tNow)
+    {
+      tNow = trace[next].t;
+    }
+    for (; next < trace.size() && trace[next].t <= tNow; next++)
+    {
+      byte input = trace[next].code >> 1;
+      if (skip[next] || input >= REPLAY_INPUTS)
+      {
+        continue;
+      }
+      bool level = trace[next].code & 0x01;
+      if (!SENSOR_EDGE_CAPTURE)
+      {
+        // polled firmware traces one level per input and pass
+        hostDrivePin(input & 1 ? PORT_TOUCH_PIN[input >> 1] : PORT_IR_PIN[input >> 1], level != (input & 1 ? TOUCH_ACTIVE_LOW : IR_ACTIVE_LOW));
+      }
+      else
+      {
+        pushEdge(input & 1 ? touchEdges[input >> 1] : irEdges[input >> 1], trace[next].t, level, stats);
+      }
+      stats.records++;
+    }
+    detectPorts(ports, tNow);
+    stats.polls++;
+    for (; eventLogQueue.tail != eventLogQueue.head; eventLogQueue.tail = (eventLogQueue.tail + 1) & (EVENT_LOG_CAPACITY - 1))
+    {
+      const EventRecord &record = eventLogQueue.records[eventLogQueue.tail];
+      events.push_back({record.code, record.sequence, extendTime(record.t, tNow)});
+    }
+  }
+  stats.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return events;
+}
+
+std::vector<LogRecord> synthesize(Timestamp duration,
+                                    unsigned long long seed)
+{
+  /*
+  Synthetic trace, every input sees bouncing contacts (IR 0.2-3s every 0.5-5s, touch 15-40ms every 50-250ms)
+    with up to 4 bounces of 50-800us at onset and release, times rounded to the clock unit
+  */
+  std::mt19937_64 rng(seed);
+  auto uniform = [&](double lo, double hi) { return std::uniform_real_distribution<double>(lo, hi)(rng); };
+  std::vector<LogRecord> trace;
+  for (byte input = 0; input < REPLAY_INPUTS; input++)
+  {
+    bool touch = input & 1;
+    byte code = input << 1;
+    trace.push_back({code, 0, 0});
+    double t = uniform(0, 1e6);
+    while (t < duration * US_PER_TICK)
+    {
+      for (int edge = 0; edge < 2; edge++)
+      {
+        for (int b = (int)uniform(0, 5); b > 0; b--)
+        {
+          trace.push_back({(byte)(code | !edge), 0, (Timestamp)(t / US_PER_TICK)});
+          t += uniform(50, 800);
+          trace.push_back({(byte)(code | edge), 0, (Timestamp)(t / US_PER_TICK)});
+          t += uniform(50, 800);
+        }
+        trace.push_back({(byte)(code | !edge), 0, (Timestamp)(t / US_PER_TICK)});
+        t += edge ? 0 : (touch ? uniform(15e3, 40e3) : uniform(2e5, 3e6));
+      }
+      t += touch ? uniform(50e3, 250e3) : uniform(5e5, 5e6);
+    }
+  }
+  return trace;
+}
+
+std::string encode(const std::vector<LogRecord> &trace)
+{
+  /*
+  Serialize a trace the way the firmware does, frames in time order per input
+  */
+  PinTraceState state;
+  initPinTrace(state);
+  hostReset();
+  hostBoard.baudRate = 0xFFFFFFFFUL;
+  for (const LogRecord &record : trace)
+  {
+    writeTraceRecord(state, record.code, record.t, PIN_TRACE_KEYFRAME_SIZE);
+  }
+  return hostBoard.serialOut;
+}
+
+void decode(const std::string &stream,
+            std::vector<LogRecord> &trace,
+            std::vector<LogRecord> &events,
+            unsigned long &unresolved)
+{
+  LogDecoder decoder;
+  LogItem item;
+  initLogDecoder(decoder, stream);
+  while (nextLogItem(decoder, item))
+  {
+    byte type = (item.code >> 1) & 0x07;
+    if (item.kind == LOG_TRACE)
+    {
+      trace.push_back({item.code, 0, item.t});
+    }
+    else if (item.kind == LOG_EVENT && (type == IR || type == TOUCH))
+    {
+      events.push_back({item.code, item.sequence, item.t});
+    }
+  }
+  unresolved = decoder.traceUnresolved;
+}
+
+bool diffEvents(const std::vector<LogRecord> &logged,
+                const std::vector<LogRecord> &replayed,
+                bool verbose)
+{
+  /*
+  Compare the logged and replayed events per input in order, prints one CSV row per input
+
+  Returns:
+  <bool> : true if every input matches
+  */
+  bool same = true;
+  printf("input,logged,replayed,matched,first_diff_logged,first_diff_replayed\n");
+  for (byte input = 0; input < REPLAY_INPUTS; input++)
+  {
+    byte side = input >> 1;
+    byte type = input & 1 ? TOUCH : IR;
+    std::vector<LogRecord> a, b;
+    for (const LogRecord &e : logged)
+    {
+      if ((e.code & 0xFE) == ((side << 4) | (type << 1))) a.push_back(e);
+    }
+    for (const LogRecord &e : replayed)
+    {
+      if ((e.code & 0xFE) == ((side << 4) | (type << 1))) b.push_back(e);
+    }
+    size_t matched = 0;
+    while (matched < a.size() && matched < b.size() && a[matched].code == b[matched].code && a[matched].t == b[matched].t)
+    {
+      matched++;
+    }
+    auto describe = [](const std::vector<LogRecord> &events, size_t i) {
+      return i < events.size() ? std::to_string(events[i].code & 0x01) + "@" + std::to_string(events[i].t) : std::string("-");
+    };
+    bool match = matched == a.size() && matched == b.size();
+    same = same && match;
+    printf("%s%u,%zu,%zu,%zu,%s,%s\n", type == IR ? "ir" : "touch", side, a.size(), b.size(), matched,
+           match ? "" : describe(a, matched).c_str(), match ? "" : describe(b, matched).c_str());
+    for (size_t i = matched; verbose && i < std::max(a.size(), b.size()) && i < matched + 10; i++)
+    {
+      fprintf(stderr, "%s%u #%zu logged %s replayed %s\n", type == IR ? "ir" : "touch", side, i,
+              describe(a, i).c_str(), describe(b, i).c_str());
+    }
+  }
+  return same;
+}
+
+void printStats(const ReplayStats &stats,
+                const std::vector<LogRecord> &events)
+{
+  double samples = (double)stats.polls * REPLAY_INPUTS;
+  fprintf(stderr, "records %lu, events %zu, polls %lu, edge overflow %lu, %.3f s, %.2f M records/s, %.2f M input samples/s\n",
+          stats.records, events.size(), stats.polls, stats.edgeOverflow, stats.wallSeconds,
+          stats.records / stats.wallSeconds / 1e6, samples / stats.wallSeconds / 1e6);
+}
+
+int main(int argc, char** argv)
+{
+  Timestamp pollPeriod = DEBOUNCE_TICK;
+  double synthetic = 0;
+  unsigned long long seed = 1;
+  bool verbose = false;
+  const char* path = nullptr;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "-p" && i + 1 < argc) pollPeriod = strtoull(argv[++i], nullptr, 10);
+    else if (arg == "-g" && i + 1 < argc) synthetic = strtod(argv[++i], nullptr);
+    else if (arg == "-s" && i + 1 < argc) seed = strtoull(argv[++i], nullptr, 10);
+    else if (arg == "-v") verbose = true;
+    else if (arg[0] != '-' && path == nullptr) path = argv[i];
+    else path = nullptr, synthetic = -1;
+  }
+  if (pollPeriod == 0 || synthetic < 0 || (path == nullptr) == (synthetic == 0))
+  {
+    fprintf(stderr, "usage: %s [-p poll ticks] [-v] log | -g seconds [-s seed]\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<LogRecord> trace, logged;
+  unsigned long unresolved = 0;
+  if (synthetic > 0)
+  {
+    // round trip through the firmware frame format before replaying
+    std::vector<LogRecord> source = synthesize((Timestamp)(synthetic * 1e6 / US_PER_TICK), seed);
+    std::string stream = encode(source);
+    decode(stream, trace, logged, unresolved);
+    bool same = trace.size() == source.size();
+    for (size_t i = 0; same && i < trace.size(); i++)
+    {
+      same = trace[i].code == source[i].code && trace[i].t == source[i].t;
+    }
+    fprintf(stderr, "encoded %zu levels in %zu bytes, round trip %s\n", source.size(), stream.size(), same ? "ok" : "MISMATCH");
+    ReplayStats stats;
+    std::vector<LogRecord> events = replay(trace, pollPeriod, stats);
+    printStats(stats, events);
+    return same ? 0 : 1;
+  }
+
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr)
+  {
+    fprintf(stderr, "cannot open %s\n", path);
+    return 2;
+  }
+  std::string stream;
+  char buffer[65536];
+  for (size_t n; (n = fread(buffer, 1, sizeof(buffer), file)) > 0;)
+  {
+    stream.append(buffer, n);
+  }
+  fclose(file);
+  decode(stream, trace, logged, unresolved);
+  if (trace.empty())
+  {
+    fprintf(stderr, "%s: no pin trace frames, was the firmware built with PIN_TRACE?\n", path);
+    return 2;
+  }
+  if (unresolved)
+  {
+    fprintf(stderr, "%lu trace frames before the first keyframe ignored\n", unresolved);
+  }
+  ReplayStats stats;
+  std::vector<LogRecord> events = replay(trace, pollPeriod, stats);
+  printStats(stats, events);
+  return diffEvents(logged, events, verbose) ? 0 : 1;
+}
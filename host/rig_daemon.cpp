@@ -0,0 +1,516 @@
+/*
+ * Host daemon - serial aggregation of many rigs from one event loop
+ *
+ *   build : g++ -std=c++17 -O2 -o rig_daemon host/rig_daemon.cpp
+ *   usage : rig_daemon [-o outdir] [-b baud] [-i status interval s] [-x] [-v] device...
+ *           -x exits once every device hung up (e.g. the pseudo terminals of rig_feeder closed)
+ *           -v prints the status table to stderr at every interval
+ *
+ *   every device (a board's serial port, or a pseudo terminal from rig_feeder) is opened raw and non
+ *   blocking and serviced from a single epoll loop together with a timerfd for the status and a signalfd
+ *   for SIGINT/SIGTERM, no thread per port - bytes are decoded incrementally with a streaming LogDecoder on
+ *   a fixed buffer per rig and written unchanged, in arrival order, to per rig session files cut at the
+ *   S records, <outdir>/<rig>.<session>.log with session 0 holding what came before the first S (banner),
+ *   through a fixed write buffer per rig - memory stays bounded whatever the rigs send
+ *
+ *   arrival times go to <outdir>/<rig>.arrival, u8 pairs (host CLOCK_REALTIME us, rig stream offset after
+ *   the read) per read, live counters to <outdir>/status.csv (replaced atomically every interval) - bytes,
+ *   events, events/s over the last interval, text lines, sessions, decode errors (stray bytes), events
+ *   lost per the EVENT_COMPACT sequence numbers, events without a time base and UART overruns reported by
+ *   the driver (TIOCGICOUNT, 0 where the driver has no counters, e.g. pseudo terminals), followed by the
+ *   leading session statistics of the latest P or E record (SESSION_STATS), also with EVENT_LOG_SUMMARY
+ */
+
+#include "../config.h"
+#include "log_decode.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/serial.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+const size_t RIG_READ_BUFFER = 64 * 1024;
+const size_t RIG_WRITE_BUFFER = 64 * 1024;
+
+struct RigCounters
+{
+  unsigned long long bytes;
+  unsigned long long events;
+  unsigned long long lines;
+  unsigned long sessions;
+  unsigned long long decodeErrors;
+  unsigned long long eventsLost;
+  unsigned long long eventsUnresolved;
+  unsigned long long ttyOverruns;
+};
+
+// leading fields of the latest session statistics (P record, or the E record after its lost events and records)
+const byte RIG_STATS_FIELDS = 7;
+const char* const RIG_STATS_NAMES = "steps,laps,errors,run,best_run,lap_interval_mean,lap_interval_min";
+
+struct Rig
+{
+  std::string path;
+  std::string name;
+  int fd;
+  bool open;
+  byte input[RIG_READ_BUFFER];
+  size_t inputSize;
+  LogDecoder decoder;
+  byte output[RIG_WRITE_BUFFER];
+  size_t outputSize;
+  int shard;                          // session file, -1 before the first byte
+  unsigned long session;
+  FILE* arrival;
+  unsigned long long streamOffset;    // bytes read so far
+  RigCounters counters;
+  unsigned long stats[RIG_STATS_FIELDS];
+  unsigned long long eventsLastInterval;
+  double eventRate;
+};
+
+unsigned long long hostMicros()
+{
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+speed_t baudConstant(unsigned long baud)
+{
+  switch (baud)
+  {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 500000: return B500000;
+    case 1000000: return B1000000;
+    case 2000000: return B2000000;
+    default: return B115200;
+  }
+}
+
+bool openRig(Rig &rig,
+             const char* path,
+             unsigned long baud)
+{
+  /*
+  Open a serial device raw, 8N1, non blocking, without taking it as controlling terminal
+  */
+  rig.path = path;
+  // /dev/ttyACM0 is rig ttyACM0, /dev/pts/3 rig pts-3
+  rig.name = strncmp(path, "/dev/", 5) == 0 ? path + 5 : path;
+  std::replace(rig.name.begin(), rig.name.end(), '/', '-');
+  rig.fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  rig.open = rig.fd >= 0;
+  if (!rig.open)
+  {
+    return false;
+  }
+  termios tio;
+  if (tcgetattr(rig.fd, &tio) == 0)
+  {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    cfsetispeed(&tio, baudConstant(baud));
+    cfsetospeed(&tio, baudConstant(baud));
+    tcsetattr(rig.fd, TCSANOW, &tio);
+  }
+  rig.inputSize = 0;
+  rig.outputSize = 0;
+  rig.shard = -1;
+  rig.session = 0;
+  rig.arrival = nullptr;
+  rig.streamOffset = 0;
+  rig.counters = RigCounters();
+  memset(rig.stats, 0, sizeof(rig.stats));
+  rig.eventsLastInterval = 0;
+  rig.eventRate = 0;
+  initLogDecoder(rig.decoder, rig.input, 0);
+  rig.decoder.streaming = true;
+  return true;
+}
+
+bool flushRig(Rig &rig)
+{
+  /*
+  Write out the buffered session bytes
+  */
+  size_t written = 0;
+  while (written < rig.outputSize && rig.shard >= 0)
+  {
+    ssize_t n = write(rig.shard, rig.output + written, rig.outputSize - written);
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return false;
+    }
+    written += n;
+  }
+  rig.outputSize = 0;
+  return true;
+}
+
+bool openShard(Rig &rig,
+               const std::string &outDir)
+{
+  /*
+  Start the next session file of a rig
+  */
+  flushRig(rig);
+  if (rig.shard >= 0)
+  {
+    close(rig.shard);
+    rig.session++;
+  }
+  std::string path = outDir + "/" + rig.name + "." + std::to_string(rig.session) + ".log";
+  rig.shard = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  return rig.shard >= 0;
+}
+
+void writeShard(Rig &rig,
+                const byte* data,
+                size_t size,
+                const std::string &outDir)
+{
+  if (rig.shard < 0)
+  {
+    openShard(rig, outDir);
+  }
+  while (size > 0)
+  {
+    size_t n = std::min(size, RIG_WRITE_BUFFER - rig.outputSize);
+    memcpy(rig.output + rig.outputSize, data, n);
+    rig.outputSize += n;
+    data += n;
+    size -= n;
+    if (rig.outputSize == RIG_WRITE_BUFFER)
+    {
+      flushRig(rig);
+    }
+  }
+}
+
+void readStats(Rig &rig,
+               const LogItem &item)
+{
+  /*
+  Keep the statistics of a P<time>,<statistics> or E<time>,<lost events>,<lost records>,<statistics> record
+  */
+  const char* c = item.line + 1;
+  const char* end = item.line + item.length;
+  byte skip = item.line[0] == 'E' ? 3 : 1;
+  for (byte field = 0; c < end && field < skip + RIG_STATS_FIELDS; field++)
+  {
+    unsigned long value = 0;
+    for (; c < end && *c >= '0' && *c <= '9'; c++)
+    {
+      value = value * 10 + (*c - '0');
+    }
+    if (field >= skip)
+    {
+      rig.stats[field - skip] = value;
+    }
+    if (c == end || *c++ != ',')
+    {
+      break;
+    }
+  }
+}
+
+void decodeRig(Rig &rig,
+               const std::string &outDir)
+{
+  /*
+  Decode what the buffer holds, pass the consumed bytes on to the session files and keep the tail that
+    may continue with the next read
+  */
+  LogDecoder &decoder = rig.decoder;
+  size_t written = 0;
+  LogItem item;
+  while (true)
+  {
+    if (!nextLogItem(decoder, item))
+    {
+      break;
+    }
+    if (item.kind == LOG_LINE && item.length > 0 && item.line[0] == 'S')
+    {
+      // a new session, its S record is the first line of the next file
+      size_t lineStart = (const byte*)item.line - rig.input;
+      writeShard(rig, rig.input + written, lineStart - written, outDir);
+      written = lineStart;
+      openShard(rig, outDir);
+      rig.counters.sessions++;
+      // a rebooted board restarts its sequence numbers
+      decoder.sequenceKnown = false;
+    }
+    if (item.kind == LOG_LINE && item.length > 1 && (item.line[0] == 'P' || item.line[0] == 'E') && item.line[1] >= '0' &&
+        item.line[1] <= '9')
+    {
+      readStats(rig, item);
+    }
+    rig.counters.events += item.kind == LOG_EVENT;
+    rig.counters.lines += item.kind == LOG_LINE;
+  }
+  writeShard(rig, rig.input + written, decoder.pos - written, outDir);
+  rig.counters.decodeErrors = decoder.bytesSkipped;
+  rig.counters.eventsLost = decoder.eventsLost;
+  rig.counters.eventsUnresolved = decoder.eventsUnresolved;
+  // keep the unread tail at the front of the buffer
+  size_t consumed = decoder.pos;
+  memmove(rig.input, rig.input + consumed, rig.inputSize - consumed);
+  rig.inputSize -= consumed;
+  resumeLogDecoder(decoder, rig.input, rig.inputSize, consumed);
+}
+
+bool serviceRig(Rig &rig,
+                const std::string &outDir)
+{
+  /*
+  Read everything the device has, decoding whenever the buffer fills
+  Returns:
+  <bool> : false once the device hung up or failed
+  */
+  while (true)
+  {
+    ssize_t n = read(rig.fd, rig.input + rig.inputSize, RIG_READ_BUFFER - rig.inputSize);
+    if (n > 0)
+    {
+      rig.inputSize += n;
+      rig.streamOffset += n;
+      rig.counters.bytes += n;
+      if (rig.arrival != nullptr)
+      {
+        unsigned long long record[2] = {hostMicros(), rig.streamOffset};
+        fwrite(record, sizeof(record), 1, rig.arrival);
+      }
+      resumeLogDecoder(rig.decoder, rig.input, rig.inputSize, 0);
+      decodeRig(rig, outDir);
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n < 0 && errno == EAGAIN)
+    {
+      return true;
+    }
+    // end of file or EIO once the other side of a pseudo terminal closed
+    return false;
+  }
+}
+
+void closeRig(Rig &rig,
+              int epoll,
+              const std::string &outDir)
+{
+  /*
+  Drain the decoder (nothing more can complete a held back frame) and close the files
+  */
+  epoll_ctl(epoll, EPOLL_CTL_DEL, rig.fd, nullptr);
+  close(rig.fd);
+  rig.open = false;
+  rig.decoder.streaming = false;
+  decodeRig(rig, outDir);
+  flushRig(rig);
+  if (rig.shard >= 0)
+  {
+    close(rig.shard);
+    rig.shard = -1;
+  }
+  if (rig.arrival != nullptr)
+  {
+    fclose(rig.arrival);
+    rig.arrival = nullptr;
+  }
+}
+
+void updateCounters(std::vector<std::unique_ptr<Rig>> &rigs,
+                    double interval)
+{
+  for (std::unique_ptr<Rig> &rig : rigs)
+  {
+    rig->eventRate = (rig->counters.events - rig->eventsLastInterval) / interval;
+    rig->eventsLastInterval = rig->counters.events;
+    serial_icounter_struct icount;
+    if (rig->open && ioctl(rig->fd, TIOCGICOUNT, &icount) == 0)
+    {
+      rig->counters.ttyOverruns = icount.overrun + icount.buf_overrun;
+    }
+    if (rig->open)
+    {
+      flushRig(*rig);
+      if (rig->arrival != nullptr)
+      {
+        fflush(rig->arrival);
+      }
+    }
+  }
+}
+
+void writeStatus(const std::vector<std::unique_ptr<Rig>> &rigs,
+                 FILE* file)
+{
+  fprintf(file, "rig,open,bytes,events,events_per_s,lines,sessions,decode_errors,events_lost,events_unresolved,tty_overruns,%s\n",
+          RIG_STATS_NAMES);
+  for (const std::unique_ptr<Rig> &rig : rigs)
+  {
+    const RigCounters &c = rig->counters;
+    fprintf(file, "%s,%d,%llu,%llu,%.1f,%llu,%lu,%llu,%llu,%llu,%llu", rig->name.c_str(), rig->open, c.bytes, c.events,
+            rig->eventRate, c.lines, c.sessions, c.decodeErrors, c.eventsLost, c.eventsUnresolved, c.ttyOverruns);
+    for (byte i = 0; i < RIG_STATS_FIELDS; i++)
+    {
+      fprintf(file, ",%lu", rig->stats[i]);
+    }
+    fprintf(file, "\n");
+  }
+}
+
+bool publishStatus(const std::vector<std::unique_ptr<Rig>> &rigs,
+                   const std::string &outDir)
+{
+  /*
+  Replace the status file atomically, readers never see half a table
+  */
+  std::string path = outDir + "/status.csv";
+  FILE* file = fopen((path + ".tmp").c_str(), "w");
+  if (file == nullptr)
+  {
+    return false;
+  }
+  writeStatus(rigs, file);
+  return fclose(file) == 0 && rename((path + ".tmp").c_str(), path.c_str()) == 0;
+}
+
+int main(int argc, char** argv)
+{
+  std::string outDir = ".";
+  unsigned long baud = BAUD_RATE;
+  double interval = 1.0;
+  bool exitOnHangup = false;
+  bool verbose = false;
+  std::vector<const char*> paths;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "-o" && i + 1 < argc) outDir = argv[++i];
+    else if (arg == "-b" && i + 1 < argc) baud = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "-i" && i + 1 < argc) interval = strtod(argv[++i], nullptr);
+    else if (arg == "-x") exitOnHangup = true;
+    else if (arg == "-v") verbose = true;
+    else if (arg[0] != '-') paths.push_back(argv[i]);
+    else paths.clear(), i = argc;
+  }
+  if (paths.empty() || interval <= 0)
+  {
+    fprintf(stderr, "usage: %s [-o outdir] [-b baud] [-i status interval s] [-x] [-v] device...\n", argv[0]);
+    return 2;
+  }
+
+  int epoll = epoll_create1(EPOLL_CLOEXEC);
+  std::vector<std::unique_ptr<Rig>> rigs;
+  for (const char* path : paths)
+  {
+    rigs.emplace_back(new Rig);
+    Rig &rig = *rigs.back();
+    if (!openRig(rig, path, baud))
+    {
+      fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+      return 1;
+    }
+    rig.arrival = fopen((outDir + "/" + rig.name + ".arrival").c_str(), "wb");
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = &rig;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, rig.fd, &event);
+  }
+
+  // status timer and termination signals are events of the same loop
+  int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  itimerspec period = {};
+  period.it_interval.tv_sec = (time_t)interval;
+  period.it_interval.tv_nsec = (long)((interval - (time_t)interval) * 1e9);
+  period.it_value = period.it_interval;
+  timerfd_settime(timer, 0, &period, nullptr);
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigprocmask(SIG_BLOCK, &signals, nullptr);
+  int signal = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.ptr = &timer;
+  epoll_ctl(epoll, EPOLL_CTL_ADD, timer, &event);
+  event.data.ptr = &signal;
+  epoll_ctl(epoll, EPOLL_CTL_ADD, signal, &event);
+
+  size_t open = rigs.size();
+  bool running = true;
+  epoll_event ready[64];
+  while (running && (open > 0 || !exitOnHangup))
+  {
+    int n = epoll_wait(epoll, ready, 64, -1);
+    for (int i = 0; i < n; i++)
+    {
+      if (ready[i].data.ptr == &timer)
+      {
+        uint64_t expirations;
+        if (read(timer, &expirations, sizeof(expirations)) == sizeof(expirations))
+        {
+          updateCounters(rigs, interval * expirations);
+          publishStatus(rigs, outDir);
+          if (verbose)
+          {
+            writeStatus(rigs, stderr);
+          }
+        }
+        continue;
+      }
+      if (ready[i].data.ptr == &signal)
+      {
+        running = false;
+        continue;
+      }
+      Rig &rig = *(Rig*)ready[i].data.ptr;
+      if (!serviceRig(rig, outDir) || (ready[i].events & (EPOLLHUP | EPOLLERR) && !(ready[i].events & EPOLLIN)))
+      {
+        closeRig(rig, epoll, outDir);
+        open--;
+      }
+    }
+  }
+  for (std::unique_ptr<Rig> &rig : rigs)
+  {
+    if (rig->open)
+    {
+      serviceRig(*rig, outDir);
+      closeRig(*rig, epoll, outDir);
+    }
+  }
+  publishStatus(rigs, outDir);
+  writeStatus(rigs, stderr);
+  return 0;
+}
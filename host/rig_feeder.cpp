@@ -0,0 +1,166 @@
+/*
+ * Host tool - replay captured logs as rigs on pseudo terminals
+ *
+ *   build : g++ -std=c++17 -O2 -o rig_feeder host/rig_feeder.cpp
+ *   usage : rig_feeder [-b baud] [-c chunk bytes] [-w wait s] log...
+ *           -b 0 writes as fast as the terminals take the data
+ *
+ *   one pseudo terminal per log, the device names are printed one per line on stdout once all are set up,
+ *   after the wait every log is written to its terminal in chunks, interleaved across the rigs and paced at
+ *   the baud rate (10 bits a byte) like boards streaming at once - then the terminals are closed, which is a
+ *   hang up for the reader, so rig_daemon -x on the printed devices ends with one session file per S record
+ *   that must be identical to the matching part of the log
+ */
+
+#include "../config.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+struct FeedRig
+{
+  std::string data;
+  size_t pos;
+  int master;
+  int slave;                          // kept open so the terminal stays up until the log is written
+};
+
+bool openPty(FeedRig &rig,
+             std::string &name)
+{
+  /*
+  Create a raw pseudo terminal pair
+  */
+  rig.master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (rig.master < 0 || grantpt(rig.master) != 0 || unlockpt(rig.master) != 0)
+  {
+    return false;
+  }
+  name = ptsname(rig.master);
+  rig.slave = open(name.c_str(), O_RDWR | O_NOCTTY);
+  if (rig.slave < 0)
+  {
+    return false;
+  }
+  termios tio;
+  tcgetattr(rig.slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(rig.slave, TCSANOW, &tio);
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned long baud = BAUD_RATE;
+  size_t chunk = 64;
+  double wait = 0.5;
+  std::vector<const char*> paths;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "-b" && i + 1 < argc) baud = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "-c" && i + 1 < argc) chunk = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "-w" && i + 1 < argc) wait = strtod(argv[++i], nullptr);
+    else if (arg[0] != '-') paths.push_back(argv[i]);
+    else paths.clear(), i = argc;
+  }
+  if (paths.empty() || chunk == 0)
+  {
+    fprintf(stderr, "usage: %s [-b baud] [-c chunk bytes] [-w wait s] log...\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<FeedRig> rigs(paths.size());
+  for (size_t i = 0; i < rigs.size(); i++)
+  {
+    FILE* file = fopen(paths[i], "rb");
+    if (file == nullptr)
+    {
+      fprintf(stderr, "cannot read %s\n", paths[i]);
+      return 1;
+    }
+    char buffer[65536];
+    for (size_t n; (n = fread(buffer, 1, sizeof(buffer), file)) > 0;)
+    {
+      rigs[i].data.append(buffer, n);
+    }
+    fclose(file);
+    rigs[i].pos = 0;
+    std::string name;
+    if (!openPty(rigs[i], name))
+    {
+      fprintf(stderr, "cannot open a pseudo terminal: %s\n", strerror(errno));
+      return 1;
+    }
+    printf("%s\n", name.c_str());
+  }
+  fflush(stdout);
+  std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+
+  // round robin over the rigs, a chunk each, each rig's bytes due at pos * 10 / baud
+  auto start = std::chrono::steady_clock::now();
+  size_t remaining = rigs.size();
+  while (remaining > 0)
+  {
+    remaining = 0;
+    for (FeedRig &rig : rigs)
+    {
+      if (rig.pos == rig.data.size())
+      {
+        continue;
+      }
+      remaining++;
+      if (baud > 0)
+      {
+        auto due = start + std::chrono::duration<double>(rig.pos * 10.0 / baud);
+        if (std::chrono::steady_clock::now() < due)
+        {
+          continue;
+        }
+      }
+      ssize_t n = write(rig.master, rig.data.data() + rig.pos, std::min(chunk, rig.data.size() - rig.pos));
+      if (n > 0)
+      {
+        rig.pos += n;
+      }
+      else if (n < 0 && errno != EINTR && errno != EAGAIN)
+      {
+        fprintf(stderr, "write failed: %s\n", strerror(errno));
+        return 1;
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(baud > 0 ? 200 : 0));
+  }
+
+  // let the reader drain the terminals before hanging up
+  for (FeedRig &rig : rigs)
+  {
+    tcdrain(rig.master);
+    while (true)
+    {
+      int pending = 0;
+      if (ioctl(rig.slave, FIONREAD, &pending) != 0 || pending == 0)
+      {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+  std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+  for (FeedRig &rig : rigs)
+  {
+    close(rig.slave);
+    close(rig.master);
+  }
+  return 0;
+}
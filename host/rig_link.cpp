@@ -0,0 +1,397 @@
+/*
+ * Host tool - session link client, configures and runs a session on a rig without reflashing it
+ *
+ *   build : g++ -std=c++17 -O2 -o rig_link host/rig_link.cpp
+ *   usage : rig_link [-b baud] [-S solenoid ms] [-I min IR break ms] [-T run min] [-m modes] [-R laps] [-D step s]
+ *                    [-c] [-f] [-o log] [-w timeout s] device [command...]
+ *           -m, -R and -D take one comma separated value per relocation step (modes as A or B), the parameters not
+ *              given keep their config.h default
+ *           -c has the board cache the parameter block in EEPROM (LINK_CACHE), it then comes up with it at power on
+ *           -f uploads the block even when the board reports it already holds the same one
+ *           -o writes the raw serial stream to the file, e.g. for decode_logs
+ *           -w gives up when the board does not answer the hello in time, e.g. a board without SESSION_LINK
+ *           commands, run in order once the board is armed - start (without waiting for the input trigger),
+ *           stop, relocate (move to the next relocation step), wait:<s>, end (wait for the E record)
+ *
+ *   the device (a board's serial port, or the pseudo terminal of rig_pty) is opened raw, the hello is repeated
+ *   until the V record comes back, so the host neither waits out a fixed delay nor misses a board still in its
+ *   bootloader after the reset of the port open - the parameter block is sent unless its CRC matches the one of
+ *   the board's active block, then an empty block arms the board with what it has - the serial output is decoded
+ *   as it arrives with a streaming LogDecoder, text lines and events are printed on stdout, the link replies and
+ *   progress on stderr
+ *
+ *   exit status 1 if the board does not answer or refuses a command, with the LinkStatus of the N record
+ */
+
+#include "../helper.h"
+#include "log_decode.h"
+#include "log_tables.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+const size_t LINK_READ_BUFFER = 64 * 1024;
+const double LINK_REPLY_TIMEOUT = 2.0;  // s
+const double LINK_HELLO_PERIOD = 0.25;  // s between hellos until the board answers
+
+// sketch time parameters are in ms unless TIME_IN_MICROSECONDS
+const unsigned long TICKS_PER_MS = TIME_IN_MICROSECONDS ? 1000UL : 1UL;
+
+const char* const LINK_STATUS_NAMES[] = {"ok", "bad version", "bad value", "busy", "unknown command"};
+
+struct HostLink
+{
+  int fd;
+  byte input[LINK_READ_BUFFER];
+  size_t inputSize;
+  LogDecoder decoder;
+  FILE* log;
+  bool open;
+  std::string line;                   // text of the line that ended the last pumpLink()
+};
+
+speed_t baudConstant(unsigned long baud)
+{
+  switch (baud)
+  {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 500000: return B500000;
+    case 1000000: return B1000000;
+    case 2000000: return B2000000;
+    default: return B115200;
+  }
+}
+
+bool openLink(HostLink &link,
+              const char* path,
+              unsigned long baud)
+{
+  /*
+  Open a serial device raw, 8N1, non blocking, without taking it as controlling terminal
+  */
+  link.fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  link.open = link.fd >= 0;
+  if (!link.open)
+  {
+    return false;
+  }
+  termios tio;
+  if (tcgetattr(link.fd, &tio) == 0)
+  {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    cfsetispeed(&tio, baudConstant(baud));
+    cfsetospeed(&tio, baudConstant(baud));
+    tcsetattr(link.fd, TCSANOW, &tio);
+  }
+  link.inputSize = 0;
+  initLogDecoder(link.decoder, link.input, 0);
+  link.decoder.streaming = true;
+  return true;
+}
+
+bool sendFrame(HostLink &link,
+               byte command,
+               const byte* payload = nullptr,
+               byte size = 0)
+{
+  /*
+  Send one command frame, LINK_SYNC, command, length, payload and the CRC of command to payload
+  */
+  byte frame[5 + LINK_PAYLOAD_MAX];
+  frame[0] = LINK_SYNC;
+  frame[1] = command;
+  frame[2] = size;
+  if (size > 0)
+  {
+    memcpy(frame + 3, payload, size);
+  }
+  uint16_t crc = 0xFFFF;
+  for (byte i = 1; i < 3 + size; i++)
+  {
+    crc = crc16(crc, frame[i]);
+  }
+  frame[3 + size] = crc;
+  frame[4 + size] = crc >> 8;
+  for (size_t sent = 0; sent < 5U + size;)
+  {
+    ssize_t n = write(link.fd, frame + sent, 5 + size - sent);
+    if (n > 0)
+    {
+      sent += n;
+    }
+    else if (n < 0 && errno != EINTR && errno != EAGAIN)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename Match>
+bool pumpLink(HostLink &link,
+              double timeout,
+              Match match)
+{
+  /*
+  Read and print what the board sends until a text line matches or the timeout
+  <double> timeout : s, negative to wait as long as the board is connected
+  <Match> match : bool(const char* line, size_t length)
+
+  Returns:
+  <bool> : true with the matching line in link.line, false on timeout or hang up
+  */
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout);
+  while (link.open)
+  {
+    // decode what the buffer holds first, a reply may have come with the previous read
+    LogItem item;
+    bool matched = false;
+    while (!matched && nextLogItem(link.decoder, item))
+    {
+      if (item.kind == LOG_LINE)
+      {
+        printf("%.*s\n", (int)item.length, item.line);
+        matched = match(item.line, item.length);
+        link.line.assign(item.line, item.length);
+      }
+      else if (item.kind == LOG_EVENT)
+      {
+        printf("%llu,%c,%s,%d\n", (unsigned long long)item.t, (item.code >> 4) == SIDE_A ? 'A' : 'B',
+               LOG_TYPE_NAMES[((item.code >> 1) & 0x7) % LOG_TYPES], item.code & 1);
+      }
+    }
+    size_t consumed = link.decoder.pos;
+    memmove(link.input, link.input + consumed, link.inputSize - consumed);
+    link.inputSize -= consumed;
+    resumeLogDecoder(link.decoder, link.input, link.inputSize, consumed);
+    if (matched)
+    {
+      fflush(stdout);
+      return true;
+    }
+
+    double left = std::chrono::duration<double>(deadline - std::chrono::steady_clock::now()).count();
+    if (timeout >= 0 && left <= 0)
+    {
+      fflush(stdout);
+      return false;
+    }
+    pollfd ready = {link.fd, POLLIN, 0};
+    if (poll(&ready, 1, timeout < 0 ? 100 : (int)(left * 1000) + 1) <= 0)
+    {
+      continue;
+    }
+    ssize_t n = read(link.fd, link.input + link.inputSize, LINK_READ_BUFFER - link.inputSize);
+    if (n > 0)
+    {
+      if (link.log != nullptr)
+      {
+        fwrite(link.input + link.inputSize, 1, n, link.log);
+      }
+      link.inputSize += n;
+      resumeLogDecoder(link.decoder, link.input, link.inputSize, 0);
+    }
+    else if (n == 0 || (errno != EINTR && errno != EAGAIN))
+    {
+      // end of file or EIO once the other side of a pseudo terminal closed
+      link.open = false;
+    }
+  }
+  fflush(stdout);
+  return false;
+}
+
+byte runCommand(HostLink &link,
+                byte command,
+                const byte* payload = nullptr,
+                byte size = 0)
+{
+  /*
+  Send a command and wait for its A or N record
+
+  Returns:
+  <byte> : LinkStatus of the reply, LINK_UNKNOWN without one
+  */
+  if (!sendFrame(link, command, payload, size))
+  {
+    return LINK_UNKNOWN;
+  }
+  bool replied = pumpLink(link, LINK_REPLY_TIMEOUT, [&](const char* line, size_t length)
+  {
+    return length >= 2 && (line[0] == 'A' || line[0] == 'N') && (byte)line[1] == command;
+  });
+  if (!replied)
+  {
+    fprintf(stderr, "no reply to %c\n", command);
+    return LINK_UNKNOWN;
+  }
+  byte status = link.line[0] == 'A' ? (byte)LINK_OK : (byte)strtoul(link.line.c_str() + 3, nullptr, 10);
+  fprintf(stderr, "%c: %s\n", command, LINK_STATUS_NAMES[status <= LINK_UNKNOWN ? status : (byte)LINK_UNKNOWN]);
+  return status;
+}
+
+std::vector<std::string> splitList(const char* list)
+{
+  std::vector<std::string> values;
+  std::string value;
+  for (const char* c = list;; c++)
+  {
+    if (*c == ',' || *c == '\0')
+    {
+      values.push_back(value);
+      value.clear();
+      if (*c == '\0')
+      {
+        break;
+      }
+      continue;
+    }
+    value.push_back(*c);
+  }
+  return values;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned long baud = BAUD_RATE;
+  bool cache = false;
+  bool force = false;
+  const char* logPath = nullptr;
+  double timeout = 10;
+  bool valid = true;
+  SessionParams params;
+  initSessionParams(params);
+  const char* path = nullptr;
+  std::vector<std::string> commands;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "-b" && i + 1 < argc) baud = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "-S" && i + 1 < argc) params.solenoidDuration = strtoul(argv[++i], nullptr, 10) * TICKS_PER_MS;
+    else if (arg == "-I" && i + 1 < argc) params.minIRBreak = strtoul(argv[++i], nullptr, 10) * TICKS_PER_MS;
+    else if (arg == "-T" && i + 1 < argc) params.runDuration = (Timestamp)(strtod(argv[++i], nullptr) * 60e3 * TICKS_PER_MS);
+    else if (arg == "-c") cache = true;
+    else if (arg == "-f") force = true;
+    else if (arg == "-o" && i + 1 < argc) logPath = argv[++i];
+    else if (arg == "-w" && i + 1 < argc) timeout = strtod(argv[++i], nullptr);
+    else if ((arg == "-m" || arg == "-R" || arg == "-D") && i + 1 < argc)
+    {
+      std::vector<std::string> values = splitList(argv[++i]);
+      valid = valid && values.size() <= RELOCATION_STEPS;
+      for (byte step = 0; step < values.size() && step < RELOCATION_STEPS; step++)
+      {
+        const char* value = values[step].c_str();
+        if (arg == "-m") params.relocationMode[step] = value[0] == 'B' || value[0] == 'b' ? MODE_B : MODE_A;
+        if (arg == "-R") params.relocationLaps[step] = strtoul(value, nullptr, 10);
+        if (arg == "-D") params.relocationDuration[step] = (Timestamp)(strtod(value, nullptr) * 1e3 * TICKS_PER_MS);
+      }
+    }
+    else if (arg[0] != '-' && path == nullptr) path = argv[i];
+    else if (arg[0] != '-') commands.push_back(arg);
+    else valid = false;
+  }
+  for (const std::string &command : commands)
+  {
+    valid = valid && (command == "start" || command == "stop" || command == "relocate" || command == "end" ||
+                      command.compare(0, 5, "wait:") == 0);
+  }
+  if (!valid || path == nullptr)
+  {
+    fprintf(stderr, "usage: %s [-b baud] [-S solenoid ms] [-I min IR break ms] [-T run min] [-m modes] [-R laps] "
+                    "[-D step s] [-c] [-f] [-o log] [-w timeout s] device [start|stop|relocate|wait:<s>|end...]\n", argv[0]);
+    return 2;
+  }
+
+  static HostLink link;
+  if (!openLink(link, path, baud))
+  {
+    fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  link.log = logPath != nullptr ? fopen(logPath, "wb") : nullptr;
+
+  // hello until the board answers, whatever it printed before (banner of a fresh reset) goes through
+  auto start = std::chrono::steady_clock::now();
+  unsigned int version = 0, size = 0, crc = 0;
+  bool hello = false;
+  while (!hello && link.open && std::chrono::steady_clock::now() - start < std::chrono::duration<double>(timeout))
+  {
+    sendFrame(link, LINK_HELLO);
+    hello = pumpLink(link, LINK_HELLO_PERIOD, [](const char* line, size_t length)
+    {
+      return length >= 2 && line[0] == 'V' && line[1] >= '0' && line[1] <= '9';
+    });
+  }
+  if (!hello || sscanf(link.line.c_str(), "V%u,%u,%u", &version, &size, &crc) != 3)
+  {
+    fprintf(stderr, "no hello from %s\n", path);
+    return 1;
+  }
+  fprintf(stderr, "hello after %.3f s: version %u, block %u bytes\n",
+          std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), version, size);
+  if (version != LINK_PARAMS_VERSION || size != LINK_PARAMS_SIZE)
+  {
+    fprintf(stderr, "the board speaks version %u with a %u byte block, this build %u with %u bytes\n", version, size,
+            LINK_PARAMS_VERSION, LINK_PARAMS_SIZE);
+    return 1;
+  }
+
+  // the CRC of the hello is over the block without flags
+  byte block[LINK_PARAMS_SIZE];
+  packSessionParams(params, 0, block);
+  bool current = crc == crc16(block, LINK_PARAMS_SIZE) && !force;
+  packSessionParams(params, cache ? LINK_CACHE : 0, block);
+  fprintf(stderr, current ? "parameters current, arming\n" : "uploading parameters\n");
+  if (runCommand(link, LINK_PARAMS, block, current ? 0 : LINK_PARAMS_SIZE) != LINK_OK)
+  {
+    return 1;
+  }
+
+  for (const std::string &command : commands)
+  {
+    byte status = LINK_OK;
+    if (command == "start") status = runCommand(link, LINK_START);
+    else if (command == "stop") status = runCommand(link, LINK_STOP);
+    else if (command == "relocate") status = runCommand(link, LINK_RELOCATE);
+    else if (command == "end")
+    {
+      bool ended = pumpLink(link, -1, [](const char* line, size_t length)
+      {
+        return length >= 2 && line[0] == 'E' && line[1] >= '0' && line[1] <= '9';
+      });
+      status = ended ? LINK_OK : LINK_UNKNOWN;
+      fprintf(stderr, ended ? "session ended\n" : "hang up before the session ended\n");
+    }
+    else
+    {
+      pumpLink(link, strtod(command.c_str() + 5, nullptr), [](const char*, size_t) { return false; });
+    }
+    if (status != LINK_OK)
+    {
+      return 1;
+    }
+  }
+  // the tail of what the board sent so far
+  pumpLink(link, 0.1, [](const char*, size_t) { return false; });
+  if (link.log != nullptr)
+  {
+    fclose(link.log);
+  }
+  close(link.fd);
+  return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * Host tool - the sketch as a rig on a pseudo terminal, in real time
+ *
+ *   build : g++ -std=c++17 -O2 -o rig_pty host/rig_pty.cpp
+ *   usage : rig_pty [-t trigger s] [-e eeprom file] [-p loop period us]
+ *           -t fires the input trigger the given time after power on, e.g. to try the session link against a
+ *              rig waiting for the acquisition, by default the trigger never comes
+ *           -e loads the virtual EEPROM from the file at power on and writes it back at the end, so a cached
+ *              parameter block (LINK_CACHE) survives like on the board
+ *
+ *   runs setup()/loop() of the sketch on the virtual board with its clock following the wall clock, the board's
+ *   serial port is the pseudo terminal whose device name is printed on stdout - what the host writes there is
+ *   what Serial.read() returns, e.g. the frames of rig_link, and the serial output is written back as it is
+ *   produced - the board powers up as soon as the name is printed and the tool exits once the board halted, a
+ *   little after its session ended or on SIGINT/SIGTERM
+ */
+
+#include "../linear_track_alternate_reward.ino"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+// virtual clock is in us, sketch time parameters are in ms unless TIME_IN_MICROSECONDS
+const unsigned long long US_PER_TICK = TIME_IN_MICROSECONDS ? 1ULL : 1000ULL;
+
+volatile sig_atomic_t stopRequested = 0;
+
+void requestStop(int)
+{
+  stopRequested = 1;
+}
+
+bool openPty(int &master,
+             int &slave,
+             std::string &name)
+{
+  /*
+  Create a raw pseudo terminal pair, the slave is kept open so the terminal stays up between host connections
+  */
+  master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+  {
+    return false;
+  }
+  name = ptsname(master);
+  slave = open(name.c_str(), O_RDWR | O_NOCTTY);
+  if (slave < 0)
+  {
+    return false;
+  }
+  termios tio;
+  tcgetattr(slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+  return true;
+}
+
+bool writeAll(int fd,
+              const char* data,
+              size_t size)
+{
+  while (size > 0)
+  {
+    ssize_t n = write(fd, data, size);
+    if (n > 0)
+    {
+      data += n;
+      size -= n;
+    }
+    else if (n < 0 && errno == EAGAIN)
+    {
+      // nobody reads the terminal, a board would block on its full TX buffer too
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    else if (n < 0 && errno != EINTR)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  double tTrigger = -1;
+  const char* eepromPath = nullptr;
+  unsigned long long loopPeriod = 100;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "-t" && i + 1 < argc) tTrigger = strtod(argv[++i], nullptr);
+    else if (arg == "-e" && i + 1 < argc) eepromPath = argv[++i];
+    else if (arg == "-p" && i + 1 < argc) loopPeriod = strtoull(argv[++i], nullptr, 10);
+    else tTrigger = -2, i = argc;
+  }
+  if (tTrigger < -1 || loopPeriod == 0)
+  {
+    fprintf(stderr, "usage: %s [-t trigger s] [-e eeprom file] [-p loop period us]\n", argv[0]);
+    return 2;
+  }
+
+  int master, slave;
+  std::string name;
+  if (!openPty(master, slave, name))
+  {
+    fprintf(stderr, "cannot open a pseudo terminal: %s\n", strerror(errno));
+    return 1;
+  }
+  signal(SIGINT, requestStop);
+  signal(SIGTERM, requestStop);
+
+  hostReset();
+  if (eepromPath != nullptr)
+  {
+    FILE* file = fopen(eepromPath, "rb");
+    if (file != nullptr)
+    {
+      size_t n = fread(hostBoard.eeprom, 1, HOST_EEPROM_SIZE, file);
+      fclose(file);
+      fprintf(stderr, "eeprom: %zu bytes from %s\n", n, eepromPath);
+    }
+  }
+  // one trigger pulse, the drive script returns the time of its next pin change
+  unsigned long long tTriggerEdges[2] = {~0ULL, ~0ULL};
+  if (tTrigger >= 0)
+  {
+    tTriggerEdges[0] = (unsigned long long)(tTrigger * 1e6);
+    tTriggerEdges[1] = tTriggerEdges[0] + US_PER_TICK * TTL_PULSE_WIDTH;
+  }
+  byte triggerEdge = 0;
+  hostBoard.drive = [&](HostBoard &board)
+  {
+    for (; triggerEdge < 2 && board.tMicros >= tTriggerEdges[triggerEdge]; triggerEdge++)
+    {
+      hostDrivePin(INPUT_TRIGGER, triggerEdge == 0);
+    }
+    return triggerEdge < 2 ? tTriggerEdges[triggerEdge] : ~0ULL;
+  };
+  printf("%s\n", name.c_str());
+  fflush(stdout);
+
+  auto start = std::chrono::steady_clock::now();
+  setup();
+  size_t sent = 0;
+  unsigned long long tStop = ~0ULL;
+  while (!hostBoard.halted && hostBoard.tMicros < tStop && !stopRequested)
+  {
+    char input[256];
+    ssize_t n = read(master, input, sizeof(input));
+    if (n > 0)
+    {
+      hostSerialInput(input, n);
+    }
+    unsigned long long tWall = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    hostAdvance(tWall > hostBoard.tMicros ? tWall - hostBoard.tMicros : 0);
+    loop();
+    if (!writeAll(master, hostBoard.serialOut.data() + sent, hostBoard.serialOut.size() - sent))
+    {
+      fprintf(stderr, "write failed: %s\n", strerror(errno));
+      return 1;
+    }
+    sent = hostBoard.serialOut.size();
+    if (hostBoard.sessionEnded && tStop == ~0ULL)
+    {
+      // let the output trigger train complete, as simulate does
+      tStop = hostBoard.tMicros + 2ULL * US_PER_TICK * TTL_DURATION;
+      tStop += SYNC_BARCODE ? US_PER_TICK * ((2ULL + SYNC_BARCODE_BITS) * SYNC_BARCODE_SLOT + TTL_TRAIN_GAP) : 0;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(loopPeriod));
+  }
+  writeAll(master, hostBoard.serialOut.data() + sent, hostBoard.serialOut.size() - sent);
+  // give the reader the tail before the hang up
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  if (eepromPath != nullptr)
+  {
+    FILE* file = fopen(eepromPath, "wb");
+    if (file != nullptr)
+    {
+      fwrite(hostBoard.eeprom, 1, HOST_EEPROM_SIZE, file);
+      fclose(file);
+    }
+  }
+  close(master);
+  close(slave);
+  return 0;
+}
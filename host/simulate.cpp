@@ -0,0 +1,588 @@
+/*
+ * Host simulator - runs setup()/loop() of the sketch on the virtual board in host/hal_host.h
+ *   against stochastic virtual animals, faster than real time
+ *
+ *   build : g++ -std=c++17 -O2 -o simulate host/simulate.cpp
+ *   usage : simulate [-n animals] [-s seed] [-p loop period us] [-t start us] [-l] [-o prefix] [-d ppm] [-x fraction] [-f hz] [-j us]
+ *           -t starts the virtual clock at the given value, e.g. 4294000000 to run across the
+ *              micros() (and with -t 4294967000000 the millis()) 32 bit overflow
+ *           -l echoes the serial stream of every session to stdout
+ *           -o writes the raw serial stream of every session to <prefix><animal>.log, e.g. for replay_trace,
+ *              and the photometry TTL edges to <prefix><animal>.ttl as "time_s,input,level" lines, e.g. for
+ *              align_sessions - time is on the photometry clock, zero at the acquisition trigger
+ *           -d runs the photometry clock fast by the given drift in ppm against the board clock
+ *           -x drops the given fraction of the photometry TTL edges
+ *           -f writes a synthetic photometry recording at the given rate in Hz to <prefix><animal>.phot as
+ *              "time_s,signal,isosbestic" lines, e.g. for peth - bleaching and motion on both channels, a
+ *              norepinephrine transient of 4 % dF/F after every reward (8 % after the relocation) on the signal
+ *           -j bounds the pulse width and period error of the recorded photometry TTL trains, defaults to
+ *              TTL_JITTER_MAX_US
+ *
+ *   prints one CSV row per animal, serial output is decoded from the captured stream and the
+ *   loop profile is the sketch's own (virtual time per pass, including serial blocking), with
+ *   LINEAR_ACTUATOR the reward port stage is simulated too (ActuatorModel) and reported in extra columns
+ *
+ *   exit status 1 if a TTL pulse width or period error of any session exceeds the -j bound
+ */
+
+#include "../linear_track_alternate_reward.ino"
+#include "log_tables.h"
+
+#include <chrono>
+#include <queue>
+#include <random>
+#include <vector>
+#include <stdlib.h>
+
+// virtual clock is in us, sketch time parameters are in ms unless TIME_IN_MICROSECONDS
+const unsigned long long US_PER_TICK = TIME_IN_MICROSECONDS ? 1ULL : 1000ULL;
+
+struct PinEdge
+{
+  unsigned long long t;
+  byte pin;
+  bool level;
+  bool operator>(const PinEdge &other) const { return t > other.t; }
+};
+
+struct AnimalModel
+{
+  /*
+  Shuttling animal - breaks the IR beam at one track end, licks in bouts, runs to the other end
+    all times in us, drawn per visit so every animal behaves differently
+  */
+  std::mt19937_64 rng;
+  std::priority_queue<PinEdge, std::vector<PinEdge>, std::greater<PinEdge>> edges;
+  unsigned long long tNextVisit;
+  byte side;
+  double meanRunTime;   // one lap length / running speed
+  double meanDwellTime; // time spent at the track end
+  double lickRate;      // licks per second while at the port
+  double chatterProb;   // chance of beam chatter on arrival
+
+  double uniform(double lo, double hi) { return std::uniform_real_distribution<double>(lo, hi)(rng); }
+
+  void scheduleVisit(unsigned long long tArrive)
+  {
+    byte irPin = side == SIDE_A ? IR_A_PIN : IR_B_PIN;
+    byte touchPin = side == SIDE_A ? TOUCH_A_PIN : TOUCH_B_PIN;
+    unsigned long long tLeave = tArrive + (unsigned long long)(std::exponential_distribution<double>(1.0 / meanDwellTime)(rng) + 2e5);
+    unsigned long long t = tArrive;
+    if (uniform(0, 1) < chatterProb)
+    {
+      // beam flickers for a few ms while the animal enters
+      int n = 2 + (int)uniform(0, 4);
+      for (int i = 0; i < n; i++)
+      {
+        edges.push({t, irPin, true});
+        t += (unsigned long long)uniform(100, 900);
+        edges.push({t, irPin, false});
+        t += (unsigned long long)uniform(100, 900);
+      }
+    }
+    edges.push({t, irPin, true});
+    edges.push({tLeave, irPin, false});
+    // lick bout, ~30ms contacts
+    double tLick = t + uniform(1e5, 4e5);
+    while (lickRate > 0 && tLick + 3e4 < tLeave)
+    {
+      edges.push({(unsigned long long)tLick, touchPin, true});
+      edges.push({(unsigned long long)(tLick + uniform(1.5e4, 4e4)), touchPin, false});
+      tLick += std::exponential_distribution<double>(lickRate / 1e6)(rng) + 5e4;
+    }
+    tNextVisit = tLeave + (unsigned long long)std::max(5e5, std::normal_distribution<double>(meanRunTime, meanRunTime / 4)(rng));
+    side = side == SIDE_A ? SIDE_B : SIDE_A;
+  }
+
+  unsigned long long drive(HostBoard &board)
+  {
+    /*
+    Apply every pin change due by now, returns the time of the next one
+    */
+    while (true)
+    {
+      while (!edges.empty() && edges.top().t <= board.tMicros)
+      {
+        hostDrivePin(edges.top().pin, edges.top().level);
+        edges.pop();
+      }
+      if (!edges.empty())
+      {
+        return edges.top().t;
+      }
+      if (board.tMicros < tNextVisit)
+      {
+        return tNextVisit;
+      }
+      scheduleVisit(tNextVisit);
+    }
+  }
+};
+
+struct ActuatorModel
+{
+  /*
+  Lead screw stage on a step/direction driver (LINEAR_ACTUATOR) - moves one step on every rising edge of the
+    step output in the direction set on the direction output, the limit switches close at the ends of the
+    travel and a hard stop ACTUATOR_HOME_OFFSET beyond the proximal switch swallows further steps, steps
+    faster than the pull-out rate are lost - positions in steps from the proximal switch
+  */
+  long position;
+  long hardStop;
+  long distalSwitch;
+  double pullOutRate;           // steps/s the motor follows at most
+  unsigned long long tStep;
+  unsigned long long minInterval;
+  unsigned long steps;
+  unsigned long lost;
+
+  void init(long start)
+  {
+    position = start;
+    hardStop = -ACTUATOR_HOME_OFFSET;
+    distalSwitch = ACTUATOR_TRAVEL + 2 * ACTUATOR_HOME_OFFSET;
+    pullOutRate = 1.25 * ACTUATOR_MAX_SPEED;
+    tStep = 0;
+    minInterval = ~0ULL;
+    steps = 0;
+    lost = 0;
+    drive();
+  }
+
+  void drive()
+  {
+    hostDrivePin(ACTUATOR_PROXIMAL_LIMIT_PIN, (position <= 0) != ACTUATOR_LIMIT_ACTIVE_LOW);
+    if (ACTUATOR_DISTAL_LIMIT_PIN != PIN_NONE)
+    {
+      hostDrivePin(ACTUATOR_DISTAL_LIMIT_PIN, (position >= distalSwitch) != ACTUATOR_LIMIT_ACTIVE_LOW);
+    }
+  }
+
+  void output(HostBoard &board, byte pin, bool level)
+  {
+    if (pin != ACTUATOR_STEP_PIN || !level)
+    {
+      return;
+    }
+    unsigned long long interval = board.tMicros - tStep;
+    minInterval = steps && interval < minInterval ? interval : minInterval;
+    bool stalled = steps && interval < 1e6 / pullOutRate;
+    tStep = board.tMicros;
+    steps++;
+    long next = position + (board.level[ACTUATOR_DIR_PIN] == ACTUATOR_DIR_DISTAL ? 1 : -1);
+    if (stalled || next < hardStop)
+    {
+      lost++;
+      return;
+    }
+    position = next;
+    drive();
+  }
+};
+
+struct SessionSummary
+{
+  unsigned long events;
+  unsigned long irBreaks;
+  unsigned long touches;
+  unsigned long rewards[2];
+  unsigned long relocations;
+  unsigned long eventsLost;
+  unsigned long long tEnd;
+  unsigned long long tTrigger;  // acquisition start, time zero of the photometry clock
+  unsigned long loopMax;
+  unsigned long loopP99;
+  unsigned long loopOverBudget;
+  unsigned long long ttlWidthErrMax;
+  unsigned long long ttlPeriodErrMax;
+  unsigned long ttlTrains;
+  unsigned long ttlDelayed;
+  unsigned long ttlDropped;
+  unsigned long actuatorMoves;
+  unsigned long actuatorSteps;
+  unsigned long actuatorLost;
+  double actuatorMaxRate;       // steps/s
+  long actuatorError;           // stage position against the position the sketch holds, steps
+};
+
+void countEvent(SessionSummary &summary, byte side, byte type, byte state)
+{
+  summary.events++;
+  if (state == ON)
+  {
+    summary.irBreaks += type == IR;
+    summary.touches += type == TOUCH;
+    summary.rewards[side & 1] += type == SOLENOID;
+    summary.relocations += type == RELOCATE;
+    summary.actuatorMoves += type == ACTUATOR;
+  }
+}
+
+SessionSummary summarize(const std::string &serialOut)
+{
+  /*
+  Decode the events of one session, binary eventLog() frames or legacy ascii lines
+    (side, type, state digits followed by time) interleaved with the S/E records, banner and pin trace
+  */
+  SessionSummary summary = {};
+  LogDecoder decoder;
+  LogItem item;
+  initLogDecoder(decoder, serialOut);
+  while (nextLogItem(decoder, item))
+  {
+    if (item.kind == LOG_EVENT)
+    {
+      countEvent(summary, item.code >> 4, (item.code >> 1) & 0x07, item.code & 0x01);
+      continue;
+    }
+    if (item.kind != LOG_LINE)
+    {
+      continue;
+    }
+    std::string line(item.line, item.length);
+    if (line.size() > 3 && line[0] >= '0' && line[0] <= '1' && line[1] >= '0' && line[1] <= '4')
+    {
+      countEvent(summary, line[0] - '0', line[1] - '0', line[2] - '0');
+    }
+    unsigned long pin, sent, delayed, dropped;
+    if (line[0] == 'T' && sscanf(line.c_str() + 1, "%lu,%lu,%lu,%lu", &pin, &sent, &delayed, &dropped) == 4)
+    {
+      // T records of the queued event outputs
+      summary.ttlDelayed += delayed;
+      summary.ttlDropped += dropped;
+    }
+  }
+  // sequence numbers missing from the stream, EVENT_COMPACT only
+  summary.eventsLost = decoder.eventsLost + decoder.eventsUnresolved;
+  return summary;
+}
+
+unsigned long long ttlWidthError(const std::vector<HostEdge> &edges)
+{
+  /*
+  Largest deviation of a recorded photometry TTL pulse from its configured width in us
+  */
+  unsigned long long tRise[HOST_NUM_PINS] = {};
+  unsigned long long errMax = 0;
+  unsigned long long width = US_PER_TICK * (TTL_PATTERN_ENCODING ? TTL_PATTERN_WIDTH : TTL_PULSE_WIDTH);
+  for (const HostEdge &edge : edges)
+  {
+    if (edge.pin != OUTPUT_IR && edge.pin != OUTPUT_TOUCH && edge.pin != OUTPUT_SOLENOID)
+    {
+      continue;
+    }
+    if (edge.level)
+    {
+      tRise[edge.pin] = edge.t;
+      continue;
+    }
+    unsigned long long high = edge.t - tRise[edge.pin];
+    if (high <= width)
+    {
+      errMax = std::max(errMax, width - high);
+    }
+    else
+    {
+      errMax = std::max(errMax, high - width);
+    }
+  }
+  return errMax;
+}
+
+unsigned long long ttlPeriodError(const std::vector<HostEdge> &edges)
+{
+  /*
+  Largest deviation of a recorded pulse period (rising edge to rising edge within a train) from the nearest
+    configured period in us, outputs send the period of the port of their event
+  */
+  unsigned long long tRise[HOST_NUM_PINS] = {};
+  unsigned long long tFall[HOST_NUM_PINS] = {};
+  bool inTrain[HOST_NUM_PINS] = {};
+  unsigned long long errMax = 0;
+  for (const HostEdge &edge : edges)
+  {
+    if (edge.pin != OUTPUT_IR && edge.pin != OUTPUT_TOUCH && edge.pin != OUTPUT_SOLENOID)
+    {
+      continue;
+    }
+    if (!edge.level)
+    {
+      tFall[edge.pin] = edge.t;
+      continue;
+    }
+    if (inTrain[edge.pin] && edge.t - tFall[edge.pin] < US_PER_TICK * TTL_TRAIN_GAP)
+    {
+      unsigned long long period = edge.t - tRise[edge.pin];
+      unsigned long long err = ~0ULL;
+      for (byte i = 0; i <= PORT_COUNT; i++)
+      {
+        unsigned long long expected = US_PER_TICK * (TTL_PATTERN_ENCODING ? TTL_PATTERN_PERIOD : i < PORT_COUNT ? PORT_TTL_PERIOD[i] : TTL_PULSE_PERIOD);
+        err = std::min(err, period > expected ? period - expected : expected - period);
+      }
+      errMax = std::max(errMax, err);
+    }
+    inTrain[edge.pin] = true;
+    tRise[edge.pin] = edge.t;
+  }
+  return errMax;
+}
+
+unsigned long countTTLTrains(const std::vector<HostEdge> &edges)
+{
+  /*
+  Number of event trains seen on the photometry inputs, a rising edge after at least TTL_TRAIN_GAP
+    of low time starts a new train
+  */
+  unsigned long long tFall[HOST_NUM_PINS] = {};
+  bool seen[HOST_NUM_PINS] = {};
+  unsigned long trains = 0;
+  for (const HostEdge &edge : edges)
+  {
+    if (edge.pin != OUTPUT_IR && edge.pin != OUTPUT_TOUCH && edge.pin != OUTPUT_SOLENOID)
+    {
+      continue;
+    }
+    if (!edge.level)
+    {
+      tFall[edge.pin] = edge.t;
+      continue;
+    }
+    if (!seen[edge.pin] || edge.t - tFall[edge.pin] >= US_PER_TICK * TTL_TRAIN_GAP)
+    {
+      trains++;
+    }
+    seen[edge.pin] = true;
+  }
+  return trains;
+}
+
+SessionSummary simulateSession(unsigned long long seed,
+                               unsigned long long loopPeriod,
+                               unsigned long long tStart,
+                               bool echo)
+{
+  /*
+  Run one full session of the sketch on a fresh virtual board
+  <unsigned long long> seed : animal seed
+  <unsigned long long> loopPeriod : virtual duration of one loop() pass in us
+  <unsigned long long> tStart : virtual clock at power on in us
+  <bool> echo : mirror serial output to stdout
+  */
+  AnimalModel animal;
+  animal.rng.seed(seed);
+  animal.side = SIDE_A;
+  animal.meanRunTime = animal.uniform(2e6, 8e6);
+  animal.meanDwellTime = animal.uniform(1e6, 4e6);
+  animal.lickRate = animal.uniform(2, 8);
+  animal.chatterProb = animal.uniform(0, 0.5);
+
+  // acquisition start trigger from the photometry system shortly after the serial link is up
+  unsigned long long tTrigger = tStart + 1001ULL * 1000ULL + (unsigned long long)animal.uniform(1e6, 3e6);
+  animal.tNextVisit = tTrigger + (unsigned long long)animal.uniform(1e6, 5e6);
+
+  animal.edges.push({tTrigger, INPUT_TRIGGER, true});
+  animal.edges.push({tTrigger + US_PER_TICK * TTL_PULSE_WIDTH, INPUT_TRIGGER, false});
+
+  hostReset(tStart);
+  hostBoard.echo = echo;
+  hostBoard.recordOutputs = true;
+  hostBoard.drive = [&](HostBoard &board) { return animal.drive(board); };
+  ActuatorModel stage;
+  if (LINEAR_ACTUATOR)
+  {
+    // the stage was left anywhere on its travel
+    stage.init((long)animal.uniform(0, ACTUATOR_TRAVEL));
+    hostBoard.output = [&](HostBoard &board, byte pin, bool level) { stage.output(board, pin, level); };
+  }
+
+  setup();
+  // stop a little after the E record so the output trigger train completes
+  unsigned long long tStop = ~0ULL;
+  unsigned long long tLimit = tTrigger + 2ULL * US_PER_TICK * (DELAY_START + RUN_TIME_DURATION);
+  while (!hostBoard.halted && hostBoard.tMicros < tStop && hostBoard.tMicros < tLimit)
+  {
+    hostAdvance(loopPeriod);
+    loop();
+    if (hostBoard.sessionEnded && tStop == ~0ULL)
+    {
+      // the trigger may wait for a sync barcode still being sent
+      tStop = hostBoard.tMicros + 2ULL * US_PER_TICK * TTL_DURATION;
+      tStop += SYNC_BARCODE ? US_PER_TICK * ((2ULL + SYNC_BARCODE_BITS) * SYNC_BARCODE_SLOT + TTL_TRAIN_GAP) : 0;
+    }
+  }
+  hostBoard.drive = nullptr;
+  hostBoard.output = nullptr;
+
+  SessionSummary summary = summarize(hostBoard.serialOut);
+  summary.tEnd = hostBoard.tMicros - tStart;
+  summary.tTrigger = tTrigger;
+  summary.loopMax = loopProfile.maxDuration;
+  summary.loopP99 = loopProfilePercentile(loopProfile, 99);
+  summary.loopOverBudget = loopProfile.overBudget;
+  summary.ttlWidthErrMax = ttlWidthError(hostBoard.outputEdges);
+  summary.ttlPeriodErrMax = ttlPeriodError(hostBoard.outputEdges);
+  summary.ttlTrains = countTTLTrains(hostBoard.outputEdges);
+#if LINEAR_ACTUATOR_ENABLED
+  summary.actuatorSteps = stage.steps;
+  summary.actuatorLost = stage.lost;
+  summary.actuatorMaxRate = stage.minInterval != ~0ULL ? 1e6 / stage.minInterval : 0;
+  summary.actuatorError = stage.position - (actuator.currentPosition + ACTUATOR_HOME_OFFSET);
+#endif
+  return summary;
+}
+
+bool writePhotometryEdges(const std::string &path,
+                          unsigned long long tTrigger,
+                          double driftPpm,
+                          double edgeLoss,
+                          unsigned long long seed)
+{
+  /*
+  Write the edges of the photometry outputs as the acquisition system records them, inputs numbered as
+    wired (OUTPUT_TRIGGER 1, OUTPUT_IR 2, OUTPUT_TOUCH 3, OUTPUT_SOLENOID 4)
+  */
+  FILE* file = fopen(path.c_str(), "w");
+  if (file == nullptr)
+  {
+    return false;
+  }
+  std::mt19937_64 rng(seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  fprintf(file, "time_s,input,level\n");
+  for (const HostEdge &edge : hostBoard.outputEdges)
+  {
+    byte input = edge.pin == OUTPUT_TRIGGER ? 1 : edge.pin == OUTPUT_IR ? 2 : edge.pin == OUTPUT_TOUCH ? 3 : edge.pin == OUTPUT_SOLENOID ? 4 : 0;
+    if (input == 0 || edge.t < tTrigger || uniform(rng) < edgeLoss)
+    {
+      continue;
+    }
+    fprintf(file, "%.6f,%d,%d\n", (edge.t - tTrigger) * (1 + driftPpm * 1e-6) / 1e6, input, edge.level);
+  }
+  return fclose(file) == 0;
+}
+
+bool writePhotometry(const std::string &path,
+                     unsigned long long tTrigger,
+                     double driftPpm,
+                     double rate,
+                     unsigned long long seed)
+{
+  /*
+  Write a synthetic photometry recording of the session just run on the photometry clock of
+    writePhotometryEdges(), the transients follow the rewards of the session log
+  */
+  FILE* file = fopen(path.c_str(), "w");
+  if (file == nullptr)
+  {
+    return false;
+  }
+  LogTables tables;
+  decodeLogTables((const byte*)hostBoard.serialOut.data(), hostBoard.serialOut.size(), tables);
+  auto photometryTime = [&](double tMicros) { return (tMicros - tTrigger) * (1 + driftPpm * 1e-6) / 1e6; };
+  size_t n = (size_t)(photometryTime(hostBoard.tMicros) * rate);
+  std::vector<double> ne(n, 0.0);
+  const std::vector<Timestamp> &relocations = tables.events[RELOCATE].t;
+  for (Timestamp t : tables.rewards.t)
+  {
+    double tReward = photometryTime((double)t * US_PER_TICK);
+    double amplitude = relocations.size() > 1 && t >= relocations[1] ? 0.08 : 0.04;
+    for (size_t k = (size_t)std::max(0.0, ceil(tReward * rate)); k < n && k < (tReward + 8) * rate; k++)
+    {
+      double u = (k / rate - tReward) / 0.8;
+      ne[k] += amplitude * u * exp(1 - u);
+    }
+  }
+  std::mt19937_64 rng(seed);
+  std::normal_distribution<double> noise(0, 0.002);
+  double motion = 0;
+  fprintf(file, "time_s,signal,isosbestic\n");
+  for (size_t k = 0; k < n; k++)
+  {
+    double t = k / rate;
+    double bleach = 1 + 0.3 * exp(-t / 600);
+    motion = 0.995 * motion + 0.1 * noise(rng);
+    double shared = bleach * (1 + motion);
+    fprintf(file, "%.4f,%.6f,%.6f\n", t, 2.0 * shared * (1 + ne[k]) + noise(rng), 0.8 * shared + noise(rng));
+  }
+  return fclose(file) == 0;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned long animals = 1;
+  unsigned long long seed = 1;
+  unsigned long long loopPeriod = 100;
+  unsigned long long tStart = 0;
+  bool echo = false;
+  std::string outPrefix;
+  double driftPpm = 0;
+  double edgeLoss = 0;
+  double photometryRate = 0;
+  unsigned long long jitterMax = TTL_JITTER_MAX_US;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "-n" && i + 1 < argc) animals = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "-s" && i + 1 < argc) seed = strtoull(argv[++i], nullptr, 10);
+    else if (arg == "-p" && i + 1 < argc) loopPeriod = strtoull(argv[++i], nullptr, 10);
+    else if (arg == "-t" && i + 1 < argc) tStart = strtoull(argv[++i], nullptr, 10);
+    else if (arg == "-l") echo = true;
+    else if (arg == "-o" && i + 1 < argc) outPrefix = argv[++i];
+    else if (arg == "-d" && i + 1 < argc) driftPpm = strtod(argv[++i], nullptr);
+    else if (arg == "-x" && i + 1 < argc) edgeLoss = strtod(argv[++i], nullptr);
+    else if (arg == "-f" && i + 1 < argc) photometryRate = strtod(argv[++i], nullptr);
+    else if (arg == "-j" && i + 1 < argc) jitterMax = strtoull(argv[++i], nullptr, 10);
+    else
+    {
+      fprintf(stderr, "usage: %s [-n animals] [-s seed] [-p loop period us] [-t start us] [-l] [-o prefix] [-d ppm] [-x fraction] [-f hz] [-j us]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  printf("animal,seed,events,ir_breaks,touches,rewards_a,rewards_b,relocations,events_lost,serial_blocked_ms,loop_max_us,loop_p99_us,loop_over_budget,ttl_width_err_max_us,ttl_period_err_max_us,ttl_trains,ttl_delayed,ttl_dropped,sim_s,wall_ms%s\n",
+         LINEAR_ACTUATOR ? ",actuator_moves,actuator_steps,actuator_lost,actuator_max_rate,actuator_error" : "");
+  bool jitterExceeded = false;
+  for (unsigned long i = 0; i < animals; i++)
+  {
+    auto wallStart = std::chrono::steady_clock::now();
+    SessionSummary s = simulateSession(seed + i, loopPeriod, tStart, echo);
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+    if (!outPrefix.empty())
+    {
+      std::string path = outPrefix + std::to_string(i) + ".log";
+      FILE* file = fopen(path.c_str(), "wb");
+      if (file == nullptr || fwrite(hostBoard.serialOut.data(), 1, hostBoard.serialOut.size(), file) != hostBoard.serialOut.size())
+      {
+        fprintf(stderr, "cannot write %s\n", path.c_str());
+        return 1;
+      }
+      fclose(file);
+      if (!writePhotometryEdges(outPrefix + std::to_string(i) + ".ttl", s.tTrigger, driftPpm, edgeLoss, seed + i))
+      {
+        fprintf(stderr, "cannot write %s%lu.ttl\n", outPrefix.c_str(), i);
+        return 1;
+      }
+      if (photometryRate > 0 &&
+          !writePhotometry(outPrefix + std::to_string(i) + ".phot", s.tTrigger, driftPpm, photometryRate, seed + i))
+      {
+        fprintf(stderr, "cannot write %s%lu.phot\n", outPrefix.c_str(), i);
+        return 1;
+      }
+    }
+    printf("%lu,%llu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.1f,%lu,%lu,%lu,%llu,%llu,%lu,%lu,%lu,%.1f,%.1f",
+           i, seed + i, s.events, s.irBreaks, s.touches, s.rewards[SIDE_A], s.rewards[SIDE_B], s.relocations, s.eventsLost,
+           hostBoard.tSerialBlocked / 1000.0, s.loopMax, s.loopP99, s.loopOverBudget, s.ttlWidthErrMax, s.ttlPeriodErrMax, s.ttlTrains, s.ttlDelayed, s.ttlDropped, s.tEnd / 1e6, wallMs);
+    if (LINEAR_ACTUATOR)
+    {
+      printf(",%lu,%lu,%lu,%.0f,%ld", s.actuatorMoves, s.actuatorSteps, s.actuatorLost, s.actuatorMaxRate, s.actuatorError);
+    }
+    printf("\n");
+    jitterExceeded = jitterExceeded || s.ttlWidthErrMax > jitterMax || s.ttlPeriodErrMax > jitterMax;
+  }
+  if (jitterExceeded)
+  {
+    fprintf(stderr, "TTL pulse width or period error over %llu us\n", jitterMax);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,555 @@
+/*
+ * Host policy sweep - Monte Carlo sessions of the sketch against learning virtual animals over a grid of
+ *   reward and relocation parameters, spread over every core
+ *
+ *   build : g++ -std=c++17 -O2 -pthread -o sweep host/sweep.cpp
+ *   usage : sweep [-n animals] [-s seed] [-j threads] [-p loop period us] [-k laps] [-S ms,..] [-B ms,..] [-R laps,..]
+ *                 [-D s,..] [-L] [-o sessions.csv]
+ *           -S solenoid open times, -B MIN_IR_BREAK values, -R rewarded laps and -D durations (0 for no limit) of every
+ *              relocation step but the last - comma separated lists, the grid is their product
+ *           -L runs the legacy IR persistance check, where MIN_IR_BREAK applies, instead of the IR debounce filter
+ *           -k error-free laps of the learning criterion
+ *           -o writes one row per session, laps to criterion per relocation step (-1 not reached)
+ *
+ *   every session runs setup()/loop() of the sketch on a fresh virtual board with the session parameters of its grid
+ *   point, the sketch state is BOARD_LOCAL so every thread runs its own copy - sessions are dealt to per thread queues
+ *   in blocks and a thread out of work steals from the back of the others, the same animals (seeds) meet every
+ *   grid point
+ *
+ *   the animals shuttle on one track between ports 0 and 1, see AnimalModel, one CSV row per grid point: reward rate
+ *   per session minute, laps, turn backs per lap and water drunk, per relocation step the fraction of animals
+ *   reaching the criterion (k laps in a row without turning back) and the 10/50/90th percentile of the laps it took
+ */
+
+#include "../linear_track_alternate_reward.ino"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <math.h>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+
+static_assert(SESSION_STATS, "the sweep reads laps, errors and rewards from the session statistics");
+
+// virtual clock is in us, sketch time parameters are in ms unless TIME_IN_MICROSECONDS
+const unsigned long long US_PER_TICK = TIME_IN_MICROSECONDS ? 1ULL : 1000ULL;
+const double TICKS_PER_MS = 1000.0 / US_PER_TICK;
+const double REWARD_SATURATION = 3e4;   // valve open time (us) giving 63% of the full reward value
+const byte GO = 0;
+const byte STAY = 1;
+
+struct PinEdge
+{
+  unsigned long long t;
+  byte pin;
+  bool level;
+  bool operator>(const PinEdge &other) const { return t > other.t; }
+};
+
+struct AnimalModel
+{
+  /*
+  Learning shuttler - at every track end the animal either runs the lap to the other port (GO) or turns back into
+    the port it just left (STAY, an error for the sketch), drawn from a softmax on action values learnt by Q-learning
+    from the water value of the next arrival - the value saturates with the valve open time, satiety (valve time
+    drunk so far) dulls it and slows running and licking, beam chatter on entry and short dropouts while in the
+    beam are the sensor noise, all times in us and the traits drawn per animal
+  */
+  std::mt19937_64 rng;
+  std::priority_queue<PinEdge, std::vector<PinEdge>, std::greater<PinEdge>> edges;
+  unsigned long long tNextVisit;
+  byte port;            // port of the current or next visit
+  byte lastPort;        // port the action leading to it was taken at, PORT_NONE before the first visit
+  byte action;
+  bool visiting;        // the visit was scheduled and its edges are not all applied yet
+  double q[2][2];       // action values per port
+  double reward;        // water value of the current visit
+  double drunk;         // valve open time at the animal's ports
+  unsigned long long tOpen[2];
+  double meanRunTime;
+  double meanDwellTime;
+  double lickRate;      // licks per second while at the port
+  double chatterProb;   // chance of beam chatter on arrival
+  double dropoutRate;   // beam dropouts per second while in the beam
+  double alpha;         // learning rate
+  double beta;          // softmax inverse temperature
+  double gamma;         // discount per visit
+  double bias;          // innate tendency to run on
+  double capacity;      // valve open time that dulls the reward to 37%
+
+  double uniform(double lo, double hi) { return std::uniform_real_distribution<double>(lo, hi)(rng); }
+
+  double motivation() { return exp(-drunk / capacity); }
+
+  void init(unsigned long long seed, unsigned long long tFirstVisit)
+  {
+    rng.seed(seed);
+    meanRunTime = uniform(2e6, 8e6);
+    meanDwellTime = uniform(1e6, 4e6);
+    lickRate = uniform(2, 8);
+    chatterProb = uniform(0, 0.5);
+    dropoutRate = uniform(0, 0.2);
+    alpha = uniform(0.1, 0.4);
+    beta = uniform(3, 6);
+    gamma = uniform(0.7, 0.9);
+    bias = uniform(0.5, 1.5);
+    capacity = uniform(2e6, 4e6);
+    edges = decltype(edges)();
+    tNextVisit = tFirstVisit;
+    port = 0;
+    lastPort = PORT_NONE;
+    action = GO;
+    visiting = false;
+    q[0][GO] = q[0][STAY] = q[1][GO] = q[1][STAY] = 0;
+    reward = 0;
+    drunk = 0;
+    tOpen[0] = tOpen[1] = 0;
+  }
+
+  void beam(unsigned long long t, bool broken)
+  {
+    edges.push({t, PORT_IR_PIN[port], broken != IR_ACTIVE_LOW});
+  }
+
+  void scheduleVisit(unsigned long long tArrive)
+  {
+    double vigour = 0.5 + 0.5 * motivation();
+    unsigned long long tLeave = tArrive + (unsigned long long)(std::exponential_distribution<double>(1.0 / meanDwellTime)(rng) + 2e5);
+    unsigned long long t = tArrive;
+    if (uniform(0, 1) < chatterProb)
+    {
+      // beam flickers for a few ms while the animal enters
+      for (int n = 2 + (int)uniform(0, 4); n > 0; n--)
+      {
+        beam(t, true);
+        t += (unsigned long long)uniform(100, 900);
+        beam(t, false);
+        t += (unsigned long long)uniform(100, 900);
+      }
+    }
+    beam(t, true);
+    auto dropoutGap = [&]() { return dropoutRate > 0 ? std::exponential_distribution<double>(dropoutRate / 1e6)(rng) : 1e300; };
+    for (double tDrop = t + dropoutGap(); tDrop + 3e4 < tLeave; tDrop += dropoutGap())
+    {
+      // the animal moves out of the beam for a moment
+      beam((unsigned long long)tDrop, false);
+      beam((unsigned long long)(tDrop + uniform(1e3, 2e4)), true);
+    }
+    beam(tLeave, false);
+    // lick bout, ~30ms contacts
+    double tLick = t + uniform(1e5, 4e5);
+    while (tLick + 4e4 < tLeave)
+    {
+      edges.push({(unsigned long long)tLick, PORT_TOUCH_PIN[port], !TOUCH_ACTIVE_LOW});
+      edges.push({(unsigned long long)(tLick + uniform(1.5e4, 4e4)), PORT_TOUCH_PIN[port], TOUCH_ACTIVE_LOW});
+      tLick += std::exponential_distribution<double>(lickRate * vigour / 1e6)(rng) + 5e4;
+    }
+  }
+
+  void decide(unsigned long long tNow)
+  {
+    /*
+    The visit is over - learn from its water, then choose the next move
+    */
+    if (lastPort != PORT_NONE)
+    {
+      double target = reward + gamma * std::max(q[port][GO], q[port][STAY]);
+      q[lastPort][action] += alpha * (target - q[lastPort][action]);
+    }
+    double vigour = 0.5 + 0.5 * motivation();
+    double pGo = 1 / (1 + exp(-(beta * (q[port][GO] - q[port][STAY]) + bias)));
+    action = uniform(0, 1) < pGo ? GO : STAY;
+    lastPort = port;
+    reward = 0;
+    if (action == GO)
+    {
+      port ^= 1;
+      tNextVisit = tNow + (unsigned long long)std::max(5e5, std::normal_distribution<double>(meanRunTime, meanRunTime / 4)(rng) / vigour);
+    }
+    else
+    {
+      tNextVisit = tNow + (unsigned long long)(uniform(5e5, 2e6) / vigour);
+    }
+  }
+
+  unsigned long long drive(HostBoard &board)
+  {
+    /*
+    Apply every pin change due by now, returns the time of the next one
+    */
+    while (true)
+    {
+      while (!edges.empty() && edges.top().t <= board.tMicros)
+      {
+        hostDrivePin(edges.top().pin, edges.top().level);
+        edges.pop();
+      }
+      if (!edges.empty())
+      {
+        return edges.top().t;
+      }
+      if (visiting)
+      {
+        visiting = false;
+        decide(board.tMicros);
+      }
+      if (board.tMicros < tNextVisit)
+      {
+        return tNextVisit;
+      }
+      scheduleVisit(tNextVisit);
+      visiting = true;
+    }
+  }
+
+  void output(HostBoard &board, byte pin, bool level)
+  {
+    /*
+    Drink from the valve of the port the animal is at
+    */
+    for (byte i = 0; i < 2; i++)
+    {
+      if (pin != PORT_SOLENOID_PIN[i])
+      {
+        continue;
+      }
+      if (level != SOLENOID_ACTIVE_LOW)
+      {
+        tOpen[i] = board.tMicros;
+      }
+      else if (tOpen[i] != 0)
+      {
+        double open = board.tMicros - tOpen[i];
+        tOpen[i] = 0;
+        if (visiting && i == port)
+        {
+          reward += (1 - exp(-open / REWARD_SATURATION)) * motivation();
+          drunk += open;
+        }
+      }
+    }
+  }
+};
+
+struct GridPoint
+{
+  double solenoidMs;
+  double minIRBreakMs;
+  unsigned int relocationLaps;
+  double relocationS;
+};
+
+struct SessionResult
+{
+  unsigned long rewards;
+  unsigned long laps;
+  unsigned long errors;
+  double waterMs;
+  double minutes;
+  long lapsToCriterion[RELOCATION_STEPS];  // -1 not reached
+};
+
+SessionResult simulateSession(const GridPoint &point,
+                              unsigned long long seed,
+                              unsigned long long loopPeriod,
+                              unsigned int criterion,
+                              bool legacyIR)
+{
+  /*
+  Run one full session of the sketch on a fresh virtual board of this thread
+  <struct GridPoint> point : session parameters
+  <unsigned long long> seed : animal seed
+  <unsigned long long> loopPeriod : virtual duration of one loop() pass in us
+  <unsigned int> criterion : error-free laps of the learning criterion
+  <bool> legacyIR : IR persistance check instead of the debounce filter
+  */
+  AnimalModel animal;
+  std::mt19937_64 start(seed ^ 0x9E3779B97F4A7C15ULL);
+  unsigned long long tTrigger = 1001ULL * 1000ULL + (unsigned long long)std::uniform_real_distribution<double>(1e6, 3e6)(start);
+  animal.init(seed, tTrigger + US_PER_TICK * DELAY_START + (unsigned long long)std::uniform_real_distribution<double>(0, 5e6)(start));
+  animal.edges.push({tTrigger, INPUT_TRIGGER, true});
+  animal.edges.push({tTrigger + US_PER_TICK * TTL_PULSE_WIDTH, INPUT_TRIGGER, false});
+
+  hostReset(0);
+  setup();
+  hostBoard.drive = [&](HostBoard &board) { return animal.drive(board); };
+  hostBoard.output = [&](HostBoard &board, byte pin, bool level) { animal.output(board, pin, level); };
+  sessionParams.solenoidDuration = (unsigned long)(point.solenoidMs * TICKS_PER_MS);
+  sessionParams.minIRBreak = (unsigned long)(point.minIRBreakMs * TICKS_PER_MS);
+  for (byte i = 0; i + 1 < RELOCATION_STEPS; i++)
+  {
+    sessionParams.relocationLaps[i] = point.relocationLaps;
+    sessionParams.relocationDuration[i] = (Timestamp)(point.relocationS * 1000.0 * TICKS_PER_MS);
+  }
+  for (byte i = 0; legacyIR && i < ports.count; i++)
+  {
+    ports.irDebounce[i].mode = DEBOUNCE_OFF;
+  }
+
+  SessionResult result = {};
+  byte step = 0;
+  unsigned int lapsAtStep = 0;
+  std::fill(result.lapsToCriterion, result.lapsToCriterion + RELOCATION_STEPS, -1L);
+  unsigned long long tLimit = tTrigger + 2ULL * US_PER_TICK * (DELAY_START + RUN_TIME_DURATION);
+  while (!hostBoard.halted && !hostBoard.sessionEnded && hostBoard.tMicros < tLimit)
+  {
+    hostAdvance(loopPeriod);
+    loop();
+    if (sessionStats.steps != step)
+    {
+      step = sessionStats.steps;
+      lapsAtStep = sessionStats.laps;
+    }
+    if (step > 0 && step <= RELOCATION_STEPS && sessionStats.run >= criterion && result.lapsToCriterion[step - 1] < 0)
+    {
+      result.lapsToCriterion[step - 1] = sessionStats.laps - lapsAtStep;
+    }
+  }
+  hostBoard.drive = nullptr;
+  hostBoard.output = nullptr;
+
+  for (byte i = 0; i < PORT_COUNT; i++)
+  {
+    result.rewards += sessionStats.rewards[i];
+  }
+  result.laps = sessionStats.laps;
+  result.errors = sessionStats.errors;
+  result.waterMs = animal.drunk / 1000.0;
+  result.minutes = RUN_TIME_DURATION * US_PER_TICK / 6e7;
+  return result;
+}
+
+// sessions left to a thread, it takes from the front of its own and steals from the back of the others
+struct WorkQueue
+{
+  std::mutex lock;
+  std::deque<size_t> tasks;
+};
+
+bool nextTask(std::vector<WorkQueue> &queues,
+              size_t self,
+              size_t &task)
+{
+  /*
+  Next session for thread self, false once every queue is empty (no session is added while sweeping)
+  */
+  for (size_t k = 0; k < queues.size(); k++)
+  {
+    WorkQueue &queue = queues[(self + k) % queues.size()];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tasks.empty())
+    {
+      continue;
+    }
+    if (k == 0)
+    {
+      task = queue.tasks.front();
+      queue.tasks.pop_front();
+    }
+    else
+    {
+      task = queue.tasks.back();
+      queue.tasks.pop_back();
+    }
+    return true;
+  }
+  return false;
+}
+
+std::vector<double> parseList(const char* list)
+{
+  std::vector<double> values;
+  char* end;
+  for (const char* p = list; *p; p = *end ? end + 1 : end)
+  {
+    values.push_back(strtod(p, &end));
+    if (end == p)
+    {
+      break;
+    }
+  }
+  return values;
+}
+
+double percentile(std::vector<double> values,
+                  double p)
+{
+  std::sort(values.begin(), values.end());
+  return values[(size_t)(p / 100.0 * (values.size() - 1) + 0.5)];
+}
+
+int main(int argc, char** argv)
+{
+  unsigned long animals = 50;
+  unsigned long long seed = 1;
+  unsigned int threads = std::max(1U, std::thread::hardware_concurrency());
+  unsigned long long loopPeriod = 1000;
+  unsigned int criterion = 10;
+  bool legacyIR = false;
+  const char* sessionsPath = nullptr;
+  std::vector<double> solenoid = {20, 40, 80};
+  std::vector<double> minIRBreak = {MIN_IR_BREAK / TICKS_PER_MS};
+  std::vector<double> relocationLaps = {20, 40, 60};
+  std::vector<double> relocationS = {RELOCATION_DURATION[0] / TICKS_PER_MS / 1000.0};
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "-n" && i + 1 < argc) animals = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "-s" && i + 1 < argc) seed = strtoull(argv[++i], nullptr, 10);
+    else if (arg == "-j" && i + 1 < argc) threads = std::max(1, atoi(argv[++i]));
+    else if (arg == "-p" && i + 1 < argc) loopPeriod = strtoull(argv[++i], nullptr, 10);
+    else if (arg == "-k" && i + 1 < argc) criterion = atoi(argv[++i]);
+    else if (arg == "-S" && i + 1 < argc) solenoid = parseList(argv[++i]);
+    else if (arg == "-B" && i + 1 < argc) minIRBreak = parseList(argv[++i]);
+    else if (arg == "-R" && i + 1 < argc) relocationLaps = parseList(argv[++i]);
+    else if (arg == "-D" && i + 1 < argc) relocationS = parseList(argv[++i]);
+    else if (arg == "-L") legacyIR = true;
+    else if (arg == "-o" && i + 1 < argc) sessionsPath = argv[++i];
+    else
+    {
+      fprintf(stderr, "usage: %s [-n animals] [-s seed] [-j threads] [-p loop period us] [-k laps] [-S ms,..] [-B ms,..] [-R laps,..] [-D s,..] [-L] [-o sessions.csv]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<GridPoint> grid;
+  for (double s : solenoid)
+  {
+    for (double b : minIRBreak)
+    {
+      for (double r : relocationLaps)
+      {
+        for (double d : relocationS)
+        {
+          grid.push_back({s, b, (unsigned int)r, d});
+        }
+      }
+    }
+  }
+  size_t sessions = grid.size() * animals;
+  if (sessions == 0)
+  {
+    fprintf(stderr, "empty grid\n");
+    return 1;
+  }
+
+  // every thread starts on its own contiguous block of sessions
+  threads = (unsigned int)std::min<size_t>(threads, sessions);
+  std::vector<WorkQueue> queues(threads);
+  for (size_t task = 0; task < sessions; task++)
+  {
+    queues[task * threads / sessions].tasks.push_back(task);
+  }
+  std::vector<SessionResult> results(sessions);
+  auto wallStart = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (unsigned int w = 0; w < threads; w++)
+  {
+    workers.emplace_back([&, w]() {
+      size_t task;
+      while (nextTask(queues, w, task))
+      {
+        results[task] = simulateSession(grid[task / animals], seed + task % animals, loopPeriod, criterion, legacyIR);
+      }
+    });
+  }
+  for (std::thread &worker : workers)
+  {
+    worker.join();
+  }
+  double wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+  if (sessionsPath)
+  {
+    FILE* file = fopen(sessionsPath, "w");
+    if (file == nullptr)
+    {
+      fprintf(stderr, "cannot write %s\n", sessionsPath);
+      return 1;
+    }
+    fprintf(file, "solenoid_ms,min_ir_break_ms,relocation_laps,relocation_s,animal,seed,rewards,laps,errors,water_ms");
+    for (byte k = 0; k < RELOCATION_STEPS; k++)
+    {
+      fprintf(file, ",step%d_laps_to_criterion", k);
+    }
+    fprintf(file, "\n");
+    for (size_t task = 0; task < sessions; task++)
+    {
+      const GridPoint &point = grid[task / animals];
+      const SessionResult &r = results[task];
+      fprintf(file, "%g,%g,%u,%g,%lu,%llu,%lu,%lu,%lu,%.0f", point.solenoidMs, point.minIRBreakMs, point.relocationLaps,
+              point.relocationS, (unsigned long)(task % animals), seed + task % animals, r.rewards, r.laps, r.errors, r.waterMs);
+      for (byte k = 0; k < RELOCATION_STEPS; k++)
+      {
+        fprintf(file, ",%ld", r.lapsToCriterion[k]);
+      }
+      fprintf(file, "\n");
+    }
+    fclose(file);
+  }
+
+  printf("solenoid_ms,min_ir_break_ms,relocation_laps,relocation_s,sessions,reward_rate_mean,reward_rate_sd,reward_rate_p10,"
+         "reward_rate_p50,reward_rate_p90,laps_mean,errors_per_lap,water_ms_mean");
+  for (byte k = 0; k < RELOCATION_STEPS; k++)
+  {
+    printf(",step%d_reached,step%d_ltc_p10,step%d_ltc_p50,step%d_ltc_p90", k, k, k, k);
+  }
+  printf("\n");
+  double minutes = 0;
+  for (size_t g = 0; g < grid.size(); g++)
+  {
+    std::vector<double> rates;
+    double laps = 0, errors = 0, water = 0;
+    for (size_t a = 0; a < animals; a++)
+    {
+      const SessionResult &r = results[g * animals + a];
+      rates.push_back(r.rewards / r.minutes);
+      laps += r.laps;
+      errors += r.errors;
+      water += r.waterMs;
+      minutes += r.minutes;
+    }
+    double mean = 0, variance = 0;
+    for (double rate : rates)
+    {
+      mean += rate / animals;
+    }
+    for (double rate : rates)
+    {
+      variance += (rate - mean) * (rate - mean) / (animals > 1 ? animals - 1 : 1);
+    }
+    const GridPoint &point = grid[g];
+    printf("%g,%g,%u,%g,%lu,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f,%.3f,%.0f", point.solenoidMs, point.minIRBreakMs, point.relocationLaps,
+           point.relocationS, animals, mean, sqrt(variance), percentile(rates, 10), percentile(rates, 50), percentile(rates, 90),
+           laps / animals, laps > 0 ? errors / laps : 0.0, water / animals);
+    for (byte k = 0; k < RELOCATION_STEPS; k++)
+    {
+      std::vector<double> ltc;
+      for (size_t a = 0; a < animals; a++)
+      {
+        long l = results[g * animals + a].lapsToCriterion[k];
+        if (l >= 0)
+        {
+          ltc.push_back(l);
+        }
+      }
+      printf(",%.3f", (double)ltc.size() / animals);
+      if (ltc.empty())
+      {
+        printf(",-,-,-");
+      }
+      else
+      {
+        printf(",%.0f,%.0f,%.0f", percentile(ltc, 10), percentile(ltc, 50), percentile(ltc, 90));
+      }
+    }
+    printf("\n");
+  }
+  fprintf(stderr, "%zu sessions, %.1f h of animal time in %.1f s on %u threads\n", sessions, minutes / 60, wallS, threads);
+  return 0;
+}
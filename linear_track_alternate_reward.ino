@@ -1,88 +1,164 @@
-#include "config.h"
-#include "data.h"
-#include "helper.h"
-
-int lastIR;
-unsigned long lastTTL = 0;
-
-TTLState inputTrigger, outputTrigger, outputIR, outputTouch, outputSolenoid;
-RuntimeState runtime;
-BlinkLEDState ledA;
-IRState irDetectorA, irDetectorB;
-TouchState touchSensorA, touchSensorB;
-SolenoidState solenoidValveA, solenoidValveB;
-
-void setup()
-{
-  lastIR = -1;
-  Serial.begin(BAUD_RATE);
-  delay(1001); // to allow serial conenction to be established
-  initTTL(inputTrigger, INPUT_TRIGGER, INPUT);
-  initTTL(outputTrigger, OUTPUT_TRIGGER, OUTPUT);
-  initTTL(outputIR, OUTPUT_IR, OUTPUT);
-  initTTL(outputTouch, OUTPUT_TOUCH, OUTPUT);
-  initTTL(outputSolenoid, OUTPUT_SOLENOID, OUTPUT);
-  initRuntime(runtime, LED_RUNTIME, &outputTrigger, &inputTrigger);
-  initBlinkLED(ledA, LED_BLINK_PIN, SIDE_A);
-  initIR(irDetectorA, IR_A_PIN, SIDE_A, IR_A_INDICATOR, &outputIR, TTL_PULSE_PERIOD);
-  initIR(irDetectorB, IR_B_PIN, SIDE_B, IR_B_INDICATOR, &outputIR, TTL_PULSE_PERIOD / 2);
-  initTouch(touchSensorA, TOUCH_A_PIN, SIDE_A, &outputTouch, TTL_PULSE_PERIOD);
-  initTouch(touchSensorB, TOUCH_B_PIN, SIDE_B, &outputTouch, TTL_PULSE_PERIOD / 2);
-  initSolenoid(solenoidValveA, SOLENOID_A_PIN, SIDE_A, &outputSolenoid, TTL_PULSE_PERIOD);
-  initSolenoid(solenoidValveB, SOLENOID_B_PIN, SIDE_B, &outputSolenoid, TTL_PULSE_PERIOD / 2);
-  // log
-  Serial.print("Linear Track Behaviour in mode: ");
-  OPERATION_MODE ? Serial.println("Mode_B") : Serial.println("Mode_A");
-}
-
-void loop()
-{ 
-  
-  updateRuntime(runtime); //inputTrigger detectTTL is interlocked with updateRuntime due to its interdependency
-                          //inputTrigger detect state is stored in inputTrigger.detect as boolean.
-  updateTTL(outputTrigger, runtime.tNow);
-  updateTTL(outputIR, runtime.tNow);
-  updateTTL(outputTouch, runtime.tNow);
-  updateTTL(outputSolenoid, runtime.tNow);
-  if (runtime.runtimeFlag)
-  { 
-    detectIR(irDetectorA, runtime.tNow);
-    detectIR(irDetectorB, runtime.tNow);
-    detectTouch(touchSensorA, runtime.tNow);
-    detectTouch(touchSensorB, runtime.tNow);
-
-    updateBlinkLED(ledA, runtime.tNow);
-    updateSolenoid(solenoidValveA, runtime.tNow);
-    updateSolenoid(solenoidValveB, runtime.tNow);
-
-    switch (OPERATION_MODE)
-    {
-      case MODE_A:
-        if (irDetectorA.currentPersistant && (lastIR == SIDE_B))
-        {
-          activateSolenoid(solenoidValveA, runtime.tNow);
-          // activateSolenoid(solenoidValveB, runtime.tNow);//ensure the reservoir inlet valve is closed
-        }
-        break;
-      case MODE_B:
-        if (irDetectorB.currentPersistant && (lastIR == SIDE_A))
-        {
-          activateSolenoid(solenoidValveB, runtime.tNow);
-          activateSolenoid(solenoidValveA, runtime.tNow);//ensure the reservoir inlet valve is closed
-        }
-      default:
-        Serial.println("Operation Mode configuration incorrect/incomplete");
-        break;
-    }
-    if (irDetectorA.breakEventMutable) 
-    {
-      irDetectorA.breakEventMutable = false;
-      lastIR = SIDE_A;
-    }
-    else if (irDetectorB.breakEventMutable)
-    {
-      irDetectorB.breakEventMutable = false;
-      lastIR = SIDE_B;
-    }
-  }
+#include "config.h"
+#include "data.h"
+#include "helper.h"
+
+BOARD_LOCAL TTLState inputTrigger, outputTrigger, outputIR, outputTouch, outputSolenoid;
+BOARD_LOCAL RuntimeState runtime;
+BOARD_LOCAL BlinkLEDState ledA;
+BOARD_LOCAL PortBank<PORT_COUNT> ports;
+#if SENSOR_EDGE_CAPTURE_ENABLED
+BOARD_LOCAL EdgeQueue irEdges[PORT_COUNT], touchEdges[PORT_COUNT];
+#else
+EdgeQueue* const irEdges = nullptr;  // sampled once per loop()
+EdgeQueue* const touchEdges = nullptr;
+#endif
+#if TTL_HARDWARE_TIMER_ENABLED
+BOARD_LOCAL TTLChannel outputTriggerChannel, outputIRChannel, outputTouchChannel, outputSolenoidChannel;
+#endif
+#if SYNC_BARCODE_ENABLED
+BOARD_LOCAL TTLQueue outputTriggerQueue; // the session end trigger waits behind a barcode
+#endif
+BOARD_LOCAL TTLQueue outputIRQueue, outputTouchQueue, outputSolenoidQueue;
+BOARD_LOCAL TimerScheduler ttlTimers, sessionTimers; // sessionTimers only run while the session is on
+BOARD_LOCAL RelocationState relocation;
+BOARD_LOCAL SyncBarcodeState syncBarcode;
+#if LINEAR_ACTUATOR_ENABLED
+BOARD_LOCAL LinearActuatorState actuator;
+BOARD_LOCAL StepperChannel actuatorChannel;
+#endif
+BOARD_LOCAL LinkState sessionLink;
+
+template <enum Mode M>
+byte rewardLap(Timestamp tNow)
+{
+  /*
+  Reward policy of one operation mode, resolved at compile time - on every track release the reward
+    when the animal arrives at the rewarded port coming from another port of the same track
+  <enum Mode> M : rank of the rewarded port on its track (MODE_A first port, MODE_B second port)
+  <Timestamp> tNow : current time
+
+  Returns:
+  <byte> : number of laps rewarded
+  */
+  byte laps = 0;
+  for (byte i = 0; i < ports.count; i++)
+  {
+    byte last = ports.lastPort[ports.track[i]];
+    if (ports.trackRank[i] == M && ports.breakEvent[i] && last != PORT_NONE && last != i)
+    {
+      activateSolenoid(ports, i, tNow, sessionParams.solenoidDuration);
+      if (M == MODE_B)
+      {
+        activateSolenoid(ports, ports.trackFirst[ports.track[i]], tNow, sessionParams.solenoidDuration);//ensure the reservoir inlet valve is closed
+      }
+      laps++;
+    }
+  }
+  return laps;
+}
+
+// reward policy per Mode, swapped by the relocation schedule so loop() carries no mode dispatch
+byte (*const rewardPolicies[])(Timestamp) = {rewardLap<MODE_A>, rewardLap<MODE_B>};
+BOARD_LOCAL byte (*rewardPolicy)(Timestamp) = rewardPolicies[OPERATION_MODE];
+
+void setup()
+{
+  Serial.begin(BAUD_RATE);
+  initClock(systemClock);
+  initSessionParams(sessionParams);
+  if (LINK_EEPROM_CACHE)
+  {
+    loadSessionParams(sessionParams);
+  }
+  initLink(sessionLink);
+  initEventLog(eventLogQueue);
+  initRecordLog(recordLogQueue);
+  initPinTrace(pinTrace);
+  initLoopProfile(loopProfile);
+  initTTL(inputTrigger, INPUT_TRIGGER, INPUT);
+  initTTL(outputTrigger, OUTPUT_TRIGGER, OUTPUT);
+  initTTL(outputIR, OUTPUT_IR, OUTPUT);
+  initTTL(outputTouch, OUTPUT_TOUCH, OUTPUT);
+  initTTL(outputSolenoid, OUTPUT_SOLENOID, OUTPUT);
+#if TTL_HARDWARE_TIMER_ENABLED
+  attachTTLChannel(outputTrigger, outputTriggerChannel);
+  attachTTLChannel(outputIR, outputIRChannel);
+  attachTTLChannel(outputTouch, outputTouchChannel);
+  attachTTLChannel(outputSolenoid, outputSolenoidChannel);
+#endif
+#if SYNC_BARCODE_ENABLED
+  attachTTLQueue(outputTrigger, outputTriggerQueue);
+#endif
+  attachTTLQueue(outputIR, outputIRQueue);
+  attachTTLQueue(outputTouch, outputTouchQueue);
+  attachTTLQueue(outputSolenoid, outputSolenoidQueue);
+  initRuntime(runtime, LED_RUNTIME, &outputTrigger, &inputTrigger, sessionParams.runDuration);
+  initBlinkLED(ledA, LED_BLINK_PIN, SIDE_A);
+  initPorts(ports, PORT_COUNT, PORT_IR_PIN, PORT_IR_INDICATOR, PORT_TOUCH_PIN, PORT_SOLENOID_PIN, PORT_TRACK, PORT_TTL_PERIOD,
+            &outputIR, &outputTouch, &outputSolenoid,
+            irEdges, touchEdges);
+  initTimerScheduler(ttlTimers);
+  initTimerScheduler(sessionTimers);
+  scheduleTTL<OutputTriggerPin>(outputTrigger, ttlTimers);
+  scheduleTTL<OutputIRPin>(outputIR, ttlTimers);
+  scheduleTTL<OutputTouchPin>(outputTouch, ttlTimers);
+  scheduleTTL<OutputSolenoidPin>(outputSolenoid, ttlTimers);
+  scheduleBlinkLED(ledA, sessionTimers);
+  scheduleSolenoids(ports, sessionTimers);
+  initSyncBarcode(syncBarcode, &outputTrigger);
+  if (SYNC_BARCODE)
+  {
+    scheduleSyncBarcode(syncBarcode, sessionTimers);
+  }
+  initSessionStats(sessionStats);
+  if (SESSION_STATS)
+  {
+    scheduleSessionStats(sessionStats, sessionTimers);
+  }
+  initRelocation(relocation);
+  rewardPolicy = rewardPolicies[relocation.mode];
+#if LINEAR_ACTUATOR_ENABLED
+  initLinearActuator(actuator, actuatorChannel);
+  homeLinearActuator(actuator, currentTime());
+#endif
+  // log
+  Serial.print(F("Linear Track Behaviour in mode: "));
+  sessionParams.relocationMode[0] ? Serial.println(F("Mode_B")) : Serial.println(F("Mode_A"));
+}
+
+void loop()
+{ 
+  if (LOOP_PROFILING)
+  {
+    updateLoopProfile(loopProfile);
+  }
+  if (SESSION_LINK)
+  {
+    updateLink(sessionLink, runtime, relocation); // host commands, ahead of updateRuntime so a start is seen at once
+  }
+  updateRuntime(runtime); //inputTrigger detectTTL is interlocked with updateRuntime due to its interdependency
+                          //inputTrigger detect state is stored in inputTrigger.detect as boolean.
+  runTimers(ttlTimers, runtime.tNow);
+#if LINEAR_ACTUATOR_ENABLED
+  updateLinearActuator(actuator, runtime.tNow); // homing runs ahead of the session
+#endif
+  if (runtime.runtimeFlag)
+  { 
+    detectPorts(ports, runtime.tNow);
+
+    runTimers(sessionTimers, runtime.tNow); // blink LED, solenoid close
+
+    if (updateRelocation(relocation, runtime.tRuntimeStart, runtime.tNow))
+    {
+      rewardPolicy = rewardPolicies[relocation.mode];
+#if LINEAR_ACTUATOR_ENABLED
+      relocateLinearActuator(actuator, relocation.mode, runtime.tNow);
+#endif
+    }
+    relocation.laps += rewardPolicy(runtime.tNow);
+    updateLastPort(ports);
+  }
+  drainEventLog(eventLogQueue);
+  drainRecordLog(recordLogQueue);
+  drainPinTrace(pinTrace);
 }
\ No newline at end of file